@@ -0,0 +1,151 @@
+// Micro-benchmarks of the message, encoding, filter and pack hot paths, run against the fake SDK.
+// Takes the usual Google Benchmark flags, e.g. "--benchmark_format=json --benchmark_out=result.json" in CI.
+
+#include "app.h"
+
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+#include "./corpora.h"
+#include "./fake_sdk.h"
+#include "event/filter.h"
+#include "message/message_class.h"
+#include "structs.h"
+#include "utils/json_writer_class.h"
+
+using namespace std;
+
+enum Corpus { CHINESE, EMOJI, CQ_CODES };
+
+static const string &corpus(const int64_t which) {
+    static const string texts[] = {
+        corpora::long_chinese_text(),
+        corpora::emoji_heavy_message(),
+        corpora::multi_cq_code_message()
+    };
+    return texts[which];
+}
+
+static void corpus_args(benchmark::internal::Benchmark *b) {
+    b->ArgName("corpus")->Arg(CHINESE)->Arg(EMOJI)->Arg(CQ_CODES);
+}
+
+static void BM_StringToCoolq(benchmark::State &state) {
+    const auto &text = corpus(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(string_to_coolq(text));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_StringToCoolq)->Apply(corpus_args);
+
+static void BM_StringFromCoolq(benchmark::State &state) {
+    const auto coolq_text = string_to_coolq(corpus(state.range(0)));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(string_from_coolq(coolq_text));
+    }
+    state.SetBytesProcessed(state.iterations() * coolq_text.size());
+}
+BENCHMARK(BM_StringFromCoolq)->Apply(corpus_args);
+
+static void BM_IconvEncode(benchmark::State &state) {
+    const auto &text = corpus(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(iconv_string_encode(text, "gb18030"));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_IconvEncode)->Apply(corpus_args);
+
+// constructing a Message splits the string into segments
+static void BM_MessageSplit(benchmark::State &state) {
+    const auto &text = corpus(state.range(0));
+    for (auto _ : state) {
+        Message message(text);
+        benchmark::DoNotOptimize(message.segments().data());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_MessageSplit)->Apply(corpus_args);
+
+// enhances the segments (without downloads, the images are local names) and merges them back
+static void BM_MessageProcessOutward(benchmark::State &state) {
+    const auto &text = corpus(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Message(text).process_outward());
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_MessageProcessOutward)->Apply(corpus_args);
+
+static void BM_MessageProcessInwardArray(benchmark::State &state) {
+    const auto &text = corpus(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Message::process_inward_raw(text, Message::Formats::ARRAY));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_MessageProcessInwardArray)->Apply(corpus_args);
+
+static void BM_MessageEscape(benchmark::State &state) {
+    const auto &text = corpus(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Message::unescape(Message::escape(text)));
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_MessageEscape)->Apply(corpus_args);
+
+// what get_group_member_list does with the bytes from CoolQ
+static void BM_GroupMemberListDecode(benchmark::State &state) {
+    const auto raw = corpora::group_member_list_bytes(12345678, static_cast<size_t>(state.range(0)));
+    for (auto _ : state) {
+        auto pack = PackView(raw);
+        string out;
+        JsonWriter writer(out);
+        writer.begin_array();
+        const auto count = pack.pop_int<int32_t>();
+        for (auto i = 0; i < count; i++) {
+            GroupMember::from_bytes(pack.pop_token()).write_json(writer);
+        }
+        writer.end_array();
+        benchmark::DoNotOptimize(out.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+    state.SetBytesProcessed(state.iterations() * raw.size());
+}
+BENCHMARK(BM_GroupMemberListDecode)->Arg(200)->Arg(2000);
+
+static void BM_GlobalFilterEval(benchmark::State &state) {
+    // the global filter is loaded from a file, as "filter.json" is
+    const auto path = sdk->directories().app_tmp() + "bench_filter.json";
+    ofstream(s2ws(path)) << corpora::large_filter_tree().dump();
+    GlobalFilter::load(path);
+
+    // a group message matching a late branch, and a private one matching only the last branch
+    auto group_event = corpora::group_message_event(1003990, 42, corpus(state.range(0)) + "kw199");
+    auto private_event = group_event;
+    private_event["message_type"] = "private";
+    private_event.erase("group_id");
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(GlobalFilter::eval(group_event));
+        benchmark::DoNotOptimize(GlobalFilter::eval(private_event));
+    }
+    state.SetItemsProcessed(state.iterations() * 2);
+
+    GlobalFilter::reset();
+}
+BENCHMARK(BM_GlobalFilterEval)->Apply(corpus_args);
+
+int main(int argc, char **argv) {
+    install_fake_sdk();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
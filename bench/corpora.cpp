@@ -0,0 +1,135 @@
+#include "./corpora.h"
+
+#include "app.h"
+
+#include "message/message_class.h"
+
+using namespace std;
+
+namespace corpora {
+    static const char *CHINESE_PARAGRAPH = u8"Ⱥ˲Ĳʽ˵ Docker ȽϷ㣬"
+        u8"Ҳ˸ϲֱ Windows п QȻͨ WebSocket ӵԼĻ˿ܡ"
+        u8"ϱӳ٣ձΪھڼ͹ˣʱҪ첽ϱ"
+        u8"ʵ̳߳أ߷Ϣڶѹ⣬д̫Ҳٶȣ"
+        u8"еǰ棬ʽдɹؼƥ䣡";
+
+    string long_chinese_text() {
+        string text;
+        while (text.size() < 8 * 1024) {
+            text += CHINESE_PARAGRAPH;
+            text += "\n";
+        }
+        return text;
+    }
+
+    string emoji_heavy_message() {
+        // smileys, a keycap sequence, a ZWJ family and a flag, the kinds CoolQ turns into [CQ:emoji] codes
+        static const char *PIECES[] = {
+            u8"\U0001F602", u8"\U0001F60D", u8"\U0001F44D", u8"\U0001F389", u8"1\uFE0F\u20E3",
+            u8"\U0001F468\u200D\U0001F469\u200D\U0001F467", u8"\U0001F1E8\U0001F1F3", u8"\u2764\uFE0F",
+            u8"", u8"\U0001F923", u8"\U0001F64F", u8" ok "
+        };
+        string message;
+        for (auto i = 0; i < 40; i++) {
+            for (const auto piece : PIECES) {
+                message += piece;
+            }
+        }
+        return message;
+    }
+
+    string multi_cq_code_message() {
+        string message;
+        for (auto i = 0; i < 12; i++) {
+            message += "[CQ:at,qq=" + to_string(10000000 + i) + "] ";
+            message += u8"[CQ:face,id=" + to_string(i % 170) + "]";
+            message += "[CQ:image,file=" + string(32, static_cast<char>('A' + i)) + ".jpg]";
+            message += u8"&#91;ת&#93; " + to_string(i) + u8"&amp;  [CQ:emoji,id=128514]";
+            message += "[CQ:share,url=https://example.com/?a=1&amp;b=2,title=" + Message::escape(u8",") + "]";
+        }
+        return message;
+    }
+
+    static void put_int(bytes &out, const uint64_t value, const size_t size) {
+        for (auto i = size; i > 0; i--) {
+            out += static_cast<char>(value >> (8 * (i - 1)) & 0xFF);
+        }
+    }
+
+    static void put_string(bytes &out, const string &utf8) {
+        const auto encoded = string_encode(utf8, Encodings::GB18030);
+        put_int(out, encoded.size(), 2);
+        out += encoded;
+    }
+
+    bytes group_member_list_bytes(const int64_t group_id, const size_t count) {
+        static const char *NICKNAMES[] = {u8"С", u8"", u8"Alice", u8"ҹ", u8"bot_"};
+        static const char *AREAS[] = {u8"", u8"Ϻ", u8"㶫 ", u8""};
+
+        bytes out;
+        put_int(out, count, 4);
+        for (size_t i = 0; i < count; i++) {
+            bytes member;
+            put_int(member, group_id, 8);
+            put_int(member, 100000000 + i, 8);
+            put_string(member, NICKNAMES[i % size(NICKNAMES)] + to_string(i));
+            put_string(member, i % 3 == 0 ? u8"ȺƬ" + to_string(i) : "");
+            put_int(member, i % 3, 4); // sex
+            put_int(member, 18 + i % 40, 4); // age
+            put_string(member, AREAS[i % size(AREAS)]);
+            put_int(member, 1500000000 + i * 60, 4); // join time
+            put_int(member, 1540000000 + i * 30, 4); // last sent time
+            put_string(member, u8"Ծ");
+            put_int(member, i == 0 ? 3 : i < 10 ? 2 : 1, 4); // role
+            put_int(member, 0, 4); // unfriendly
+            put_string(member, i % 50 == 0 ? u8"ͷ" : "");
+            put_int(member, 0, 4); // title expire time
+            put_int(member, 1, 4); // card changeable
+
+            put_int(out, member.size(), 2);
+            out += member;
+        }
+        return out;
+    }
+
+    json large_filter_tree() {
+        auto branches = json::array();
+        for (auto i = 0; i < 200; i++) {
+            auto group_ids = json::array();
+            for (auto j = 0; j < 20; j++) {
+                group_ids.push_back(1000000 + i * 20 + j);
+            }
+            branches.push_back({
+                {"group_id", {{".in", group_ids}}},
+                {"message", {{".keywords", {u8"ؼ" + to_string(i), "kw" + to_string(i), u8"֪ͨ"}}}}
+            });
+        }
+        for (auto i = 0; i < 50; i++) {
+            branches.push_back({
+                {"message_type", "group"},
+                {"user_id", {{".not", {{".in", {i, i + 1, i + 2}}}}}},
+                {"message", {{".regex", "^(!|/)cmd" + to_string(i) + "\\b"}}}
+            });
+        }
+        // the common case, a private message, is only matched by the last branch
+        branches.push_back({{"message_type", "private"}, {"message", {{".contains", u8""}}}});
+        return {{".or", branches}};
+    }
+
+    json group_message_event(const int64_t group_id, const int64_t user_id, const string &message) {
+        return {
+            {"time", 1540000000},
+            {"self_id", 10000},
+            {"post_type", "message"},
+            {"message_type", "group"},
+            {"sub_type", "normal"},
+            {"message_id", 1},
+            {"group_id", group_id},
+            {"user_id", user_id},
+            {"anonymous", nullptr},
+            {"message", message},
+            {"raw_message", message},
+            {"font", 0}
+        };
+    }
+} // namespace corpora
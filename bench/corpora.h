@@ -0,0 +1,39 @@
+#pragma once
+
+#include "common.h"
+
+/**
+ * Realistic inputs shared by the benchmarks and the replay harness, all built from code,
+ * so that neither of them depends on data files.
+ */
+namespace corpora {
+    /**
+     * About 8 KB of Chinese chat text with a little punctuation and ASCII, in UTF-8.
+     */
+    std::string long_chinese_text();
+
+    /**
+     * A chat message where most of the characters are emoji, including keycaps and ZWJ sequences, in UTF-8.
+     */
+    std::string emoji_heavy_message();
+
+    /**
+     * A message with dozens of CQ codes (at, face, image, emoji, share) between short texts, in UTF-8.
+     */
+    std::string multi_cq_code_message();
+
+    /**
+     * The raw bytes CoolQ returns for the member list of a group with "count" members.
+     */
+    bytes group_member_list_bytes(int64_t group_id, size_t count = 2000);
+
+    /**
+     * A filter of a few hundred branches, using ".in", ".keywords", ".regex" and nested ".and"/".not".
+     */
+    json large_filter_tree();
+
+    /**
+     * A group message event as posted, with the message in string format.
+     */
+    json group_message_event(int64_t group_id, int64_t user_id, const std::string &message);
+} // namespace corpora
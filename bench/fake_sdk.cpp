@@ -0,0 +1,66 @@
+#include "./fake_sdk.h"
+
+#include "app.h"
+
+#include <atomic>
+#include <cstdio>
+#include <boost/filesystem.hpp>
+
+#include "utils/base64.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static bool verbose_logs = false;
+static string app_directory; // in the encoding of CoolQ, like the real one
+static string group_member_list_base64;
+static atomic<int32_t> next_message_id = 1;
+
+static int32_t __stdcall fake_send_msg(int32_t, int64_t, const char *) { return next_message_id++; }
+static int32_t __stdcall fake_delete_msg(int32_t, int64_t) { return 0; }
+static int64_t __stdcall fake_get_login_qq(int32_t) { return 10000; }
+static const char *__stdcall fake_get_login_nick(int32_t) { return "bench"; }
+static const char *__stdcall fake_get_app_directory(int32_t) { return app_directory.c_str(); }
+static int32_t __stdcall fake_get_csrf_token(int32_t) { return 0; }
+static const char *__stdcall fake_get_cookies(int32_t) { return ""; }
+
+static const char *__stdcall fake_get_group_member_list(int32_t, int64_t) {
+    return group_member_list_base64.c_str();
+}
+
+static int32_t __stdcall fake_add_log(int32_t, const int32_t level, const char *category, const char *msg) {
+    if (verbose_logs) {
+        printf("[%d] %s: %s\n", level, category, msg);
+    }
+    return 0;
+}
+
+void install_fake_sdk(const bool verbose) {
+    verbose_logs = verbose;
+
+    const auto dir = fs::temp_directory_path() / "coolq-http-api-bench" / "app" / CQAPP_ID;
+    fs::create_directories(dir);
+    app_directory = dir.string() + "\\";
+
+    CQ_sendPrivateMsg = fake_send_msg;
+    CQ_sendGroupMsg = fake_send_msg;
+    CQ_sendDiscussMsg = fake_send_msg;
+    CQ_deleteMsg = fake_delete_msg;
+    CQ_getLoginQQ = fake_get_login_qq;
+    CQ_getLoginNick = fake_get_login_nick;
+    CQ_getAppDirectory = fake_get_app_directory;
+    CQ_getCsrfToken = fake_get_csrf_token;
+    CQ_getCookies = fake_get_cookies;
+    CQ_getGroupMemberList = fake_get_group_member_list;
+    CQ_addLog = fake_add_log;
+
+    sdk = Sdk(0);
+    if (!verbose) {
+        Log::set_min_level(CQLOG_FATAL);
+    }
+}
+
+void set_fake_group_member_list(const bytes &raw) {
+    group_member_list_base64 = base64_encode(reinterpret_cast<const unsigned char *>(raw.data()),
+                                             static_cast<unsigned>(raw.size()));
+}
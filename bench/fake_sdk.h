@@ -0,0 +1,16 @@
+#pragma once
+
+#include "common.h"
+
+/**
+ * Stand in for CoolQ, so that the plugin code can run in a normal executable.
+ *
+ * The SDK functions are replaced by fakes which answer from memory, the app directory is a temporary one,
+ * and the logs are dropped unless "verbose" is set.
+ */
+void install_fake_sdk(bool verbose = false);
+
+/**
+ * The group member list the fake "getGroupMemberList" returns, as raw bytes before base64 encoding.
+ */
+void set_fake_group_member_list(const bytes &raw);
@@ -0,0 +1,173 @@
+#include "./fake_sinks.h"
+
+#include "app.h"
+
+#include <cmath>
+
+#include "utils/gzip.h"
+
+using namespace std;
+
+void DeliveryRecorder::received(const string &sink, const json &payload, const Clock::time_point at) {
+    unique_lock<mutex> lock(mutex_);
+    auto &stats = sinks_[sink];
+    if (stats.seen.empty()) {
+        stats.seen.resize(dispatched_at_.size());
+        stats.first_at = at;
+    }
+    stats.last_at = at;
+
+    if (payload.is_array()) {
+        for (const auto &event : payload) {
+            received_event(stats, event, at);
+        }
+    } else if (const auto it = payload.find("events"); it != payload.end() && it->is_array()) {
+        for (const auto &event : *it) {
+            received_event(stats, event, at);
+        }
+    } else {
+        received_event(stats, payload, at);
+    }
+}
+
+void DeliveryRecorder::received_event(SinkStats &stats, const json &event, const Clock::time_point at) {
+    stats.received++;
+    if (!event.is_object()) {
+        stats.unmatched++;
+        return;
+    }
+
+    const auto is_message = event.value("post_type", "") == "message";
+    const auto it = event.find(is_message ? "message_id" : "time");
+    const auto key = it != event.end() && it->is_number_integer() ? it->get<int64_t>() : 0;
+    if (key <= 0 || static_cast<size_t>(key) >= dispatched_at_.size()) {
+        stats.unmatched++;
+        return;
+    }
+    if (stats.seen[key]) {
+        stats.duplicates++; // e.g. a batch sent again after reconnecting
+        return;
+    }
+    stats.seen[key] = true;
+    stats.latencies_ms.push_back(chrono::duration<double, milli>(at - dispatched_at_[key]).count());
+}
+
+size_t DeliveryRecorder::delivered(const string &sink) const {
+    unique_lock<mutex> lock(mutex_);
+    const auto it = sinks_.find(sink);
+    return it != sinks_.end() ? it->second.latencies_ms.size() : 0;
+}
+
+json DeliveryRecorder::report() const {
+    unique_lock<mutex> lock(mutex_);
+    auto result = json::object();
+    for (const auto &entry : sinks_) {
+        auto stats = entry.second;
+        const auto seconds = chrono::duration<double>(stats.last_at - stats.first_at).count();
+        const auto delivered = stats.latencies_ms.size();
+        result[entry.first] = {
+            {"delivered", delivered},
+            {"received", stats.received},
+            {"duplicates", stats.duplicates},
+            {"unmatched", stats.unmatched},
+            {"events_per_second", seconds > 0 ? delivered / seconds : 0.0},
+            {"latency_ms", percentiles(stats.latencies_ms)}
+        };
+    }
+    return result;
+}
+
+json percentiles(vector<double> &values) {
+    if (values.empty()) {
+        return nullptr;
+    }
+    sort(values.begin(), values.end());
+    const auto at = [&](const double p) {
+        const auto rank = static_cast<size_t>(ceil(p * values.size()));
+        return values[max(rank, size_t(1)) - 1];
+    };
+    return {{"p50", at(0.5)}, {"p90", at(0.9)}, {"p99", at(0.99)}, {"p999", at(0.999)}, {"max", values.back()}};
+}
+
+FakeHttpSink::FakeHttpSink(const unsigned short port, const unsigned delay_ms, DeliveryRecorder &recorder)
+    : delay_ms_(delay_ms), recorder_(recorder) {
+    server_.config.address = "127.0.0.1";
+    server_.config.port = port;
+    server_.config.thread_pool_size = 4;
+
+    server_.default_resource["POST"] = [this](shared_ptr<HttpServer::Response> response,
+                                              shared_ptr<HttpServer::Request> request) {
+        const auto received_at = DeliveryRecorder::Clock::now();
+
+        auto body = request->content.string();
+        if (request->header.find("Content-Encoding") != request->header.end()) {
+            body = gzip_decompress(body).value_or("");
+        }
+        const auto content_type = request->header.find("Content-Type");
+        const auto format = content_type != request->header.end()
+                                ? wire_format_from_media_type(content_type->second).value_or(WireFormat::JSON)
+                                : WireFormat::JSON;
+
+        if (delay_ms_ > 0) {
+            this_thread::sleep_for(chrono::milliseconds(delay_ms_)); // a slow receiver, to exercise backpressure
+        }
+        try {
+            recorder_.received("http", wire_parse(body, format), received_at);
+        } catch (invalid_argument &) {
+            recorder_.received("http", nullptr, received_at);
+        }
+        response->write(SimpleWeb::StatusCode::success_no_content);
+    };
+}
+
+void FakeHttpSink::start() {
+    thread_ = thread([this] { server_.start(); });
+}
+
+void FakeHttpSink::stop() {
+    server_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+FakeWsSink::FakeWsSink(const unsigned short port, const WireFormat format, DeliveryRecorder &recorder)
+    : format_(format), recorder_(recorder) {
+    server_.config.address = "127.0.0.1";
+    server_.config.port = port;
+
+    // the universal client sends its events on the same connection as the API responses
+    auto &event_endpoint = server_.endpoint["^/(event/?)?$"];
+    event_endpoint.on_message = [this](shared_ptr<WsServer::Connection> connection,
+                                       shared_ptr<WsServer::Message> message) {
+        const auto received_at = DeliveryRecorder::Clock::now();
+
+        json payload;
+        try {
+            payload = wire_parse(message->string(), format_);
+        } catch (invalid_argument &) {
+            recorder_.received("ws", nullptr, received_at);
+            return;
+        }
+        recorder_.received("ws", payload, received_at);
+
+        if (const auto it = payload.find("batch_seq"); payload.is_object() && it != payload.end()) {
+            auto send_stream = make_shared<WsServer::SendStream>();
+            *send_stream << json{{"ack", *it}}.dump();
+            connection->send(send_stream);
+        }
+    };
+
+    server_.endpoint["^/api/?$"]; // accepted, and never called
+}
+
+void FakeWsSink::start() {
+    thread_ = thread([this] { server_.start(); });
+}
+
+void FakeWsSink::stop() {
+    server_.stop();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "utils/wire_format.h"
+#include "web_server/server_http.hpp"
+#include "web_server/server_ws.hpp"
+
+/**
+ * Match the events received by the sinks with the time they were dispatched to the entry points,
+ * by a key the replay harness gives every event ("message_id" of messages, "time" of the others).
+ */
+class DeliveryRecorder {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit DeliveryRecorder(size_t event_count) : dispatched_at_(event_count + 1) {}
+
+    /// The key must be in [1, event_count].
+    void dispatched(uint64_t key, Clock::time_point at) { dispatched_at_[key] = at; }
+
+    /**
+     * Record every event in a payload a sink received, which is an event, an array of them (batched HTTP post)
+     * or a {"batch_seq": ..., "events": [...]} object (batched reverse WebSocket).
+     */
+    void received(const std::string &sink, const json &payload, Clock::time_point at);
+
+    /// The number of distinct events the sink received.
+    size_t delivered(const std::string &sink) const;
+
+    /**
+     * {sink: {"received", "duplicates", "unmatched", "events_per_second", "latency_ms": {"p50", ...}}}
+     */
+    json report() const;
+
+private:
+    struct SinkStats {
+        std::vector<bool> seen;
+        size_t received = 0;
+        size_t duplicates = 0;
+        size_t unmatched = 0; // events without a valid key, e.g. heartbeats
+        std::vector<double> latencies_ms;
+        Clock::time_point first_at;
+        Clock::time_point last_at;
+    };
+
+    std::vector<Clock::time_point> dispatched_at_; // written before the event is dispatched, so no lock is needed
+    mutable std::mutex mutex_;
+    std::map<std::string, SinkStats> sinks_;
+
+    void received_event(SinkStats &stats, const json &event, Clock::time_point at);
+};
+
+/**
+ * Percentiles of the values, as {"p50", "p90", "p99", "p999", "max"}, the values are sorted in place.
+ */
+json percentiles(std::vector<double> &values);
+
+/**
+ * An HTTP server standing in for "post_url", it answers every POST with 204 after "delay_ms".
+ */
+class FakeHttpSink {
+public:
+    FakeHttpSink(unsigned short port, unsigned delay_ms, DeliveryRecorder &recorder);
+
+    void start();
+    void stop();
+
+private:
+    using HttpServer = SimpleWeb::Server<SimpleWeb::HTTP>;
+
+    HttpServer server_;
+    std::thread thread_;
+    unsigned delay_ms_;
+    DeliveryRecorder &recorder_;
+};
+
+/**
+ * A WebSocket server standing in for the reverse WebSocket endpoints, it records the events on "/event/"
+ * and "/" (the universal client), acknowledges their batches, and accepts the API connections on "/api/"
+ * without ever calling an API.
+ */
+class FakeWsSink {
+public:
+    FakeWsSink(unsigned short port, WireFormat format, DeliveryRecorder &recorder);
+
+    void start();
+    void stop();
+
+private:
+    using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
+
+    WsServer server_;
+    std::thread thread_;
+    WireFormat format_;
+    DeliveryRecorder &recorder_;
+};
@@ -0,0 +1,450 @@
+// Replay a recorded event stream through the exported event entry points, against fake HTTP and WebSocket sinks,
+// and report the throughput and latency of the whole delivery pipeline. Run without arguments for the usage.
+
+#include "app.h"
+
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/ini_parser.hpp>
+
+#include "./corpora.h"
+#include "./fake_sdk.h"
+#include "./fake_sinks.h"
+#include "message/message_class.h"
+
+using namespace std;
+
+extern "C" {
+int32_t __stdcall Initialize(int32_t auth_code);
+int32_t __stdcall Enable();
+int32_t __stdcall Disable();
+int32_t __stdcall Exit();
+int32_t __stdcall __event_private_msg(int32_t sub_type, int32_t msg_id, int64_t from_qq, const char *msg,
+                                      int32_t font);
+int32_t __stdcall __event_group_msg(int32_t sub_type, int32_t msg_id, int64_t from_group, int64_t from_qq,
+                                    const char *from_anonymous, const char *msg, int32_t font);
+int32_t __stdcall __event_discuss_msg(int32_t sub_type, int32_t msg_id, int64_t from_discuss, int64_t from_qq,
+                                      const char *msg, int32_t font);
+int32_t __stdcall __event_group_upload(int32_t sub_type, int32_t send_time, int64_t from_group, int64_t from_qq,
+                                       const char *file);
+int32_t __stdcall __event_group_admin(int32_t sub_type, int32_t send_time, int64_t from_group,
+                                      int64_t being_operate_qq);
+int32_t __stdcall __event_group_member_decrease(int32_t sub_type, int32_t send_time, int64_t from_group,
+                                                int64_t from_qq, int64_t being_operate_qq);
+int32_t __stdcall __event_group_member_increase(int32_t sub_type, int32_t send_time, int64_t from_group,
+                                                int64_t from_qq, int64_t being_operate_qq);
+int32_t __stdcall __event_friend_add(int32_t sub_type, int32_t send_time, int64_t from_qq);
+int32_t __stdcall __event_add_friend_request(int32_t sub_type, int32_t send_time, int64_t from_qq, const char *msg,
+                                             const char *response_flag);
+int32_t __stdcall __event_add_group_request(int32_t sub_type, int32_t send_time, int64_t from_group,
+                                            int64_t from_qq, const char *msg, const char *response_flag);
+}
+
+using Clock = DeliveryRecorder::Clock;
+
+struct Options {
+    string events_path; // empty for a synthetic stream
+    size_t synthetic_count = 10000;
+    double rate = 0; // events per second, 0 to follow the recorded "time" fields
+    double speed = 1; // how much faster than recorded, if "rate" is 0
+    size_t loops = 1;
+    size_t threads = 1; // CoolQ calls the entry points from several threads
+    string base_config;
+    bool http_sink = true;
+    bool ws_sink = false;
+    unsigned short http_port = 18080;
+    unsigned short ws_port = 18081;
+    unsigned sink_delay_ms = 0;
+    unsigned drain_timeout = 30; // seconds to wait for the sinks after the last dispatch
+    string report_path;
+    bool verbose = false;
+};
+
+static void print_usage() {
+    cout << "usage: coolq-http-api-replay [events.jsonl] [options]\n"
+            "\n"
+            "Replays the events (one posted event, or an array of them, per line) through the event entry points.\n"
+            "Without a file, a synthetic stream of messages and notices is used.\n"
+            "\n"
+            "  --events N          number of synthetic events (10000)\n"
+            "  --rate N            dispatch N events per second (default: follow the recorded \"time\" fields)\n"
+            "  --speed X           replay X times faster than recorded (1), if no rate is given\n"
+            "  --loops N           replay the stream N times (1)\n"
+            "  --threads N         dispatch from N threads (1)\n"
+            "  --config FILE       base config.cfg, the post and reverse WebSocket URLs are set to the sinks\n"
+            "  --sink http|ws|both which fake sinks to deliver to (http)\n"
+            "  --http-port N       port of the fake HTTP sink (18080)\n"
+            "  --ws-port N         port of the fake reverse WebSocket sink (18081)\n"
+            "  --sink-delay MS     let the fake HTTP sink take MS milliseconds per request (0)\n"
+            "  --drain-timeout S   seconds to wait for outstanding deliveries (30)\n"
+            "  --report FILE       also write the report as JSON\n"
+            "  --verbose           print the plugin logs\n";
+}
+
+static optional<Options> parse_options(const int argc, char **argv) {
+    Options options;
+    for (auto i = 1; i < argc; i++) {
+        const string arg = argv[i];
+        const auto value = [&]() -> string {
+            if (i + 1 >= argc) {
+                throw invalid_argument("missing value of " + arg);
+            }
+            return argv[++i];
+        };
+
+        if (arg == "--events") {
+            options.synthetic_count = stoul(value());
+        } else if (arg == "--rate") {
+            options.rate = stod(value());
+        } else if (arg == "--speed") {
+            options.speed = stod(value());
+        } else if (arg == "--loops") {
+            options.loops = max(stoul(value()), 1ul);
+        } else if (arg == "--threads") {
+            options.threads = max(stoul(value()), 1ul);
+        } else if (arg == "--config") {
+            options.base_config = value();
+        } else if (arg == "--sink") {
+            const auto sink = value();
+            options.http_sink = sink == "http" || sink == "both";
+            options.ws_sink = sink == "ws" || sink == "both";
+        } else if (arg == "--http-port") {
+            options.http_port = static_cast<unsigned short>(stoul(value()));
+        } else if (arg == "--ws-port") {
+            options.ws_port = static_cast<unsigned short>(stoul(value()));
+        } else if (arg == "--sink-delay") {
+            options.sink_delay_ms = stoul(value());
+        } else if (arg == "--drain-timeout") {
+            options.drain_timeout = stoul(value());
+        } else if (arg == "--report") {
+            options.report_path = value();
+        } else if (arg == "--verbose") {
+            options.verbose = true;
+        } else if (arg == "--help" || arg == "-h" || boost::starts_with(arg, "--")) {
+            return nullopt;
+        } else {
+            options.events_path = arg;
+        }
+    }
+    return options;
+}
+
+static vector<json> load_events(const string &path) {
+    vector<json> events;
+    ifstream file(path);
+    if (!file.is_open()) {
+        throw invalid_argument("cannot open " + path);
+    }
+    for (string line; getline(file, line);) {
+        boost::trim(line);
+        if (line.empty()) {
+            continue;
+        }
+        auto j = json::parse(line);
+        const auto batch = j.find("events"); // a batch received from the reverse WebSocket
+        auto &items = j.is_object() && batch != j.end() ? *batch : j;
+        if (items.is_array()) {
+            for (auto &event : items) {
+                events.push_back(move(event));
+            }
+        } else {
+            events.push_back(move(items));
+        }
+    }
+    return events;
+}
+
+static vector<json> synthetic_events(const size_t count) {
+    // mostly short chat messages, with the benchmark corpora now and then
+    const string texts[] = {
+        u8"Ϻ",
+        u8"֪ô÷ WebSocket ",
+        u8"[CQ:at,qq=10000] Ҳһ[CQ:face,id=14]",
+        u8"յ \U0001F44D",
+        corpora::emoji_heavy_message(),
+        u8"õ",
+        corpora::multi_cq_code_message(),
+        u8"˵㿪ᣬҼǵ׼ʱμ",
+        corpora::long_chinese_text()
+    };
+
+    vector<json> events;
+    for (size_t i = 0; i < count; i++) {
+        const auto &text = texts[i % size(texts)];
+        if (i % 10 < 7) {
+            events.push_back(corpora::group_message_event(1000000 + i % 20, 20000 + i % 500, text));
+        } else if (i % 10 < 9) {
+            auto event = corpora::group_message_event(0, 20000 + i % 500, text);
+            event["message_type"] = "private";
+            event["sub_type"] = "friend";
+            event.erase("group_id");
+            events.push_back(event);
+        } else {
+            events.push_back({
+                {"post_type", "event"},
+                {"event", "group_increase"},
+                {"sub_type", "approve"},
+                {"group_id", 1000000 + i % 20},
+                {"operator_id", 10001},
+                {"user_id", 30000 + i}
+            });
+        }
+        events.back()["time"] = 1540000000 + i / 100; // 100 events per second when following the time fields
+    }
+    return events;
+}
+
+/**
+ * The string format of a message, for an array message of the recording.
+ */
+static string message_string(const json &message) {
+    if (message.is_string()) {
+        return message.get<string>();
+    }
+
+    string result;
+    for (const auto &segment : message) {
+        const auto type = segment.value("type", "");
+        const auto data = segment.value("data", json::object());
+        if (type == "text") {
+            result += Message::escape(data.value("text", ""));
+            continue;
+        }
+        result += "[CQ:" + type;
+        for (auto it = data.begin(); it != data.end(); ++it) {
+            result += "," + it.key() + "=" + Message::escape(it->is_string() ? it->get<string>() : it->dump());
+        }
+        result += "]";
+    }
+    return result;
+}
+
+/**
+ * Call the entry point of the event, the key is passed as "message_id" of messages and "time" of the others,
+ * which the sinks use to find out the dispatch time. Return false if the event has no entry point.
+ */
+static bool dispatch(const json &event, const int32_t key) {
+    const auto post_type = event.value("post_type", "");
+    const auto group_id = event.value("group_id", int64_t(0));
+    const auto user_id = event.value("user_id", int64_t(0));
+
+    if (post_type == "message") {
+        const auto msg = string_to_coolq(message_string(event.value("message", json(""))));
+        const auto font = event.value("font", 0);
+        const auto message_type = event.value("message_type", "");
+        if (message_type == "private") {
+            const auto sub_type = event.value("sub_type", "friend");
+            const auto sub_type_code = sub_type == "friend" ? 11 : sub_type == "group" ? 2 : sub_type == "discuss" ? 3 : 1;
+            __event_private_msg(sub_type_code, key, user_id, msg.c_str(), font);
+        } else if (message_type == "group") {
+            __event_group_msg(1, key, group_id, user_id, "", msg.c_str(), font);
+        } else if (message_type == "discuss") {
+            __event_discuss_msg(1, key, event.value("discuss_id", int64_t(0)), user_id, msg.c_str(), font);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    const auto sub_type = event.value("sub_type", "");
+    const auto operator_id = event.value("operator_id", int64_t(0));
+    if (post_type == "event") {
+        const auto name = event.value("event", "");
+        if (name == "group_upload") {
+            __event_group_upload(1, key, group_id, user_id, "");
+        } else if (name == "group_admin") {
+            __event_group_admin(sub_type == "set" ? 2 : 1, key, group_id, user_id);
+        } else if (name == "group_decrease") {
+            __event_group_member_decrease(sub_type == "leave" ? 1 : sub_type == "kick" ? 2 : 3, key, group_id,
+                                          operator_id, user_id);
+        } else if (name == "group_increase") {
+            __event_group_member_increase(sub_type == "invite" ? 2 : 1, key, group_id, operator_id, user_id);
+        } else if (name == "friend_add") {
+            __event_friend_add(1, key, user_id);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    if (post_type == "request") {
+        const auto msg = string_to_coolq(event.value("message", ""));
+        const auto flag = string_to_coolq(event.value("flag", ""));
+        const auto request_type = event.value("request_type", "");
+        if (request_type == "friend") {
+            __event_add_friend_request(1, key, user_id, msg.c_str(), flag.c_str());
+        } else if (request_type == "group") {
+            __event_add_group_request(sub_type == "invite" ? 2 : 1, key, group_id, user_id, msg.c_str(),
+                                      flag.c_str());
+        } else {
+            return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Write the config file the plugin will load on "Enable", based on the given one, pointed at the sinks.
+ *
+ * \return the written config
+ */
+static boost::property_tree::ptree write_config(const Options &options) {
+    boost::property_tree::ptree pt;
+    if (!options.base_config.empty()) {
+        read_ini(options.base_config, pt);
+    }
+
+    const auto set_default = [&](const string &key, const string &value) {
+        if (!pt.get_optional<string>("general." + key)) {
+            pt.put("general." + key, value);
+        }
+    };
+    set_default("use_http", "no"); // the API servers are not part of the pipeline, keep them off unless asked for
+    set_default("use_ws", "no");
+    set_default("log_level", "warning");
+
+    pt.put("general.auto_check_update", "no");
+    pt.put("general.post_url", options.http_sink ? "http://127.0.0.1:" + to_string(options.http_port) + "/" : "");
+    pt.put("general.use_ws_reverse", options.ws_sink ? "yes" : "no");
+    if (options.ws_sink) {
+        const auto url = "ws://127.0.0.1:" + to_string(options.ws_port) + "/";
+        pt.put("general.ws_reverse_url", url);
+        pt.put("general.ws_reverse_api_url", url + "api/");
+        pt.put("general.ws_reverse_event_url", url + "event/");
+    }
+
+    write_ini(ansi(sdk->directories().app() + "config.cfg"), pt);
+    return pt;
+}
+
+int main(int argc, char **argv) {
+    optional<Options> parsed;
+    vector<json> events;
+    try {
+        parsed = parse_options(argc, argv);
+        if (parsed) {
+            events = parsed->events_path.empty() ? synthetic_events(parsed->synthetic_count)
+                                                 : load_events(parsed->events_path);
+        }
+    } catch (exception &e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (!parsed) {
+        print_usage();
+        return 1;
+    }
+    const auto &options = parsed.value();
+    if (events.empty()) {
+        cerr << "no events to replay" << endl;
+        return 1;
+    }
+
+    // the offsets of the events in one loop
+    vector<double> offsets(events.size());
+    const auto first_time = events.front().value("time", int64_t(0));
+    for (size_t i = 0; i < events.size(); i++) {
+        offsets[i] = options.rate > 0
+                         ? i / options.rate
+                         : max(events[i].value("time", first_time) - first_time, int64_t(0)) / options.speed;
+    }
+    const auto loop_span = options.rate > 0 ? events.size() / options.rate : offsets.back() + 1 / options.speed;
+
+    const auto total = events.size() * options.loops;
+    if (total >= static_cast<size_t>(INT32_MAX)) {
+        cerr << "too many events" << endl;
+        return 1;
+    }
+    DeliveryRecorder recorder(total);
+
+    optional<FakeHttpSink> http_sink;
+    optional<FakeWsSink> ws_sink;
+
+    // "Initialize" loads CQP.dll, which isn't there, so the fakes go in after it
+    Initialize(0);
+    install_fake_sdk(options.verbose);
+    const auto written_config = write_config(options);
+
+    if (options.http_sink) {
+        http_sink.emplace(options.http_port, options.sink_delay_ms, recorder);
+        http_sink->start();
+    }
+    if (options.ws_sink) {
+        const auto format = written_config.get<string>("general.ws_reverse_format", "json");
+        ws_sink.emplace(options.ws_port, wire_format_from_name(format).value_or(WireFormat::JSON), recorder);
+        ws_sink->start();
+    }
+
+    Enable();
+    if (options.ws_sink) {
+        this_thread::sleep_for(chrono::seconds(1)); // let the reverse WebSocket clients connect
+    }
+
+    cout << "replaying " << total << " events from " << options.threads << " thread(s)" << endl;
+
+    atomic<size_t> next = 0;
+    atomic<size_t> skipped = 0;
+    vector<vector<double>> entry_ms(options.threads);
+    vector<thread> dispatchers;
+    const auto start = Clock::now();
+    for (size_t t = 0; t < options.threads; t++) {
+        dispatchers.emplace_back([&, t] {
+            for (size_t n; (n = next++) < total;) {
+                const auto loop = n / events.size();
+                const auto i = n % events.size();
+                const auto key = static_cast<int32_t>(n + 1);
+
+                this_thread::sleep_until(start + chrono::duration_cast<Clock::duration>(
+                                             chrono::duration<double>(loop * loop_span + offsets[i])));
+                const auto dispatched_at = Clock::now();
+                recorder.dispatched(key, dispatched_at);
+                if (!dispatch(events[i], key)) {
+                    skipped++;
+                    continue;
+                }
+                // how long the CoolQ thread was held
+                entry_ms[t].push_back(chrono::duration<double, milli>(Clock::now() - dispatched_at).count());
+            }
+        });
+    }
+    for (auto &dispatcher : dispatchers) {
+        dispatcher.join();
+    }
+    const auto dispatch_seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    // wait until every sink has got every event, or no more arrive
+    const auto expected = total - skipped;
+    const auto drain_deadline = Clock::now() + chrono::seconds(options.drain_timeout);
+    while (Clock::now() < drain_deadline
+           && (options.http_sink && recorder.delivered("http") < expected
+               || options.ws_sink && recorder.delivered("ws") < expected)) {
+        this_thread::sleep_for(chrono::milliseconds(100));
+    }
+
+    Disable();
+    Exit();
+    if (http_sink) http_sink->stop();
+    if (ws_sink) ws_sink->stop();
+
+    vector<double> all_entry_ms;
+    for (const auto &ms : entry_ms) {
+        all_entry_ms.insert(all_entry_ms.end(), ms.begin(), ms.end());
+    }
+    json report = {
+        {"dispatched", expected},
+        {"skipped", skipped.load()},
+        {"dispatch_seconds", dispatch_seconds},
+        {"dispatch_per_second", dispatch_seconds > 0 ? expected / dispatch_seconds : 0.0},
+        {"entry_point_ms", percentiles(all_entry_ms)},
+        {"sinks", recorder.report()}
+    };
+
+    cout << report.dump(4) << endl;
+    if (!options.report_path.empty()) {
+        ofstream(options.report_path) << report.dump(4) << endl;
+    }
+    return 0;
+}
@@ -45,6 +45,9 @@ docute.init({
                 }
             ]
         },
+        {
+            title: '性能测量', path: '/Performance'
+        },
         {
             title: 'HTTPS', path: 'https://github.com/richardchien/coolq-http-api/wiki/HTTPS'
         },
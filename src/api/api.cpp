@@ -1,18 +1,120 @@
 #include "./api.h"
 
+#include "app.h"
+
+#include <future>
+
+#include "utils/deadline_class.h"
+#include "utils/metrics_class.h"
+#include "utils/tracing.h"
+
 using namespace std;
 
 extern ApiHandlerMap api_handlers; // defined in handlers.cpp
 
+chrono::milliseconds api_timeout(const Params &params) {
+    if (const auto timeout = params.get_integer("request_timeout", 0); timeout > 0) {
+        return chrono::milliseconds(timeout);
+    }
+    return chrono::milliseconds(config.api_timeout);
+}
+
+void invoke_api_handler(const string &action, const ApiHandler &handler, const Params &params, ApiResult &result) {
+    const auto start = Metrics::Clock::now();
+    {
+        CQHTTP_TRACE_SCOPE("api", action.c_str());
+        Deadline::Scope scope(api_timeout(params));
+        handler(params, result);
+        if (result.deferred) {
+            // recorded once the result is completed
+            result.deferred->then([action, start](const ApiResult &completed) {
+                Metrics::instance().observe_api(action, Metrics::seconds_since(start), completed.retcode);
+            });
+            return;
+        }
+        if (Deadline::exceeded() && result.retcode != ApiResult::RetCodes::OK
+            && result.retcode != ApiResult::RetCodes::ASYNC) {
+            result.retcode = ApiResult::RetCodes::HTTP_GATEWAY_TIMEOUT;
+        }
+    }
+    Metrics::instance().observe_api(action, Metrics::seconds_since(start), result.retcode);
+}
+
 void invoke_api(const string &action, const Params &params, ApiResult &result) {
     if (const auto it = api_handlers.find(action); it != api_handlers.end()) {
-        it->second(params, result);
+        invoke_api_handler(it->first, it->second, params, result);
     } else {
         throw invalid_argument("there is no api handler matching the given \"action\"");
     }
 }
 
 void invoke_api(const string &action, const Params &params) {
-    static ApiResult result;
+    ApiResult result;
     invoke_api(action, params, result);
 }
+
+/**
+ * Invoke one item of a batch, which has the same structure as a WebSocket API call.
+ */
+static json invoke_api_item(json &item) {
+    ApiResult result;
+
+    if (!(item.is_object() && item.find("action") != item.end() && item["action"].is_string())) {
+        result.retcode = ApiResult::RetCodes::HTTP_BAD_REQUEST;
+        return result.json();
+    }
+
+    auto json_params = json::object();
+    if (item.find("params") != item.end() && item["params"].is_object()) {
+        json_params = move(item["params"]);
+    }
+    const Params params(move(json_params));
+
+    try {
+        invoke_api(item["action"].get<string>(), params, result);
+    } catch (invalid_argument &) {
+        result.retcode = ApiResult::RetCodes::HTTP_NOT_FOUND;
+    }
+    if (result.deferred) {
+        result = result.deferred->wait(); // the batch result is sent as a whole
+    }
+
+    auto resp_json = result.json();
+    if (const auto it = item.find("echo"); it != item.end()) {
+        resp_json["echo"] = move(*it);
+    }
+    return resp_json;
+}
+
+json invoke_api_batch(json items, const bool parallel) {
+    auto results = json::array();
+
+    if (parallel && pool && !pool->in_worker() && items.size() > 1) {
+        // the tasks share the items, so they stay alive even if a task outlives this call
+        const auto shared_items = make_shared<json>(move(items));
+        vector<future<json>> futures;
+        futures.reserve(shared_items->size());
+        for (auto &item : *shared_items) {
+            futures.push_back(pool->push([shared_items, &item](int) { return invoke_api_item(item); }));
+        }
+
+        // wait for all of the tasks before rethrowing the first exception
+        exception_ptr exception;
+        for (auto &f : futures) {
+            try {
+                results.push_back(f.get());
+            } catch (...) {
+                if (!exception) exception = current_exception();
+            }
+        }
+        if (exception) {
+            rethrow_exception(exception);
+        }
+    } else {
+        for (auto &item : items) {
+            results.push_back(invoke_api_item(item));
+        }
+    }
+
+    return results;
+}
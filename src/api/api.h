@@ -2,7 +2,33 @@
 
 #include "common.h"
 
+#include <chrono>
+
 #include "./types.h"
 
+/**
+ * The timeout of an API call, from its "request_timeout" parameter or "api_timeout", zero if unlimited.
+ */
+std::chrono::milliseconds api_timeout(const Params &params);
+
+/**
+ * Call "handler" of "action" within the deadline given by api_timeout (see Deadline), and record the metrics.
+ * A call that fails after exceeding the deadline gets the retcode HTTP_GATEWAY_TIMEOUT.
+ * If the handler defers the result (see ApiResult::deferred), it returns before the result is completed.
+ */
+void invoke_api_handler(const std::string &action, const ApiHandler &handler, const Params &params,
+                        ApiResult &result);
+
 void invoke_api(const std::string &action, const Params &params, ApiResult &result);
 void invoke_api(const std::string &action, const Params &params = {});
+
+/**
+ * Invoke a list of actions, each of which is an object like {"action": ..., "params": ..., "echo": ...}.
+ *
+ * \param parallel: run the actions concurrently in the worker thread pool,
+ *                  ignored when called in a worker of the pool, where waiting for other tasks may deadlock
+ * \return an array of the results (with "echo" if given), in the same order as "items"
+ *
+ * "items" is taken by value, so that the params and echoes can be moved out of it.
+ */
+json invoke_api_batch(json items, const bool parallel = false);
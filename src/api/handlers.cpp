@@ -21,13 +21,26 @@
 
 #include <boost/filesystem.hpp>
 #include <boost/process.hpp>
+#include <condition_variable>
 #include <set>
 
 #include "./types.h"
+#include "./param_schema.h"
 #include "structs.h"
 #include "utils/params_class.h"
+#include "utils/deadline_class.h"
 #include "utils/http_utils.h"
+#include "utils/rolling_stats_class.h"
 #include "service/hub_class.h"
+#include "./info_cache_class.h"
+#include "./send_queue_class.h"
+#include "./online_monitor_class.h"
+#include "message/media_cache_class.h"
+#include "message/message_store_class.h"
+#include "message/message_class.h"
+#include "event/trace_class.h"
+#include "event/journal_class.h"
+#include "event/post_targets_class.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -46,13 +59,34 @@ static bool __add_api_handler(const string &name, ApiHandler handler) {
     static bool __dummy_##handler_name = __add_api_handler(#handler_name, __##handler_name); \
     static void __##handler_name(const Params &params, ApiResult &result)
 
-static void handle_async(const ApiHandler handler, const Params &params, ApiResult &result) {
+/**
+ * Define a handler whose parameters are parsed into "args_type" (see param_schema.h) first,
+ * a request missing any required parameter fails without calling the handler.
+ */
+#define TYPED_HANDLER(handler_name, args_type) \
+    static void __typed_##handler_name(const args_type &, const Params &, ApiResult &); \
+    HANDLER(handler_name) { \
+        args_type args; \
+        if (param_schema::parse(params.raw(), args)) { \
+            __typed_##handler_name(args, params, result); \
+        } \
+    } \
+    static void __typed_##handler_name(const args_type &args, const Params &params, ApiResult &result)
+
+#define FIELD(args_type, required_or_optional, name) param_schema::required_or_optional(#name, &args_type::name)
+
+static void handle_async(ApiHandler handler, const Params &params, ApiResult &result,
+                         const TaskPriority priority = TaskPriority::HIGH) {
     static const auto TAG = u8"API异步";
     if (pool) {
-        pool->push([handler, params, result](int) {
-            // copy "params" and "result" in the async task
-            auto async_params = params;
-            auto async_result = result;
+        // copying "params" only shares the json, "result" is not needed by the task at all
+        pool->push(priority, [handler = move(handler), async_params = params, deadline = Deadline::current()](int) {
+            Deadline::Scope scope(deadline);
+            if (Deadline::exceeded()) {
+                Log::d(TAG, u8"API 请求异步处理任务开始前已超时，已取消");
+                return;
+            }
+            ApiResult async_result;
             handler(async_params, async_result);
             Log::d(TAG, u8"成功执行一个 API 请求异步处理任务");
         });
@@ -64,58 +98,120 @@ static void handle_async(const ApiHandler handler, const Params &params, ApiResu
     }
 }
 
+/**
+ * Refuse the message while the send queue is saturated, so that the client backs off instead of piling up more.
+ */
+static bool send_queue_full(ApiResult &result) {
+    if (SendQueue::instance().full()) {
+        result.retcode = RetCodes::HTTP_SERVICE_UNAVAILABLE;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Put the message into the send queue if it's started, so that no worker thread is blocked waiting for it,
+ * otherwise fall back to handle_async.
+ */
+static void handle_send_async(const SendQueue::TargetType type, const string &target_id_key,
+                              const ApiHandler handler, const Params &params, ApiResult &result) {
+    if (!SendQueue::instance().started()) {
+        handle_async(handler, params, result);
+        return;
+    }
+    if (send_queue_full(result)) {
+        return;
+    }
+
+    auto target_id = params.get_integer(target_id_key, 0);
+    auto message = params.get_outbound_message();
+    if (target_id && !message.text.empty()
+        && SendQueue::instance().push(type, target_id, message.text, move(message.encoded))) {
+        result.retcode = RetCodes::ASYNC;
+    }
+}
+
 static ApiResult::RetCode to_retcode(const int32_t ret) {
     return ret < 0 ? ret : RetCodes::OK;
 }
 
+/**
+ * Failing because the deadline of the call passed in the send queue is reported as a timeout, like in invoke_api_handler.
+ */
+static ApiResult::RetCode to_retcode(const int32_t ret, const optional<Deadline::Clock::time_point> &deadline) {
+    return ret < 0 && deadline && Deadline::Clock::now() >= *deadline ? RetCodes::HTTP_GATEWAY_TIMEOUT
+                                                                         : to_retcode(ret);
+}
+
+/**
+ * Send the message through the send queue, and defer the result until it's sent,
+ * so that the calling (IO) thread isn't blocked while the target is throttled.
+ */
+static void send_deferred(const SendQueue::TargetType type, const int64_t target_id, OutboundCache::Result message,
+                          ApiResult &result) {
+    const auto deferred = result.defer();
+    SendQueue::instance().send(type, target_id, message.text, move(message.encoded),
+                               [deferred, deadline = Deadline::current()](const int32_t ret) {
+                                   ApiResult sent;
+                                   sent.retcode = to_retcode(ret, deadline);
+                                   if (ret > 0) {
+                                       sent.data = {{"message_id", ret}};
+                                   }
+                                   deferred->complete(move(sent));
+                               });
+}
+
 #pragma region Send Message
 
-HANDLER(send_private_msg) {
-    auto user_id = params.get_integer("user_id", 0);
-    auto message = params.get_message();
-    if (user_id && !message.empty()) {
-        const auto ret = sdk->send_private_msg(user_id, message);
-        result.retcode = to_retcode(ret);
-        if (ret > 0) {
-            result.data = {{"message_id", ret}};
-        }
+struct SendPrivateMsgArgs {
+    int64_t user_id = 0;
+
+    static constexpr auto fields() { return std::make_tuple(FIELD(SendPrivateMsgArgs, required, user_id)); }
+};
+
+TYPED_HANDLER(send_private_msg, SendPrivateMsgArgs) {
+    auto message = params.get_outbound_message();
+    if (!message.text.empty() && !send_queue_full(result)) {
+        send_deferred(SendQueue::TargetType::PRIVATE, args.user_id, move(message), result);
     }
 }
 
 HANDLER(send_private_msg_async) {
-    handle_async(__send_private_msg, params, result);
+    handle_send_async(SendQueue::TargetType::PRIVATE, "user_id", __send_private_msg, params, result);
 }
 
-HANDLER(send_group_msg) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto message = params.get_message();
-    if (group_id && !message.empty()) {
-        const auto ret = sdk->send_group_msg(group_id, message);
-        result.retcode = to_retcode(ret);
-        if (ret > 0) {
-            result.data = {{"message_id", ret}};
-        }
+struct SendGroupMsgArgs {
+    int64_t group_id = 0;
+
+    static constexpr auto fields() { return std::make_tuple(FIELD(SendGroupMsgArgs, required, group_id)); }
+};
+
+TYPED_HANDLER(send_group_msg, SendGroupMsgArgs) {
+    auto message = params.get_outbound_message();
+    if (!message.text.empty() && !send_queue_full(result)) {
+        send_deferred(SendQueue::TargetType::GROUP, args.group_id, move(message), result);
     }
 }
 
 HANDLER(send_group_msg_async) {
-    handle_async(__send_group_msg, params, result);
+    handle_send_async(SendQueue::TargetType::GROUP, "group_id", __send_group_msg, params, result);
 }
 
-HANDLER(send_discuss_msg) {
-    auto discuss_id = params.get_integer("discuss_id", 0);
-    auto message = params.get_message();
-    if (discuss_id && !message.empty()) {
-        const auto ret = sdk->send_discuss_msg(discuss_id, message);
-        result.retcode = to_retcode(ret);
-        if (ret > 0) {
-            result.data = {{"message_id", ret}};
-        }
+struct SendDiscussMsgArgs {
+    int64_t discuss_id = 0;
+
+    static constexpr auto fields() { return std::make_tuple(FIELD(SendDiscussMsgArgs, required, discuss_id)); }
+};
+
+TYPED_HANDLER(send_discuss_msg, SendDiscussMsgArgs) {
+    auto message = params.get_outbound_message();
+    if (!message.text.empty() && !send_queue_full(result)) {
+        send_deferred(SendQueue::TargetType::DISCUSS, args.discuss_id, move(message), result);
     }
 }
 
 HANDLER(send_discuss_msg_async) {
-    handle_async(__send_discuss_msg, params, result);
+    handle_send_async(SendQueue::TargetType::DISCUSS, "discuss_id", __send_discuss_msg, params, result);
 }
 
 HANDLER(send_msg) {
@@ -130,29 +226,197 @@ HANDLER(send_msg) {
 }
 
 HANDLER(send_msg_async) {
-    handle_async(__send_msg, params, result);
+    const auto message_type = params.get_string("message_type");
+    if (message_type == "private") {
+        __send_private_msg_async(params, result);
+    } else if (message_type == "group") {
+        __send_group_msg_async(params, result);
+    } else if (message_type == "discuss") {
+        __send_discuss_msg_async(params, result);
+    } else {
+        handle_async(__send_msg, params, result);
+    }
+}
+
+/**
+ * Collect the targets from the "user_ids", "group_ids" and "discuss_ids" arrays, or only from "group_ids".
+ */
+static vector<SendQueue::TargetKey> broadcast_targets(const Params &params, const bool groups_only) {
+    static const pair<const char *, SendQueue::TargetType> KEYS[] = {
+        {"group_ids", SendQueue::TargetType::GROUP},
+        {"user_ids", SendQueue::TargetType::PRIVATE},
+        {"discuss_ids", SendQueue::TargetType::DISCUSS},
+    };
+
+    vector<SendQueue::TargetKey> targets;
+    for (const auto &[key, type] : KEYS) {
+        if (groups_only && type != SendQueue::TargetType::GROUP) {
+            continue;
+        }
+        if (const auto ids = params.get(key); ids && ids->is_array()) {
+            for (const auto &id : *ids) {
+                int64_t target_id = 0;
+                param_schema::convert(id, target_id);
+                if (target_id > 0) {
+                    targets.emplace_back(type, target_id);
+                }
+            }
+        }
+    }
+    return targets;
 }
 
-HANDLER(delete_msg) {
-    auto message_id = params.get_integer("message_id", 0);
-    if (message_id > 0) {
-        result.retcode = to_retcode(sdk->delete_msg(message_id));
+/**
+ * Convert the message once and send it to all the targets through the send queue.
+ */
+static void handle_broadcast(const Params &params, ApiResult &result, const bool groups_only) {
+    const auto targets = broadcast_targets(params, groups_only);
+    if (targets.empty() || send_queue_full(result)) {
+        return;
+    }
+    const auto message = params.get_message();
+    if (message.empty()) {
+        return;
+    }
+
+    // the result is deferred until all the targets are sent, see send_deferred
+    const auto deferred = result.defer();
+    SendQueue::instance().send_multi(targets, message, [targets, deferred, deadline = Deadline::current()](
+                                         const vector<int32_t> rets) {
+        static const char *ID_KEYS[] = {"user_id", "group_id", "discuss_id"}; // in the order of TargetType
+        auto results = json::array();
+        for (size_t i = 0; i < targets.size(); i++) {
+            json item = {{ID_KEYS[static_cast<int>(targets[i].first)], targets[i].second},
+                         {"retcode", to_retcode(rets[i], deadline)}};
+            if (rets[i] > 0) {
+                item["message_id"] = rets[i];
+            }
+            results.push_back(move(item));
+        }
+        ApiResult sent;
+        sent.data = {{"results", move(results)}};
+        sent.retcode = RetCodes::OK;
+        deferred->complete(move(sent));
+    });
+}
+
+static void handle_broadcast_async(const Params &params, ApiResult &result, const bool groups_only) {
+    if (!SendQueue::instance().started()) {
+        handle_async([groups_only](const Params &p, ApiResult &r) { handle_broadcast(p, r, groups_only); },
+                     params, result);
+        return;
+    }
+    if (send_queue_full(result)) {
+        return;
+    }
+
+    const auto targets = broadcast_targets(params, groups_only);
+    if (targets.empty()) {
+        return;
+    }
+    const auto message = params.get_message();
+    if (!message.empty() && SendQueue::instance().push_multi(targets, message)) {
+        result.retcode = RetCodes::ASYNC;
     }
 }
 
+HANDLER(send_broadcast) { handle_broadcast(params, result, false); }
+
+HANDLER(send_broadcast_async) { handle_broadcast_async(params, result, false); }
+
+HANDLER(send_group_msg_multi) { handle_broadcast(params, result, true); }
+
+HANDLER(send_group_msg_multi_async) { handle_broadcast_async(params, result, true); }
+
+struct DeleteMsgArgs {
+    int64_t message_id = 0;
+
+    static constexpr auto fields() { return std::make_tuple(FIELD(DeleteMsgArgs, required, message_id)); }
+};
+
+TYPED_HANDLER(delete_msg, DeleteMsgArgs) {
+    if (args.message_id > 0) {
+        result.retcode = to_retcode(sdk->delete_msg(args.message_id));
+    }
+}
+
+/**
+ * Convert a record of the message store to the response format,
+ * the message is converted the same way as in the events, and also kept as is in "raw_message".
+ */
+static json stored_message_json(json record) {
+    auto raw_message = record["message"].get<string>();
+    record["message"] = Message::process_inward_raw(raw_message);
+    record["raw_message"] = move(raw_message);
+    return record;
+}
+
+struct GetMsgArgs {
+    int32_t message_id = 0;
+
+    static constexpr auto fields() { return std::make_tuple(FIELD(GetMsgArgs, required, message_id)); }
+};
+
+TYPED_HANDLER(get_msg, GetMsgArgs) {
+    if (!MessageStore::instance().started()) {
+        result.retcode = RetCodes::OPERATION_FAILED;
+        return;
+    }
+    if (auto record = MessageStore::instance().get(args.message_id)) {
+        result.data = stored_message_json(move(record.value()));
+        result.retcode = RetCodes::OK;
+    } else {
+        result.retcode = RetCodes::OPERATION_FAILED;
+    }
+}
+
+struct GetGroupMsgHistoryArgs {
+    int64_t group_id = 0;
+    int32_t before_message_id = 0;
+    int32_t count = 20;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(GetGroupMsgHistoryArgs, required, group_id),
+                               FIELD(GetGroupMsgHistoryArgs, optional, before_message_id),
+                               FIELD(GetGroupMsgHistoryArgs, optional, count));
+    }
+};
+
+TYPED_HANDLER(get_group_msg_history, GetGroupMsgHistoryArgs) {
+    static const int32_t MAX_COUNT = 100;
+
+    if (!MessageStore::instance().started()) {
+        result.retcode = RetCodes::OPERATION_FAILED;
+        return;
+    }
+    const auto count = static_cast<size_t>(max(0, min(args.count, MAX_COUNT)));
+    result.data = {{"messages", json::array()}};
+    for (auto &record : MessageStore::instance().group_history(args.group_id, args.before_message_id, count)) {
+        result.data["messages"].push_back(stored_message_json(move(record)));
+    }
+    result.retcode = RetCodes::OK;
+}
+
 #pragma endregion
 
 #pragma region Send Like
 
-HANDLER(send_like) {
+struct SendLikeArgs {
+    int64_t user_id = 0;
+    int32_t times = 1;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SendLikeArgs, required, user_id), FIELD(SendLikeArgs, optional, times));
+    }
+};
+
+TYPED_HANDLER(send_like, SendLikeArgs) {
     // CoolQ Pro only
-    auto user_id = params.get_integer("user_id", 0);
-    auto times = static_cast<int32_t>(params.get_integer("times", 1));
-    if (user_id && times > 0) {
-        if (times == 1) {
-            result.retcode = to_retcode(sdk->send_like(user_id));
+    if (args.times > 0) {
+        if (args.times == 1) {
+            result.retcode = to_retcode(sdk->send_like(args.user_id));
         } else {
-            result.retcode = to_retcode(sdk->send_like(user_id, times));
+            result.retcode = to_retcode(sdk->send_like(args.user_id, args.times));
         }
     }
 }
@@ -161,121 +425,200 @@ HANDLER(send_like) {
 
 #pragma region Group & Discuss Operation
 
-HANDLER(set_group_kick) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto user_id = params.get_integer("user_id", 0);
-    auto reject_add_request = params.get_bool("reject_add_request", false);
-    if (group_id && user_id) {
-        result.retcode = to_retcode(sdk->set_group_kick(group_id, user_id, reject_add_request));
+struct SetGroupKickArgs {
+    int64_t group_id = 0;
+    int64_t user_id = 0;
+    bool reject_add_request = false;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupKickArgs, required, group_id),
+                               FIELD(SetGroupKickArgs, required, user_id),
+                               FIELD(SetGroupKickArgs, optional, reject_add_request));
     }
+};
+
+TYPED_HANDLER(set_group_kick, SetGroupKickArgs) {
+    result.retcode = to_retcode(sdk->set_group_kick(args.group_id, args.user_id, args.reject_add_request));
 }
 
-HANDLER(set_group_ban) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto user_id = params.get_integer("user_id", 0);
-    auto duration = params.get_integer("duration", 30 * 60 /* 30 minutes */);
-    if (group_id && user_id && duration >= 0) {
-        result.retcode = to_retcode(sdk->set_group_ban(group_id, user_id, duration));
+struct SetGroupBanArgs {
+    int64_t group_id = 0;
+    int64_t user_id = 0;
+    int64_t duration = 30 * 60 /* 30 minutes */;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupBanArgs, required, group_id),
+                               FIELD(SetGroupBanArgs, required, user_id),
+                               FIELD(SetGroupBanArgs, optional, duration));
+    }
+};
+
+TYPED_HANDLER(set_group_ban, SetGroupBanArgs) {
+    if (args.duration >= 0) {
+        result.retcode = to_retcode(sdk->set_group_ban(args.group_id, args.user_id, args.duration));
     }
 }
 
-HANDLER(set_group_anonymous_ban) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto anonymous_flag = params.get_string("flag", "");
-    auto duration = params.get_integer("duration", 30 * 60 /* 30 minutes */);
-    if (group_id && !anonymous_flag.empty() && duration >= 0) {
-        result.retcode = to_retcode(sdk->set_group_anonymous_ban(group_id, anonymous_flag, duration));
+struct SetGroupAnonymousBanArgs {
+    int64_t group_id = 0;
+    std::string flag;
+    int64_t duration = 30 * 60 /* 30 minutes */;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupAnonymousBanArgs, required, group_id),
+                               FIELD(SetGroupAnonymousBanArgs, required, flag),
+                               FIELD(SetGroupAnonymousBanArgs, optional, duration));
+    }
+};
+
+TYPED_HANDLER(set_group_anonymous_ban, SetGroupAnonymousBanArgs) {
+    if (args.duration >= 0) {
+        result.retcode = to_retcode(sdk->set_group_anonymous_ban(args.group_id, args.flag, args.duration));
     }
 }
 
-HANDLER(set_group_whole_ban) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto enable = params.get_bool("enable", true);
-    if (group_id) {
-        result.retcode = to_retcode(sdk->set_group_whole_ban(group_id, enable));
+/**
+ * Parameters of the handlers that turn something of a group on or off.
+ */
+struct GroupSwitchArgs {
+    int64_t group_id = 0;
+    bool enable = true;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(GroupSwitchArgs, required, group_id), FIELD(GroupSwitchArgs, optional, enable));
     }
+};
+
+TYPED_HANDLER(set_group_whole_ban, GroupSwitchArgs) {
+    result.retcode = to_retcode(sdk->set_group_whole_ban(args.group_id, args.enable));
 }
 
-HANDLER(set_group_admin) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto user_id = params.get_integer("user_id", 0);
-    auto enable = params.get_bool("enable", true);
-    if (group_id && user_id) {
-        result.retcode = to_retcode(sdk->set_group_admin(group_id, user_id, enable));
+struct SetGroupAdminArgs {
+    int64_t group_id = 0;
+    int64_t user_id = 0;
+    bool enable = true;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupAdminArgs, required, group_id),
+                               FIELD(SetGroupAdminArgs, required, user_id),
+                               FIELD(SetGroupAdminArgs, optional, enable));
     }
+};
+
+TYPED_HANDLER(set_group_admin, SetGroupAdminArgs) {
+    result.retcode = to_retcode(sdk->set_group_admin(args.group_id, args.user_id, args.enable));
 }
 
-HANDLER(set_group_anonymous) {
+TYPED_HANDLER(set_group_anonymous, GroupSwitchArgs) {
     // CoolQ Pro only
-    auto group_id = params.get_integer("group_id", 0);
-    auto enable = params.get_bool("enable", true);
-    if (group_id) {
-        result.retcode = to_retcode(sdk->set_group_anonymous(group_id, enable));
-    }
+    result.retcode = to_retcode(sdk->set_group_anonymous(args.group_id, args.enable));
 }
 
-HANDLER(set_group_card) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto user_id = params.get_integer("user_id", 0);
-    auto card = params.get_string("card", "");
-    if (group_id && user_id) {
-        result.retcode = to_retcode(sdk->set_group_card(group_id, user_id, card));
+struct SetGroupCardArgs {
+    int64_t group_id = 0;
+    int64_t user_id = 0;
+    std::string card;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupCardArgs, required, group_id),
+                               FIELD(SetGroupCardArgs, required, user_id),
+                               FIELD(SetGroupCardArgs, optional, card));
     }
+};
+
+TYPED_HANDLER(set_group_card, SetGroupCardArgs) {
+    result.retcode = to_retcode(sdk->set_group_card(args.group_id, args.user_id, args.card));
 }
 
-HANDLER(set_group_leave) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto is_dismiss = params.get_bool("is_dismiss", false);
-    if (group_id) {
-        result.retcode = to_retcode(sdk->set_group_leave(group_id, is_dismiss));
+struct SetGroupLeaveArgs {
+    int64_t group_id = 0;
+    bool is_dismiss = false;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupLeaveArgs, required, group_id),
+                               FIELD(SetGroupLeaveArgs, optional, is_dismiss));
     }
+};
+
+TYPED_HANDLER(set_group_leave, SetGroupLeaveArgs) {
+    result.retcode = to_retcode(sdk->set_group_leave(args.group_id, args.is_dismiss));
 }
 
-HANDLER(set_group_special_title) {
-    auto group_id = params.get_integer("group_id", 0);
-    auto user_id = params.get_integer("user_id", 0);
-    auto special_title = params.get_string("special_title", "");
-    auto duration = params.get_integer("duration", -1 /* permanent */); // seems to have no effect
-    if (group_id && user_id) {
-        result.retcode = to_retcode(sdk->set_group_special_title(group_id, user_id, special_title, duration));
+struct SetGroupSpecialTitleArgs {
+    int64_t group_id = 0;
+    int64_t user_id = 0;
+    std::string special_title;
+    int64_t duration = -1 /* permanent */; // seems to have no effect
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupSpecialTitleArgs, required, group_id),
+                               FIELD(SetGroupSpecialTitleArgs, required, user_id),
+                               FIELD(SetGroupSpecialTitleArgs, optional, special_title),
+                               FIELD(SetGroupSpecialTitleArgs, optional, duration));
     }
+};
+
+TYPED_HANDLER(set_group_special_title, SetGroupSpecialTitleArgs) {
+    result.retcode = to_retcode(
+        sdk->set_group_special_title(args.group_id, args.user_id, args.special_title, args.duration));
 }
 
-HANDLER(set_discuss_leave) {
-    auto discuss_id = params.get_integer("discuss_id", 0);
-    if (discuss_id) {
-        result.retcode = to_retcode(sdk->set_discuss_leave(discuss_id));
-    }
+struct SetDiscussLeaveArgs {
+    int64_t discuss_id = 0;
+
+    static constexpr auto fields() { return std::make_tuple(FIELD(SetDiscussLeaveArgs, required, discuss_id)); }
+};
+
+TYPED_HANDLER(set_discuss_leave, SetDiscussLeaveArgs) {
+    result.retcode = to_retcode(sdk->set_discuss_leave(args.discuss_id));
 }
 
 #pragma endregion
 
 #pragma region Request Operation
 
-HANDLER(set_friend_add_request) {
-    auto flag = params.get_string("flag", "");
-    auto approve = params.get_bool("approve", true);
-    auto remark = params.get_string("remark", "");
-    if (!flag.empty()) {
-        result.retcode = to_retcode(
-            sdk->set_friend_add_request(flag, approve ? CQREQUEST_ALLOW : CQREQUEST_DENY, remark));
+struct SetFriendAddRequestArgs {
+    std::string flag;
+    bool approve = true;
+    std::string remark;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetFriendAddRequestArgs, required, flag),
+                               FIELD(SetFriendAddRequestArgs, optional, approve),
+                               FIELD(SetFriendAddRequestArgs, optional, remark));
     }
+};
+
+TYPED_HANDLER(set_friend_add_request, SetFriendAddRequestArgs) {
+    result.retcode = to_retcode(
+        sdk->set_friend_add_request(args.flag, args.approve ? CQREQUEST_ALLOW : CQREQUEST_DENY, args.remark));
 }
 
-HANDLER(set_group_add_request) {
-    auto flag = params.get_string("flag", "");
-    auto type = params.get_string("type", "");
-    auto approve = params.get_bool("approve", true);
-    auto reason = params.get_string("reason", "");
+struct SetGroupAddRequestArgs {
+    std::string flag;
+    std::string type;
+    bool approve = true;
+    std::string reason;
+
+    static constexpr auto fields() {
+        return std::make_tuple(FIELD(SetGroupAddRequestArgs, required, flag),
+                               FIELD(SetGroupAddRequestArgs, required, type),
+                               FIELD(SetGroupAddRequestArgs, optional, approve),
+                               FIELD(SetGroupAddRequestArgs, optional, reason));
+    }
+};
+
+TYPED_HANDLER(set_group_add_request, SetGroupAddRequestArgs) {
     auto request_type = -1;
-    if (type == "add") {
+    if (args.type == "add") {
         request_type = CQREQUEST_GROUPADD;
-    } else if (type == "invite") {
+    } else if (args.type == "invite") {
         request_type = CQREQUEST_GROUPINVITE;
     }
-    if (!flag.empty() && request_type != -1) {
-        result.retcode = to_retcode(
-            sdk->set_group_add_request(flag, request_type, approve ? CQREQUEST_ALLOW : CQREQUEST_DENY, reason));
+    if (request_type != -1) {
+        result.retcode = to_retcode(sdk->set_group_add_request(args.flag, request_type,
+                                                               args.approve ? CQREQUEST_ALLOW : CQREQUEST_DENY,
+                                                               args.reason));
     }
 }
 
@@ -293,15 +636,48 @@ HANDLER(get_login_info) {
     };
 }
 
+/**
+ * Look up the local info cache, and then the shared one (see InfoCache::get_shared), which fills the local one.
+ */
+template <typename Key>
+static optional<json> get_cached_info(TtlCache<Key, json> &cache, const Key &key, const string &shared_key) {
+    if (auto cached = cache.get(key)) {
+        return cached;
+    }
+    if (const auto shared = InfoCache::get_shared(shared_key)) {
+        try {
+            auto data = json::parse(shared.value());
+            cache.set(key, data, InfoCache::ttl());
+            return data;
+        } catch (invalid_argument &) {
+            // written by an incompatible version, fetch it again
+        }
+    }
+    return nullopt;
+}
+
 HANDLER(get_stranger_info) {
     auto user_id = params.get_integer("user_id", 0);
     auto no_cache = params.get_bool("no_cache", false);
     if (user_id) {
+        auto &cache = InfoCache::instance().strangers;
+        const auto shared_key = "stranger_" + to_string(user_id);
+        if (const auto cached = InfoCache::enabled() && !no_cache
+                                    ? get_cached_info(cache, user_id, shared_key) : nullopt) {
+            result.data = cached.value();
+            result.retcode = RetCodes::OK;
+            return;
+        }
+
         auto bytes = sdk->get_stranger_info_raw(user_id, no_cache);
         if (bytes.size() >= Stranger::MIN_SIZE) {
             auto stranger = Stranger::from_bytes(bytes);
             result.data = stranger.json();
             result.retcode = RetCodes::OK;
+            if (InfoCache::enabled()) {
+                cache.set(user_id, result.data, InfoCache::ttl());
+                InfoCache::set_shared(shared_key, result.data.dump());
+            }
         } else {
             result.retcode = RetCodes::INVALID_DATA;
         }
@@ -309,21 +685,35 @@ HANDLER(get_stranger_info) {
 }
 
 HANDLER(get_group_list) {
+    auto no_cache = params.get_bool("no_cache", false);
+    auto &cache = InfoCache::instance().group_list;
+    if (const auto cached = InfoCache::enabled() && !no_cache ? cache.get(true) : nullopt) {
+        result.data_str = cached.value();
+        result.retcode = RetCodes::OK;
+        return;
+    }
+
     auto bytes = sdk->get_group_list_raw();
     if (bytes.size() >= 4 /* at least has a count */) {
-        auto pack = Pack(bytes);
+        auto pack = PackView(bytes);
 
-        auto group_list = json::array();
+        // write the records into the response directly, instead of building a json array first
+        auto group_list_str = make_shared<string>();
+        JsonWriter writer(*group_list_str);
+        writer.begin_array();
 
         const auto count = pack.pop_int<int32_t>(); // get number of groups
         for (auto i = 0; i < count; i++) {
             const auto token = pack.pop_token();
-            auto group = Group::from_bytes(token);
-            group_list.push_back(group.json());
+            Group::from_bytes(token).write_json(writer);
         }
 
-        result.data = group_list;
+        writer.end_array();
+        result.data_str = group_list_str;
         result.retcode = RetCodes::OK;
+        if (InfoCache::enabled()) {
+            cache.set(true, result.data_str, InfoCache::ttl());
+        }
     } else {
         result.retcode = RetCodes::INVALID_DATA;
     }
@@ -331,22 +721,45 @@ HANDLER(get_group_list) {
 
 HANDLER(get_group_member_list) {
     auto group_id = params.get_integer("group_id", 0);
+    auto no_cache = params.get_bool("no_cache", false);
     if (group_id) {
+        auto &cache = InfoCache::instance().group_member_lists;
+        const auto shared_key = "member_list_" + to_string(group_id);
+        if (const auto cached = InfoCache::enabled() && !no_cache ? cache.get(group_id) : nullopt) {
+            // serve the serialized member list directly, a large group can have thousands of members
+            result.data_str = cached.value();
+            result.retcode = RetCodes::OK;
+            return;
+        }
+        if (const auto shared = InfoCache::enabled() && !no_cache ? InfoCache::get_shared(shared_key) : nullopt) {
+            result.data_str = make_shared<const string>(shared.value());
+            result.retcode = RetCodes::OK;
+            cache.set(group_id, result.data_str, InfoCache::ttl());
+            return;
+        }
+
         auto bytes = sdk->get_group_member_list_raw(group_id);
         if (bytes.size() >= 4 /* at least has a count */) {
-            auto pack = Pack(bytes);
+            auto pack = PackView(bytes);
 
-            auto member_list = json::array();
+            // write the records into the response directly, instead of building a json array first
+            auto member_list_str = make_shared<string>();
+            JsonWriter writer(*member_list_str);
+            writer.begin_array();
 
             const auto count = pack.pop_int<int32_t>();
             for (auto i = 0; i < count; i++) {
                 const auto token = pack.pop_token();
-                auto member = GroupMember::from_bytes(token);
-                member_list.push_back(member.json());
+                GroupMember::from_bytes(token).write_json(writer);
             }
 
-            result.data = member_list;
+            writer.end_array();
+            result.data_str = member_list_str;
             result.retcode = RetCodes::OK;
+            if (InfoCache::enabled()) {
+                cache.set(group_id, result.data_str, InfoCache::ttl());
+                InfoCache::set_shared(shared_key, *result.data_str);
+            }
         } else {
             result.retcode = RetCodes::INVALID_DATA;
         }
@@ -358,11 +771,24 @@ HANDLER(get_group_member_info) {
     auto user_id = params.get_integer("user_id", 0);
     auto no_cache = params.get_bool("no_cache", false);
     if (group_id && user_id) {
+        auto &cache = InfoCache::instance().group_members;
+        const auto shared_key = "member_" + to_string(group_id) + "_" + to_string(user_id);
+        if (const auto cached = InfoCache::enabled() && !no_cache
+                                    ? get_cached_info(cache, {group_id, user_id}, shared_key) : nullopt) {
+            result.data = cached.value();
+            result.retcode = RetCodes::OK;
+            return;
+        }
+
         auto bytes = sdk->get_group_member_info_raw(group_id, user_id, no_cache);
         if (bytes.size() >= GroupMember::MIN_SIZE) {
             auto member = GroupMember::from_bytes(bytes);
             result.data = member.json();
             result.retcode = RetCodes::OK;
+            if (InfoCache::enabled()) {
+                cache.set({group_id, user_id}, result.data, InfoCache::ttl());
+                InfoCache::set_shared(shared_key, result.data.dump());
+            }
         } else {
             result.retcode = RetCodes::INVALID_DATA;
         }
@@ -412,13 +838,20 @@ HANDLER(get_status) {
 
     for (const auto &entry : ServiceHub::instance().get_services()) {
         result.data[entry.first + "_service_good"] = entry.second->good();
+        if (auto stats = entry.second->stats(); !stats.is_null()) {
+            result.data[entry.first + "_service_stats"] = move(stats);
+        }
     }
 
-    ApiResult tmp_result;
-    __get_stranger_info(Params{json{{"user_id", 10000}, {"no_cache", true}}}, tmp_result);
+    if (auto post_targets = PostTargets::instance().stats(); !post_targets.empty()) {
+        result.data["post_targets"] = move(post_targets);
+    }
 
-    auto online = tmp_result.retcode == RetCodes::OK;
+    const auto online_state = OnlineMonitor::instance().state();
+    const auto online = online_state.online;
     result.data["online"] = online;
+    result.data["online_check_age"] = chrono::duration_cast<chrono::seconds>(
+        OnlineMonitor::Clock::now() - online_state.checked_at).count();
 
     result.data["good"] = app.is_initialized()
             && (app.is_enabled() && ServiceHub::instance().good()
@@ -426,8 +859,15 @@ HANDLER(get_status) {
             && online;
 }
 
+HANDLER(get_stats) {
+    result.retcode = RetCodes::OK;
+    result.data = RollingStats::instance().snapshot();
+}
+
 #ifdef _DEBUG
 #define BUILD_CONFIGURATION "debug"
+#elif defined(CQHTTP_TRACING)
+#define BUILD_CONFIGURATION "profile"
 #else
 #define BUILD_CONFIGURATION "release"
 #endif
@@ -474,6 +914,10 @@ HANDLER(set_restart_plugin) {
     result.retcode = RetCodes::ASYNC;
 }
 
+HANDLER(reload_config) {
+    result.retcode = app.reload() ? RetCodes::OK : RetCodes::OPERATION_FAILED;
+}
+
 HANDLER(clean_data_dir) {
     const auto data_dir = params.get_string("data_dir");
     set<string> allowed_data_dirs = {"image", "record", "show", "bface"};
@@ -482,6 +926,7 @@ HANDLER(clean_data_dir) {
         try {
             fs::remove_all(ws_dir_fullpath);
             fs::create_directory(ws_dir_fullpath);
+            MediaCache::instance().clear();
             result.retcode = RetCodes::OK;
         } catch (fs::filesystem_error &) {
             result.retcode = RetCodes::OPERATION_FAILED;
@@ -490,88 +935,181 @@ HANDLER(clean_data_dir) {
 }
 
 HANDLER(clean_data_dir_async) {
-    handle_async(__clean_data_dir, params, result);
+    handle_async(__clean_data_dir, params, result, TaskPriority::LOW);
+}
+
+HANDLER(get_event_traces) {
+    const auto limit = params.get_integer("limit", 100);
+    result.data = EventTrace::recent(limit > 0 ? limit : 0);
+    result.retcode = RetCodes::OK;
+}
+
+HANDLER(get_events) {
+    static const size_t MAX_LIMIT = 1000;
+
+    auto &journal = EventJournal::instance();
+    if (!journal.started()) {
+        result.retcode = RetCodes::OPERATION_FAILED;
+        return;
+    }
+
+    const auto from_seq = params.get_integer("from_seq", 0);
+    const auto limit = params.get_integer("limit", 100);
+    auto events = json::array();
+    for (auto &record : journal.read(from_seq > 0 ? from_seq : 0,
+                                     limit > 0 ? min(static_cast<size_t>(limit), MAX_LIMIT) : 0)) {
+        events.push_back(json::parse(record.data));
+    }
+    result.data = {
+        {"events", move(events)},
+        {"first_seq", journal.first_seq()},
+        {"last_seq", journal.last_seq()}
+    };
+    result.retcode = RetCodes::OK;
 }
 
 #pragma endregion
 
 #pragma region Experimental
 
-HANDLER(_get_friend_list) {
-    const auto cookies = sdk->get_cookies();
-    const auto g_tk = to_string(sdk->get_csrf_token());
+static const chrono::seconds QZONE_CREDENTIALS_TTL = chrono::minutes(10);
+static const chrono::seconds FRIEND_LIST_MAX_STALENESS = chrono::hours(1); // after it expires
+
+static InfoCache::QzoneCredentials qzone_credentials() {
+    auto &cache = InfoCache::instance().qzone_credentials;
+    if (const auto cached = cache.get(true)) {
+        return cached.value();
+    }
+    InfoCache::QzoneCredentials credentials{sdk->get_cookies(), to_string(sdk->get_csrf_token())};
+    if (!credentials.cookies.empty()) {
+        cache.set(true, credentials, QZONE_CREDENTIALS_TTL);
+    }
+    return credentials;
+}
+
+/**
+ * Convert the friend list returned by QZone, the mobile and desktop APIs differ only in a few keys.
+ */
+static json convert_qzone_friend_list(const json &data, const char *list_key, const char *nickname_key) {
+    auto groups = json::array();
+
+    map<int64_t, size_t> gpid_idx_map;
+    for (const auto &gp : data.at("gpnames")) {
+        const auto gpid = gp.at("gpid").get<int64_t>();
+        gpid_idx_map[gpid] = groups.size();
+        groups.push_back({
+            {"friend_group_id", gpid},
+            {"friend_group_name", gp.at("gpname").get<string>()},
+            {"friends", json::array()},
+        });
+    }
+
+    for (const auto &frnd : data.at(list_key)) {
+        groups[gpid_idx_map[frnd.at("groupid").get<int64_t>()]]["friends"].push_back({
+            {"user_id", frnd.at("uin").get<int64_t>()},
+            {"nickname", frnd.at(nickname_key).get<string>()},
+            {"remark", frnd.at("remark").get<string>()},
+        });
+    }
+    return groups;
+}
+
+/**
+ * Request the mobile and the desktop web QZone APIs at the same time, and take the first good response,
+ * the other request is left to finish in its own thread.
+ */
+static optional<json> fetch_friend_list() {
+    const auto credentials = qzone_credentials();
     const auto login_qq = to_string(sdk->get_login_qq());
 
-    {
-        // try mobile QZone API
-        const auto url = "http://m.qzone.com/friend/mfriend_list?g_tk=" + g_tk + "&res_uin=" + login_qq +
-                "&res_type=normal&format=json";
-        const auto res = get_remote_json(url, true, cookies).value_or(nullptr);
-        try {
-            if (res.at("code").get<int>() == 0) {
-                // succeeded
-                auto resp_data = res.at("data");
-                result.data = json::array();
-
-                map<int64_t, int> gpid_idx_map;
-                for (auto gp : resp_data.at("gpnames")) {
-                    auto res_gp = json::object();
-                    auto gpid = gp.at("gpid").get<int64_t>();
-                    res_gp["friend_group_id"] = gpid;
-                    res_gp["friend_group_name"] = gp.at("gpname").get<string>();
-                    res_gp["friends"] = json::array();
-                    gpid_idx_map[gpid] = result.data.size();
-                    result.data.push_back(res_gp);
+    struct State {
+        mutex mutex;
+        condition_variable cv;
+        optional<json> result;
+        int pending = 2;
+    };
+    const auto state = make_shared<State>();
+
+    const auto request = [&](string url, function<optional<json>(const json &)> convert) {
+        thread([state, url = move(url), convert = move(convert), cookies = credentials.cookies] {
+            optional<json> data;
+            if (const auto res = get_remote_json(url, true, cookies)) {
+                try {
+                    data = convert(res.value());
+                } catch (exception &) {
+                    // unexpected response
+                }
+            }
+            {
+                unique_lock<mutex> lock(state->mutex);
+                state->pending--;
+                if (data && !state->result) {
+                    state->result = move(data);
                 }
+            }
+            state->cv.notify_all();
+        }).detach();
+    };
 
-                for (auto frnd : resp_data.at("list")) {
-                    auto gpid = frnd.at("groupid").get<int64_t>();
-                    auto res_frnd = json::object();
-                    res_frnd["user_id"] = frnd.at("uin").get<int64_t>();
-                    res_frnd["nickname"] = frnd.at("nick").get<string>();
-                    res_frnd["remark"] = frnd.at("remark").get<string>();
-                    result.data[gpid_idx_map[gpid]]["friends"].push_back(res_frnd);
+    request("http://m.qzone.com/friend/mfriend_list?g_tk=" + credentials.csrf_token + "&res_uin=" + login_qq
+                + "&res_type=normal&format=json",
+            [](const json &res) -> optional<json> {
+                if (res.at("code").get<int>() != 0) {
+                    return nullopt;
                 }
+                return convert_qzone_friend_list(res.at("data"), "list", "nick");
+            });
+    request("https://h5.qzone.qq.com/proxy/domain/r.qzone.qq.com/cgi-bin/tfriend/friend_show_qqfriends.cgi?g_tk="
+                + credentials.csrf_token + "&uin=" + login_qq,
+            [](const json &res) -> optional<json> { return convert_qzone_friend_list(res, "items", "name"); });
+
+    unique_lock<mutex> lock(state->mutex);
+    state->cv.wait(lock, [&] { return state->result || state->pending == 0; });
+    if (!state->result) {
+        InfoCache::instance().qzone_credentials.clear(); // the cookies may have expired
+    }
+    return state->result;
+}
 
-                result.retcode = RetCodes::OK;
-                return;
-            }
-        } catch (exception &) {}
+static void cache_friend_list(json data) {
+    if (InfoCache::enabled()) {
+        InfoCache::instance().friend_list.set(true, {move(data), chrono::steady_clock::now()},
+                                              InfoCache::ttl() + FRIEND_LIST_MAX_STALENESS);
     }
+}
 
-    {
-        // try desktop web QZone API
-        const auto url =
-                "https://h5.qzone.qq.com/proxy/domain/r.qzone.qq.com/cgi-bin/tfriend/friend_show_qqfriends.cgi?g_tk=" +
-                g_tk + "&uin=" + login_qq;
-        const auto res = get_remote_json(url, true, cookies).value_or(nullptr);
-        try {
-            auto resp_data = res;
-            result.data = json::array();
-
-            map<int64_t, int> gpid_idx_map;
-            for (auto gp : resp_data.at("gpnames")) {
-                auto res_gp = json::object();
-                auto gpid = gp.at("gpid").get<int64_t>();
-                res_gp["friend_group_id"] = gpid;
-                res_gp["friend_group_name"] = gp.at("gpname").get<string>();
-                res_gp["friends"] = json::array();
-                gpid_idx_map[gpid] = result.data.size();
-                result.data.push_back(res_gp);
-            }
+/**
+ * Refresh the cached friend list in the background, at most one refresh at a time.
+ */
+static void refresh_friend_list_async() {
+    auto &refreshing = InfoCache::instance().friend_list_refreshing;
+    if (!pool || refreshing.exchange(true)) {
+        return;
+    }
+    pool->push(TaskPriority::LOW, [&refreshing](int) {
+        if (auto data = fetch_friend_list()) {
+            cache_friend_list(move(data.value()));
+        }
+        refreshing = false;
+    });
+}
 
-            for (auto frnd : resp_data.at("items")) {
-                auto gpid = frnd.at("groupid").get<int64_t>();
-                auto res_frnd = json::object();
-                res_frnd["user_id"] = frnd.at("uin").get<int64_t>();
-                res_frnd["nickname"] = frnd.at("name").get<string>();
-                res_frnd["remark"] = frnd.at("remark").get<string>();
-                result.data[gpid_idx_map[gpid]]["friends"].push_back(res_frnd);
-            }
+HANDLER(_get_friend_list) {
+    const auto no_cache = params.get_bool("no_cache", false);
+    if (const auto cached = InfoCache::enabled() && !no_cache ? InfoCache::instance().friend_list.get(true) : nullopt) {
+        if (chrono::steady_clock::now() - cached->fetched_at >= InfoCache::ttl()) {
+            refresh_friend_list_async(); // stale, but still good enough for now
+        }
+        result.data = cached->data;
+        result.retcode = RetCodes::OK;
+        return;
+    }
 
-            result.retcode = RetCodes::OK;
-            return;
-        } catch (exception &) {}
+    if (auto data = fetch_friend_list()) {
+        cache_friend_list(data.value());
+        result.data = move(data.value());
+        result.retcode = RetCodes::OK;
+        return;
     }
 
     // failed
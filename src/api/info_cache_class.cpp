@@ -0,0 +1,61 @@
+#include "./info_cache_class.h"
+
+#include "app.h"
+
+#include "utils/shared_cache_class.h"
+
+using namespace std;
+
+bool InfoCache::enabled() {
+    return config.info_cache_ttl > 0;
+}
+
+chrono::seconds InfoCache::ttl() {
+    return chrono::seconds(config.info_cache_ttl);
+}
+
+optional<string> InfoCache::get_shared(const string &key) {
+    if (const auto shared = SharedCache::current()) {
+        return shared->get(key, ttl());
+    }
+    return nullopt;
+}
+
+void InfoCache::set_shared(const string &key, const string &value) {
+    if (const auto shared = SharedCache::current()) {
+        shared->set(key, value);
+    }
+}
+
+void InfoCache::invalidate_group_member(const int64_t group_id, const int64_t user_id) {
+    group_members.erase({group_id, user_id});
+    group_member_lists.erase(group_id);
+    if (const auto shared = SharedCache::current()) {
+        shared->erase("member_" + to_string(group_id) + "_" + to_string(user_id));
+        shared->erase("member_list_" + to_string(group_id));
+    }
+}
+
+void InfoCache::invalidate_group(const int64_t group_id) {
+    group_members.erase_if([group_id](const pair<int64_t, int64_t> &key) { return key.first == group_id; });
+    group_member_lists.erase(group_id);
+    group_list.clear();
+    // the group itself is still there for the other bots, only the membership of this one changed
+    if (const auto shared = SharedCache::current()) {
+        shared->erase("member_" + to_string(group_id) + "_" + to_string(sdk->get_login_qq()));
+        shared->erase("member_list_" + to_string(group_id));
+    }
+}
+
+void InfoCache::invalidate_friend_list() {
+    friend_list.clear();
+}
+
+void InfoCache::clear() {
+    strangers.clear();
+    group_list.clear();
+    group_member_lists.clear();
+    group_members.clear();
+    qzone_credentials.clear();
+    friend_list.clear();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+
+#include "utils/ttl_cache_class.h"
+
+/**
+ * Plugin side cache of the information fetched from CoolQ,
+ * so that frequent calls of "get_group_member_info" and friends don't have to go through CoolQ every time.
+ * Entries live for "info_cache_ttl" seconds, or until the related group events invalidate them.
+ */
+class InfoCache {
+public:
+    static InfoCache &instance() {
+        static InfoCache cache;
+        return cache;
+    }
+
+    /**
+     * Whether the cache is enabled, i.e. "info_cache_ttl" > 0.
+     */
+    static bool enabled();
+    static std::chrono::seconds ttl();
+
+    TtlCache<int64_t, json> strangers; // user_id -> stranger
+    TtlCache<bool, std::shared_ptr<const std::string>> group_list; // only one entry, serialized
+    TtlCache<int64_t, std::shared_ptr<const std::string>> group_member_lists; // group_id -> serialized member list
+    TtlCache<std::pair<int64_t, int64_t>, json> group_members; // (group_id, user_id) -> member
+
+    struct QzoneCredentials {
+        std::string cookies;
+        std::string csrf_token;
+    };
+
+    struct FriendList {
+        json data;
+        std::chrono::steady_clock::time_point fetched_at; // fresh for ttl(), served stale while refreshing after that
+    };
+
+    TtlCache<bool, QzoneCredentials> qzone_credentials; // only one entry, cached even if the cache is disabled
+    TtlCache<bool, FriendList> friend_list; // only one entry
+    std::atomic<bool> friend_list_refreshing = false;
+
+    /**
+     * The shared cache ("shared_cache_dir") behind the local one, only for the information that doesn't depend on
+     * the logged in account (strangers and group members), so that bots in the same groups fetch it only once.
+     * Keys are "stranger_<user_id>", "member_<group_id>_<user_id>" and "member_list_<group_id>".
+     */
+    static std::optional<std::string> get_shared(const std::string &key);
+    static void set_shared(const std::string &key, const std::string &value);
+
+    /**
+     * Called when a member joins, leaves, or has the admin role changed.
+     */
+    void invalidate_group_member(int64_t group_id, int64_t user_id);
+
+    /**
+     * Called when the logged in account joins or leaves a group.
+     */
+    void invalidate_group(int64_t group_id);
+
+    /**
+     * Called when a friend is added.
+     */
+    void invalidate_friend_list();
+
+    void clear();
+
+private:
+    InfoCache() = default;
+};
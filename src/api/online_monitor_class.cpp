@@ -0,0 +1,67 @@
+#include "./online_monitor_class.h"
+
+#include "app.h"
+
+#include "structs.h"
+
+using namespace std;
+
+static const auto TAG = u8"在线状态";
+
+static const int64_t PROBE_USER_ID = 10000; // an official account which always exists
+
+bool OnlineMonitor::check() {
+    // CoolQ can only fetch a stranger's info through the QQ server if it's online
+    return sdk->get_stranger_info_raw(PROBE_USER_ID, true).size() >= Stranger::MIN_SIZE;
+}
+
+void OnlineMonitor::start() {
+    unique_lock<mutex> lock(mutex_);
+    if (running_ || config.online_check_interval == 0) {
+        return;
+    }
+
+    const auto interval = chrono::seconds(config.online_check_interval);
+    running_ = true;
+    thread_ = thread([this, interval] {
+        unique_lock<mutex> lock(mutex_);
+        while (running_) {
+            lock.unlock();
+            const State state{check(), Clock::now()};
+            lock.lock();
+            if (state_ && state_->online != state.online) {
+                Log::d(TAG, state.online ? u8"QQ 已恢复在线" : u8"QQ 已离线");
+            }
+            state_ = state;
+            cv_.wait_for(lock, interval, [this] { return !running_; });
+        }
+    });
+    Log::d(TAG, u8"在线状态检查已启动，每 " + to_string(config.online_check_interval) + u8" 秒检查一次");
+}
+
+void OnlineMonitor::stop() {
+    {
+        unique_lock<mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    state_ = nullopt;
+}
+
+OnlineMonitor::State OnlineMonitor::state() {
+    {
+        unique_lock<mutex> lock(mutex_);
+        if (running_ && state_) {
+            return state_.value();
+        }
+    }
+    return {check(), Clock::now()};
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * Check whether the logged in QQ is online in a background thread every "online_check_interval" seconds,
+ * so that "get_status" can return the latest result without going through CoolQ on every call.
+ */
+class OnlineMonitor {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct State {
+        bool online;
+        Clock::time_point checked_at;
+    };
+
+    static OnlineMonitor &instance() {
+        static OnlineMonitor monitor;
+        return monitor;
+    }
+
+    void start();
+    void stop();
+
+    /**
+     * Get the latest result, checks immediately if the monitor is not started or hasn't checked yet.
+     */
+    State state();
+
+private:
+    OnlineMonitor() = default;
+
+    std::optional<State> state_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    bool running_ = false;
+
+    static bool check();
+};
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "common.h"
+
+#include <tuple>
+
+/**
+ * Typed parameters of API handlers.
+ *
+ * The parameters of a handler are declared as a struct, whose members hold the default values,
+ * with a static "fields" function listing the keys bound to the members, for example:
+ *
+ *     struct SetGroupBanArgs {
+ *         int64_t group_id = 0;
+ *         int64_t duration = 30 * 60;
+ *
+ *         static constexpr auto fields() {
+ *             return std::make_tuple(param_schema::required("group_id", &SetGroupBanArgs::group_id),
+ *                                    param_schema::optional("duration", &SetGroupBanArgs::duration));
+ *         }
+ *     };
+ *
+ * The values are converted the same way as Params::get_integer() and friends do,
+ * so a value of a wrong type leaves the default value. A required parameter must be present and non-zero (non-empty).
+ */
+namespace param_schema {
+    template <typename Struct, typename T>
+    struct Field {
+        const char *name;
+        T Struct::*member;
+        bool required;
+    };
+
+    template <typename Struct, typename T>
+    constexpr Field<Struct, T> required(const char *name, T Struct::*member) {
+        return {name, member, true};
+    }
+
+    template <typename Struct, typename T>
+    constexpr Field<Struct, T> optional(const char *name, T Struct::*member) {
+        return {name, member, false};
+    }
+
+    inline void convert(const json &value, int64_t &out) {
+        if (value.is_string()) {
+            try {
+                out = std::stoll(value.get_ref<const std::string &>());
+            } catch (std::invalid_argument &) {
+                // invalid integer string
+            } catch (std::out_of_range &) {
+                // too large
+            }
+        } else if (value.is_number_integer()) {
+            out = value.get<int64_t>();
+        }
+    }
+
+    inline void convert(const json &value, int32_t &out) {
+        int64_t v = out;
+        convert(value, v);
+        out = static_cast<int32_t>(v);
+    }
+
+    inline void convert(const json &value, bool &out) {
+        if (value.is_string()) {
+            out = to_bool(value.get_ref<const std::string &>(), out);
+        } else if (value.is_boolean()) {
+            out = value.get<bool>();
+        }
+    }
+
+    inline void convert(const json &value, std::string &out) {
+        if (value.is_string()) {
+            out = value.get<std::string>();
+        }
+    }
+
+    inline bool is_set(const int64_t v) { return v != 0; }
+    inline bool is_set(const int32_t v) { return v != 0; }
+    inline bool is_set(const bool) { return true; }
+    inline bool is_set(const std::string &v) { return !v.empty(); }
+
+    /**
+     * Fill "args" from the parameter object in one pass over it.
+     *
+     * \return false if any required parameter is missing
+     */
+    template <typename Args>
+    bool parse(const json &params, Args &args) {
+        constexpr auto fields = Args::fields();
+        if (params.is_object()) {
+            for (auto it = params.begin(); it != params.end(); ++it) {
+                const auto &key = it.key();
+                // stop at the first field with the key
+                std::apply([&](const auto &... field) {
+                    (void)((key == field.name && (convert(it.value(), args.*(field.member)), true)) || ...);
+                }, fields);
+            }
+        }
+        return std::apply([&](const auto &... field) {
+            return ((!field.required || is_set(args.*(field.member))) && ...);
+        }, fields);
+    }
+} // namespace param_schema
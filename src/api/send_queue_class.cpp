@@ -0,0 +1,306 @@
+#include "./send_queue_class.h"
+
+#include "app.h"
+
+#include "utils/deadline_class.h"
+
+using namespace std;
+
+static const auto TAG = u8"发送队列";
+
+static const size_t MAX_MERGED_MESSAGE_SIZE = 3000; // in bytes, to stay below QQ's limit of a single message
+
+void SendQueue::start() {
+    if (running_ || config.send_queue_rate <= 0) {
+        return;
+    }
+
+    rate_ = config.send_queue_rate;
+    burst_ = max(config.send_queue_burst, 1.0);
+    merge_ = config.send_queue_merge;
+    max_size_ = config.send_queue_max_size;
+    queued_count_ = 0;
+
+    running_ = true;
+    thread_ = thread([this] { worker_loop(); });
+    Log::d(TAG, u8"发送队列已启动，每个对象每秒最多发送 " + to_string(rate_) + u8" 条消息");
+}
+
+void SendQueue::stop() {
+    if (!running_) {
+        return;
+    }
+
+    size_t dropped_count = 0;
+    vector<Callback> callbacks;
+    {
+        unique_lock<mutex> lock(mutex_);
+        running_ = false;
+        for (auto &target : targets_) {
+            for (auto &item : target.second.items) {
+                dropped_count++;
+                move(item.callbacks.begin(), item.callbacks.end(), back_inserter(callbacks));
+            }
+        }
+        targets_.clear();
+        ready_targets_.clear();
+        queued_count_ = 0;
+    }
+    cv_.notify_all();
+    for (const auto &callback : callbacks) {
+        callback(-1); // tell the waiting callers that the message is not sent
+    }
+
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+
+    if (dropped_count > 0) {
+        Log::w(TAG, u8"发送队列已停止，队列中 " + to_string(dropped_count) + u8" 条消息未发送");
+    }
+    Log::d(TAG, u8"发送队列已停止");
+}
+
+void SendQueue::set_limits(const double rate, const double burst, const bool merge) {
+    {
+        unique_lock<mutex> lock(mutex_);
+        if (!running_ || rate <= 0) {
+            return;
+        }
+        rate_ = rate;
+        burst_ = max(burst, 1.0);
+        merge_ = merge;
+    }
+    cv_.notify_one(); // the worker may be waiting with the old rate
+    Log::d(TAG, u8"发送队列的速率限制已更新，每个对象每秒最多发送 " + to_string(rate) + u8" 条消息");
+}
+
+size_t SendQueue::queue_size() {
+    unique_lock<mutex> lock(mutex_);
+    size_t size = 0;
+    for (const auto &entry : targets_) {
+        size += entry.second.items.size();
+    }
+    return size;
+}
+
+void SendQueue::send(const TargetType type, const int64_t target_id, const string &message,
+                     shared_ptr<const string> encoded, Callback callback) {
+    if (!running_) {
+        callback(encoded ? send_encoded_now(type, target_id, *encoded) : send_now(type, target_id, message));
+        return;
+    }
+    enqueue({type, target_id}, message, move(callback), move(encoded));
+}
+
+bool SendQueue::push(const TargetType type, const int64_t target_id, const string &message,
+                     shared_ptr<const string> encoded) {
+    if (!running_) {
+        return false;
+    }
+    enqueue({type, target_id}, message, nullptr, move(encoded));
+    return true;
+}
+
+void SendQueue::send_multi(const vector<TargetKey> &targets, const string &message,
+                           function<void(vector<int32_t>)> callback) {
+    const auto encoded = make_shared<const string>(string_to_coolq(message));
+
+    if (!running_ || targets.empty()) {
+        vector<int32_t> results;
+        results.reserve(targets.size());
+        for (const auto &target : targets) {
+            results.push_back(send_encoded_now(target.first, target.second, *encoded));
+        }
+        callback(move(results));
+        return;
+    }
+
+    // the results are collected as the targets are sent, the last one calls back
+    struct Collected {
+        mutex mtx;
+        vector<int32_t> results;
+        size_t remaining;
+        function<void(vector<int32_t>)> callback;
+    };
+    const auto collected = make_shared<Collected>();
+    collected->results.resize(targets.size(), -1);
+    collected->remaining = targets.size();
+    collected->callback = move(callback);
+    for (size_t i = 0; i < targets.size(); i++) {
+        enqueue(targets[i], string(), [collected, i](const int32_t ret) {
+            {
+                unique_lock<mutex> lock(collected->mtx);
+                collected->results[i] = ret;
+                if (--collected->remaining > 0) {
+                    return;
+                }
+            }
+            collected->callback(move(collected->results));
+        }, encoded);
+    }
+}
+
+bool SendQueue::push_multi(const vector<TargetKey> &targets, const string &message) {
+    if (!running_) {
+        return false;
+    }
+    const auto encoded = make_shared<const string>(string_to_coolq(message));
+    for (const auto &target : targets) {
+        enqueue(target, string(), nullptr, encoded);
+    }
+    return true;
+}
+
+void SendQueue::enqueue(const Key &key, string message, Callback callback, shared_ptr<const string> encoded) {
+    {
+        unique_lock<mutex> lock(mutex_);
+        if (!running_) {
+            lock.unlock();
+            if (callback) {
+                callback(-1);
+            }
+            return;
+        }
+
+        auto [it, inserted] = targets_.try_emplace(key);
+        auto &target = it->second;
+        if (inserted) {
+            target.tokens = burst_;
+            target.last_refill = Clock::now();
+        }
+
+        if (target.items.empty()) {
+            ready_targets_.push_back(key);
+        }
+
+        // only a waiting caller can give up, messages pushed without waiting are always sent
+        const auto deadline = callback ? Deadline::current() : nullopt;
+
+        if (merge_ && !message.empty() && !target.items.empty() && !target.items.back().message.empty()
+            && target.items.back().message.size() + 1 + message.size() <= MAX_MERGED_MESSAGE_SIZE) {
+            // merge consecutive messages to the same target, they will share the same result
+            auto &last = target.items.back();
+            last.message += "\n" + message;
+            last.encoded = nullptr; // the merged message is encoded when sent
+            last.deadline = last.deadline && deadline ? max(*last.deadline, *deadline) : nullopt;
+            if (callback) {
+                last.callbacks.push_back(move(callback));
+            }
+        } else {
+            Item item{move(message), move(encoded), {}, deadline};
+            if (callback) {
+                item.callbacks.push_back(move(callback));
+            }
+            target.items.push_back(move(item));
+            queued_count_++;
+        }
+    }
+    cv_.notify_one();
+}
+
+void SendQueue::worker_loop() {
+    while (true) {
+        Key key;
+        Item item;
+        vector<Callback> expired_callbacks;
+        {
+            unique_lock<mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return !running_ || !ready_targets_.empty(); });
+            if (!running_) {
+                break;
+            }
+
+            // find the first target (in round-robin order) that has a token
+            const auto now = Clock::now();
+            auto min_wait = chrono::duration<double>::max();
+            auto found = false;
+            for (size_t i = 0; i < ready_targets_.size(); i++) {
+                auto &target = targets_[ready_targets_.front()];
+
+                const chrono::duration<double> elapsed = now - target.last_refill;
+                target.tokens = min(burst_, target.tokens + elapsed.count() * rate_);
+                target.last_refill = now;
+
+                if (const auto deadline = target.items.front().deadline; deadline && now >= *deadline) {
+                    // the callers have given up waiting, drop it without using the token
+                    auto &callbacks = target.items.front().callbacks;
+                    move(callbacks.begin(), callbacks.end(), back_inserter(expired_callbacks));
+                    target.items.pop_front();
+                    queued_count_--;
+                    if (target.items.empty()) {
+                        ready_targets_.pop_front();
+                        i--; // the next target is at the front now
+                    }
+                    continue;
+                }
+
+                if (target.tokens >= 1.0) {
+                    key = ready_targets_.front();
+                    ready_targets_.pop_front();
+                    item = move(target.items.front());
+                    target.items.pop_front();
+                    queued_count_--;
+                    target.tokens -= 1.0;
+                    if (!target.items.empty()) {
+                        ready_targets_.push_back(key); // go to the end of the round
+                    }
+                    found = true;
+                    break;
+                }
+
+                min_wait = min(min_wait, chrono::duration<double>((1.0 - target.tokens) / rate_));
+                if (const auto deadline = target.items.front().deadline) {
+                    min_wait = min(min_wait, chrono::duration<double>(*deadline - now)); // answer the callers in time
+                }
+                ready_targets_.push_back(ready_targets_.front());
+                ready_targets_.pop_front();
+            }
+
+            if (!found && expired_callbacks.empty()) {
+                // no target can send now, wait for the earliest token or deadline, or a new message
+                cv_.wait_for(lock, chrono::duration_cast<chrono::milliseconds>(min_wait) + chrono::milliseconds(1));
+                continue;
+            }
+        }
+
+        for (const auto &callback : expired_callbacks) {
+            callback(-1);
+        }
+        if (!found) {
+            continue;
+        }
+
+        const auto ret = item.encoded ? send_encoded_now(key.first, key.second, *item.encoded)
+                                      : send_now(key.first, key.second, item.message);
+        for (const auto &callback : item.callbacks) {
+            callback(ret);
+        }
+    }
+}
+
+int32_t SendQueue::send_now(const TargetType type, const int64_t target_id, const string &message) {
+    switch (type) {
+    case TargetType::PRIVATE:
+        return sdk->send_private_msg(target_id, message);
+    case TargetType::GROUP:
+        return sdk->send_group_msg(target_id, message);
+    case TargetType::DISCUSS:
+        return sdk->send_discuss_msg(target_id, message);
+    default:
+        return -1;
+    }
+}
+
+int32_t SendQueue::send_encoded_now(const TargetType type, const int64_t target_id, const string &coolq_msg) {
+    switch (type) {
+    case TargetType::PRIVATE:
+        return sdk->send_private_msg_encoded(target_id, coolq_msg);
+    case TargetType::GROUP:
+        return sdk->send_group_msg_encoded(target_id, coolq_msg);
+    case TargetType::DISCUSS:
+        return sdk->send_discuss_msg_encoded(target_id, coolq_msg);
+    default:
+        return -1;
+    }
+}
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+
+/**
+ * Outbound message queue, which limits the sending rate of each target (private, group or discuss)
+ * with a token bucket, and sends to the targets in round-robin order,
+ * so that bursts to one target don't trigger QQ's risk control nor starve the others.
+ */
+class SendQueue {
+public:
+    enum class TargetType { PRIVATE, GROUP, DISCUSS };
+    using TargetKey = std::pair<TargetType, int64_t>;
+    using Callback = std::function<void(int32_t)>;
+
+    static SendQueue &instance() {
+        static SendQueue queue;
+        return queue;
+    }
+
+    void start();
+    void stop();
+    bool started() const { return running_; }
+
+    /**
+     * Count of the messages waiting in the queue.
+     */
+    size_t queue_size();
+
+    /**
+     * Whether the queue holds "send_queue_max_size" messages, in which case new messages should be refused.
+     */
+    bool full() const { return running_ && max_size_ > 0 && queued_count_ >= max_size_; }
+
+    /**
+     * Change the rate limit of a started queue, the queued messages are kept.
+     */
+    void set_limits(double rate, double burst, bool merge);
+
+    /**
+     * Send a message through the queue, or immediately if the queue is not started,
+     * without waiting for it: "callback" is called with the return value of the CoolQ function
+     * (message id if succeeded, -1 if given up after the deadline of the caller) by the thread which sends it.
+     *
+     * \param encoded: the message already converted to CoolQ's encoding, if known
+     */
+    void send(TargetType type, int64_t target_id, const std::string &message,
+              std::shared_ptr<const std::string> encoded, Callback callback);
+
+    /**
+     * Put a message into the queue without waiting.
+     *
+     * \return false if the queue is not started
+     */
+    bool push(TargetType type, int64_t target_id, const std::string &message,
+              std::shared_ptr<const std::string> encoded = nullptr);
+
+    /**
+     * Send one message to many targets, converting it to CoolQ's encoding only once
+     * (in round-robin order with the other targets if the queue is started).
+     * "callback" is called once all of them are sent, with the return values in the order of "targets".
+     */
+    void send_multi(const std::vector<TargetKey> &targets, const std::string &message,
+                    std::function<void(std::vector<int32_t>)> callback);
+
+    /**
+     * Put one message for many targets into the queue without waiting.
+     *
+     * \return false if the queue is not started
+     */
+    bool push_multi(const std::vector<TargetKey> &targets, const std::string &message);
+
+private:
+    SendQueue() = default;
+
+    using Key = TargetKey;
+    using Clock = std::chrono::steady_clock;
+
+    struct Item {
+        std::string message; // empty for the items of send_multi, which are never merged
+        std::shared_ptr<const std::string> encoded; // shared by the targets of send_multi, or from the outbound cache
+        std::vector<Callback> callbacks; // of the callers waiting for the result
+        std::optional<Clock::time_point> deadline; // dropped if not sent before it (see Deadline)
+    };
+
+    struct Target {
+        std::deque<Item> items;
+        double tokens;
+        Clock::time_point last_refill;
+    };
+
+    std::map<Key, Target> targets_;
+    std::deque<Key> ready_targets_; // targets that have queued items, in round-robin order
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    std::atomic<bool> running_ = false;
+
+    std::atomic<size_t> queued_count_ = 0; // items (merged messages count as one) in all targets
+    size_t max_size_ = 0;
+
+    double rate_ = 1.0; // tokens per second
+    double burst_ = 1.0;
+    bool merge_ = false;
+
+    void enqueue(const Key &key, std::string message, Callback callback,
+                 std::shared_ptr<const std::string> encoded = nullptr);
+    void worker_loop();
+    static int32_t send_now(TargetType type, int64_t target_id, const std::string &message);
+    static int32_t send_encoded_now(TargetType type, int64_t target_id, const std::string &coolq_msg);
+};
@@ -21,7 +21,15 @@
 
 #include "common.h"
 
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+
 #include "utils/params_class.h"
+#include "utils/wire_format.h"
+
+class ApiDeferredResult;
 
 struct ApiResult {
     using RetCode = int;
@@ -39,32 +47,141 @@ struct ApiResult {
         static const RetCode HTTP_UNAUTHORIZED = 1401;
         static const RetCode HTTP_FORBIDDEN = 1403;
         static const RetCode HTTP_NOT_FOUND = 1404;
+        static const RetCode HTTP_SERVICE_UNAVAILABLE = 1503; // overloaded, the client should retry later
+        static const RetCode HTTP_GATEWAY_TIMEOUT = 1504; // the deadline of the request is exceeded
     };
 
     RetCode retcode; // succeeded: 0, lack of parameters or invalid ones: 1xx, CQ error code: -11, -23, etc... (< 0)
     json data;
 
+    // already serialized "data", if not null, it's used instead of "data",
+    // so that large cached results don't have to be dumped again for every request
+    std::shared_ptr<const std::string> data_str;
+
+    // set by a handler which completes the result later in another thread (e.g. a message waiting in the send queue),
+    // the caller then gets the result from it instead of "retcode" and "data"
+    std::shared_ptr<ApiDeferredResult> deferred;
+
     ApiResult() : retcode(RetCodes::DEFAULT_ERROR) {}
 
-    json json() const {
-        std::string status;
+    /**
+     * Make the result deferred, and return the object through which the handler completes it.
+     */
+    std::shared_ptr<ApiDeferredResult> defer();
+
+    std::string status() const {
         switch (retcode) {
         case RetCodes::OK:
-            status = "ok";
-            break;
+            return "ok";
         case RetCodes::ASYNC:
-            status = "async";
-            break;
+            return "async";
         default:
-            status = "failed";
+            return "failed";
         }
+    }
+
+    json json() const {
         return {
-            {"status", status},
+            {"status", status()},
             {"retcode", retcode},
-            {"data", data}
+            {"data", data_str ? nlohmann::json::parse(*data_str) : data}
         };
     }
+
+    /**
+     * Serialize the result (with "echo" if it's not null) into the response body.
+     */
+    std::string dump(const nlohmann::json &echo = nullptr) const {
+        if (!data_str) {
+            auto j = json();
+            if (!echo.is_null()) {
+                j["echo"] = echo;
+            }
+            return j.dump();
+        }
+
+        // splice the serialized data in directly, the keys are in the same order as json::dump()
+        std::string body = "{\"data\":" + *data_str;
+        if (!echo.is_null()) {
+            body += ",\"echo\":" + echo.dump();
+        }
+        body += ",\"retcode\":" + std::to_string(retcode) + ",\"status\":\"" + status() + "\"}";
+        return body;
+    }
+
+    /**
+     * Serialize the result in the given format, see dump() above.
+     */
+    std::string dump(const WireFormat format, const nlohmann::json &echo = nullptr) const {
+        if (format == WireFormat::JSON) {
+            return dump(echo);
+        }
+        auto j = json();
+        if (!echo.is_null()) {
+            j["echo"] = echo;
+        }
+        return wire_dump(j, format);
+    }
 };
 
+/**
+ * The result of a call which is completed by another thread, so that the calling (e.g. IO) thread isn't blocked.
+ */
+class ApiDeferredResult {
+public:
+    using Callback = std::function<void(const ApiResult &)>;
+
+    /**
+     * Complete the result, the callbacks are called in the current thread.
+     */
+    void complete(ApiResult result) {
+        std::vector<Callback> callbacks;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            result_ = std::move(result);
+            callbacks = std::move(callbacks_);
+        }
+        cv_.notify_all();
+        for (const auto &callback : callbacks) {
+            callback(*result_); // never modified again
+        }
+    }
+
+    /**
+     * Call "callback" once the result is completed, or right now if it already is.
+     * The callbacks are called in the order they are added.
+     */
+    void then(Callback callback) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!result_) {
+                callbacks_.push_back(std::move(callback));
+                return;
+            }
+        }
+        callback(*result_);
+    }
+
+    /**
+     * Block until the result is completed, only for callers which can't continue in a callback.
+     */
+    ApiResult wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this] { return result_.has_value(); });
+        return *result_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::optional<ApiResult> result_;
+    std::vector<Callback> callbacks_;
+};
+
+inline std::shared_ptr<ApiDeferredResult> ApiResult::defer() {
+    deferred = std::make_shared<ApiDeferredResult>();
+    return deferred;
+}
+
 using ApiHandler = std::function<void(const Params &, ApiResult &)>;
 using ApiHandlerMap = std::unordered_map<std::string, ApiHandler>;
@@ -37,7 +37,14 @@ extern std::optional<Sdk> sdk;
 #include "conf/config_struct.h"
 extern Config config;
 
-#include "ctpl/ctpl_stl.h"
-extern std::shared_ptr<ctpl::thread_pool> pool;
+/**
+ * The latest loaded configuration, which is newer than "config" after a hot reload (see Application::reload).
+ * The fields that support hot reload (see Config::assign_hot_reloadable) must be read from here.
+ */
+std::shared_ptr<const Config> live_config();
+void set_live_config(std::shared_ptr<const Config> c);
+
+#include "utils/task_scheduler_class.h"
+extern std::shared_ptr<TaskScheduler> pool;
 
 #include "log_class.h"
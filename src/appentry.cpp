@@ -20,6 +20,7 @@
 #include "app.h"
 
 #include "update.h"
+#include "utils/tracing.h"
 
 using namespace std;
 
@@ -37,6 +38,7 @@ CQEVENT(const char *, AppInfo, 0)
  */
 CQEVENT(int32_t, Initialize, 4)
 (const int32_t auth_code) {
+    tracing::start(); // does nothing unless built in the "Profile" configuration
     app.initialize(auth_code);
     return 0;
 }
@@ -48,9 +50,7 @@ CQEVENT(int32_t, Enable, 0)
 () {
     app.enable();
     if (config.auto_check_update) {
-        pool->push([](int) {
-            check_update(true);
-        });
+        check_update_async(true);
     }
     return 0;
 }
@@ -60,6 +60,7 @@ CQEVENT(int32_t, Enable, 0)
  */
 CQEVENT(int32_t, Disable, 0)
 () {
+    cancel_update_check();
     app.disable();
     return 0;
 }
@@ -77,6 +78,8 @@ CQEVENT(int32_t, Start, 0)
  */
 CQEVENT(int32_t, Exit, 0)
 () {
+    cancel_update_check();
     app.exit();
+    tracing::stop();
     return 0;
 }
@@ -26,6 +26,15 @@
 #include "conf/loader.h"
 #include "service/hub_class.h"
 #include "event/filter.h"
+#include "event/async_poster_class.h"
+#include "event/post_targets_class.h"
+#include "event/journal_class.h"
+#include "message/message_store_class.h"
+#include "message/outbound_cache_class.h"
+#include "api/info_cache_class.h"
+#include "api/send_queue_class.h"
+#include "api/online_monitor_class.h"
+#include "utils/pool_autoscaler_class.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -37,23 +46,51 @@ void Application::initialize(const int32_t auth_code) {
     restart_worker_running_ = true;
     restart_worker_thread_ = thread([&]() {
         static const auto tag = u8"重启";
+        unique_lock<mutex> lock(restart_mutex_);
         while (restart_worker_running_) {
-            if (should_restart_) {
-                // this may not be thread-safe, but currently it's ok
-                should_restart_ = false;
-                if (restart_delay_ > 0) {
-                    Log::i(tag, u8"HTTP API 插件将在 " + to_string(restart_delay_) + u8" 毫秒后重启");
+            if (!should_reload_ && !should_restart_) {
+                if (enabled_ && live_config()->auto_reload) {
+                    restart_cv_.wait_for(lock, chrono::milliseconds(500)); // check the watched files every 500 ms
+                } else {
+                    restart_cv_.wait(lock); // until woken up by restart_async(), reload_async(), enable() or exit()
                 }
-                Sleep(restart_delay_);
+                if (!restart_worker_running_) {
+                    break;
+                }
+            }
+
+            const auto reload_requested = exchange(should_reload_, false);
+            const auto restart_requested = exchange(should_restart_, false);
+            const auto restart_delay = restart_delay_;
+            lock.unlock(); // enable() and reload() wake up this thread, which needs the lock
+
+            if (reload_requested || enabled_ && live_config()->auto_reload && watched_files_changed()) {
+                reload();
+            }
+            if (restart_requested) {
+                if (restart_delay > 0) {
+                    Log::i(tag, u8"HTTP API 插件将在 " + to_string(restart_delay) + u8" 毫秒后重启");
+                }
+                Sleep(restart_delay);
                 disable();
                 enable();
                 Log::i(tag, u8"HTTP API 插件重启成功");
             }
-            Sleep(500); // wait 500 ms for the next check
+
+            lock.lock();
         }
     });
 }
 
+static void apply_log_level(const string &level_name) {
+    if (const auto level = Log::parse_level(level_name)) {
+        Log::set_min_level(level.value());
+    } else {
+        Log::set_min_level(CQLOG_DEBUG);
+        Log::w(u8"日志", u8"日志级别 " + level_name + u8" 无效，将输出所有日志");
+    }
+}
+
 void Application::enable() {
     static const auto TAG = u8"启用";
 
@@ -67,22 +104,45 @@ void Application::enable() {
     if (const auto c = load_configuration(sdk->directories().app() + "config.cfg")) {
         config = c.value();
     }
+    set_live_config(make_shared<const Config>(config));
+    watched_files_changed(); // remember the current modification times
 
-    ServiceHub::instance().start();
+    apply_log_level(config.log_level);
+    Log::start_async();
+
+    // the event pipeline goes first, so that it's ready once the services begin to accept connections
+
+    if (!pool) {
+        Log::d(TAG, u8"工作线程池创建成功");
+        pool = make_shared<TaskScheduler>(
+            config.thread_pool_size > 0 ? config.thread_pool_size : thread::hardware_concurrency() * 2 + 1,
+            config.thread_pool_max_size
+        );
+    }
+    PoolAutoscaler::instance().start(); // only started if "thread_pool_max_size" is larger than the initial size
 
     GlobalFilter::reset();
     if (config.use_filter) {
         GlobalFilter::load(sdk->directories().app() + "filter.json");
     }
 
-    if (!pool) {
-        Log::d(TAG, u8"工作线程池创建成功");
-        pool = make_shared<ctpl::thread_pool>(
-            config.thread_pool_size > 0 ? config.thread_pool_size : thread::hardware_concurrency() * 2 + 1
-        );
+    EventJournal::instance().start(); // only started if "use_journal" is true
+    MessageStore::instance().start(); // only started if "use_message_store" is true
+
+    if (config.use_async_post) {
+        AsyncPoster::instance().start();
+    }
+    if (config.post_prewarm && config.has_post_targets()) {
+        PostTargets::instance().prewarm(); // in background
     }
 
+    SendQueue::instance().start(); // only started if "send_queue_rate" > 0
+
+    ServiceHub::instance().start(); // the services are started concurrently
+    OnlineMonitor::instance().start(); // only started if "online_check_interval" > 0
+
     enabled_ = true;
+    wake_restart_worker(); // "auto_reload" may be on now
     Log::i(TAG, u8"HTTP API 插件已启用");
 }
 
@@ -93,8 +153,16 @@ void Application::disable() {
         return;
     }
 
+    AsyncPoster::instance().stop();
     ServiceHub::instance().stop();
+    EventJournal::instance().stop();
+    MessageStore::instance().stop();
+    SendQueue::instance().stop();
+    OnlineMonitor::instance().stop();
+    InfoCache::instance().clear();
+    OutboundCache::instance().clear();
 
+    PoolAutoscaler::instance().stop();
     if (pool) {
         pool->stop();
         pool = nullptr;
@@ -103,20 +171,100 @@ void Application::disable() {
 
     enabled_ = false;
     Log::i(TAG, u8"HTTP API 插件已停用");
+    Log::stop_async();
 }
 
 void Application::exit() {
     disable();
 
-    restart_worker_running_ = false;
+    {
+        unique_lock<mutex> lock(restart_mutex_);
+        restart_worker_running_ = false;
+    }
+    restart_cv_.notify_all();
     if (restart_worker_thread_.joinable()) {
         restart_worker_thread_.join();
     }
 }
 
 void Application::restart_async(const unsigned long delay_millisecond) {
-    restart_delay_ = delay_millisecond;
-    should_restart_ = true; // this will let the restart worker do it
+    {
+        unique_lock<mutex> lock(restart_mutex_);
+        restart_delay_ = delay_millisecond;
+        should_restart_ = true; // this will let the restart worker do it
+    }
+    restart_cv_.notify_all();
+}
+
+bool Application::reload() {
+    static const auto TAG = u8"重新加载";
+
+    unique_lock<mutex> lock(reload_mutex_);
+    if (!enabled_) {
+        return false;
+    }
+
+    const auto c = load_configuration(sdk->directories().app() + "config.cfg");
+    if (!c) {
+        Log::e(TAG, u8"配置文件重新加载失败，将继续使用原有配置");
+        return false;
+    }
+
+    const auto old_config = live_config();
+    auto new_config = make_shared<Config>(*old_config);
+    new_config->assign_hot_reloadable(c.value());
+
+    if ((old_config->send_queue_rate > 0) != (new_config->send_queue_rate > 0)) {
+        Log::w(TAG, u8"启用或关闭发送队列需要重启插件才能生效");
+    }
+    SendQueue::instance().set_limits(new_config->send_queue_rate, new_config->send_queue_burst,
+                                     new_config->send_queue_merge);
+
+    auto succeeded = true;
+    if (new_config->use_filter) {
+        succeeded = GlobalFilter::reload(sdk->directories().app() + "filter.json");
+    } else {
+        GlobalFilter::reset();
+    }
+
+    apply_log_level(new_config->log_level);
+    set_live_config(move(new_config));
+
+    Log::i(TAG, u8"配置和过滤规则已重新加载，连接和服务未重启");
+    lock.unlock();
+    wake_restart_worker(); // "auto_reload" may be changed
+    return succeeded;
+}
+
+void Application::reload_async() {
+    {
+        unique_lock<mutex> lock(restart_mutex_);
+        should_reload_ = true; // also done by the restart worker
+    }
+    restart_cv_.notify_all();
+}
+
+void Application::wake_restart_worker() {
+    // taking the lock makes sure the worker is either waiting or yet to check "auto_reload"
+    { unique_lock<mutex> lock(restart_mutex_); }
+    restart_cv_.notify_all();
+}
+
+bool Application::watched_files_changed() {
+    auto changed = false;
+    for (const auto &filename : {"config.cfg", "filter.json"}) {
+        const auto path = s2ws(sdk->directories().app() + filename);
+        boost::system::error_code ec;
+        const auto time = fs::last_write_time(path, ec);
+        if (ec) {
+            continue;
+        }
+        if (auto &last_time = watched_file_times_[filename]; last_time != time) {
+            changed = changed || last_time != 0;
+            last_time = time;
+        }
+    }
+    return changed;
 }
 
 bool Application::is_locked() const {
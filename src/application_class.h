@@ -22,6 +22,8 @@
 
 #include "common.h"
 
+#include <condition_variable>
+
 class Application {
 public:
     void initialize(int32_t auth_code);
@@ -30,6 +32,14 @@ public:
     void exit();
     void restart_async(const unsigned long delay_millisecond = 0);
 
+    /**
+     * Reload the filter and the hot reloadable fields of the configuration (see Config::assign_hot_reloadable),
+     * without restarting the services, so that connections and queued events are kept.
+     * Other changed fields take effect on the next restart.
+     */
+    bool reload();
+    void reload_async();
+
     bool is_initialized() const { return initialized_; }
     bool is_enabled() const { return enabled_; }
 
@@ -41,6 +51,15 @@ private:
 
     bool should_restart_ = false;
     unsigned long restart_delay_ = 0;
+    bool should_reload_ = false;
+    std::mutex reload_mutex_;
+    std::map<std::string, std::time_t> watched_file_times_; // for "auto_reload"
     std::thread restart_worker_thread_;
     bool restart_worker_running_ = false;
+    // guards the flags above which signal the restart worker
+    std::mutex restart_mutex_;
+    std::condition_variable restart_cv_;
+
+    bool watched_files_changed();
+    void wake_restart_worker();
 };
@@ -28,22 +28,123 @@ struct Config {
     std::string ws_host = "0.0.0.0";
     unsigned short ws_port = 6700;
     bool use_ws = false;
+    bool ws_use_http_port = false;
+    size_t ws_api_max_in_flight = 0;
+    size_t ws_api_max_pending = 1000;
+    size_t ws_event_queue_size = 1000;
+    std::string ws_event_queue_full_action = "drop";
+    bool ws_compression = false;
+    int ws_compression_level = -1;
+    bool ws_compression_context_takeover = true;
+    size_t ws_compression_min_size = 0;
+    size_t ws_max_message_size = 67108864;
     std::string ws_reverse_api_url = "";
     std::string ws_reverse_event_url = "";
+    std::string ws_reverse_url = "";
+    bool ws_reverse_use_universal_client = false;
+    size_t ws_reverse_api_connections = 1;
     unsigned long ws_reverse_reconnect_interval = 3000;
+    unsigned long ws_reverse_reconnect_max_interval = 60000;
+    size_t ws_reverse_event_buffer_size = 0;
     bool ws_reverse_reconnect_on_code_1000 = false;
+    std::string ws_reverse_event_filter = "";
+    std::string ws_reverse_format = "json";
+    bool ws_reverse_event_batch = false;
+    size_t ws_reverse_batch_size = 100;
+    unsigned long ws_reverse_batch_interval = 50;
+    size_t ws_reverse_batch_max_unacked = 100;
     bool use_ws_reverse = false;
+    bool use_pipe = false;
+    std::string pipe_name = "coolq-http-api";
+    bool use_shm_ring = false;
+    std::string shm_ring_name = "coolq-http-api-events";
+    size_t shm_ring_size = 16 * 1024 * 1024;
     std::string post_url = "";
+    std::string post_urls = "";
+    std::string post_url_mode = "broadcast";
+    size_t post_circuit_failures = 3;
+    unsigned long post_circuit_cooldown = 30;
+    unsigned long post_timeout = 0;
+    bool post_prewarm = true;
+    bool use_async_post = false;
+    size_t async_post_queue_size = 1024;
+    size_t async_post_thread_pool_size = 4;
+    size_t async_post_batch_size = 1;
+    unsigned long async_post_batch_interval = 0;
+    bool async_post_ordered = false;
+    std::string event_priority = "request,event>private>group,discuss";
+    unsigned long async_post_shed_latency = 0;
+    size_t send_queue_max_size = 0;
+    bool post_compression = false;
+    std::string post_format = "json";
+    bool http_compression = true;
+    size_t http_compression_min_size = 1024;
+    int http_compression_level = -1;
+    size_t http_max_request_size = 64 * 1024 * 1024;
+    long http_keep_alive_timeout = 30;
+    unsigned long api_timeout = 0;
     std::string access_token = "";
     std::string secret = "";
+    std::string signature_algorithm = "sha1";
     std::string post_message_format = "string";
     bool serve_data_files = false;
     std::string update_source = "https://raw.githubusercontent.com/richardchien/coolq-http-api-release/master/";
     std::string update_channel = "stable";
     bool auto_check_update = false;
     bool auto_perform_update = false;
+    unsigned long auto_check_update_delay = 60;
     size_t thread_pool_size = 4;
+    size_t thread_pool_min_size = 1;
+    size_t thread_pool_max_size = 0;
+    unsigned long thread_pool_target_wait = 100;
     size_t server_thread_pool_size = 1;
+    bool server_io_service_per_thread = false;
+    unsigned long info_cache_ttl = 0;
+    double send_queue_rate = 0;
+    double send_queue_burst = 5;
+    bool send_queue_merge = false;
     bool convert_unicode_emoji = true;
     bool use_filter = false;
+    unsigned long event_dedup_window = 0;
+    bool auto_reload = false;
+    size_t media_cache_size = 0;
+    std::string shared_cache_dir = "";
+    size_t outbound_cache_size = 0;
+    size_t download_concurrency = 1;
+    size_t download_chunk_size = 1024;
+    size_t download_max_connections_per_host = 4;
+    std::string log_level = "debug";
+    unsigned long online_check_interval = 0;
+    double event_trace_sample_rate = 0;
+    bool use_journal = false;
+    size_t journal_segment_size = 64 * 1024 * 1024;
+    size_t journal_max_segments = 16;
+    bool use_message_store = false;
+    unsigned long message_store_days = 7;
+
+    /// Whether events are posted over HTTP, i.e. "post_url" or "post_urls" is set.
+    bool has_post_targets() const { return !post_url.empty() || !post_urls.empty(); }
+
+    /**
+     * Copy the fields that can take effect without restarting the plugin.
+     */
+    void assign_hot_reloadable(const Config &other) {
+        post_url = other.post_url;
+        post_urls = other.post_urls;
+        post_url_mode = other.post_url_mode;
+        post_timeout = other.post_timeout;
+        post_compression = other.post_compression;
+        access_token = other.access_token;
+        secret = other.secret;
+        signature_algorithm = other.signature_algorithm;
+        post_message_format = other.post_message_format;
+        send_queue_rate = other.send_queue_rate;
+        send_queue_burst = other.send_queue_burst;
+        send_queue_merge = other.send_queue_merge;
+        use_filter = other.use_filter;
+        event_dedup_window = other.event_dedup_window;
+        auto_reload = other.auto_reload;
+        log_level = other.log_level;
+        event_trace_sample_rate = other.event_trace_sample_rate;
+    }
 };
@@ -98,24 +98,99 @@ optional<Config> load_configuration(const string &filepath) {
         GET_CONFIG(ws_host, string);
         GET_CONFIG(ws_port, unsigned short);
         GET_BOOL_CONFIG(use_ws);
+        GET_BOOL_CONFIG(ws_use_http_port);
+        GET_CONFIG(ws_api_max_in_flight, size_t);
+        GET_CONFIG(ws_api_max_pending, size_t);
+        GET_CONFIG(ws_event_queue_size, size_t);
+        GET_CONFIG(ws_event_queue_full_action, string);
+        GET_BOOL_CONFIG(ws_compression);
+        GET_CONFIG(ws_compression_level, int);
+        GET_BOOL_CONFIG(ws_compression_context_takeover);
+        GET_CONFIG(ws_compression_min_size, size_t);
+        GET_CONFIG(ws_max_message_size, size_t);
         GET_CONFIG(ws_reverse_api_url, string);
         GET_CONFIG(ws_reverse_event_url, string);
+        GET_CONFIG(ws_reverse_url, string);
+        GET_BOOL_CONFIG(ws_reverse_use_universal_client);
+        GET_CONFIG(ws_reverse_api_connections, size_t);
         GET_CONFIG(ws_reverse_reconnect_interval, unsigned long);
+        GET_CONFIG(ws_reverse_reconnect_max_interval, unsigned long);
+        GET_CONFIG(ws_reverse_event_buffer_size, size_t);
         GET_BOOL_CONFIG(ws_reverse_reconnect_on_code_1000);
+        GET_CONFIG(ws_reverse_event_filter, string);
+        GET_CONFIG(ws_reverse_format, string);
+        GET_BOOL_CONFIG(ws_reverse_event_batch);
+        GET_CONFIG(ws_reverse_batch_size, size_t);
+        GET_CONFIG(ws_reverse_batch_interval, unsigned long);
+        GET_CONFIG(ws_reverse_batch_max_unacked, size_t);
         GET_BOOL_CONFIG(use_ws_reverse);
+        GET_BOOL_CONFIG(use_pipe);
+        GET_CONFIG(pipe_name, string);
+        GET_BOOL_CONFIG(use_shm_ring);
+        GET_CONFIG(shm_ring_name, string);
+        GET_CONFIG(shm_ring_size, size_t);
         GET_CONFIG(post_url, string);
+        GET_CONFIG(post_urls, string);
+        GET_CONFIG(post_url_mode, string);
+        GET_CONFIG(post_circuit_failures, size_t);
+        GET_CONFIG(post_circuit_cooldown, unsigned long);
+        GET_CONFIG(post_timeout, unsigned long);
+        GET_BOOL_CONFIG(post_prewarm);
+        GET_BOOL_CONFIG(use_async_post);
+        GET_CONFIG(async_post_queue_size, size_t);
+        GET_CONFIG(async_post_thread_pool_size, size_t);
+        GET_CONFIG(async_post_batch_size, size_t);
+        GET_CONFIG(async_post_batch_interval, unsigned long);
+        GET_BOOL_CONFIG(async_post_ordered);
+        GET_CONFIG(event_priority, string);
+        GET_CONFIG(async_post_shed_latency, unsigned long);
+        GET_BOOL_CONFIG(post_compression);
+        GET_CONFIG(post_format, string);
+        GET_BOOL_CONFIG(http_compression);
+        GET_CONFIG(http_compression_min_size, size_t);
+        GET_CONFIG(http_compression_level, int);
+        GET_CONFIG(http_max_request_size, size_t);
+        GET_CONFIG(http_keep_alive_timeout, long);
+        GET_CONFIG(api_timeout, unsigned long);
         GET_CONFIG(access_token, string);
         GET_CONFIG(secret, string);
+        GET_CONFIG(signature_algorithm, string);
         GET_CONFIG(post_message_format, string);
         GET_BOOL_CONFIG(serve_data_files);
         GET_CONFIG(update_source, string);
         GET_CONFIG(update_channel, string);
         GET_BOOL_CONFIG(auto_check_update);
         GET_BOOL_CONFIG(auto_perform_update);
+        GET_CONFIG(auto_check_update_delay, unsigned long);
         GET_CONFIG(thread_pool_size, size_t);
+        GET_CONFIG(thread_pool_min_size, size_t);
+        GET_CONFIG(thread_pool_max_size, size_t);
+        GET_CONFIG(thread_pool_target_wait, unsigned long);
         GET_CONFIG(server_thread_pool_size, size_t);
+        GET_BOOL_CONFIG(server_io_service_per_thread);
+        GET_CONFIG(info_cache_ttl, unsigned long);
+        GET_CONFIG(send_queue_rate, double);
+        GET_CONFIG(send_queue_burst, double);
+        GET_BOOL_CONFIG(send_queue_merge);
+        GET_CONFIG(send_queue_max_size, size_t);
         GET_BOOL_CONFIG(convert_unicode_emoji);
         GET_BOOL_CONFIG(use_filter);
+        GET_CONFIG(event_dedup_window, unsigned long);
+        GET_BOOL_CONFIG(auto_reload);
+        GET_CONFIG(media_cache_size, size_t);
+        GET_CONFIG(shared_cache_dir, string);
+        GET_CONFIG(outbound_cache_size, size_t);
+        GET_CONFIG(download_concurrency, size_t);
+        GET_CONFIG(download_chunk_size, size_t);
+        GET_CONFIG(download_max_connections_per_host, size_t);
+        GET_CONFIG(log_level, string);
+        GET_CONFIG(online_check_interval, unsigned long);
+        GET_CONFIG(event_trace_sample_rate, double);
+        GET_BOOL_CONFIG(use_journal);
+        GET_CONFIG(journal_segment_size, size_t);
+        GET_CONFIG(journal_max_segments, size_t);
+        GET_BOOL_CONFIG(use_message_store);
+        GET_CONFIG(message_store_days, unsigned long);
         #undef GET_CONFIG
 
         Log::i(TAG, u8"配置文件加载成功");
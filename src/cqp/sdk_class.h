@@ -24,6 +24,7 @@
 #include "./funcs.h"
 
 #include "utils/base64.h"
+#include "utils/tracing.h"
 
 class Sdk {
 public:
@@ -32,18 +33,39 @@ public:
     #pragma region Send Message
 
     int32_t send_private_msg(int64_t qq, const std::string &msg) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_private_msg");
         return CQ_sendPrivateMsg(this->ac_, qq, string_to_coolq(msg).c_str());
     }
 
     int32_t send_group_msg(int64_t group_id, const std::string &msg) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_group_msg");
         return CQ_sendGroupMsg(this->ac_, group_id, string_to_coolq(msg).c_str());
     }
 
     int32_t send_discuss_msg(int64_t discuss_id, const std::string &msg) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_discuss_msg");
         return CQ_sendDiscussMsg(this->ac_, discuss_id, string_to_coolq(msg).c_str());
     }
 
+    // the following take messages already converted by string_to_coolq, so that one message can be sent to many targets
+
+    int32_t send_private_msg_encoded(int64_t qq, const std::string &coolq_msg) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_private_msg_encoded");
+        return CQ_sendPrivateMsg(this->ac_, qq, coolq_msg.c_str());
+    }
+
+    int32_t send_group_msg_encoded(int64_t group_id, const std::string &coolq_msg) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_group_msg_encoded");
+        return CQ_sendGroupMsg(this->ac_, group_id, coolq_msg.c_str());
+    }
+
+    int32_t send_discuss_msg_encoded(int64_t discuss_id, const std::string &coolq_msg) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_discuss_msg_encoded");
+        return CQ_sendDiscussMsg(this->ac_, discuss_id, coolq_msg.c_str());
+    }
+
     int32_t delete_msg(int64_t msg_id) const {
+        CQHTTP_TRACE_SCOPE("sdk", "delete_msg");
         return CQ_deleteMsg(this->ac_, msg_id);
     }
 
@@ -52,10 +74,12 @@ public:
     #pragma region Send Like
 
     int32_t send_like(int64_t qq) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_like");
         return CQ_sendLike(this->ac_, qq);
     }
 
     int32_t send_like(int64_t qq, int32_t times) const {
+        CQHTTP_TRACE_SCOPE("sdk", "send_like");
         return CQ_sendLikeV2(this->ac_, qq, times);
     }
 
@@ -64,45 +88,55 @@ public:
     #pragma region Group & Discuss Operation
 
     int32_t set_group_kick(int64_t group_id, int64_t qq, bool reject_add_request) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_kick");
         return CQ_setGroupKick(this->ac_, group_id, qq, reject_add_request);
     }
 
     int32_t set_group_ban(int64_t group_id, int64_t qq, int64_t duration) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_ban");
         return CQ_setGroupBan(this->ac_, group_id, qq, duration);
     }
 
     int32_t set_group_anonymous_ban(int64_t group_id, const std::string &anonymous_flag, int64_t duration) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_anonymous_ban");
         return CQ_setGroupAnonymousBan(this->ac_, group_id, string_to_coolq(anonymous_flag).c_str(),
                                        duration);
     }
 
     int32_t set_group_whole_ban(int64_t group_id, bool enable) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_whole_ban");
         return CQ_setGroupWholeBan(this->ac_, group_id, enable);
     }
 
     int32_t set_group_admin(int64_t group_id, int64_t qq, bool set) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_admin");
         return CQ_setGroupAdmin(this->ac_, group_id, qq, set);
     }
 
     int32_t set_group_anonymous(int64_t group_id, bool enable) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_anonymous");
         return CQ_setGroupAnonymous(this->ac_, group_id, enable);
     }
 
     int32_t set_group_card(int64_t group_id, int64_t qq, const std::string &new_card) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_card");
         return CQ_setGroupCard(this->ac_, group_id, qq, string_to_coolq(new_card).c_str());
     }
 
     int32_t set_group_leave(int64_t group_id, bool is_dismiss) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_leave");
         return CQ_setGroupLeave(this->ac_, group_id, is_dismiss);
     }
 
     int32_t set_group_special_title(int64_t group_id, int64_t qq, const std::string &new_special_title,
                                     int64_t duration) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_special_title");
         return CQ_setGroupSpecialTitle(this->ac_, group_id, qq,
                                        string_to_coolq(new_special_title).c_str(), duration);
     }
 
     int32_t set_discuss_leave(int64_t discuss_id) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_discuss_leave");
         return CQ_setDiscussLeave(this->ac_, discuss_id);
     }
 
@@ -112,18 +146,21 @@ public:
 
     int32_t set_friend_add_request(const std::string &response_flag, int32_t response_operation,
                                    const std::string &remark) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_friend_add_request");
         return CQ_setFriendAddRequest(this->ac_, string_to_coolq(response_flag).c_str(),
                                       response_operation, string_to_coolq(remark).c_str());
     }
 
     int32_t set_group_add_request(const std::string &response_flag, int32_t request_type,
                                   int32_t response_operation) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_add_request");
         return CQ_setGroupAddRequest(this->ac_, string_to_coolq(response_flag).c_str(),
                                      request_type, response_operation);
     }
 
     int32_t set_group_add_request(const std::string &response_flag, int32_t request_type, int32_t response_operation,
                                   const std::string &reason) const {
+        CQHTTP_TRACE_SCOPE("sdk", "set_group_add_request");
         return CQ_setGroupAddRequestV2(this->ac_, string_to_coolq(response_flag).c_str(),
                                        request_type, response_operation,
                                        string_to_coolq(reason).c_str());
@@ -138,23 +175,28 @@ public:
     }
 
     std::string get_login_nick() const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_login_nick");
         auto nick = CQ_getLoginNick(this->ac_);
         return nick ? string_from_coolq(nick) : std::string();
     }
 
     bytes get_stranger_info_raw(int64_t qq, bool no_cache) const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_stranger_info_raw");
         return base64_decode(CQ_getStrangerInfo(this->ac_, qq, no_cache));
     }
 
     bytes get_group_list_raw() const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_group_list_raw");
         return base64_decode(CQ_getGroupList(this->ac_));
     }
 
     bytes get_group_member_list_raw(int64_t group_id) const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_group_member_list_raw");
         return base64_decode(CQ_getGroupMemberList(this->ac_, group_id));
     }
 
     bytes get_group_member_info_raw(int64_t group_id, int64_t qq, bool no_cache) const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_group_member_info_raw");
         return base64_decode(CQ_getGroupMemberInfoV2(this->ac_, group_id, qq, no_cache));
     }
 
@@ -163,11 +205,13 @@ public:
     #pragma region Get CoolQ Information
 
     std::string get_cookies() const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_cookies");
         auto cookies = CQ_getCookies(this->ac_);
         return cookies ? string_from_coolq(cookies) : std::string();
     }
 
     int32_t get_csrf_token() const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_csrf_token");
         return CQ_getCsrfToken(this->ac_);
     }
 
@@ -176,6 +220,7 @@ public:
     }
 
     std::string get_record(const std::string &file, const std::string &out_format) const {
+        CQHTTP_TRACE_SCOPE("sdk", "get_record");
         const auto raw = CQ_getRecord(this->ac_, string_to_coolq(file).c_str(), string_to_coolq(out_format).c_str());
         return string_from_coolq(raw);
     }
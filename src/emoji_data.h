@@ -2,856 +2,135 @@
 
 #include "common.h"
 
-#include <unordered_set>
+#include <array>
+#include <iterator>
 
-std::unordered_set<uint32_t> emoji_set = {
-    8252,
-    8265,
-    8482,
-    8505,
-    8596,
-    8597,
-    // 8598,
-    // 8599,
-    // 8600,
-    // 8601,
-    8617,
-    8618,
-    8986,
-    8987,
-    9193,
-    9194,
-    9195,
-    9196,
-    9200,
-    9203,
-    9410,
-    9642,
-    9643,
-    9654,
-    9664,
-    9723,
-    9724,
-    9725,
-    9726,
-    9728,
-    9729,
-    9742,
-    9745,
-    9748,
-    9749,
-    9757,
-    9786,
-    9800,
-    9801,
-    9802,
-    9803,
-    9804,
-    9805,
-    9806,
-    9807,
-    9808,
-    9809,
-    9810,
-    9811,
-    9824,
-    9827,
-    9829,
-    9830,
-    9832,
-    9851,
-    9855,
-    9875,
-    9888,
-    9889,
-    9898,
-    9899,
-    9917,
-    9918,
-    9924,
-    9925,
-    9934,
-    9940,
-    9962,
-    9970,
-    9971,
-    9973,
-    9978,
-    9981,
-    9986,
-    9989,
-    9992,
-    9993,
-    9994,
-    9995,
-    9996,
-    9999,
-    10002,
-    10004,
-    10006,
-    10024,
-    10035,
-    10036,
-    10052,
-    10055,
-    10060,
-    10062,
-    10067,
-    10068,
-    10069,
-    10071,
-    10084,
-    10133,
-    10134,
-    10135,
-    10145,
-    10160,
-    10175,
-    10548,
-    10549,
-    11013,
-    11014,
-    11015,
-    11035,
-    11036,
-    11088,
-    11093,
-    // 12336,
-    12349,
-    12951,
-    12953,
-    58634,
-    126980,
-    127183,
-    127344,
-    127345,
-    127358,
-    127359,
-    127374,
-    127377,
-    127378,
-    127379,
-    127380,
-    127381,
-    127382,
-    127383,
-    127384,
-    127385,
-    127386,
-    127462,
-    127463,
-    127464,
-    127465,
-    127466,
-    127467,
-    127468,
-    127469,
-    127470,
-    127471,
-    127472,
-    127473,
-    127474,
-    127475,
-    127476,
-    127477,
-    127478,
-    127479,
-    127480,
-    127481,
-    127482,
-    127483,
-    127484,
-    127485,
-    127486,
-    127487,
-    127489,
-    127490,
-    127514,
-    127535,
-    127538,
-    127539,
-    127540,
-    127541,
-    127542,
-    127543,
-    127544,
-    127545,
-    127546,
-    127568,
-    127569,
-    127744,
-    127745,
-    127746,
-    127747,
-    127748,
-    127749,
-    127750,
-    127751,
-    127752,
-    127753,
-    127754,
-    127755,
-    127756,
-    127757,
-    127758,
-    127759,
-    127760,
-    127761,
-    127762,
-    127763,
-    127764,
-    127765,
-    127766,
-    127767,
-    127768,
-    127769,
-    127770,
-    127771,
-    127772,
-    127773,
-    127774,
-    127775,
-    127776,
-    127792,
-    127793,
-    127794,
-    127795,
-    127796,
-    127797,
-    127799,
-    127800,
-    127801,
-    127802,
-    127803,
-    127804,
-    127805,
-    127806,
-    127807,
-    127808,
-    127809,
-    127810,
-    127811,
-    127812,
-    127813,
-    127814,
-    127815,
-    127816,
-    127817,
-    127818,
-    127819,
-    127820,
-    127821,
-    127822,
-    127823,
-    127824,
-    127825,
-    127826,
-    127827,
-    127828,
-    127829,
-    127830,
-    127831,
-    127832,
-    127833,
-    127834,
-    127835,
-    127836,
-    127837,
-    127838,
-    127839,
-    127840,
-    127841,
-    127842,
-    127843,
-    127844,
-    127845,
-    127846,
-    127847,
-    127848,
-    127849,
-    127850,
-    127851,
-    127852,
-    127853,
-    127854,
-    127855,
-    127856,
-    127857,
-    127858,
-    127859,
-    127860,
-    127861,
-    127862,
-    127863,
-    127864,
-    127865,
-    127866,
-    127867,
-    127868,
-    127872,
-    127873,
-    127874,
-    127875,
-    127876,
-    127877,
-    127878,
-    127879,
-    127880,
-    127881,
-    127882,
-    127883,
-    127884,
-    127885,
-    127886,
-    127887,
-    127888,
-    127889,
-    127890,
-    127891,
-    127904,
-    127905,
-    127906,
-    127907,
-    127908,
-    127909,
-    127910,
-    127911,
-    127912,
-    127913,
-    127914,
-    127915,
-    127916,
-    127917,
-    127918,
-    127919,
-    127920,
-    127921,
-    127922,
-    127923,
-    127924,
-    127925,
-    127926,
-    127927,
-    127928,
-    127929,
-    127930,
-    127931,
-    127932,
-    127933,
-    127934,
-    127935,
-    127936,
-    127937,
-    127938,
-    127939,
-    127940,
-    127942,
-    127943,
-    127944,
-    127945,
-    127946,
-    127968,
-    127969,
-    127970,
-    127971,
-    127972,
-    127973,
-    127974,
-    127975,
-    127976,
-    127977,
-    127978,
-    127979,
-    127980,
-    127981,
-    127982,
-    127983,
-    127984,
-    128000,
-    128001,
-    128002,
-    128003,
-    128004,
-    128005,
-    128006,
-    128007,
-    128008,
-    128009,
-    128010,
-    128011,
-    128012,
-    128013,
-    128014,
-    128015,
-    128016,
-    128017,
-    128018,
-    128019,
-    128020,
-    128021,
-    128022,
-    128023,
-    128024,
-    128025,
-    128026,
-    128027,
-    128028,
-    128029,
-    128030,
-    128031,
-    128032,
-    128033,
-    128034,
-    128035,
-    128036,
-    128037,
-    128038,
-    128039,
-    128040,
-    128041,
-    128042,
-    128043,
-    128044,
-    128045,
-    128046,
-    128047,
-    128048,
-    128049,
-    128050,
-    128051,
-    128052,
-    128053,
-    128054,
-    128055,
-    128056,
-    128057,
-    128058,
-    128059,
-    128060,
-    128061,
-    128062,
-    128064,
-    128066,
-    128067,
-    128068,
-    128069,
-    128070,
-    128071,
-    128072,
-    128073,
-    128074,
-    128075,
-    128076,
-    128077,
-    128078,
-    128079,
-    128080,
-    128081,
-    128082,
-    128083,
-    128084,
-    128085,
-    128086,
-    128087,
-    128088,
-    128089,
-    128090,
-    128091,
-    128092,
-    128093,
-    128094,
-    128095,
-    128096,
-    128097,
-    128098,
-    128099,
-    128100,
-    128101,
-    128102,
-    128103,
-    128104,
-    128105,
-    128106,
-    128107,
-    128108,
-    128109,
-    128110,
-    128111,
-    128112,
-    128113,
-    128114,
-    128115,
-    128116,
-    128117,
-    128118,
-    128119,
-    128120,
-    128121,
-    128122,
-    128123,
-    128124,
-    128125,
-    128126,
-    128127,
-    128128,
-    128129,
-    128130,
-    128131,
-    128132,
-    128133,
-    128134,
-    128135,
-    128136,
-    128137,
-    128138,
-    128139,
-    128140,
-    128141,
-    128142,
-    128143,
-    128144,
-    128145,
-    128146,
-    128147,
-    128148,
-    128149,
-    128150,
-    128151,
-    128152,
-    128153,
-    128154,
-    128155,
-    128156,
-    128157,
-    128158,
-    128159,
-    128160,
-    128161,
-    128162,
-    128163,
-    128164,
-    128165,
-    128166,
-    128167,
-    128168,
-    128169,
-    128170,
-    128171,
-    128172,
-    128173,
-    128174,
-    128175,
-    128176,
-    128177,
-    128178,
-    128179,
-    128180,
-    128181,
-    128182,
-    128183,
-    128184,
-    128185,
-    128186,
-    128187,
-    128188,
-    128189,
-    128190,
-    128191,
-    128192,
-    128193,
-    128194,
-    128195,
-    128196,
-    128197,
-    128198,
-    128199,
-    128200,
-    128201,
-    128202,
-    128203,
-    128204,
-    128205,
-    128206,
-    128207,
-    128208,
-    128209,
-    128210,
-    128211,
-    128212,
-    128213,
-    128214,
-    128215,
-    128216,
-    128217,
-    128218,
-    128219,
-    128220,
-    128221,
-    128222,
-    128223,
-    128224,
-    128225,
-    128226,
-    128227,
-    128228,
-    128229,
-    128230,
-    128231,
-    128232,
-    128233,
-    128234,
-    128235,
-    128236,
-    128237,
-    128238,
-    128239,
-    128240,
-    128241,
-    128242,
-    128243,
-    128244,
-    128245,
-    128246,
-    128247,
-    128249,
-    128250,
-    128251,
-    128252,
-    128256,
-    128257,
-    128258,
-    128259,
-    128260,
-    128261,
-    128262,
-    128263,
-    128264,
-    128265,
-    128266,
-    128267,
-    128268,
-    128269,
-    128270,
-    128271,
-    128272,
-    128273,
-    128274,
-    128275,
-    128276,
-    128277,
-    128278,
-    128279,
-    128280,
-    128281,
-    128282,
-    128283,
-    128284,
-    128285,
-    128286,
-    128287,
-    128288,
-    128289,
-    128290,
-    128291,
-    128292,
-    128293,
-    128294,
-    128295,
-    128296,
-    128297,
-    128298,
-    128299,
-    128300,
-    128301,
-    128302,
-    128303,
-    128304,
-    128305,
-    128306,
-    128307,
-    128308,
-    128309,
-    128310,
-    128311,
-    128312,
-    128313,
-    128314,
-    128315,
-    128316,
-    128317,
-    128336,
-    128337,
-    128338,
-    128339,
-    128340,
-    128341,
-    128342,
-    128343,
-    128344,
-    128345,
-    128346,
-    128347,
-    128348,
-    128349,
-    128350,
-    128351,
-    128352,
-    128353,
-    128354,
-    128355,
-    128356,
-    128357,
-    128358,
-    128359,
-    128507,
-    128508,
-    128509,
-    128510,
-    128511,
-    128512,
-    128513,
-    128514,
-    128515,
-    128516,
-    128517,
-    128518,
-    128519,
-    128520,
-    128521,
-    128522,
-    128523,
-    128524,
-    128525,
-    128526,
-    128527,
-    128528,
-    128529,
-    128530,
-    128531,
-    128532,
-    128533,
-    128534,
-    128535,
-    128536,
-    128537,
-    128538,
-    128539,
-    128540,
-    128541,
-    128542,
-    128543,
-    128544,
-    128545,
-    128546,
-    128547,
-    128548,
-    128549,
-    128550,
-    128551,
-    128552,
-    128553,
-    128554,
-    128555,
-    128556,
-    128557,
-    128558,
-    128559,
-    128560,
-    128561,
-    128562,
-    128563,
-    128564,
-    128565,
-    128566,
-    128567,
-    128568,
-    128569,
-    128570,
-    128571,
-    128572,
-    128573,
-    128574,
-    128575,
-    128576,
-    128581,
-    128582,
-    128583,
-    128584,
-    128585,
-    128586,
-    128587,
-    128588,
-    128589,
-    128590,
-    128591,
-    128640,
-    128641,
-    128642,
-    128643,
-    128644,
-    128645,
-    128646,
-    128647,
-    128648,
-    128649,
-    128650,
-    128651,
-    128652,
-    128653,
-    128654,
-    128655,
-    128656,
-    128657,
-    128658,
-    128659,
-    128660,
-    128661,
-    128662,
-    128663,
-    128664,
-    128665,
-    128666,
-    128667,
-    128668,
-    128669,
-    128670,
-    128671,
-    128672,
-    128673,
-    128674,
-    128675,
-    128676,
-    128677,
-    128678,
-    128679,
-    128680,
-    128681,
-    128682,
-    128683,
-    128684,
-    128685,
-    128686,
-    128687,
-    128688,
-    128689,
-    128690,
-    128691,
-    128692,
-    128693,
-    128694,
-    128695,
-    128696,
-    128697,
-    128698,
-    128699,
-    128700,
-    128701,
-    128702,
-    128703,
-    128704,
-    128705,
-    128706,
-    128707,
-    128708,
-    128709,
+/**
+ * Inclusive codepoint ranges of the emojis that CoolQ represents with "[CQ:emoji,id=xxx]",
+ * sorted in ascending order.
+ */
+struct EmojiRange {
+    uint32_t first;
+    uint32_t last;
 };
+
+static constexpr EmojiRange emoji_ranges[] = {
+    {8252, 8252},
+    {8265, 8265},
+    {8482, 8482},
+    {8505, 8505},
+    {8596, 8597},
+    {8617, 8618},
+    {8986, 8987},
+    {9193, 9196},
+    {9200, 9200},
+    {9203, 9203},
+    {9410, 9410},
+    {9642, 9643},
+    {9654, 9654},
+    {9664, 9664},
+    {9723, 9726},
+    {9728, 9729},
+    {9742, 9742},
+    {9745, 9745},
+    {9748, 9749},
+    {9757, 9757},
+    {9786, 9786},
+    {9800, 9811},
+    {9824, 9824},
+    {9827, 9827},
+    {9829, 9830},
+    {9832, 9832},
+    {9851, 9851},
+    {9855, 9855},
+    {9875, 9875},
+    {9888, 9889},
+    {9898, 9899},
+    {9917, 9918},
+    {9924, 9925},
+    {9934, 9934},
+    {9940, 9940},
+    {9962, 9962},
+    {9970, 9971},
+    {9973, 9973},
+    {9978, 9978},
+    {9981, 9981},
+    {9986, 9986},
+    {9989, 9989},
+    {9992, 9996},
+    {9999, 9999},
+    {10002, 10002},
+    {10004, 10004},
+    {10006, 10006},
+    {10024, 10024},
+    {10035, 10036},
+    {10052, 10052},
+    {10055, 10055},
+    {10060, 10060},
+    {10062, 10062},
+    {10067, 10069},
+    {10071, 10071},
+    {10084, 10084},
+    {10133, 10135},
+    {10145, 10145},
+    {10160, 10160},
+    {10175, 10175},
+    {10548, 10549},
+    {11013, 11015},
+    {11035, 11036},
+    {11088, 11088},
+    {11093, 11093},
+    {12349, 12349},
+    {12951, 12951},
+    {12953, 12953},
+    {58634, 58634},
+    {126980, 126980},
+    {127183, 127183},
+    {127344, 127345},
+    {127358, 127359},
+    {127374, 127374},
+    {127377, 127386},
+    {127462, 127487},
+    {127489, 127490},
+    {127514, 127514},
+    {127535, 127535},
+    {127538, 127546},
+    {127568, 127569},
+    {127744, 127776},
+    {127792, 127797},
+    {127799, 127868},
+    {127872, 127891},
+    {127904, 127940},
+    {127942, 127946},
+    {127968, 127984},
+    {128000, 128062},
+    {128064, 128064},
+    {128066, 128247},
+    {128249, 128252},
+    {128256, 128317},
+    {128336, 128359},
+    {128507, 128576},
+    {128581, 128591},
+    {128640, 128709},
+};
+
+static constexpr uint32_t EMOJI_CODEPOINT_MIN = emoji_ranges[0].first;
+static constexpr uint32_t EMOJI_CODEPOINT_MAX = std::cend(emoji_ranges)[-1].last;
+
+/**
+ * One bit per codepoint in [EMOJI_CODEPOINT_MIN, EMOJI_CODEPOINT_MAX], generated at compile time.
+ */
+using EmojiBitmap = std::array<uint64_t, (EMOJI_CODEPOINT_MAX - EMOJI_CODEPOINT_MIN) / 64 + 1>;
+
+static constexpr EmojiBitmap make_emoji_bitmap() {
+    EmojiBitmap bitmap{};
+    for (const auto &range : emoji_ranges) {
+        for (auto cp = range.first; cp <= range.last; cp++) {
+            const auto offset = cp - EMOJI_CODEPOINT_MIN;
+            bitmap[offset / 64] |= uint64_t(1) << offset % 64;
+        }
+    }
+    return bitmap;
+}
+
+static constexpr EmojiBitmap emoji_bitmap = make_emoji_bitmap();
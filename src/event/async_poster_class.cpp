@@ -0,0 +1,278 @@
+#include "./async_poster_class.h"
+
+#include "app.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include "utils/http_utils.h"
+#include "utils/metrics_class.h"
+#include "./post_targets_class.h"
+
+using namespace std;
+
+static const auto TAG = u8"异步上报";
+
+void AsyncPoster::start() {
+    if (running_) {
+        return;
+    }
+
+    queue_size_ = config.async_post_queue_size;
+    ordered_ = config.async_post_ordered;
+    batch_size_ = max(config.async_post_batch_size, size_t(1));
+    batch_interval_ = config.async_post_batch_interval;
+    format_ = wire_format_from_name(config.post_format).value_or(WireFormat::JSON);
+    shed_latency_ = chrono::milliseconds(config.async_post_shed_latency);
+
+    // e.g. "request,event>private>group,discuss", from high to low, the types not listed are normal
+    priorities_.clear();
+    vector<string> levels;
+    boost::split(levels, config.event_priority, boost::is_any_of(">"));
+    for (size_t i = 0; i < levels.size() && i < PRIORITY_COUNT; i++) {
+        vector<string> types;
+        boost::split(types, levels[i], boost::is_any_of(","));
+        for (auto &type : types) {
+            boost::trim(type);
+            if (!type.empty()) {
+                // with less than 3 levels, the last one is low
+                const auto level = i + 1 == levels.size() && levels.size() < PRIORITY_COUNT ? PRIORITY_COUNT - 1 : i;
+                priorities_[type] = static_cast<TaskPriority>(level);
+            }
+        }
+    }
+
+    const auto worker_count = config.async_post_thread_pool_size > 0
+                                  ? config.async_post_thread_pool_size
+                                  : thread::hardware_concurrency() * 2 + 1;
+
+    const auto lane_count = ordered_ ? worker_count : 1;
+    lanes_.clear();
+    for (size_t i = 0; i < lane_count; i++) {
+        lanes_.push_back(make_unique<Lane>());
+    }
+
+    running_ = true;
+    for (size_t i = 0; i < worker_count; i++) {
+        workers_.emplace_back([this, &lane = *lanes_[i % lane_count]] { worker_loop(lane); });
+    }
+    Log::d(TAG, u8"异步上报线程池创建成功，线程数：" + to_string(worker_count)
+           + (ordered_ ? u8"，同一会话的事件按顺序上报" : ""));
+}
+
+void AsyncPoster::stop() {
+    if (!running_) {
+        return;
+    }
+
+    size_t dropped_count = 0;
+    running_ = false;
+    for (auto &lane : lanes_) {
+        {
+            // the workers check "running_" while holding the lock
+            unique_lock<mutex> lock(lane->mutex);
+            dropped_count += lane->size();
+            for (auto &queue : lane->queues) {
+                queue.clear();
+            }
+        }
+        lane->cv.notify_all();
+    }
+    queued_count_ = 0;
+
+    for (auto &worker : workers_) {
+        if (worker.joinable()) {
+            worker.join();
+        }
+    }
+    workers_.clear();
+
+    if (dropped_count > 0) {
+        Log::w(TAG, u8"异步上报已停止，队列中 " + to_string(dropped_count) + u8" 个事件未上报");
+    }
+    Log::d(TAG, u8"异步上报线程池关闭成功");
+}
+
+TaskPriority AsyncPoster::priority_of(const json &payload) const {
+    for (const auto key : {"message_type", "post_type"}) {
+        if (const auto it = payload.find(key); it != payload.end() && it->is_string()) {
+            if (const auto p = priorities_.find(it->get_ref<const string &>()); p != priorities_.end()) {
+                return p->second;
+            }
+        }
+    }
+    return TaskPriority::NORMAL;
+}
+
+bool AsyncPoster::push(SerializedPayload payload_str, ResponseHandler response_handler, string trace_id,
+                       const size_t lane_key, const TaskPriority priority) {
+    if (!running_) {
+        return false;
+    }
+
+    auto &lane = *lanes_[lane_key % lanes_.size()];
+    {
+        unique_lock<mutex> lock(lane.mutex);
+        if (!running_) {
+            return false;
+        }
+        if (queue_size_ > 0 && queued_count_ >= queue_size_) {
+            // make room by dropping the oldest low priority event, if this one is more important,
+            // but never from the middle of an ordered lane, where the new event is dropped instead
+            auto &low_queue = lane.queues[PRIORITY_COUNT - 1];
+            if (ordered_ || priority == TaskPriority::LOW || low_queue.empty()) {
+                return false; // counted as failed by the caller
+            }
+            low_queue.pop_front();
+            queued_count_--;
+            shed_count_++;
+            Metrics::instance().observe_post("http", 0, false);
+        }
+        lane.queues[static_cast<size_t>(priority)].push_back(
+            {move(payload_str), move(response_handler), move(trace_id), Clock::now(), lane.next_seq++});
+        queued_count_++;
+    }
+    lane.cv.notify_one();
+    return true;
+}
+
+void AsyncPoster::worker_loop(Lane &lane) {
+    while (true) {
+        vector<Item> items;
+        {
+            unique_lock<mutex> lock(lane.mutex);
+            lane.cv.wait(lock, [&] { return !running_ || lane.size() > 0; });
+            if (!running_) {
+                break;
+            }
+
+            if (batch_size_ > 1 && batch_interval_ > 0 && lane.size() < batch_size_) {
+                // wait a little while for more events, so that they can be posted in one request
+                lane.cv.wait_for(lock, chrono::milliseconds(batch_interval_), [&] {
+                    return !running_ || lane.size() >= batch_size_;
+                });
+                if (!running_) {
+                    break;
+                }
+            }
+
+            const auto now = Clock::now();
+            const auto take = [&](const size_t p) {
+                auto &queue = lane.queues[p];
+                auto item = move(queue.front());
+                queue.pop_front();
+                queued_count_--;
+                // not in an ordered lane, where it would leave a gap in the middle of a conversation
+                if (!ordered_ && p == PRIORITY_COUNT - 1 && shed_latency_.count() > 0
+                    && now - item.enqueued_at > shed_latency_) {
+                    shed_count_++; // too late to be useful, and leave the way to the others
+                    Metrics::instance().observe_post("http", 0, false);
+                    return;
+                }
+                items.push_back(move(item));
+            };
+
+            if (ordered_) {
+                // in the order of the events whatever their priorities, not to reorder the events of a conversation
+                while (items.size() < batch_size_) {
+                    optional<size_t> oldest;
+                    for (size_t p = 0; p < PRIORITY_COUNT; p++) {
+                        if (!lane.queues[p].empty()
+                            && (!oldest || lane.queues[p].front().seq < lane.queues[*oldest].front().seq)) {
+                            oldest = p;
+                        }
+                    }
+                    if (!oldest) {
+                        break;
+                    }
+                    take(*oldest);
+                }
+            } else {
+                // higher priorities first
+                for (size_t p = 0; p < PRIORITY_COUNT && items.size() < batch_size_; p++) {
+                    while (!lane.queues[p].empty() && items.size() < batch_size_) {
+                        take(p);
+                    }
+                }
+            }
+        }
+
+        if (!items.empty()) {
+            post_items(items);
+        }
+    }
+}
+
+void AsyncPoster::post_items(const vector<Item> &items) const {
+    // if batching is enabled, always post an array, even if there is only one event in it
+    const auto is_batch = batch_size_ > 1;
+
+    string body;
+    if (is_batch) {
+        // join the already serialized events directly, instead of building a new json array
+        vector<const string *> elements;
+        elements.reserve(items.size());
+        for (const auto &item : items) {
+            elements.push_back(item.payload_str.get());
+        }
+        body = wire_join_array(elements, format_);
+    } else {
+        body = *items.front().payload_str;
+    }
+
+    Log::d(TAG, u8"开始通过 HTTP 上报 " + to_string(items.size()) + u8" 个事件");
+
+    if (!live_config()->has_post_targets()) {
+        return; // "post_url" and "post_urls" are cleared by a hot reload
+    }
+
+    // the trace ids of the sampled events in this request
+    string trace_ids;
+    for (const auto &item : items) {
+        if (!item.trace_id.empty()) {
+            trace_ids += (trace_ids.empty() ? "" : ",") + item.trace_id;
+        }
+    }
+    map<string, string> headers;
+    if (!trace_ids.empty()) {
+        headers["X-Trace-Id"] = trace_ids;
+    }
+    if (is_binary(format_)) {
+        headers["Content-Type"] = wire_media_type(format_);
+    }
+
+    const auto start = Metrics::Clock::now();
+    const auto resp = PostTargets::instance().post(body, headers);
+    const auto seconds = Metrics::seconds_since(start);
+    for (size_t i = 0; i < items.size(); i++) {
+        Metrics::instance().observe_post("http", seconds, resp.ok());
+    }
+
+    if (!resp.ok() || resp.body.empty()) {
+        return;
+    }
+
+    Log::d(TAG, [&] { return u8"收到响应 " + resp.body; });
+
+    json resp_payload;
+    try {
+        resp_payload = json::parse(resp.body);
+    } catch (invalid_argument &) {
+        // failed to parse json
+        Log::d(TAG, u8"上报响应不是有效的 JSON，已忽略");
+        return;
+    }
+
+    if (is_batch) {
+        // the response of a batch is an array, whose elements correspond to the events in order
+        if (!resp_payload.is_array()) {
+            return;
+        }
+        for (size_t i = 0; i < items.size() && i < resp_payload.size(); i++) {
+            if (items[i].response_handler && resp_payload[i].is_object()) {
+                items[i].response_handler(move(resp_payload[i]));
+            }
+        }
+    } else if (items.front().response_handler && resp_payload.is_object()) {
+        items.front().response_handler(move(resp_payload));
+    }
+}
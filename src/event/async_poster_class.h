@@ -0,0 +1,112 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+
+#include "service/pushable_interface.h"
+#include "utils/task_scheduler_class.h"
+#include "utils/wire_format.h"
+
+/**
+ * Post events to "post_url" in background worker threads,
+ * so that the CoolQ event callback thread won't be blocked by a slow HTTP server.
+ *
+ * If "async_post_ordered" is enabled, each worker has its own queue (lane), and the events of a conversation
+ * always go to the same lane, so that they are posted in order, while different conversations are posted in parallel.
+ *
+ * Events are also classified into priorities by "event_priority", higher ones are posted first, except that a lane
+ * of "async_post_ordered" is always posted in the order of the events, to keep the conversations in it in order.
+ * Under a flood,
+ * low priority events that have waited longer than "async_post_shed_latency" are dropped, and when the queue is full,
+ * a higher priority event replaces the oldest low priority one. Ordered lanes never drop queued events,
+ * a new event is rejected when the queue is full.
+ */
+class AsyncPoster {
+public:
+    using ResponseHandler = std::function<void(json)>;
+
+    static AsyncPoster &instance() {
+        static AsyncPoster poster;
+        return poster;
+    }
+
+    void start();
+    void stop();
+    bool started() const { return running_; }
+
+    size_t queue_size() const { return queued_count_; }
+    size_t shed_count() const { return shed_count_; }
+
+    /**
+     * The priority of an event according to "event_priority", by its "message_type" or "post_type".
+     */
+    TaskPriority priority_of(const json &payload) const;
+
+    /**
+     * Put an event into the queue.
+     *
+     * \param payload_str: the serialized event to post, in the format of "post_format"
+     * \param response_handler: will be called in a worker thread if the response is a JSON object
+     * \param trace_id: sent in the "X-Trace-Id" header if not empty (see EventTrace)
+     * \param lane_key: events with the same key are posted in order if "async_post_ordered" is enabled
+     * \param priority: see priority_of
+     * \return false if the queue is full and the event is dropped
+     */
+    bool push(SerializedPayload payload_str, ResponseHandler response_handler = nullptr, std::string trace_id = "",
+              size_t lane_key = 0, TaskPriority priority = TaskPriority::NORMAL);
+
+private:
+    AsyncPoster() = default;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Item {
+        SerializedPayload payload_str;
+        ResponseHandler response_handler;
+        std::string trace_id;
+        Clock::time_point enqueued_at;
+        uint64_t seq; // in the lane
+    };
+
+    static constexpr size_t PRIORITY_COUNT = 3;
+
+    struct Lane {
+        std::deque<Item> queues[PRIORITY_COUNT]; // indexed by TaskPriority
+        std::mutex mutex;
+        std::condition_variable cv;
+        uint64_t next_seq = 0;
+
+        size_t size() const {
+            size_t size = 0;
+            for (const auto &queue : queues) {
+                size += queue.size();
+            }
+            return size;
+        }
+    };
+
+    // one lane shared by all workers, or one lane per worker if ordered
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    std::atomic<size_t> queued_count_ = 0; // in all lanes
+    std::atomic<size_t> shed_count_ = 0;
+
+    std::vector<std::thread> workers_;
+    std::atomic<bool> running_ = false;
+
+    size_t queue_size_ = 0;
+    bool ordered_ = false;
+    size_t batch_size_ = 1;
+    unsigned long batch_interval_ = 0;
+    WireFormat format_ = WireFormat::JSON;
+    std::map<std::string, TaskPriority> priorities_; // "message_type" or "post_type" -> priority
+    std::chrono::milliseconds shed_latency_{0};
+
+    void worker_loop(Lane &lane);
+    void post_items(const std::vector<Item> &items) const;
+};
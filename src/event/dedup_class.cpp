@@ -0,0 +1,60 @@
+#include "./dedup_class.h"
+
+#include "app.h"
+
+using namespace std;
+
+/**
+ * FNV-1a, 64 bits even in the 32-bit build, where std::hash would make collisions (i.e. lost events) likely.
+ */
+static uint64_t fnv1a_64(const string &s, uint64_t hash = 14695981039346656037ULL) {
+    for (const auto c : s) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+static optional<uint64_t> identity_of(const json &payload) {
+    const auto post_type_it = payload.find("post_type");
+    if (post_type_it == payload.end() || !post_type_it->is_string()) {
+        return nullopt;
+    }
+
+    string id;
+    if (const auto it = payload.find("message_id"); it != payload.end() && it->is_number_integer()) {
+        id = to_string(it->get<int64_t>());
+    } else if (const auto it = payload.find("flag"); it != payload.end() && it->is_string()) {
+        id = it->get<string>();
+    } else {
+        return nullopt; // notices and meta events have no identity
+    }
+    return fnv1a_64(id, fnv1a_64(post_type_it->get<string>() + '\0'));
+}
+
+bool EventDedup::seen(const json &payload, const chrono::seconds window) {
+    const auto key = identity_of(payload);
+    if (!key) {
+        return false;
+    }
+
+    const auto now = Clock::now();
+    unique_lock<mutex> lock(mutex_);
+    expire(now, window);
+    if (!keys_.insert(key.value()).second) {
+        return true;
+    }
+    order_.emplace_back(now, key.value());
+    if (order_.size() > MAX_SIZE) {
+        keys_.erase(order_.front().second);
+        order_.pop_front();
+    }
+    return false;
+}
+
+void EventDedup::expire(const Clock::time_point now, const chrono::seconds window) {
+    while (!order_.empty() && order_.front().first + window <= now) {
+        keys_.erase(order_.front().second);
+        order_.pop_front();
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+
+/**
+ * Remembers the recent events which have an identity ("message_id" of messages, "flag" of requests),
+ * so that the ones delivered again by CoolQ (e.g. after it reconnects) can be dropped before they are posted.
+ *
+ * Only a 64-bit hash of (post_type, id) is kept for each event, for at most "event_dedup_window" seconds,
+ * and at most MAX_SIZE of them, the oldest forgotten first.
+ */
+class EventDedup {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static EventDedup &instance() {
+        static EventDedup dedup;
+        return dedup;
+    }
+
+    /**
+     * Remember the event, if it has an identity.
+     *
+     * \return true if the same event has been seen within the window, i.e. it should be dropped
+     */
+    bool seen(const json &payload, std::chrono::seconds window);
+
+private:
+    EventDedup() = default;
+
+    static constexpr size_t MAX_SIZE = 100000;
+
+    std::unordered_set<uint64_t> keys_;
+    std::deque<std::pair<Clock::time_point, uint64_t>> order_; // by the time first seen
+    std::mutex mutex_;
+
+    void expire(Clock::time_point now, std::chrono::seconds window);
+};
@@ -20,6 +20,7 @@
 #include "app.h"
 
 #include "./events.h"
+#include "utils/tracing.h"
 
 /**
  * Type=21 私聊消息
@@ -27,7 +28,8 @@
  */
 CQEVENT(int32_t, __event_private_msg, 24)
 (int32_t sub_type, int32_t msg_id, int64_t from_qq, const char *msg, int32_t font) {
-    return event_private_msg(sub_type, msg_id, from_qq, string_from_coolq(msg), font);
+    CQHTTP_TRACE_SCOPE("event", "private_msg");
+    return event_private_msg(sub_type, msg_id, from_qq, msg, font);
 }
 
 /**
@@ -36,8 +38,9 @@ CQEVENT(int32_t, __event_private_msg, 24)
 CQEVENT(int32_t, __event_group_msg, 36)
 (int32_t sub_type, int32_t msg_id, int64_t from_group, int64_t from_qq, const char *from_anonymous, const char *msg,
  int32_t font) {
+    CQHTTP_TRACE_SCOPE("event", "group_msg");
     return event_group_msg(sub_type, msg_id, from_group, from_qq, string_from_coolq(from_anonymous),
-                           string_from_coolq(msg), font);
+                           msg, font);
 }
 
 /**
@@ -45,7 +48,8 @@ CQEVENT(int32_t, __event_group_msg, 36)
  */
 CQEVENT(int32_t, __event_discuss_msg, 32)
 (int32_t sub_type, int32_t msg_id, int64_t from_discuss, int64_t from_qq, const char *msg, int32_t font) {
-    return event_discuss_msg(sub_type, msg_id, from_discuss, from_qq, string_from_coolq(msg), font);
+    CQHTTP_TRACE_SCOPE("event", "discuss_msg");
+    return event_discuss_msg(sub_type, msg_id, from_discuss, from_qq, msg, font);
 }
 
 /**
@@ -53,6 +57,7 @@ CQEVENT(int32_t, __event_discuss_msg, 32)
  */
 CQEVENT(int32_t, __event_group_upload, 28)
 (int32_t sub_type, int32_t send_time, int64_t from_group, int64_t from_qq, const char *file) {
+    CQHTTP_TRACE_SCOPE("event", "group_upload");
     return event_group_upload(sub_type, send_time, from_group, from_qq, string_from_coolq(file));
 }
 
@@ -62,6 +67,7 @@ CQEVENT(int32_t, __event_group_upload, 28)
  */
 CQEVENT(int32_t, __event_group_admin, 24)
 (int32_t sub_type, int32_t send_time, int64_t from_group, int64_t being_operate_qq) {
+    CQHTTP_TRACE_SCOPE("event", "group_admin");
     return event_group_admin(sub_type, send_time, from_group, being_operate_qq);
 }
 
@@ -73,6 +79,7 @@ CQEVENT(int32_t, __event_group_admin, 24)
  */
 CQEVENT(int32_t, __event_group_member_decrease, 32)
 (int32_t sub_type, int32_t send_time, int64_t from_group, int64_t from_qq, int64_t being_operate_qq) {
+    CQHTTP_TRACE_SCOPE("event", "group_member_decrease");
     return event_group_member_decrease(sub_type, send_time, from_group, from_qq, being_operate_qq);
 }
 
@@ -84,6 +91,7 @@ CQEVENT(int32_t, __event_group_member_decrease, 32)
  */
 CQEVENT(int32_t, __event_group_member_increase, 32)
 (int32_t sub_type, int32_t send_time, int64_t from_group, int64_t from_qq, int64_t being_operate_qq) {
+    CQHTTP_TRACE_SCOPE("event", "group_member_increase");
     return event_group_member_increase(sub_type, send_time, from_group, from_qq, being_operate_qq);
 }
 
@@ -92,6 +100,7 @@ CQEVENT(int32_t, __event_group_member_increase, 32)
  */
 CQEVENT(int32_t, __event_friend_add, 16)
 (int32_t sub_type, int32_t send_time, int64_t from_qq) {
+    CQHTTP_TRACE_SCOPE("event", "friend_add");
     return event_friend_add(sub_type, send_time, from_qq);
 }
 
@@ -102,6 +111,7 @@ CQEVENT(int32_t, __event_friend_add, 16)
  */
 CQEVENT(int32_t, __event_add_friend_request, 24)
 (int32_t sub_type, int32_t send_time, int64_t from_qq, const char *msg, const char *response_flag) {
+    CQHTTP_TRACE_SCOPE("event", "add_friend_request");
     return event_add_friend_request(sub_type, send_time, from_qq, string_from_coolq(msg),
                                     string_from_coolq(response_flag));
 }
@@ -114,6 +124,7 @@ CQEVENT(int32_t, __event_add_friend_request, 24)
  */
 CQEVENT(int32_t, __event_add_group_request, 32)
 (int32_t sub_type, int32_t send_time, int64_t from_group, int64_t from_qq, const char *msg, const char *response_flag) {
+    CQHTTP_TRACE_SCOPE("event", "add_group_request");
     return event_add_group_request(sub_type, send_time, from_group, from_qq, string_from_coolq(msg),
                                    string_from_coolq(response_flag));
 }
@@ -26,55 +26,163 @@
 #include "structs.h"
 #include "service/hub_class.h"
 #include "utils/http_utils.h"
+#include "utils/metrics_class.h"
+#include "utils/rolling_stats_class.h"
+#include "utils/wire_format.h"
+#include "utils/tracing.h"
 #include "./filter.h"
+#include "./async_poster_class.h"
+#include "./trace_class.h"
+#include "./journal_class.h"
+#include "./post_targets_class.h"
+#include "./dedup_class.h"
+#include "api/info_cache_class.h"
+#include "message/message_store_class.h"
 
 using namespace std;
 
 #define ENSURE_POST_NEEDED \
-    if (config.post_url.empty() && !ServiceHub::instance().has_pushable_services()) { \
+    if (!live_config()->has_post_targets() && !ServiceHub::instance().has_pushable_services()) { \
         return CQEVENT_IGNORE; \
+    } \
+    EventTrace::begin();
+
+/**
+ * Fields of the payload that are relatively expensive to build (e.g. decoding the message).
+ * They are built before filtering only if the filter reads them, otherwise after the event has passed.
+ */
+using LazyFields = vector<pair<string, function<json()>>>;
+
+/**
+ * The conversation (group, discuss or private chat) of an event, events of the same one are posted in order
+ * if "async_post_ordered" is enabled.
+ */
+static size_t conversation_key(const json &payload) {
+    static const pair<const char *, size_t> ID_FIELDS[] = {{"group_id", 1}, {"discuss_id", 2}, {"user_id", 3}};
+    for (const auto &field : ID_FIELDS) {
+        if (const auto it = payload.find(field.first); it != payload.end() && it->is_number_integer()) {
+            return hash<int64_t>()(it->get<int64_t>()) * 31 + field.second;
+        }
     }
+    return 0;
+}
 
-static int32_t post_event(json payload, const function<void(const Params &)> response_handler = nullptr) {
+static void count_event(const char *category, const json &payload) {
+    if (const auto it = payload.find("post_type"); it != payload.end() && it->is_string()) {
+        RollingStats::instance().count(category, it->get_ref<const string &>());
+    }
+}
+
+static int32_t post_event(json payload, LazyFields lazy_fields,
+                          const function<void(const Params &)> response_handler = nullptr) {
     static const auto TAG = u8"上报";
 
-    payload["self_id"] = sdk->get_login_qq();
+    EventTrace::mark("ingest");
+    struct TraceFinisher {
+        ~TraceFinisher() { EventTrace::finish(); }
+    } trace_finisher;
+
+    // one snapshot for the whole event, so that a reload in the middle doesn't mix two configs
+    const auto c = live_config();
+    const auto post_over_http = c->has_post_targets();
+    count_event("events_in", payload);
+
+    if (c->event_dedup_window > 0) {
+        if (EventDedup::instance().seen(payload, chrono::seconds(c->event_dedup_window))) {
+            EventTrace::mark("filtered");
+            Metrics::instance().count_filtered("dedup");
+            Log::d(TAG, u8"事件与之前的事件重复，停止上报");
+            return CQEVENT_IGNORE;
+        }
+        EventTrace::mark("dedup");
+    }
+
+    lazy_fields.emplace_back("self_id", [] { return sdk->get_login_qq(); });
     if (payload.find("time") == payload.end()) {
         payload["time"] = time(nullptr);
     }
 
     auto should_block = false;
 
+    for (auto &field : lazy_fields) {
+        if (GlobalFilter::may_read(field.first)) {
+            payload[field.first] = field.second();
+            field.second = nullptr;
+        }
+    }
+
+    EventTrace::mark("decode");
 
-    if (!GlobalFilter::eval(payload)) {
+    const auto passed = [&] {
+        CQHTTP_TRACE_SCOPE("filter", "global");
+        return GlobalFilter::eval(payload);
+    }();
+    if (!passed) {
+        EventTrace::mark("filtered");
+        Metrics::instance().count_filtered("global");
         Log::d(TAG, u8"事件已被过滤器拦截，停止上报");
-        goto finish;
+        return CQEVENT_IGNORE;
     }
+    EventTrace::mark("filter");
 
-    if (payload.find("message") != payload.end()) {
-        // convert message to the needed format
-        payload["message"] = Message(payload["message"].get<string>()).process_inward();
+    for (const auto &field : lazy_fields) {
+        if (field.second) {
+            payload[field.first] = field.second();
+        }
     }
+    EventTrace::mark("decode_rest");
 
+    if (const auto it = payload.find("message"); it != payload.end()) {
+        // convert message to the needed format, parsing the decoded string in place instead of copying it
+        *it = Message::process_inward_raw(it->get_ref<const string &>());
+        EventTrace::mark("convert");
+    }
+    count_event("events_out", payload);
 
-    if (!config.post_url.empty()) {
-        // do http post and handle response
-        Log::d(TAG, u8"开始通过 HTTP 上报事件");
 
-        const auto resp = post_json(config.post_url, payload);
+    // serialize only once, and share the result among all the receivers
+    const SerializedPayload payload_str = EventJournal::instance().started()
+                                              ? EventJournal::instance().append(payload)
+                                              : make_shared<string>(payload.dump());
+    EventTrace::mark("serialize");
+
+    map<string, string> post_headers;
+    if (const auto trace_id = EventTrace::current_id(); !trace_id.empty()) {
+        post_headers["X-Trace-Id"] = trace_id;
+    }
+
+    // the HTTP post body, only encoded again if "post_format" is a binary one
+    auto post_body = payload_str;
+    if (const auto format = wire_format_from_name(c->post_format).value_or(WireFormat::JSON); is_binary(format)) {
+        post_body = make_shared<string>(wire_dump(payload, format));
+        post_headers["Content-Type"] = wire_media_type(format);
+    }
 
-        if (resp.status_code == 0) {
-            Log::d(TAG, u8"HTTP 上报地址 " + config.post_url + u8" 无法访问");
-        } else {
-            Log::d(TAG, u8"通过 HTTP 上报数据到 " + config.post_url + (resp.ok() ? u8" 成功" : u8" 失败")
-                   + u8"，状态码：" + to_string(resp.status_code));
+    if (post_over_http && c->use_async_post && AsyncPoster::instance().started()) {
+        // post in background, the response (if any) will be handled in the worker thread,
+        // so the "block" operation is not supported in this case
+        const auto pushed = AsyncPoster::instance().push(post_body, [response_handler](json resp_payload) {
+            if (response_handler) response_handler(Params(move(resp_payload)));
+        }, EventTrace::current_id(), conversation_key(payload), AsyncPoster::instance().priority_of(payload));
+        EventTrace::mark("http_queued");
+        if (!pushed) {
+            Metrics::instance().observe_post("http", 0, false);
+            Log::w(TAG, u8"异步上报队列已满，事件已被丢弃");
         }
+    } else if (post_over_http) {
+        // do http post and handle response
+        Log::d(TAG, u8"开始通过 HTTP 上报事件");
+
+        const auto start = Metrics::Clock::now();
+        const auto resp = PostTargets::instance().post(*post_body, post_headers);
+        Metrics::instance().observe_post("http", Metrics::seconds_since(start), resp.ok());
+        EventTrace::mark("http");
 
         if (resp.ok() && !resp.body.empty()) {
-            Log::d(TAG, u8"收到响应 " + resp.body);
+            Log::d(TAG, [&] { return u8"收到响应 " + resp.body; });
 
             try {
-                if (const auto resp_payload = json::parse(resp.body); resp_payload.is_object()) {
+                if (auto resp_payload = json::parse(resp.body); resp_payload.is_object()) {
                     Params params(move(resp_payload));
 
                     // custom handler
@@ -91,14 +199,31 @@ static int32_t post_event(json payload, const function<void(const Params &)> res
         }
     }
 
-    ServiceHub::instance().push_event(payload);
+    ServiceHub::instance().push_event(payload, payload_str);
 
-finish:
     return should_block ? CQEVENT_BLOCK : CQEVENT_IGNORE;
 }
 
-int32_t event_private_msg(int32_t sub_type, int32_t msg_id, int64_t from_qq, const string &msg, int32_t font) {
-    ENSURE_POST_NEEDED;
+static int32_t post_event(json payload, const function<void(const Params &)> response_handler = nullptr) {
+    return post_event(move(payload), {}, response_handler);
+}
+
+static string anonymous_name(const int64_t from_qq, const string &from_anonymous) {
+    if (from_qq == 80000000 && !from_anonymous.empty()) {
+        return Anonymous::from_bytes(base64_decode(from_anonymous)).name;
+    }
+    return "";
+}
+
+int32_t event_private_msg(int32_t sub_type, int32_t msg_id, int64_t from_qq, const char *msg, int32_t font) {
+    // the message is decoded at most once, for the message store and for posting
+    optional<string> message;
+    const auto get_message = [&]() -> const string & {
+        if (!message) {
+            message = string_from_coolq(msg);
+        }
+        return message.value();
+    };
 
     const auto sub_type_str = [&]() {
         switch (sub_type) {
@@ -115,17 +240,34 @@ int32_t event_private_msg(int32_t sub_type, int32_t msg_id, int64_t from_qq, con
         }
     }();
 
-    const json payload = {
+    if (MessageStore::instance().started()) {
+        MessageStore::instance().add({
+            {"time", time(nullptr)},
+            {"message_type", "private"},
+            {"sub_type", sub_type_str},
+            {"message_id", msg_id},
+            {"user_id", from_qq},
+            {"message", get_message()},
+            {"font", font}
+        });
+    }
+
+    ENSURE_POST_NEEDED;
+
+    json payload = {
         {"post_type", "message"},
         {"message_type", "private"},
         {"sub_type", sub_type_str},
         {"message_id", msg_id},
         {"user_id", from_qq},
-        {"message", msg},
         {"font", font}
     };
 
-    return post_event(move(payload), [&](const Params &params) {
+    LazyFields lazy_fields = {
+        {"message", [&] { return get_message(); }}
+    };
+
+    return post_event(move(payload), move(lazy_fields), [=](const Params &params) {
         const auto reply = params.get_message("reply");
         if (!reply.empty()) {
             sdk->send_private_msg(from_qq, reply);
@@ -134,16 +276,7 @@ int32_t event_private_msg(int32_t sub_type, int32_t msg_id, int64_t from_qq, con
 }
 
 int32_t event_group_msg(int32_t sub_type, int32_t msg_id, int64_t from_group, int64_t from_qq,
-                        const string &from_anonymous, const string &msg, int32_t font) {
-    ENSURE_POST_NEEDED;
-
-    string anonymous;
-    if (from_qq == 80000000 && !from_anonymous.empty()) {
-        const auto anonymous_bin = base64_decode(from_anonymous);
-        anonymous = Anonymous::from_bytes(anonymous_bin).name;
-    }
-    auto is_anonymous = !anonymous.empty();
-
+                        const string &from_anonymous, const char *msg, int32_t font) {
     const auto sub_type_str = [&]() {
         if (from_qq == 80000000) {
             return "anonymous";
@@ -157,30 +290,63 @@ int32_t event_group_msg(int32_t sub_type, int32_t msg_id, int64_t from_group, in
         return "unknown";
     }();
 
-    string final_msg;
-    {
-        auto prefix = "&#91;" + anonymous + "&#93;:";
-        if (!anonymous.empty() && boost::starts_with(msg, prefix)) {
-            final_msg = msg.substr(prefix.length());
-        } else {
-            final_msg = move(msg);
+    // both "anonymous" and "message" need the anonymous name, parse it at most once
+    optional<string> anonymous;
+    const auto get_anonymous = [&]() -> const string & {
+        if (!anonymous) {
+            anonymous = anonymous_name(from_qq, from_anonymous);
+        }
+        return anonymous.value();
+    };
+
+    // the message is decoded at most once, for the message store and for posting
+    optional<string> message;
+    const auto get_message = [&]() -> const string & {
+        if (!message) {
+            message = string_from_coolq(msg);
+            const auto &name = get_anonymous();
+            if (const auto prefix = "&#91;" + name + "&#93;:"; !name.empty() && boost::starts_with(*message, prefix)) {
+                message->erase(0, prefix.length());
+            }
         }
+        return message.value();
+    };
+
+    if (MessageStore::instance().started()) {
+        MessageStore::instance().add({
+            {"time", time(nullptr)},
+            {"message_type", "group"},
+            {"sub_type", sub_type_str},
+            {"message_id", msg_id},
+            {"group_id", from_group},
+            {"user_id", from_qq},
+            {"anonymous", get_anonymous()},
+            {"message", get_message()},
+            {"font", font}
+        });
     }
 
-    const json payload = {
+    ENSURE_POST_NEEDED;
+
+    json payload = {
         {"post_type", "message"},
         {"message_type", "group"},
         {"sub_type", sub_type_str},
         {"message_id", msg_id},
         {"group_id", from_group},
         {"user_id", from_qq},
-        {"anonymous", anonymous},
         {"anonymous_flag", from_anonymous},
-        {"message", final_msg},
         {"font", font}
     };
 
-    return post_event(move(payload), [&](const Params &params) {
+    LazyFields lazy_fields = {
+        {"anonymous", [&] { return get_anonymous(); }},
+        {"message", [&] { return get_message(); }}
+    };
+
+    return post_event(move(payload), move(lazy_fields), [=](const Params &params) {
+        const auto is_anonymous = !anonymous_name(from_qq, from_anonymous).empty();
+
         const auto reply = params.get_message("reply");
         if (!reply.empty()) {
             auto prefix = params.get_bool("at_sender", true) ? "[CQ:at,qq=" + to_string(from_qq) + "] " : "";
@@ -206,21 +372,44 @@ int32_t event_group_msg(int32_t sub_type, int32_t msg_id, int64_t from_group, in
     });
 }
 
-int32_t event_discuss_msg(int32_t sub_type, int32_t msg_id, int64_t from_discuss, int64_t from_qq, const string &msg,
+int32_t event_discuss_msg(int32_t sub_type, int32_t msg_id, int64_t from_discuss, int64_t from_qq, const char *msg,
                           int32_t font) {
+    optional<string> message;
+    const auto get_message = [&]() -> const string & {
+        if (!message) {
+            message = string_from_coolq(msg);
+        }
+        return message.value();
+    };
+
+    if (MessageStore::instance().started()) {
+        MessageStore::instance().add({
+            {"time", time(nullptr)},
+            {"message_type", "discuss"},
+            {"message_id", msg_id},
+            {"discuss_id", from_discuss},
+            {"user_id", from_qq},
+            {"message", get_message()},
+            {"font", font}
+        });
+    }
+
     ENSURE_POST_NEEDED;
 
-    const json payload = {
+    json payload = {
         {"post_type", "message"},
         {"message_type", "discuss"},
         {"message_id", msg_id},
         {"discuss_id", from_discuss},
         {"user_id", from_qq},
-        {"message", msg},
         {"font", font}
     };
 
-    return post_event(move(payload), [&](const Params &params) {
+    LazyFields lazy_fields = {
+        {"message", [&] { return get_message(); }}
+    };
+
+    return post_event(move(payload), move(lazy_fields), [=](const Params &params) {
         const auto reply = params.get_message("reply");
         if (!reply.empty()) {
             auto prefix = params.get_bool("at_sender", true) ? "[CQ:at,qq=" + to_string(from_qq) + "] " : "";
@@ -235,7 +424,7 @@ int32_t event_group_upload(int32_t sub_type, int32_t send_time, int64_t from_gro
 
     const auto file_bin = base64_decode(file);
 
-    const json payload = {
+    json payload = {
         {"post_type", "event"},
         {"event", "group_upload"},
         {"time", send_time},
@@ -248,6 +437,8 @@ int32_t event_group_upload(int32_t sub_type, int32_t send_time, int64_t from_gro
 }
 
 int32_t event_group_admin(int32_t sub_type, int32_t send_time, int64_t from_group, int64_t being_operate_qq) {
+    InfoCache::instance().invalidate_group_member(from_group, being_operate_qq);
+
     ENSURE_POST_NEEDED;
 
     const auto sub_type_str = [&]() {
@@ -261,7 +452,7 @@ int32_t event_group_admin(int32_t sub_type, int32_t send_time, int64_t from_grou
         }
     }();
 
-    const json payload = {
+    json payload = {
         {"post_type", "event"},
         {"event", "group_admin"},
         {"sub_type", sub_type_str},
@@ -275,6 +466,12 @@ int32_t event_group_admin(int32_t sub_type, int32_t send_time, int64_t from_grou
 
 int32_t event_group_member_decrease(int32_t sub_type, int32_t send_time, int64_t from_group, int64_t from_qq,
                                     int64_t being_operate_qq) {
+    if (being_operate_qq == sdk->get_login_qq()) {
+        InfoCache::instance().invalidate_group(from_group);
+    } else {
+        InfoCache::instance().invalidate_group_member(from_group, being_operate_qq);
+    }
+
     ENSURE_POST_NEEDED;
 
     const auto sub_type_str = [&]() {
@@ -293,7 +490,7 @@ int32_t event_group_member_decrease(int32_t sub_type, int32_t send_time, int64_t
         }
     }();
 
-    const json payload = {
+    json payload = {
         {"post_type", "event"},
         {"event", "group_decrease"},
         {"sub_type", sub_type_str},
@@ -308,6 +505,12 @@ int32_t event_group_member_decrease(int32_t sub_type, int32_t send_time, int64_t
 
 int32_t event_group_member_increase(int32_t sub_type, int32_t send_time, int64_t from_group, int64_t from_qq,
                                     int64_t being_operate_qq) {
+    if (being_operate_qq == sdk->get_login_qq()) {
+        InfoCache::instance().invalidate_group(from_group);
+    } else {
+        InfoCache::instance().invalidate_group_member(from_group, being_operate_qq);
+    }
+
     ENSURE_POST_NEEDED;
 
     const auto sub_type_str = [&]() {
@@ -321,7 +524,7 @@ int32_t event_group_member_increase(int32_t sub_type, int32_t send_time, int64_t
         }
     }();
 
-    const json payload = {
+    json payload = {
         {"post_type", "event"},
         {"event", "group_increase"},
         {"sub_type", sub_type_str},
@@ -335,9 +538,11 @@ int32_t event_group_member_increase(int32_t sub_type, int32_t send_time, int64_t
 }
 
 int32_t event_friend_add(int32_t sub_type, int32_t send_time, int64_t from_qq) {
+    InfoCache::instance().invalidate_friend_list();
+
     ENSURE_POST_NEEDED;
 
-    const json payload = {
+    json payload = {
         {"post_type", "event"},
         {"event", "friend_add"},
         {"time", send_time},
@@ -351,7 +556,7 @@ int32_t event_add_friend_request(int32_t sub_type, int32_t send_time, int64_t fr
                                  const string &response_flag) {
     ENSURE_POST_NEEDED;
 
-    const json payload = {
+    json payload = {
         {"post_type", "request"},
         {"request_type", "friend"},
         {"time", send_time},
@@ -360,7 +565,7 @@ int32_t event_add_friend_request(int32_t sub_type, int32_t send_time, int64_t fr
         {"flag", response_flag}
     };
 
-    return post_event(move(payload), [&](const Params &params) {
+    return post_event(move(payload), [=](const Params &params) {
         if (auto approve_opt = params.get<bool>("approve"); approve_opt) {
             auto approve = approve_opt.value();
             sdk->set_friend_add_request(response_flag, approve ? CQREQUEST_ALLOW : CQREQUEST_DENY,
@@ -384,7 +589,7 @@ int32_t event_add_group_request(int32_t sub_type, int32_t send_time, int64_t fro
         }
     }();
 
-    const json payload = {
+    json payload = {
         {"post_type", "request"},
         {"request_type", "group"},
         {"sub_type", sub_type_str},
@@ -395,7 +600,7 @@ int32_t event_add_group_request(int32_t sub_type, int32_t send_time, int64_t fro
         {"flag", response_flag}
     };
 
-    return post_event(move(payload), [&](const Params &params) {
+    return post_event(move(payload), [=](const Params &params) {
         if (auto approve_opt = params.get<bool>("approve"); approve_opt) {
             auto approve = approve_opt.value();
             sdk->set_group_add_request(response_flag, sub_type, approve ? CQREQUEST_ALLOW : CQREQUEST_DENY,
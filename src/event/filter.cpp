@@ -2,7 +2,10 @@
 
 #include "app.h"
 
+#include "utils/aho_corasick_class.h"
+
 #include <regex>
+#include <unordered_set>
 #include <boost/filesystem.hpp>
 
 using namespace std;
@@ -12,36 +15,235 @@ class FilterSyntexError : public invalid_argument {
     using invalid_argument::invalid_argument;
 };
 
-static shared_ptr<IFilter> construct_op(const string &op_name, const json &op_argument);
-
-class NotOperator : public IFilter {
+/**
+ * A filter compiled into a flat instruction list.
+ *
+ * Evaluation keeps a boolean result register and a "current node" of the payload. Logical operators
+ * become conditional jumps over the rest of their operands, and key lookups are resolved into paths,
+ * so evaluating an event is a single loop without virtual calls or exceptions.
+ */
+class CompiledFilter : public IFilter {
 public:
-    static shared_ptr<NotOperator> construct(const json &argument) {
-        if (!argument.is_object()) {
-            throw FilterSyntexError("the argument of 'not' operator must be an object");
-        }
-        auto op = make_shared<NotOperator>();
-        op->operand_ = ::construct_op("and", argument);
-        return op;
-    }
+    enum class OpCode {
+        ENTER, // descend into "path" of the current node, or set the result to false and jump if missing
+        LEAVE, // go back to the node before the matching ENTER
+        SET, // set the result to "flag"
+        NOT,
+        JUMP_IF_FALSE,
+        JUMP_IF_TRUE,
+        EQUAL, // compare with "value", "flag" means "not equal" (so do the following EQUAL_*)
+        EQUAL_STRING,
+        EQUAL_INTEGER,
+        IN_STRING, // the current node is a substring of "str"
+        IN_STRING_SET, // the current node is one of "str_set"
+        IN_ARRAY, // the current node is one of the elements of "value"
+        CONTAINS,
+        REGEX,
+        KEYWORDS, // the current node contains any of the keywords of "keywords"
+    };
+
+    struct Instruction {
+        OpCode code;
+        size_t target = 0; // jump target
+        bool flag = false;
+        std::vector<std::string> path;
+        json value;
+        std::string str;
+        int64_t integer = 0;
+        std::shared_ptr<const std::unordered_set<std::string>> str_set;
+        std::shared_ptr<const std::regex> regex;
+        std::shared_ptr<const AhoCorasick> keywords;
+    };
 
-    bool eval(const json &payload) override {
-        return !operand_->eval(payload);
+    CompiledFilter(vector<Instruction> program, const size_t max_depth, set<string> read_keys,
+                   const bool reads_whole_payload)
+        : program_(move(program)), max_depth_(max_depth), read_keys_(move(read_keys)),
+          reads_whole_payload_(reads_whole_payload) {}
+
+    bool eval(const json &payload) override;
+
+    bool may_read(const string &key) const override {
+        return reads_whole_payload_ || read_keys_.find(key) != read_keys_.end();
     }
 
 private:
-    shared_ptr<IFilter> operand_;
+    vector<Instruction> program_;
+    size_t max_depth_; // max nesting of ENTER
+    set<string> read_keys_; // top-level keys looked up by ENTER
+    bool reads_whole_payload_; // some operator applies to the payload itself, e.g. {".eq": {...}}
 };
 
-class AndOperator : public IFilter {
+bool CompiledFilter::eval(const json &payload) {
+    // filters rarely nest deeply, so avoid allocating in the common case
+    const json *inline_nodes[16];
+    vector<const json *> heap_nodes;
+    auto saved_nodes = inline_nodes;
+    if (max_depth_ > size(inline_nodes)) {
+        heap_nodes.resize(max_depth_);
+        saved_nodes = heap_nodes.data();
+    }
+    size_t depth = 0;
+
+    const json *node = &payload;
+    auto res = true;
+
+    const auto size = program_.size();
+    for (size_t pc = 0; pc < size;) {
+        const auto &ins = program_[pc++];
+        switch (ins.code) {
+        case OpCode::ENTER: {
+            auto child = node;
+            for (const auto &key : ins.path) {
+                if (!child->is_object()) {
+                    child = nullptr;
+                    break;
+                }
+                // look up the underlying map directly, which is much cheaper than json::find
+                const auto &object = child->get_ref<const json::object_t &>();
+                const auto it = object.find(key);
+                if (it == object.end()) {
+                    child = nullptr;
+                    break;
+                }
+                child = &it->second;
+            }
+            if (child) {
+                saved_nodes[depth++] = node;
+                node = child;
+            } else {
+                res = false;
+                pc = ins.target;
+            }
+            break;
+        }
+        case OpCode::LEAVE:
+            node = saved_nodes[--depth];
+            break;
+        case OpCode::SET:
+            res = ins.flag;
+            break;
+        case OpCode::NOT:
+            res = !res;
+            break;
+        case OpCode::JUMP_IF_FALSE:
+            if (!res) pc = ins.target;
+            break;
+        case OpCode::JUMP_IF_TRUE:
+            if (res) pc = ins.target;
+            break;
+        case OpCode::EQUAL:
+            res = (*node == ins.value) != ins.flag;
+            break;
+        case OpCode::EQUAL_STRING:
+            res = (node->is_string() && node->get_ref<const string &>() == ins.str) != ins.flag;
+            break;
+        case OpCode::EQUAL_INTEGER:
+            res = (node->is_number_integer() ? node->get<int64_t>() == ins.integer : *node == ins.value) != ins.flag;
+            break;
+        case OpCode::IN_STRING:
+            res = node->is_string() && boost::algorithm::contains(ins.str, node->get_ref<const string &>());
+            break;
+        case OpCode::IN_STRING_SET:
+            res = node->is_string() && ins.str_set->count(node->get_ref<const string &>()) > 0;
+            break;
+        case OpCode::IN_ARRAY:
+            res = find(ins.value.begin(), ins.value.end(), *node) != ins.value.end();
+            break;
+        case OpCode::CONTAINS:
+            res = node->is_string() && boost::algorithm::contains(node->get_ref<const string &>(), ins.str);
+            break;
+        case OpCode::REGEX:
+            res = node->is_string() && regex_search(node->get_ref<const string &>(), *ins.regex);
+            break;
+        case OpCode::KEYWORDS:
+            res = node->is_string() && ins.keywords->contains_any(node->get_ref<const string &>());
+            break;
+        }
+    }
+
+    return res;
+}
+
+/**
+ * Translate a filter expression into the instructions of CompiledFilter.
+ * Every operator leaves its result in the result register, and keeps the current node unchanged.
+ */
+class FilterCompiler {
 public:
-    static shared_ptr<AndOperator> construct(const json &argument) {
+    using Instruction = CompiledFilter::Instruction;
+    using OpCode = CompiledFilter::OpCode;
+
+    shared_ptr<CompiledFilter> compile(const json &root_filter) {
+        program_.clear();
+        depth_ = max_depth_ = 0;
+        read_keys_.clear();
+        reads_whole_payload_ = false;
+        compile_and(root_filter);
+        return make_shared<CompiledFilter>(move(program_), max_depth_, move(read_keys_), reads_whole_payload_);
+    }
+
+private:
+    vector<Instruction> program_;
+    size_t depth_ = 0;
+    size_t max_depth_ = 0;
+    set<string> read_keys_;
+    bool reads_whole_payload_ = false;
+
+    void mark_payload_read() {
+        if (depth_ == 0) {
+            reads_whole_payload_ = true;
+        }
+    }
+
+    size_t emit(OpCode code, const bool flag = false) {
+        Instruction ins;
+        ins.code = code;
+        ins.flag = flag;
+        program_.push_back(move(ins));
+        return program_.size() - 1;
+    }
+
+    void patch_jumps_here(const vector<size_t> &jumps) {
+        for (const auto i : jumps) {
+            program_[i].target = program_.size();
+        }
+    }
+
+    void compile_op(const string &op_name, const json &argument) {
+        static const map<string, void (FilterCompiler::*)(const json &)> op_compiler_map = {
+            {"not", &FilterCompiler::compile_not},
+            {"and", &FilterCompiler::compile_and},
+            {"or", &FilterCompiler::compile_or},
+            {"eq", &FilterCompiler::compile_eq},
+            {"neq", &FilterCompiler::compile_neq},
+            {"in", &FilterCompiler::compile_in},
+            {"contains", &FilterCompiler::compile_contains},
+            {"regex", &FilterCompiler::compile_regex},
+            {"regex_any", &FilterCompiler::compile_regex_any},
+            {"keywords", &FilterCompiler::compile_keywords},
+        };
+
+        const auto it = op_compiler_map.find(op_name);
+        if (it == op_compiler_map.end()) {
+            throw FilterSyntexError("the operator '" + op_name + "' is not supported");
+        }
+        (this->*it->second)(argument);
+    }
+
+    void compile_not(const json &argument) {
         if (!argument.is_object()) {
-            throw FilterSyntexError("the argument of 'and' operator must be an object");
+            throw FilterSyntexError("the argument of 'not' operator must be an object");
         }
+        compile_and(argument);
+        emit(OpCode::NOT);
+    }
 
-        auto op = make_shared<AndOperator>();
+    void compile_and(const json &argument) {
+        if (!argument.is_object()) {
+            throw FilterSyntexError("the argument of 'and' operator must be an object");
+        }
 
+        vector<size_t> exits;
         for (auto it = argument.begin(); it != argument.end(); ++it) {
             const auto &key = it.key();
             const auto &value = it.value();
@@ -55,258 +257,280 @@ public:
                 //   ".foo": {
                 //       "bar": "baz"
                 //   }
-                op->operands_.push_back({"", ::construct_op(key.substr(1), value)});
-            } else if (value.is_object()) {
-                // is an normal key with an object as the value
+                compile_op(key.substr(1), value);
+            } else {
+                // is an normal key
                 //   "foo": {
                 //       ".bar": "baz"
                 //   }
-                op->operands_.push_back({key, ::construct_op("and", value)});
-            } else {
-                // is an normal key with a non-object as the value
+                // or
                 //   "foo": "bar"
-                op->operands_.push_back({key, ::construct_op("eq", value)});
+                compile_key({key}, value);
             }
+            // short-circuit if this operand is false
+            exits.push_back(emit(OpCode::JUMP_IF_FALSE));
         }
 
-        return op;
-    }
-
-    bool eval(const json &payload) override {
-        auto res = true;
-
-        for (const auto &operand : operands_) {
-            if (operand.first.empty()) {
-                // is an operator
-                res = res && operand.second->eval(payload);
-            } else {
-                // is an normal key
-                try {
-                    auto &sub_payload = payload.at(operand.first);
-                    res = res && operand.second->eval(sub_payload);
-                } catch (exception &) {
-                    res = false;
-                }
-            }
-
-            if (res == false) {
-                break;
-            }
+        if (exits.empty()) {
+            emit(OpCode::SET, true);
+        } else {
+            // the last operand's result is the result of the whole "and"
+            program_.pop_back();
+            exits.pop_back();
+            patch_jumps_here(exits);
         }
-
-        return res;
     }
 
-private:
-    vector<pair<string, shared_ptr<IFilter>>> operands_;
-};
-
-class OrOperator : public IFilter {
-public:
-    static shared_ptr<OrOperator> construct(const json &argument) {
+    void compile_or(const json &argument) {
         if (!argument.is_array()) {
             throw FilterSyntexError("the argument of 'or' operator must be an array");
         }
 
-        auto op = make_shared<OrOperator>();
-
-        for (auto &elem : argument) {
-            op->operands_.push_back(::construct_op("and", elem));
+        vector<size_t> exits;
+        for (const auto &elem : argument) {
+            compile_and(elem);
+            exits.push_back(emit(OpCode::JUMP_IF_TRUE));
         }
 
-        return op;
+        if (exits.empty()) {
+            emit(OpCode::SET, false);
+        } else {
+            program_.pop_back();
+            exits.pop_back();
+            patch_jumps_here(exits);
+        }
     }
 
-    bool eval(const json &payload) override {
-        auto res = false;
-
-        for (const auto &operand : operands_) {
-            res = res || operand->eval(payload);
-
-            if (res == true) {
-                break;
+    void compile_key(vector<string> path, const json &value) {
+        // merge nested single keys into one path, e.g. "sender": {"role": "owner"}
+        if (value.is_object() && value.size() == 1) {
+            const auto &key = value.begin().key();
+            if (!key.empty() && key.front() != '.') {
+                path.push_back(key);
+                return compile_key(move(path), value.begin().value());
             }
         }
 
-        return res;
-    }
-
-private:
-    vector<shared_ptr<IFilter>> operands_;
-};
-
-class EqualOperator : public IFilter {
-public:
-    static shared_ptr<EqualOperator> construct(const json &argument) {
-        auto op = make_shared<EqualOperator>();
-        op->value_ = argument;
-        return op;
-    }
+        if (depth_ == 0) {
+            read_keys_.insert(path.front());
+        }
 
-    bool eval(const json &payload) override {
-        return payload == value_;
+        const auto enter = emit(OpCode::ENTER);
+        program_[enter].path = move(path);
+        max_depth_ = max(max_depth_, ++depth_);
+        if (value.is_object()) {
+            compile_and(value);
+        } else {
+            compile_eq(value);
+        }
+        --depth_;
+        emit(OpCode::LEAVE);
+        program_[enter].target = program_.size();
     }
 
-private:
-    json value_;
-};
-
-class NotEqualOperator : public IFilter {
-public:
-    static shared_ptr<NotEqualOperator> construct(const json &argument) {
-        auto op = make_shared<NotEqualOperator>();
-        op->value_ = argument;
-        return op;
+    void compile_equal(const json &argument, const bool negate) {
+        mark_payload_read();
+        if (argument.is_string()) {
+            program_[emit(OpCode::EQUAL_STRING, negate)].str = argument.get<string>();
+        } else if (argument.is_number_integer()) {
+            const auto i = emit(OpCode::EQUAL_INTEGER, negate);
+            program_[i].integer = argument.get<int64_t>();
+            program_[i].value = argument;
+        } else {
+            program_[emit(OpCode::EQUAL, negate)].value = argument;
+        }
     }
 
-    bool eval(const json &payload) override {
-        return payload != value_;
-    }
+    void compile_eq(const json &argument) { compile_equal(argument, false); }
 
-private:
-    json value_;
-};
+    void compile_neq(const json &argument) { compile_equal(argument, true); }
 
-class InOperator : public IFilter {
-public:
-    static shared_ptr<InOperator> construct(const json &argument) {
-        if (!(argument.is_string() || argument.is_array())) {
+    void compile_in(const json &argument) {
+        mark_payload_read();
+        if (argument.is_string()) {
+            program_[emit(OpCode::IN_STRING)].str = argument.get<string>();
+        } else if (argument.is_array()) {
+            if (all_of(argument.begin(), argument.end(), [](const json &elem) { return elem.is_string(); })) {
+                unordered_set<string> str_set;
+                for (const auto &elem : argument) {
+                    str_set.insert(elem.get<string>());
+                }
+                program_[emit(OpCode::IN_STRING_SET)].str_set = make_shared<const unordered_set<string>>(
+                    move(str_set));
+            } else {
+                program_[emit(OpCode::IN_ARRAY)].value = argument;
+            }
+        } else {
             throw FilterSyntexError("the argument of 'in' operator must be a string or an array");
         }
-
-        auto op = make_shared<InOperator>();
-        op->range_ = argument;
-        return op;
     }
 
-    bool eval(const json &payload) override {
-        if (range_.is_string()) {
-            return payload.is_string() && boost::algorithm::contains(range_.get<string>(), payload.get<string>());
+    void compile_contains(const json &argument) {
+        if (!argument.is_string()) {
+            throw FilterSyntexError("the argument of 'contains' operator must be a string");
         }
-
-        return find(range_.begin(), range_.end(), payload) != range_.end();
+        mark_payload_read();
+        program_[emit(OpCode::CONTAINS)].str = argument.get<string>();
     }
 
-private:
-    json range_;
-};
-
-class ContainsOperator : public IFilter {
-public:
-    static shared_ptr<ContainsOperator> construct(const json &argument) {
+    void compile_regex(const json &argument) {
         if (!argument.is_string()) {
-            throw FilterSyntexError("the argument of 'contains' operator must be a string");
+            throw FilterSyntexError("the argument of 'regex' operator must be a string");
+        }
+        mark_payload_read();
+        try {
+            program_[emit(OpCode::REGEX)].regex = make_shared<const regex>(argument.get<string>());
+        } catch (regex_error &e) {
+            throw FilterSyntexError(string("the argument of 'regex' operator is not a valid regex: ") + e.what());
         }
-
-        auto op = make_shared<ContainsOperator>();
-        op->test_ = argument;
-        return op;
     }
 
-    bool eval(const json &payload) override {
-        if (!payload.is_string()) {
-            return false;
+    static vector<string> string_list_argument(const string &op_name, const json &argument) {
+        if (!argument.is_array()
+            || !all_of(argument.begin(), argument.end(), [](const json &elem) { return elem.is_string(); })) {
+            throw FilterSyntexError("the argument of '" + op_name + "' operator must be an array of strings");
         }
-        return boost::algorithm::contains(payload.get<string>(), test_.get<string>());
+        return argument.get<vector<string>>();
     }
 
-private:
-    json test_;
-};
-
-class RegexOperator : public IFilter {
-public:
-    static shared_ptr<RegexOperator> construct(const json &argument) {
-        if (!argument.is_string()) {
-            throw FilterSyntexError("the argument of 'regex' operator must be a string");
-        }
+    void emit_keywords(const vector<string> &keywords) {
+        program_[emit(OpCode::KEYWORDS)].keywords = make_shared<const AhoCorasick>(keywords);
+    }
 
-        auto op = make_shared<RegexOperator>();
-        op->regex_ = regex(argument.get<string>());
-        return op;
+    void compile_keywords(const json &argument) {
+        mark_payload_read();
+        emit_keywords(string_list_argument("keywords", argument));
     }
 
-    bool eval(const json &payload) override {
-        if (!payload.is_string()) {
-            return false;
-        }
+    void compile_regex_any(const json &argument) {
+        mark_payload_read();
 
-        smatch m;
-        const auto input = payload.get<string>();
-        return regex_search(input.cbegin(), input.cend(), m, regex_);
-    }
+        // literal patterns go to one Aho-Corasick automaton, the others are joined into one regex,
+        // except those with back references, whose group numbers would change after joining
+        static const regex BACK_REFERENCE_REGEX(R"(\\[1-9])");
 
-private:
-    regex regex_;
-};
+        vector<string> literals;
+        string joined_pattern;
+        vector<string> separate_patterns;
+        for (const auto &pattern : string_list_argument("regex_any", argument)) {
+            try {
+                static_cast<void>(regex(pattern)); // just to validate
+            } catch (regex_error &e) {
+                throw FilterSyntexError("'" + pattern + "' in the argument of 'regex_any' operator is not a valid regex: "
+                                        + e.what());
+            }
 
-static shared_ptr<IFilter> construct_op(const string &op_name, const json &op_argument) {
-    static const map<string, function<shared_ptr<IFilter>(const json &)>> op_constructor_map = {
-        {"not", NotOperator::construct},
-        {"and", AndOperator::construct},
-        {"or", OrOperator::construct},
-        {"eq", EqualOperator::construct},
-        {"neq", NotEqualOperator::construct},
-        {"in", InOperator::construct},
-        {"contains", ContainsOperator::construct},
-        {"regex", RegexOperator::construct},
-    };
+            if (pattern.find_first_of("\\^$.|?*+()[]{}") == string::npos) {
+                literals.push_back(pattern);
+            } else if (regex_search(pattern, BACK_REFERENCE_REGEX)) {
+                separate_patterns.push_back(pattern);
+            } else {
+                joined_pattern += (joined_pattern.empty() ? "(?:" : "|(?:") + pattern + ")";
+            }
+        }
 
-    if (op_constructor_map.find(op_name) == op_constructor_map.end()) {
-        throw FilterSyntexError("the operator '" + op_name + "'" + "is not supported");
-    }
+        vector<size_t> exits;
+        const auto emit_regex = [&](const string &pattern) {
+            program_[emit(OpCode::REGEX)].regex = make_shared<const regex>(pattern);
+            exits.push_back(emit(OpCode::JUMP_IF_TRUE));
+        };
 
-    return op_constructor_map.at(op_name)(op_argument);
-}
+        if (!literals.empty()) {
+            emit_keywords(literals);
+            exits.push_back(emit(OpCode::JUMP_IF_TRUE));
+        }
+        if (!joined_pattern.empty()) {
+            emit_regex(joined_pattern);
+        }
+        for (const auto &pattern : separate_patterns) {
+            emit_regex(pattern);
+        }
+
+        if (exits.empty()) {
+            emit(OpCode::SET, false);
+        } else {
+            program_.pop_back();
+            exits.pop_back();
+            patch_jumps_here(exits);
+        }
+    }
+};
 
 shared_ptr<IFilter> construct_filter(const json &root_filter) {
-    return construct_op("and", root_filter);
+    return FilterCompiler().compile(root_filter);
 }
 
-shared_ptr<IFilter> GlobalFilter::filter_ = nullptr;
-
-void GlobalFilter::load(const string &path) {
-    static const auto TAG = u8"事件过滤器";
+static const auto TAG = u8"事件过滤器";
 
-    filter_ = nullptr;
+shared_ptr<IFilter> load_filter(const string &path) {
+    shared_ptr<IFilter> filter;
 
+    const auto filename = path.substr(path.find_last_of("\\/") + 1);
     if (const auto ws_path = s2ws(path); fs::is_regular_file(ws_path)) {
         if (ifstream f(ws_path); f.is_open()) {
-            json filter_json;
-            f >> filter_json;
-
             try {
-                filter_ = construct_filter(filter_json);
-                Log::i(TAG, u8"过滤规则加载成功");
+                json filter_json;
+                f >> filter_json;
+                filter = construct_filter(filter_json);
+                Log::i(TAG, u8"过滤规则 " + filename + u8" 加载成功");
             } catch (FilterSyntexError &e) {
-                Log::e(TAG, string(u8"过滤规则语法错误，错误信息：") + e.what());
+                Log::e(TAG, u8"过滤规则 " + filename + u8" 语法错误，错误信息：" + e.what());
+            } catch (invalid_argument &) {
+                Log::e(TAG, u8"过滤规则 " + filename + u8" 不是有效的 JSON");
             }
         }
     } else {
-        Log::e(TAG, u8"没有找到过滤规则文件 filter.json");
+        Log::e(TAG, u8"没有找到过滤规则文件 " + filename);
     }
 
-    if (!filter_) {
+    return filter;
+}
+
+shared_ptr<IFilter> GlobalFilter::filter_ = nullptr;
+
+void GlobalFilter::load(const string &path) {
+    auto filter = load_filter(path);
+
+    if (!filter) {
         // we was expecting to load a filter, but we failed
         // so we should block all event by default
 
         class BlockAllFilter : public IFilter {
         public:
             bool eval(const json &) override { return false; }
+            bool may_read(const string &) const override { return false; }
         };
 
-        filter_ = make_shared<BlockAllFilter>();
+        filter = make_shared<BlockAllFilter>();
         Log::e(TAG, u8"过滤规则加载失败，将暂停所有事件上报");
     }
+
+    atomic_store(&filter_, move(filter));
+}
+
+bool GlobalFilter::reload(const string &path) {
+    auto filter = load_filter(path);
+    if (!filter) {
+        Log::e(TAG, u8"过滤规则重新加载失败，将继续使用原有的过滤规则");
+        return false;
+    }
+    atomic_store(&filter_, move(filter));
+    return true;
 }
 
 void GlobalFilter::reset() {
-    filter_ = nullptr;
+    atomic_store(&filter_, shared_ptr<IFilter>());
 }
 
 bool GlobalFilter::eval(const json &payload) {
-    if (!filter_) {
+    const auto filter = atomic_load(&filter_);
+    if (!filter) {
         return true;
     }
-    return filter_->eval(payload);
+    return filter->eval(payload);
+}
+
+bool GlobalFilter::may_read(const string &key) {
+    const auto filter = atomic_load(&filter_);
+    return filter && filter->may_read(key);
 }
@@ -6,16 +6,44 @@ class IFilter {
 public:
     virtual ~IFilter() = default;
     virtual bool eval(const json &payload) = 0;
+
+    /**
+     * Whether the filter may look at the given top-level field of the payload when evaluating.
+     */
+    virtual bool may_read(const std::string &key) const { return true; }
 };
 
+/**
+ * Compile a filter expression, throw std::invalid_argument if it has syntax errors.
+ */
 std::shared_ptr<IFilter> construct_filter(const json &root_filter);
 
+/**
+ * Load and compile the filter expression in a JSON file, return nullptr (and log the reason) if failed.
+ */
+std::shared_ptr<IFilter> load_filter(const std::string &path);
+
+/**
+ * The filter set by "filter.json", which can be swapped atomically while events are being evaluated.
+ */
 class GlobalFilter {
 public:
     static void load(const std::string &path);
+
+    /**
+     * Like "load", but keep the current filter if the new one fails to load.
+     */
+    static bool reload(const std::string &path);
+
     static void reset();
     static bool eval(const json &payload);
 
+    /**
+     * Whether the global filter may look at the given top-level field, if not, the field can be left out
+     * of the payload until the event has passed the filter.
+     */
+    static bool may_read(const std::string &key);
+
 private:
     static std::shared_ptr<IFilter> filter_;
 };
@@ -0,0 +1,327 @@
+#include "./journal_class.h"
+
+#include "app.h"
+
+#include <boost/crc.hpp>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static const auto TAG = u8"事件日志";
+
+/*
+ * A segment file starts with 8 bytes of magic and the sequence number of its first record (8 bytes),
+ * followed by the records, each of which is the size of the data (4 bytes), the CRC-32 of the data (4 bytes),
+ * the sequence number (8 bytes) and the data, padded to a multiple of 8 bytes.
+ * The unused part of a segment is zeroed, so a size of 0 marks the end.
+ */
+static const char SEGMENT_MAGIC[8] = {'C', 'Q', 'H', 'J', 'R', 'N', 'L', '1'};
+static const size_t SEGMENT_HEADER_SIZE = 16;
+static const size_t RECORD_HEADER_SIZE = 16;
+static const size_t MIN_SEGMENT_SIZE = 64 * 1024;
+
+static size_t record_size(const size_t data_size) { return (RECORD_HEADER_SIZE + data_size + 7) / 8 * 8; }
+
+static uint32_t crc32(const char *data, const size_t size) {
+    boost::crc_32_type crc;
+    crc.process_bytes(data, size);
+    return crc.checksum();
+}
+
+static wstring segment_file_name(const uint64_t first_seq) {
+    wchar_t name[32];
+    swprintf(name, 32, L"%020llu.seg", static_cast<unsigned long long>(first_seq));
+    return name;
+}
+
+/**
+ * Read the header of the record at "offset", which must have the sequence number "expected_seq".
+ *
+ * \return false if there is no (valid) record there
+ */
+static bool read_record_header(const char *view, const size_t size, const size_t offset, const uint64_t expected_seq,
+                               uint32_t &data_size, uint32_t &crc) {
+    if (offset + RECORD_HEADER_SIZE > size) {
+        return false;
+    }
+    uint64_t seq;
+    memcpy(&data_size, view + offset, sizeof(data_size));
+    memcpy(&crc, view + offset + 4, sizeof(crc));
+    memcpy(&seq, view + offset + 8, sizeof(seq));
+    return data_size > 0 && offset + record_size(data_size) <= size && seq == expected_seq;
+}
+
+struct EventJournal::MappedFile {
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+    char *view = nullptr;
+    size_t size = 0;
+
+    ~MappedFile() { close(); }
+
+    /**
+     * Map the whole file, extending it to at least "min_size" bytes (zero-filled) if it's writable.
+     */
+    bool open(const wstring &path, const bool writable, const size_t min_size = 0) {
+        file = CreateFileW(path.c_str(), writable ? GENERIC_READ | GENERIC_WRITE : GENERIC_READ,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+                           writable ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        LARGE_INTEGER file_size;
+        if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &file_size)) {
+            close();
+            return false;
+        }
+        size = max(static_cast<size_t>(file_size.QuadPart), writable ? min_size : 0);
+        if (size == 0) {
+            close(); // empty files can't be mapped
+            return false;
+        }
+        mapping = CreateFileMappingW(file, nullptr, writable ? PAGE_READWRITE : PAGE_READONLY,
+                                     static_cast<DWORD>(static_cast<uint64_t>(size) >> 32),
+                                     static_cast<DWORD>(size & 0xFFFFFFFF), nullptr);
+        if (mapping) {
+            view = static_cast<char *>(MapViewOfFile(mapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, size));
+        }
+        if (!view) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * Unmap the file, and cut it at "used_size" if it's not 0.
+     */
+    void close(const size_t used_size = 0) {
+        if (view) {
+            FlushViewOfFile(view, 0);
+            UnmapViewOfFile(view);
+            view = nullptr;
+        }
+        if (mapping) {
+            CloseHandle(mapping);
+            mapping = nullptr;
+        }
+        if (file != INVALID_HANDLE_VALUE) {
+            if (used_size > 0) {
+                LARGE_INTEGER pos;
+                pos.QuadPart = used_size;
+                SetFilePointerEx(file, pos, nullptr, FILE_BEGIN);
+                SetEndOfFile(file);
+            }
+            CloseHandle(file);
+            file = INVALID_HANDLE_VALUE;
+        }
+    }
+};
+
+EventJournal::EventJournal() = default;
+EventJournal::~EventJournal() = default;
+
+void EventJournal::start() {
+    if (running_ || !config.use_journal) {
+        return;
+    }
+
+    unique_lock<shared_mutex> lock(mutex_);
+    segment_size_ = max(config.journal_segment_size, MIN_SEGMENT_SIZE);
+    max_segments_ = max(config.journal_max_segments, static_cast<size_t>(1));
+    directory_ = s2ws(sdk->directories().app() + "journal\\");
+
+    segments_.clear();
+    try {
+        fs::create_directories(directory_);
+        for (const auto &entry : fs::directory_iterator(directory_)) {
+            const auto name = entry.path().filename().wstring();
+            if (name.size() == 24 && name.substr(20) == L".seg") {
+                try {
+                    segments_.push_back({stoull(name.substr(0, 20)), entry.path().wstring()});
+                } catch (exception &) {}
+            }
+        }
+    } catch (fs::filesystem_error &) {
+        Log::e(TAG, u8"无法访问事件日志目录 " + ws2s(directory_));
+        return;
+    }
+    sort(segments_.begin(), segments_.end(), [](const Segment &a, const Segment &b) {
+        return a.first_seq < b.first_seq;
+    });
+
+    if (!segments_.empty()) {
+        recover_active();
+    } else {
+        next_seq_ = 1;
+        open_active(next_seq_, 0);
+    }
+
+    running_ = true;
+    Log::d(TAG, u8"事件日志已启动，下一个事件的序号为 " + to_string(next_seq_));
+}
+
+void EventJournal::stop() {
+    if (!running_) {
+        return;
+    }
+
+    unique_lock<shared_mutex> lock(mutex_);
+    running_ = false;
+    seal_active();
+    segments_.clear();
+    Log::d(TAG, u8"事件日志已停止");
+}
+
+bool EventJournal::open_active(const uint64_t first_seq, const size_t min_size) {
+    const auto path = directory_ + segment_file_name(first_seq);
+    active_ = make_unique<MappedFile>();
+    if (!active_->open(path, true, max(segment_size_, min_size))) {
+        Log::e(TAG, u8"创建事件日志文件 " + ws2s(path) + u8" 失败，错误码：" + to_string(GetLastError()));
+        active_ = nullptr;
+        return false;
+    }
+
+    memcpy(active_->view, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+    memcpy(active_->view + sizeof(SEGMENT_MAGIC), &first_seq, sizeof(first_seq));
+    active_offset_ = SEGMENT_HEADER_SIZE;
+    segments_.push_back({first_seq, path});
+
+    while (segments_.size() > max_segments_) {
+        DeleteFileW(segments_.front().path.c_str());
+        segments_.pop_front();
+    }
+    return true;
+}
+
+void EventJournal::seal_active() {
+    if (active_) {
+        active_->close(active_offset_); // the unused zeros are not kept
+        active_ = nullptr;
+    }
+}
+
+void EventJournal::recover_active() {
+    const auto &segment = segments_.back();
+    active_ = make_unique<MappedFile>();
+    if (!active_->open(segment.path, true, segment_size_)) {
+        Log::e(TAG, u8"打开事件日志文件 " + ws2s(segment.path) + u8" 失败，错误码：" + to_string(GetLastError()));
+        active_ = nullptr;
+        next_seq_ = segment.first_seq;
+        return;
+    }
+
+    const auto view = active_->view;
+    const auto size = active_->size;
+    auto offset = SEGMENT_HEADER_SIZE;
+    auto seq = segment.first_seq;
+    if (memcmp(view, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC)) == 0) {
+        // find the end of the complete records, the last one may be cut off by a crash
+        uint32_t data_size, crc;
+        while (read_record_header(view, size, offset, seq, data_size, crc)
+            && crc32(view + offset + RECORD_HEADER_SIZE, data_size) == crc) {
+            offset += record_size(data_size);
+            seq++;
+        }
+    } else {
+        memcpy(view, SEGMENT_MAGIC, sizeof(SEGMENT_MAGIC));
+        memcpy(view + sizeof(SEGMENT_MAGIC), &seq, sizeof(seq));
+    }
+    memset(view + offset, 0, size - offset);
+
+    active_offset_ = offset;
+    next_seq_ = seq;
+}
+
+SerializedPayload EventJournal::append(json &payload) {
+    unique_lock<shared_mutex> lock(mutex_);
+    if (!running_) {
+        return make_shared<string>(payload.dump());
+    }
+
+    // the number is used even if writing fails, so that it never refers to two different events
+    const auto seq = next_seq_++;
+    payload["journal_seq"] = seq;
+    auto payload_str = make_shared<string>(payload.dump());
+
+    const auto data_size = static_cast<uint32_t>(payload_str->size());
+    const auto need = record_size(data_size);
+    if (!active_ || active_offset_ + need > active_->size) {
+        seal_active();
+        if (!open_active(seq, SEGMENT_HEADER_SIZE + need)) {
+            return payload_str;
+        }
+    }
+
+    const auto crc = crc32(payload_str->data(), data_size);
+    const auto record = active_->view + active_offset_;
+    memcpy(record + RECORD_HEADER_SIZE, payload_str->data(), data_size);
+    memcpy(record + 8, &seq, sizeof(seq));
+    memcpy(record + 4, &crc, sizeof(crc));
+    memcpy(record, &data_size, sizeof(data_size));
+    active_offset_ += need;
+
+    return payload_str;
+}
+
+vector<EventJournal::Record> EventJournal::read(const uint64_t from_seq, const size_t limit,
+                                                const uint64_t until_seq) const {
+    shared_lock<shared_mutex> lock(mutex_);
+    vector<Record> records;
+    if (segments_.empty() || limit == 0) {
+        return records;
+    }
+
+    // the last segment starting at or before "from_seq"
+    auto i = upper_bound(segments_.cbegin(), segments_.cend(), from_seq, [](const uint64_t seq, const Segment &s) {
+        return seq < s.first_seq;
+    }) - segments_.cbegin();
+    if (i > 0) {
+        i--;
+    }
+
+    for (; i < static_cast<ptrdiff_t>(segments_.size()); i++) {
+        const auto &segment = segments_[i];
+        const char *view;
+        size_t size;
+        MappedFile file;
+        if (i == static_cast<ptrdiff_t>(segments_.size()) - 1 && active_) {
+            view = active_->view;
+            size = active_offset_;
+        } else if (file.open(segment.path, false)) {
+            view = file.view;
+            size = file.size;
+        } else {
+            continue;
+        }
+
+        auto offset = SEGMENT_HEADER_SIZE;
+        auto seq = segment.first_seq;
+        uint32_t data_size, crc;
+        while (read_record_header(view, size, offset, seq, data_size, crc)) {
+            if (seq > until_seq) {
+                return records;
+            }
+            if (seq >= from_seq) {
+                records.push_back({seq, string(view + offset + RECORD_HEADER_SIZE, data_size)});
+                if (records.size() >= limit) {
+                    return records;
+                }
+            }
+            offset += record_size(data_size);
+            seq++;
+        }
+    }
+    return records;
+}
+
+uint64_t EventJournal::first_seq() const {
+    shared_lock<shared_mutex> lock(mutex_);
+    if (segments_.empty() || segments_.front().first_seq >= next_seq_) {
+        return 0;
+    }
+    return segments_.front().first_seq;
+}
+
+uint64_t EventJournal::last_seq() const {
+    shared_lock<shared_mutex> lock(mutex_);
+    return segments_.empty() ? 0 : next_seq_ - 1;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <deque>
+#include <shared_mutex>
+
+#include "service/pushable_interface.h"
+
+/**
+ * Append-only journal of the posted events (those that passed the global filter), in memory-mapped segment files,
+ * so that consumers which were down can catch up from the sequence number of the last event they received.
+ *
+ * Every event gets a "journal_seq" field, increasing by 1 for each event. The journal is kept in "journal_segment_size"
+ * sized files in the "journal" directory of the app directory, at most "journal_max_segments" of them,
+ * the oldest segment is deleted when a new one is started.
+ */
+class EventJournal {
+public:
+    struct Record {
+        uint64_t seq;
+        std::string data; // the event serialized as JSON
+    };
+
+    static EventJournal &instance() {
+        static EventJournal journal;
+        return journal;
+    }
+
+    void start();
+    void stop();
+    bool started() const { return running_; }
+
+    /**
+     * Assign the next sequence number to the event ("journal_seq" field), serialize it and write it to the journal.
+     *
+     * \return the serialized event, to be shared with the receivers
+     */
+    SerializedPayload append(json &payload);
+
+    /**
+     * Read the events with a sequence number in [from_seq, until_seq], at most "limit" of them, in order.
+     * If "from_seq" is older than the oldest kept event, the reading starts at the oldest one.
+     */
+    std::vector<Record> read(uint64_t from_seq, size_t limit, uint64_t until_seq = UINT64_MAX) const;
+
+    /// The sequence number of the oldest kept event, 0 if there is none.
+    uint64_t first_seq() const;
+
+    /// The sequence number of the newest event, 0 if there is none.
+    uint64_t last_seq() const;
+
+private:
+    // defined where MappedFile is complete
+    EventJournal();
+    ~EventJournal();
+
+    struct Segment {
+        uint64_t first_seq;
+        std::wstring path;
+    };
+
+    struct MappedFile;
+
+    // all segments in order, the last one is the one written to
+    std::deque<Segment> segments_;
+    std::unique_ptr<MappedFile> active_;
+    size_t active_offset_ = 0; // where the next record is written in the active segment
+    uint64_t next_seq_ = 1;
+
+    mutable std::shared_mutex mutex_; // appending takes it exclusively, reading shared
+    std::atomic<bool> running_ = false;
+
+    size_t segment_size_ = 0;
+    size_t max_segments_ = 0;
+    std::wstring directory_;
+
+    bool open_active(uint64_t first_seq, size_t min_size);
+    void seal_active();
+    void recover_active();
+};
@@ -0,0 +1,185 @@
+#include "./post_targets_class.h"
+
+#include "app.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include "utils/deadline_class.h"
+#include "utils/rolling_stats_class.h"
+#include "utils/tracing.h"
+
+using namespace std;
+
+static const auto TAG = u8"上报";
+
+HttpSimpleResponse PostTargets::post(const string &body, const map<string, string> &headers) {
+    const auto mode = live_config()->post_url_mode;
+    const auto targets = select(mode);
+    if (targets.empty()) {
+        return {};
+    }
+
+    if (mode == "broadcast") {
+        // the others are posted in background, only the response of the first one is waited for
+        if (targets.size() > 1) {
+            const auto shared_body = make_shared<const string>(body);
+            for (size_t i = 1; i < targets.size(); i++) {
+                auto task = [this, target = targets[i], shared_body, headers] {
+                    post_to(target, *shared_body, headers);
+                };
+                if (pool) {
+                    pool->push(TaskPriority::NORMAL, [task](int) { task(); });
+                } else {
+                    task();
+                }
+            }
+        }
+        return post_to(targets.front(), body, headers);
+    }
+
+    HttpSimpleResponse resp;
+    for (const auto &target : targets) {
+        resp = post_to(target, body, headers);
+        if (resp.status_code != 0 && resp.status_code < 500) {
+            break; // the target has handled the event, no matter whether it succeeded
+        }
+    }
+    return resp;
+}
+
+vector<shared_ptr<PostTargets::Target>> PostTargets::select(const string &mode) {
+    const auto c = live_config();
+
+    unique_lock<mutex> lock(mutex_);
+    if (c->post_url != post_url_ || c->post_urls != post_urls_) {
+        // "post_url" or "post_urls" is changed by a hot reload, keep the state of the unchanged targets
+        map<string, shared_ptr<Target>> old_targets;
+        for (const auto &target : targets_) {
+            old_targets[target->url] = target;
+        }
+        targets_.clear();
+
+        const auto add_target = [&](const string &url, const int weight) {
+            auto &target = old_targets[url];
+            if (!target) {
+                target = make_shared<Target>();
+                target->url = url;
+            }
+            target->weight = weight;
+            if (find(targets_.begin(), targets_.end(), target) == targets_.end()) {
+                targets_.push_back(target);
+            }
+        };
+
+        // "post_url" is a single URL as is, which may contain any character
+        if (const auto url = boost::trim_copy(c->post_url); !url.empty()) {
+            add_target(url, 1);
+        }
+
+        // "post_urls" is separated by whitespaces, which can't appear in a URL unescaped
+        vector<string> entries;
+        boost::split(entries, c->post_urls, boost::is_space(), boost::token_compress_on);
+        for (auto &entry : entries) {
+            if (entry.empty()) {
+                continue;
+            }
+            auto weight = 1;
+            if (const auto pos = entry.rfind('*');
+                pos != string::npos && pos > 0 && pos + 1 < entry.size()
+                && all_of(entry.begin() + pos + 1, entry.end(), [](const unsigned char ch) { return isdigit(ch); })) {
+                try {
+                    weight = max(stoi(entry.substr(pos + 1)), 1);
+                    entry.erase(pos);
+                } catch (out_of_range &) {}
+            }
+            add_target(entry, weight);
+        }
+        post_url_ = c->post_url;
+        post_urls_ = c->post_urls;
+    }
+
+    // the targets which are not skipped because of failing recently
+    vector<shared_ptr<Target>> available;
+    const auto now = Clock::now();
+    for (const auto &target : targets_) {
+        if (targets_.size() == 1 || target->skipped_until <= now) {
+            available.push_back(target);
+        }
+    }
+    if (available.empty()) {
+        available = targets_;
+    }
+
+    if (mode == "round_robin" && available.size() > 1) {
+        // smooth weighted round-robin (as in nginx), the chosen target goes first, and the rest follow as fallbacks
+        auto total_weight = 0;
+        shared_ptr<Target> chosen;
+        for (const auto &target : available) {
+            target->current_weight += target->weight;
+            total_weight += target->weight;
+            if (!chosen || target->current_weight > chosen->current_weight) {
+                chosen = target;
+            }
+        }
+        chosen->current_weight -= total_weight;
+        const auto it = find(available.begin(), available.end(), chosen);
+        rotate(available.begin(), it, available.end());
+    }
+    return available;
+}
+
+HttpSimpleResponse PostTargets::post_to(const shared_ptr<Target> &target, const string &body,
+                                        const map<string, string> &headers) {
+    Deadline::Scope scope(chrono::milliseconds(live_config()->post_timeout));
+    const auto resp = [&] {
+        CQHTTP_TRACE_SCOPE("post", target->url.c_str());
+        return post_json(target->url, body, headers);
+    }();
+    if (resp.status_code != 0) {
+        RollingStats::instance().add_bytes("bytes_sent", "http_post", body.size());
+    }
+    if (resp.status_code == 0) {
+        Log::d(TAG, u8"HTTP 上报地址 " + target->url + u8" 无法访问");
+    } else {
+        Log::d(TAG, u8"通过 HTTP 上报数据到 " + target->url + (resp.ok() ? u8" 成功" : u8" 失败")
+               + u8"，状态码：" + to_string(resp.status_code));
+    }
+
+    const auto failed = resp.status_code == 0 || resp.status_code >= 500;
+    unique_lock<mutex> lock(mutex_);
+    if (!failed) {
+        target->consecutive_failures = 0;
+    } else {
+        target->failure_count++;
+        if (++target->consecutive_failures >= max(config.post_circuit_failures, static_cast<size_t>(1))) {
+            // also extended when the retry after the last skipping fails
+            target->skipped_until = Clock::now() + chrono::seconds(config.post_circuit_cooldown);
+            if (targets_.size() > 1) {
+                Log::w(TAG, u8"HTTP 上报地址 " + target->url + u8" 连续 " + to_string(target->consecutive_failures)
+                       + u8" 次上报失败，将在 " + to_string(config.post_circuit_cooldown) + u8" 秒内跳过");
+            }
+        }
+    }
+    return resp;
+}
+
+void PostTargets::prewarm() {
+    for (const auto &target : select("broadcast")) {
+        prewarm_http_connection(target->url);
+    }
+}
+
+json PostTargets::stats() {
+    unique_lock<mutex> lock(mutex_);
+    const auto now = Clock::now();
+    auto result = json::array();
+    for (const auto &target : targets_) {
+        result.push_back({
+            {"url", target->url},
+            {"weight", target->weight},
+            {"failures", target->failure_count},
+            {"skipped", targets_.size() > 1 && target->skipped_until > now}
+        });
+    }
+    return result;
+}
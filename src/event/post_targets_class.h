@@ -0,0 +1,68 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+#include "utils/http_utils.h"
+
+/**
+ * The HTTP post targets, i.e. the URL in "post_url" (taken as is), followed by the ones listed in "post_urls",
+ * separated by whitespaces, each of which may have a weight (used by "round_robin") as a "*N" suffix,
+ * e.g. "http://a:8080/ http://b:8080/*2".
+ *
+ * How an event is posted depends on "post_url_mode":
+ * - "broadcast": to all targets concurrently, the response of the first available one is used
+ * - "round_robin": to one target chosen by weighted round-robin, or the next one if it fails
+ * - "failover": to the first target that doesn't fail, in the order given
+ *
+ * A target failing "post_circuit_failures" times in a row is skipped for "post_circuit_cooldown" seconds,
+ * after which one event is tried again to see whether it has recovered. This only applies if there are
+ * multiple targets, and if all of them are skipped, all of them are tried anyway.
+ */
+class PostTargets {
+public:
+    static PostTargets &instance() {
+        static PostTargets targets;
+        return targets;
+    }
+
+    /**
+     * Post the body to the targets in the current "post_url" and "post_urls".
+     *
+     * \return the response to be handled (quick operations), whose status code is 0 if all targets failed
+     */
+    HttpSimpleResponse post(const std::string &body, const std::map<std::string, std::string> &headers);
+
+    json stats();
+
+    /// Open connections to all the targets in background, see prewarm_http_connection().
+    void prewarm();
+
+private:
+    PostTargets() = default;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Target {
+        std::string url;
+        int weight = 1;
+        int current_weight = 0; // of smooth weighted round-robin
+        size_t consecutive_failures = 0;
+        Clock::time_point skipped_until;
+        size_t failure_count = 0;
+    };
+
+    std::vector<std::shared_ptr<Target>> targets_;
+    std::string post_url_; // "targets_" is parsed from these two
+    std::string post_urls_;
+    std::mutex mutex_;
+
+    /// The targets to try in order, according to the mode.
+    std::vector<std::shared_ptr<Target>> select(const std::string &mode);
+
+    HttpSimpleResponse post_to(const std::shared_ptr<Target> &target, const std::string &body,
+                               const std::map<std::string, std::string> &headers);
+};
@@ -0,0 +1,84 @@
+#include "./trace_class.h"
+
+#include "app.h"
+
+#include <deque>
+#include <mutex>
+#include <random>
+
+using namespace std;
+
+static const size_t MAX_STORED_TRACES = 1024;
+
+static thread_local optional<EventTrace> current_trace;
+
+static deque<EventTrace> finished_traces; // the latest at the front
+static mutex finished_traces_mutex;
+
+static mt19937_64 &random_engine() {
+    static thread_local mt19937_64 engine(random_device{}());
+    return engine;
+}
+
+void EventTrace::begin() {
+    current_trace = nullopt;
+
+    const auto rate = live_config()->event_trace_sample_rate;
+    if (rate <= 0 || rate < 1 && uniform_real_distribution<double>(0, 1)(random_engine()) >= rate) {
+        return;
+    }
+
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    EventTrace trace;
+    trace.id_.reserve(16);
+    for (auto n = random_engine()(); trace.id_.size() < 16; n >>= 4) {
+        trace.id_.push_back(HEX_DIGITS[n & 0xf]);
+    }
+    trace.time_ = time(nullptr);
+    trace.start_ = Clock::now();
+    current_trace = move(trace);
+}
+
+void EventTrace::mark(const char *stage) {
+    if (current_trace) {
+        const auto elapsed = chrono::duration_cast<chrono::microseconds>(Clock::now() - current_trace->start_);
+        current_trace->stages_.emplace_back(stage, elapsed.count());
+    }
+}
+
+string EventTrace::current_id() {
+    return current_trace ? current_trace->id_ : "";
+}
+
+void EventTrace::finish() {
+    if (!current_trace) {
+        return;
+    }
+
+    unique_lock<mutex> lock(finished_traces_mutex);
+    finished_traces.push_front(move(current_trace.value()));
+    if (finished_traces.size() > MAX_STORED_TRACES) {
+        finished_traces.pop_back();
+    }
+    lock.unlock();
+    current_trace = nullopt;
+}
+
+json EventTrace::recent(const size_t limit) {
+    auto result = json::array();
+    unique_lock<mutex> lock(finished_traces_mutex);
+    for (size_t i = 0; i < finished_traces.size() && i < limit; i++) {
+        result.push_back(finished_traces[i].to_json());
+    }
+    return result;
+}
+
+json EventTrace::to_json() const {
+    auto stages = json::array();
+    int64_t last = 0;
+    for (const auto &stage : stages_) {
+        stages.push_back({{"stage", stage.first}, {"at", stage.second}, {"duration", stage.second - last}});
+        last = stage.second;
+    }
+    return {{"trace_id", id_}, {"time", time_}, {"total", last}, {"stages", stages}};
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <vector>
+
+/**
+ * Timing of the stages an event goes through (building the payload, decoding, filtering, converting, posting),
+ * recorded for the events sampled by "event_trace_sample_rate".
+ * A trace belongs to the thread handling the event, and is kept in a ring buffer of recent traces when finished.
+ */
+class EventTrace {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Start tracing the event handled by the current thread, if it's sampled.
+     */
+    static void begin();
+
+    /**
+     * Record that the current event has just finished "stage", does nothing if it's not traced.
+     */
+    static void mark(const char *stage);
+
+    /**
+     * Id of the current trace, or empty if the current event is not traced.
+     */
+    static std::string current_id();
+
+    /**
+     * Finish the current trace and put it into the ring buffer.
+     */
+    static void finish();
+
+    /**
+     * The most recent "limit" finished traces, the latest first.
+     */
+    static json recent(size_t limit);
+
+private:
+    std::string id_;
+    std::time_t time_;
+    Clock::time_point start_;
+    std::vector<std::pair<const char *, int64_t>> stages_; // stage, microseconds since start
+
+    json to_json() const;
+};
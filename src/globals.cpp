@@ -24,4 +24,14 @@ using namespace std;
 Application app; // always available while CoolQ is running
 optional<Sdk> sdk; // will be initialized in "Initialize" event
 Config config; // will be initiated in "Enable" event
-shared_ptr<ctpl::thread_pool> pool; // will be initiated in "Enable" event
+shared_ptr<TaskScheduler> pool; // will be initiated in "Enable" event
+
+static shared_ptr<const Config> live_config_ = make_shared<const Config>();
+
+shared_ptr<const Config> live_config() {
+    return atomic_load(&live_config_);
+}
+
+void set_live_config(shared_ptr<const Config> c) {
+    atomic_store(&live_config_, move(c));
+}
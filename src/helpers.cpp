@@ -21,9 +21,10 @@
 
 #include "app.h"
 
-#include <codecvt>
 #include <random>
+#include <fstream>
 #include <openssl/hmac.h>
+#include <openssl/crypto.h>
 #include <boost/compute/detail/lru_cache.hpp>
 
 using namespace std;
@@ -78,96 +79,301 @@ int message_box(const unsigned type, const string &text) {
                        type | MB_SETFOREGROUND | MB_TASKMODAL | MB_TOPMOST);
 }
 
-string hmac_sha1_hex(const string &key, const string &msg) {
-    unsigned digest_len = 20;
-    const auto digest = new unsigned char[digest_len];
-    HMAC_CTX ctx;
-    HMAC_CTX_init(&ctx);
-    HMAC_Init_ex(&ctx, key.c_str(), key.size(), EVP_sha1(), nullptr);
-    HMAC_Update(&ctx, reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size());
-    HMAC_Final(&ctx, digest, &digest_len);
-    HMAC_CTX_cleanup(&ctx);
-
-    stringstream ss;
+namespace {
+    /**
+     * An HMAC context which keeps the key set up, so that it's only rekeyed when the key changes.
+     */
+    struct KeyedHmacContext {
+        HMAC_CTX ctx;
+        std::optional<string> key;
+
+        KeyedHmacContext() { HMAC_CTX_init(&ctx); }
+        ~KeyedHmacContext() { HMAC_CTX_cleanup(&ctx); }
+    };
+}
+
+static string to_hex(const unsigned char *digest, const unsigned digest_len) {
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    string result(digest_len * 2, '\0');
     for (unsigned i = 0; i < digest_len; ++i) {
-        ss << hex << setfill('0') << setw(2) << static_cast<unsigned int>(digest[i]);
+        result[i * 2] = HEX_DIGITS[digest[i] >> 4];
+        result[i * 2 + 1] = HEX_DIGITS[digest[i] & 0xf];
     }
-    delete[] digest;
-    return ss.str();
+    return result;
+}
+
+static string hmac_hex(KeyedHmacContext &context, const EVP_MD *md, const string &key, const string &msg) {
+    if (context.key != key) {
+        HMAC_Init_ex(&context.ctx, key.c_str(), key.size(), md, nullptr);
+        context.key = key;
+    } else {
+        HMAC_Init_ex(&context.ctx, nullptr, 0, nullptr, nullptr); // reuse the key set up last time
+    }
+    HMAC_Update(&context.ctx, reinterpret_cast<const unsigned char *>(msg.c_str()), msg.size());
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned digest_len = 0;
+    HMAC_Final(&context.ctx, digest, &digest_len);
+    return to_hex(digest, digest_len);
+}
+
+string hmac_sha1_hex(const string &key, const string &msg) {
+    static thread_local KeyedHmacContext context;
+    return hmac_hex(context, EVP_sha1(), key, msg);
+}
+
+string hmac_sha256_hex(const string &key, const string &msg) {
+    static thread_local KeyedHmacContext context;
+    return hmac_hex(context, EVP_sha256(), key, msg);
+}
+
+optional<string> file_sha256_hex(const string &path) {
+    ifstream f(s2ws(path), ios::binary);
+    if (!f.is_open()) {
+        return nullopt;
+    }
+
+    const auto ctx = EVP_MD_CTX_create();
+    EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr);
+    char buf[64 * 1024];
+    while (f.read(buf, sizeof(buf)) || f.gcount() > 0) {
+        EVP_DigestUpdate(ctx, buf, static_cast<size_t>(f.gcount()));
+    }
+    const auto ok = f.eof();
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned digest_len = 0;
+    EVP_DigestFinal_ex(ctx, digest, &digest_len);
+    EVP_MD_CTX_destroy(ctx);
+
+    if (!ok) {
+        return nullopt;
+    }
+    return to_hex(digest, digest_len);
+}
+
+bool constant_time_equals(const string &a, const string &b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    return CRYPTO_memcmp(a.data(), b.data(), a.size()) == 0;
 }
 
 #include "emoji_data.h"
 
 bool is_emoji(const uint32_t codepoint) {
-    return emoji_set.find(codepoint) != emoji_set.end();
+    if (codepoint < EMOJI_CODEPOINT_MIN || codepoint > EMOJI_CODEPOINT_MAX) {
+        return false;
+    }
+    const auto offset = codepoint - EMOJI_CODEPOINT_MIN;
+    return emoji_bitmap[offset / 64] >> offset % 64 & 1;
+}
+
+/**
+ * Decode one UTF-8 encoded codepoint starting at "pos".
+ *
+ * \return the length of the sequence, or 0 if it's not a valid one
+ */
+static size_t decode_utf8(const string &str, const size_t pos, uint32_t &codepoint) {
+    const auto lead = static_cast<unsigned char>(str[pos]);
+    size_t len;
+    if (lead < 0x80) {
+        codepoint = lead;
+        return 1;
+    } else if ((lead & 0xE0) == 0xC0) {
+        len = 2;
+        codepoint = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+        len = 3;
+        codepoint = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+        len = 4;
+        codepoint = lead & 0x07;
+    } else {
+        return 0;
+    }
+
+    if (pos + len > str.size()) {
+        return 0;
+    }
+    for (size_t i = 1; i < len; i++) {
+        const auto c = static_cast<unsigned char>(str[pos + i]);
+        if ((c & 0xC0) != 0x80) {
+            return 0;
+        }
+        codepoint = codepoint << 6 | c & 0x3F;
+    }
+    return len;
 }
 
 string string_to_coolq(const string &str) {
     // call CoolQ API
 
     if (config.convert_unicode_emoji) {
+        // walk the UTF-8 bytes directly, and copy the non-emoji runs untouched
         string processed_str;
+        size_t last_end_pos = 0;
 
-        wstring_convert<codecvt_utf8<uint32_t>, uint32_t> uint32_conv;
-        auto uint32_str = uint32_conv.from_bytes(str);
+        for (size_t pos = 0; pos < str.size();) {
+            if (static_cast<unsigned char>(str[pos]) < 0x80) {
+                pos++; // ASCII is never emoji
+                continue;
+            }
 
-        auto append_text = [&](const decltype(uint32_str.cbegin()) &begin,
-                               const decltype(uint32_str.cbegin()) &end) {
-            decltype(uint32_str) uint32_part_str(begin, end);
-            auto utf8_part_str = uint32_conv.to_bytes(uint32_part_str);
-            processed_str += utf8_part_str;
-        };
+            uint32_t codepoint;
+            const auto len = decode_utf8(str, pos, codepoint);
+            if (len == 0) {
+                pos++; // invalid sequence, leave it to iconv
+                continue;
+            }
 
-        auto last_it = uint32_str.cbegin();
-        for (auto it = uint32_str.cbegin(); it != uint32_str.cend(); ++it) {
-            const auto codepoint = *it;
             if (is_emoji(codepoint)) {
-                // is emoji
-                append_text(last_it, it);
+                if (processed_str.empty()) {
+                    processed_str.reserve(str.size() + 16);
+                }
+                processed_str.append(str, last_end_pos, pos - last_end_pos);
                 processed_str += "[CQ:emoji,id=" + to_string(codepoint) + "]";
-                last_it = it + 1;
+                last_end_pos = pos + len;
             }
+            pos += len;
         }
-        append_text(last_it, uint32_str.cend());
 
-        return iconv_string_encode(processed_str, "gb18030");
+        if (last_end_pos > 0) {
+            processed_str.append(str, last_end_pos, string::npos);
+            return iconv_string_encode(processed_str, "gb18030");
+        }
     }
 
     return iconv_string_encode(str, "gb18030");
 }
 
+/**
+ * Append the UTF-8 encoding of the codepoint to "out".
+ */
+static void append_utf8(string &out, const char32_t codepoint) {
+    if (codepoint < 0x80) {
+        out.push_back(static_cast<char>(codepoint));
+    } else if (codepoint < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | codepoint >> 6));
+        out.push_back(static_cast<char>(0x80 | codepoint & 0x3F));
+    } else if (codepoint < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | codepoint >> 12));
+        out.push_back(static_cast<char>(0x80 | codepoint >> 6 & 0x3F));
+        out.push_back(static_cast<char>(0x80 | codepoint & 0x3F));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | codepoint >> 18));
+        out.push_back(static_cast<char>(0x80 | codepoint >> 12 & 0x3F));
+        out.push_back(static_cast<char>(0x80 | codepoint >> 6 & 0x3F));
+        out.push_back(static_cast<char>(0x80 | codepoint & 0x3F));
+    }
+}
+
+/**
+ * Replace "[CQ:emoji,id=xxx]" with the real emoji characters,
+ * scanning for the prefix directly instead of using regex.
+ */
+static string decode_emoji_codes(const string &str) {
+    static const string prefix = "[CQ:emoji,";
+
+    auto pos = str.find(prefix);
+    if (pos == string::npos) {
+        return str;
+    }
+
+    string result;
+    result.reserve(str.size());
+    size_t last_end_pos = 0;
+
+    while (pos != string::npos) {
+        // expecting "\s*id=(\d+)\]" after the prefix
+        auto p = pos + prefix.size();
+        while (p < str.size() && isspace(static_cast<unsigned char>(str[p]))) p++;
+
+        optional<unsigned long> id;
+        size_t code_end_pos = p;
+        if (str.compare(p, 3, "id=") == 0) {
+            const auto digits_begin = p + 3;
+            auto digits_end = digits_begin;
+            while (digits_end < str.size() && isdigit(static_cast<unsigned char>(str[digits_end]))) digits_end++;
+            if (digits_end > digits_begin && digits_end < str.size() && str[digits_end] == ']') {
+                try {
+                    id = stoul(str.substr(digits_begin, digits_end - digits_begin));
+                    code_end_pos = digits_end + 1;
+                } catch (out_of_range &) {}
+            }
+        }
+
+        if (!id) {
+            // not a valid emoji code, keep it as is
+            pos = str.find(prefix, pos + 1);
+            continue;
+        }
+
+        result.append(str, last_end_pos, pos - last_end_pos);
+
+        const auto codepoint_str = to_string(id.value());
+        if (boost::starts_with(codepoint_str, "100000") && codepoint_str.size() > strlen("100000")) {
+            // keycap # to keycap 9
+            append_utf8(result, static_cast<char32_t>(stoul(codepoint_str.substr(strlen("100000")))));
+            result += "\xef\xb8\x8f\xe2\x83\xa3"; // U+FE0F U+20E3
+        } else if (id.value() <= 0x10FFFF) {
+            append_utf8(result, static_cast<char32_t>(id.value()));
+        } else {
+            result.append(str, pos, code_end_pos - pos);
+        }
+
+        last_end_pos = code_end_pos;
+        pos = str.find(prefix, last_end_pos);
+    }
+
+    result.append(str, last_end_pos, string::npos);
+    return result;
+}
+
+/**
+ * CoolQ sometimes use "#\uFE0F" to represent "#\uFE0F\u20E3",
+ * we should convert them into correct emoji codepoints here.
+ *     \uFE0F == \xef\xb8\x8f
+ *     \u20E3 == \xe2\x83\xa3
+ */
+static string fix_keycap_emojis(const string &str) {
+    static const string fe0f = "\xef\xb8\x8f";
+    static const string keycap = "\xe2\x83\xa3";
+
+    auto pos = str.find(fe0f);
+    if (pos == string::npos) {
+        return str;
+    }
+
+    string result;
+    result.reserve(str.size() + keycap.size());
+    size_t last_end_pos = 0;
+
+    for (; pos != string::npos; pos = str.find(fe0f, pos + fe0f.size())) {
+        if (pos == 0) {
+            continue;
+        }
+        const auto c = str[pos - 1];
+        if (!(c == '#' || c == '*' || c >= '0' && c <= '9')) {
+            continue;
+        }
+        const auto after_pos = pos + fe0f.size();
+        if (str.compare(after_pos, keycap.size(), keycap) == 0) {
+            continue; // already correct
+        }
+        result.append(str, last_end_pos, after_pos - last_end_pos);
+        result += keycap;
+        last_end_pos = after_pos;
+    }
+
+    result.append(str, last_end_pos, string::npos);
+    return result;
+}
+
 string string_from_coolq(const string &str) {
     // handle CoolQ event or data
     auto result = iconv_string_decode(str, "gb18030");
 
     if (config.convert_unicode_emoji) {
-        smatch m;
-
-        result = sregex_replace(result, regex(R"(\[CQ:emoji,\s*id=(\d+)\])"), [](const smatch &m) {
-            const auto codepoint_str = m.str(1);
-            u32string u32_str;
-
-            if (boost::starts_with(codepoint_str, "100000")) {
-                // keycap # to keycap 9
-                const auto codepoint = static_cast<char32_t>(stoul(codepoint_str.substr(strlen("100000"))));
-                u32_str.append({codepoint, 0xFE0F, 0x20E3});
-            } else {
-                const auto codepoint = static_cast<char32_t>(stoul(codepoint_str));
-                u32_str.append({codepoint});
-            }
-
-            const auto p = reinterpret_cast<const uint32_t *>(u32_str.data());
-            wstring_convert<codecvt_utf8<uint32_t>, uint32_t> conv;
-            return conv.to_bytes(p, p + u32_str.size());
-        });
-
-        // CoolQ sometimes use "#\uFE0F" to represent "#\uFE0F\u20E3"
-        // we should convert them into correct emoji codepoints here
-        //     \uFE0F == \xef\xb8\x8f
-        //     \u20E3 == \xe2\x83\xa3
-        result = sregex_replace(result, regex("([#*0-9]\xef\xb8\x8f)(\xe2\x83\xa3)?"), [](const smatch &m) {
-            return m.str(1) + "\xe2\x83\xa3";
-        });
+        result = fix_keycap_emojis(decode_emoji_codes(result));
     }
 
     return result;
@@ -51,6 +51,19 @@ static std::shared_ptr<T> make_shared_array(const size_t size) {
 int message_box(const unsigned type, const std::string &text);
 
 std::string hmac_sha1_hex(const std::string &key, const std::string &msg);
+std::string hmac_sha256_hex(const std::string &key, const std::string &msg);
+
+/**
+ * Hash a file chunk by chunk, without reading the whole file into memory.
+ * \return nullopt if the file can't be read
+ */
+std::optional<std::string> file_sha256_hex(const std::string &path);
+
+/**
+ * Compare two strings in time independent of the position of the first difference,
+ * for checking secrets like access token.
+ */
+bool constant_time_equals(const std::string &a, const std::string &b);
 
 bool is_emoji(const uint32_t codepoint);
 
@@ -0,0 +1,92 @@
+#include "./log_class.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+using namespace std;
+
+atomic<int> Log::min_level_ = CQLOG_DEBUG;
+atomic<bool> Log::async_ = false;
+
+namespace {
+    struct LogItem {
+        int level;
+        string tag;
+        string msg;
+    };
+
+    // when the queue is full, logs are written in the calling thread instead, so nothing is lost
+    const size_t MAX_QUEUED_LOGS = 10000;
+
+    deque<LogItem> queue;
+    mutex queue_mutex;
+    condition_variable queue_cv;
+    thread writer_thread;
+}
+
+optional<int> Log::parse_level(const string &name) {
+    static const pair<const char *, int> levels[] = {
+        {"debug", CQLOG_DEBUG},
+        {"info", CQLOG_INFO},
+        {"warning", CQLOG_WARNING},
+        {"error", CQLOG_ERROR},
+        {"fatal", CQLOG_FATAL},
+    };
+    for (const auto &level : levels) {
+        if (boost::iequals(name, level.first)) {
+            return level.second;
+        }
+    }
+    return nullopt;
+}
+
+void Log::start_async() {
+    unique_lock<mutex> lock(queue_mutex);
+    if (async_) {
+        return;
+    }
+    async_ = true;
+    writer_thread = thread([] {
+        unique_lock<mutex> lock(queue_mutex);
+        while (true) {
+            queue_cv.wait(lock, [] { return !async_ || !queue.empty(); });
+            if (queue.empty()) {
+                break; // stopped and all written
+            }
+            auto items = move(queue);
+            queue.clear();
+            lock.unlock();
+            for (const auto &item : items) {
+                write(item.level, item.tag, item.msg);
+            }
+            lock.lock();
+        }
+    });
+}
+
+void Log::stop_async() {
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        if (!async_) {
+            return;
+        }
+        async_ = false;
+    }
+    queue_cv.notify_all();
+    if (writer_thread.joinable()) {
+        writer_thread.join();
+    }
+}
+
+bool Log::push_async(const int level, const string &tag, const string &msg) {
+    {
+        unique_lock<mutex> lock(queue_mutex);
+        if (!async_ || queue.size() >= MAX_QUEUED_LOGS) {
+            return false;
+        }
+        queue.push_back({level, tag, msg});
+    }
+    queue_cv.notify_one();
+    return true;
+}
@@ -21,10 +21,59 @@
 
 #include "cqp/sdk.h"
 
+#include <atomic>
+#include <type_traits>
+
 extern std::optional<Sdk> sdk;
 
 class Log {
 public:
+    /**
+     * Whether logs of the given level will be written,
+     * messages that are costly to build should only be built if this returns true.
+     */
+    static bool enabled(const int level) {
+        return level >= min_level_.load(std::memory_order_relaxed);
+    }
+
+    static void set_min_level(const int level) {
+        min_level_ = level;
+    }
+
+    /**
+     * Parse a level name in config file ("debug", "info", "warning", "error", "fatal").
+     */
+    static std::optional<int> parse_level(const std::string &name);
+
+    /**
+     * Start a background thread to call "add_log" of CoolQ,
+     * so that the threads writing logs won't wait for it.
+     */
+    static void start_async();
+
+    /**
+     * Write all the queued logs and stop the background thread.
+     */
+    static void stop_async();
+
+    /**
+     * Lazy versions of the above, the message will be built by calling "make_msg"
+     * only if the level is enabled, e.g. Log::d(TAG, [&] { return u8"响应：" + body; }).
+     */
+    template <typename F, typename = std::enable_if_t<std::is_invocable_r_v<std::string, F>>>
+    static void d(const std::string &tag, F &&make_msg) {
+        if (enabled(CQLOG_DEBUG)) {
+            log(CQLOG_DEBUG, tag, make_msg());
+        }
+    }
+
+    template <typename F, typename = std::enable_if_t<std::is_invocable_r_v<std::string, F>>>
+    static void i(const std::string &tag, F &&make_msg) {
+        if (enabled(CQLOG_INFO)) {
+            log(CQLOG_INFO, tag, make_msg());
+        }
+    }
+
     static void i(const std::string &tag, const std::string &msg) {
         log(CQLOG_INFO, tag, msg);
     }
@@ -58,6 +107,20 @@ public:
     }
 
     static void log(const int level, const std::string &tag, const std::string &msg) {
+        if (!enabled(level)) {
+            return;
+        }
+        if (!async_ || !push_async(level, tag, msg)) {
+            write(level, tag, msg);
+        }
+    }
+
+private:
+    static std::atomic<int> min_level_;
+    static std::atomic<bool> async_;
+
+    static bool push_async(int level, const std::string &tag, const std::string &msg);
+    static void write(int level, const std::string &tag, const std::string &msg) {
         if (sdk) {
             sdk->add_log(level, tag, msg);
         }
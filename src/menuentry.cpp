@@ -36,9 +36,7 @@ CQEVENT(int32_t, __menu_restart, 0)() {
  * Menu: Check update.
  */
 CQEVENT(int32_t, __menu_check_update, 0)() {
-    pool->push([](int) {
-        check_update(false);
-    });
+    check_update_async(false);
     return 0;
 }
 
@@ -0,0 +1,154 @@
+#include "./media_cache_class.h"
+
+#include "app.h"
+
+#include <boost/filesystem.hpp>
+
+#include "utils/shared_cache_class.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static const auto TAG = u8"媒体缓存";
+
+bool MediaCache::fetch(const string &url, const string &data_dir, const string &filename, const bool revalidate) {
+    const auto path = data_file_full_path(data_dir, filename);
+    const auto ws_path = s2ws(path);
+
+    HttpCacheValidators validators;
+    auto exists = false;
+    {
+        unique_lock<mutex> lock(mutex_);
+        scan(data_dir);
+        exists = fs::is_regular_file(ws_path);
+        if (const auto it = entries_.find(path); exists && it != entries_.end()) {
+            touch(it->second, it->first, time(nullptr));
+            validators = it->second.validators;
+        }
+    }
+
+    if (exists && !revalidate) {
+        return true;
+    }
+
+    const auto shared = SharedCache::current();
+    if (!exists && shared && shared->get_file(filename, path)) {
+        // downloaded by another instance, revalidated by the modification time if "cache=0" next time
+        boost::system::error_code ec;
+        const auto size = fs::file_size(ws_path, ec);
+        unique_lock<mutex> lock(mutex_);
+        put(path, ec ? 0 : size, {});
+        evict(path);
+        return true;
+    }
+
+    if (exists && validators.etag.empty() && validators.last_modified.empty()) {
+        // downloaded before the plugin started, fall back to the modification time of the local file
+        boost::system::error_code ec;
+        if (const auto mtime = fs::last_write_time(ws_path, ec); !ec) {
+            validators.last_modified = http_date(mtime);
+        }
+    }
+
+    switch (download_remote_file_if_modified(url, path, validators, true)) {
+    case DownloadResult::NOT_MODIFIED:
+        if (exists) {
+            Log::d(TAG, u8"文件 " + filename + u8" 未修改，使用缓存");
+            return true;
+        }
+        return false; // the server says not modified, but we don't have it at all
+    case DownloadResult::DOWNLOADED: {
+        boost::system::error_code ec;
+        const auto size = fs::file_size(ws_path, ec);
+        if (shared) {
+            shared->put_file(filename, path);
+        }
+        unique_lock<mutex> lock(mutex_);
+        put(path, ec ? 0 : size, validators);
+        evict(path);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+void MediaCache::clear() {
+    unique_lock<mutex> lock(mutex_);
+    entries_.clear();
+    by_access_.clear();
+    scanned_dirs_.clear();
+    total_size_ = 0;
+}
+
+void MediaCache::scan(const string &data_dir) {
+    if (!scanned_dirs_.insert(data_dir).second) {
+        return;
+    }
+
+    // take the existing files into account, using the modification time as the last access time
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(s2ws(data_file_full_path(data_dir, "")), ec), end; !ec && it != end;
+         it.increment(ec)) {
+        if (!fs::is_regular_file(it->status()) || it->path().extension() != ".tmp") {
+            continue;
+        }
+        boost::system::error_code size_ec, mtime_ec;
+        const auto size = fs::file_size(it->path(), size_ec);
+        const auto mtime = fs::last_write_time(it->path(), mtime_ec);
+        if (size_ec || mtime_ec) {
+            continue; // never count a bad size into the quota
+        }
+
+        const auto path = data_file_full_path(data_dir, ws2s(it->path().filename().wstring()));
+        if (entries_.find(path) == entries_.end()) {
+            entries_[path] = {size, {}, by_access_.emplace(mtime, path)};
+            total_size_ += size;
+        }
+    }
+}
+
+void MediaCache::put(const string &path, const uintmax_t size, const HttpCacheValidators &validators) {
+    const auto [it, inserted] = entries_.try_emplace(path);
+    auto &entry = it->second;
+    if (inserted) {
+        entry.access = by_access_.emplace(time(nullptr), path);
+    } else {
+        touch(entry, path, time(nullptr));
+    }
+    total_size_ = total_size_ - entry.size + size;
+    entry.size = size;
+    entry.validators = validators;
+}
+
+void MediaCache::touch(Entry &entry, const string &path, const time_t access_time) {
+    by_access_.erase(entry.access);
+    entry.access = by_access_.emplace(access_time, path);
+}
+
+void MediaCache::evict(const string &keep_path) {
+    const auto quota = uintmax_t(config.media_cache_size) * 1024 * 1024;
+    if (quota == 0) {
+        return;
+    }
+
+    size_t evicted_count = 0;
+    while (total_size_ > quota && entries_.size() > 1) {
+        auto lru = by_access_.begin();
+        if (lru->second == keep_path) {
+            ++lru; // there are at least 2 entries
+        }
+        const auto it = entries_.find(lru->second);
+
+        boost::system::error_code ec;
+        fs::remove(s2ws(it->first), ec);
+        total_size_ -= it->second.size;
+        entries_.erase(it);
+        by_access_.erase(lru);
+        evicted_count++;
+    }
+
+    if (evicted_count > 0) {
+        Log::d(TAG, u8"缓存超过大小限制，已删除 " + to_string(evicted_count) + u8" 个最久未使用的文件");
+    }
+}
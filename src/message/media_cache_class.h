@@ -0,0 +1,58 @@
+#pragma once
+
+#include "common.h"
+
+#include <map>
+#include <mutex>
+#include <set>
+
+#include "utils/http_utils.h"
+
+/**
+ * Index of the files downloaded for outgoing messages, which are named by the md5 of their urls.
+ * Least recently used files are evicted when the total size exceeds "media_cache_size",
+ * and the HTTP validators are kept, so that "cache=0" can revalidate instead of downloading again.
+ * If "shared_cache_dir" is set, files missing locally are looked up there before being downloaded (see SharedCache).
+ */
+class MediaCache {
+public:
+    static MediaCache &instance() {
+        static MediaCache cache;
+        return cache;
+    }
+
+    /**
+     * Make sure the file of the url is in the data directory, return false if failed to download.
+     * The caller should make sure no other thread is fetching the same file at the same time.
+     *
+     * \param revalidate: ask the server whether the cached file is still fresh, instead of using it directly
+     */
+    bool fetch(const std::string &url, const std::string &data_dir, const std::string &filename, bool revalidate);
+
+    /**
+     * Forget all the entries, they will be scanned from the data directories again.
+     */
+    void clear();
+
+private:
+    MediaCache() = default;
+
+    using AccessIndex = std::multimap<std::time_t, std::string>; // last access time -> full path
+
+    struct Entry {
+        uintmax_t size = 0;
+        HttpCacheValidators validators;
+        AccessIndex::iterator access;
+    };
+
+    std::map<std::string, Entry> entries_; // full path -> entry
+    AccessIndex by_access_; // the least recently used first, so that evicting doesn't search all the entries
+    std::set<std::string> scanned_dirs_;
+    uintmax_t total_size_ = 0;
+    std::mutex mutex_;
+
+    void scan(const std::string &data_dir);
+    void put(const std::string &path, uintmax_t size, const HttpCacheValidators &validators);
+    void touch(Entry &entry, const std::string &path, std::time_t access_time);
+    void evict(const std::string &keep_path);
+};
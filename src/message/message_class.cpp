@@ -21,174 +21,345 @@
 
 #include "app.h"
 
+#include <condition_variable>
+#include <mutex>
+#include <string_view>
+
+#include "utils/deadline_class.h"
+#include "utils/rolling_stats_class.h"
+
 using namespace std;
-using boost::algorithm::replace_all;
 
 const string Message::Formats::STRING = "string";
 const string Message::Formats::ARRAY = "array";
 
+/**
+ * Append the escaped text to "out" in one pass,
+ * runs of characters that need no escaping are copied in bulk.
+ */
+static void append_escaped(string &out, const string_view &sv) {
+    size_t run_begin = 0;
+    for (size_t i = 0; i < sv.size(); i++) {
+        const char *replacement;
+        switch (sv[i]) {
+        case '&':
+            replacement = "&amp;";
+            break;
+        case '[':
+            replacement = "&#91;";
+            break;
+        case ']':
+            replacement = "&#93;";
+            break;
+        case ',':
+            replacement = "&#44;";
+            break;
+        default:
+            continue;
+        }
+        out.append(sv.data() + run_begin, i - run_begin);
+        out.append(replacement);
+        run_begin = i + 1;
+    }
+    out.append(sv.data() + run_begin, sv.size() - run_begin);
+}
+
+/**
+ * Append the unescaped text to "out" in one pass,
+ * runs of characters between '&'s are copied in bulk.
+ */
+static void append_unescaped(string &out, const string_view &sv) {
+    static const struct {
+        string_view escaped;
+        char c;
+    } entities[] = {{"&#91;", '['}, {"&#93;", ']'}, {"&#44;", ','}, {"&amp;", '&'}};
+
+    size_t run_begin = 0;
+    auto amp_pos = sv.find('&');
+    while (amp_pos != string_view::npos) {
+        auto next_pos = amp_pos + 1;
+        for (const auto &entity : entities) {
+            if (sv.compare(amp_pos, entity.escaped.size(), entity.escaped) == 0) {
+                out.append(sv.data() + run_begin, amp_pos - run_begin);
+                out.push_back(entity.c);
+                next_pos = amp_pos + entity.escaped.size();
+                run_begin = next_pos;
+                break;
+            }
+        }
+        amp_pos = sv.find('&', next_pos);
+    }
+    out.append(sv.data() + run_begin, sv.size() - run_begin);
+}
+
 string Message::escape(string msg) {
-    replace_all(msg, "&", "&amp;");
-    replace_all(msg, "[", "&#91;");
-    replace_all(msg, "]", "&#93;");
-    replace_all(msg, ",", "&#44;");
-    return msg;
+    if (msg.find_first_of("&[],") == string::npos) {
+        return msg;
+    }
+    string result;
+    result.reserve(msg.size() + msg.size() / 4);
+    append_escaped(result, msg);
+    return result;
 }
 
 string Message::unescape(string msg) {
-    replace_all(msg, "&#91;", "[");
-    replace_all(msg, "&#93;", "]");
-    replace_all(msg, "&#44;", ",");
-    replace_all(msg, "&amp;", "&");
-    return msg;
+    if (msg.find('&') == string::npos) {
+        return msg;
+    }
+    string result;
+    result.reserve(msg.size());
+    append_unescaped(result, msg);
+    return result;
+}
+
+Message::SegmentData::SegmentData(initializer_list<value_type> items) {
+    items_.reserve(items.size());
+    for (const auto &item : items) {
+        (*this)[item.first] = item.second;
+    }
+}
+
+Message::SegmentData::iterator Message::SegmentData::find(const string_view &key) {
+    const auto it = lower_bound(items_.begin(), items_.end(), key,
+                                [](const value_type &item, const string_view &k) { return item.first < k; });
+    return it != items_.end() && it->first == key ? it : items_.end();
+}
+
+Message::SegmentData::const_iterator Message::SegmentData::find(const string_view &key) const {
+    return const_cast<SegmentData *>(this)->find(key);
+}
+
+string &Message::SegmentData::operator[](const string_view &key) {
+    auto it = lower_bound(items_.begin(), items_.end(), key,
+                          [](const value_type &item, const string_view &k) { return item.first < k; });
+    if (it == items_.end() || it->first != key) {
+        it = items_.emplace(it, string(key), string());
+    }
+    return it->second;
 }
 
 /**
- * Implement a FSM manually,
- * because the regex lib of VC++ will throw stack overflow in some cases.
+ * Unescape the given part of message into a new string.
  */
-static list<Message::Segment> split(const string &raw_msg) {
-    list<Message::Segment> segments;
-    const static auto TEXT = 0;
-    const static auto FUNCTION_NAME = 1;
-    const static auto PARAMS = 2;
-    auto state = TEXT;
-    const auto end = raw_msg.cend();
-    stringstream text_s, function_name_s, params_s;
-    auto curr_cq_start = end;
-    for (auto it = raw_msg.cbegin(); it != end; ++it) {
-        const auto curr = *it;
-        switch (state) {
-        case TEXT: {
-        text:
-            if (curr == '[' && end - it >= 5 /* [CQ:a] at least 5 chars behind */
-                && *(it + 1) == 'C' && *(it + 2) == 'Q' && *(it + 3) == ':') {
-                state = FUNCTION_NAME;
-                curr_cq_start = it;
-                it += 3;
-            } else {
-                text_s << curr;
-            }
+static string unescaped(const string_view &sv) {
+    string result;
+    result.reserve(sv.size());
+    append_unescaped(result, sv);
+    return result;
+}
+
+/**
+ * Parse the params part of a CQ code, e.g. "qq=123456,file=abc.jpg".
+ */
+static void split_params(const string_view &params_sv, Message::SegmentData &data) {
+    size_t pos = 0;
+    while (pos < params_sv.size()) {
+        // split key and value
+        const auto eq_pos = params_sv.find('=', pos);
+        if (eq_pos == string_view::npos) {
+            data[params_sv.substr(pos)] = "";
             break;
         }
-        case FUNCTION_NAME: {
-            if (curr >= 'A' && curr <= 'Z'
-                || curr >= 'a' && curr <= 'z'
-                || curr >= '0' && curr <= '9') {
-                function_name_s << curr;
-            } else if (curr == ',') {
-                // function name out, params in
-                state = PARAMS;
-            } else if (curr == ']') {
-                // CQ code end, with no params
-                goto params;
-            } else {
-                // unrecognized character
-                text_s << string(curr_cq_start, it); // mark as text
-                curr_cq_start = end;
-                function_name_s = stringstream();
-                params_s = stringstream();
-                state = TEXT;
-                // because the current char may be '[', so we goto text part
-                goto text;
-            }
+        const auto comma_pos = params_sv.find(',', eq_pos + 1);
+        const auto value_sv = comma_pos == string_view::npos
+                                  ? params_sv.substr(eq_pos + 1)
+                                  : params_sv.substr(eq_pos + 1, comma_pos - (eq_pos + 1));
+        data[params_sv.substr(pos, eq_pos - pos)] = unescaped(value_sv);
+        if (comma_pos == string_view::npos) {
             break;
         }
-        case PARAMS: {
-        params:
-            if (curr == ']') {
-                // CQ code end
-                Message::Segment seg;
-
-                seg.type = function_name_s.str();
-                while (params_s.rdbuf()->in_avail()) {
-                    // split key and value
-                    string key, value;
-                    getline(params_s, key, '=');
-                    getline(params_s, value, ',');
-                    seg.data[key] = Message::unescape(value);
-                }
+        pos = comma_pos + 1;
+    }
+}
 
-                if (text_s.rdbuf()->in_avail()) {
-                    // there is a text segment before this CQ code
-                    segments.push_back(Message::Segment{"text", {{"text", Message::unescape(text_s.str())}}});
-                    text_s = stringstream();
-                }
+/**
+ * Scan the raw message in a single pass, without using regex,
+ * because the regex lib of VC++ will throw stack overflow in some cases.
+ * The parts are passed to the callbacks as views of the raw message, still escaped:
+ * on_text(text), and on_code(function_name, params) for every CQ code.
+ */
+template <typename OnText, typename OnCode>
+static void scan(const string_view &raw, OnText &&on_text, OnCode &&on_code) {
+    const auto len = raw.size();
+
+    auto is_name_char = [](const char c) {
+        return c >= 'A' && c <= 'Z' || c >= 'a' && c <= 'z' || c >= '0' && c <= '9';
+    };
+
+    size_t text_begin = 0; // begin of the text that hasn't been passed to on_text
+    size_t pos = 0;
+    while (pos < len) {
+        const auto cq_begin = raw.find("[CQ:", pos);
+        if (cq_begin == string_view::npos || len - cq_begin < 5 /* [CQ:a] at least 5 chars behind */) {
+            break;
+        }
+
+        auto name_end = cq_begin + 4;
+        while (name_end < len && is_name_char(raw[name_end])) {
+            name_end++;
+        }
+        if (name_end == len) {
+            // we are in CQ code, but it ended with no ']', so it's a text segment
+            break;
+        }
+        if (raw[name_end] != ',' && raw[name_end] != ']') {
+            // unrecognized character, mark as text and continue from the current char (because it may be '[')
+            pos = name_end;
+            continue;
+        }
 
-                segments.push_back(seg);
-                curr_cq_start = end;
-                text_s = stringstream();
-                function_name_s = stringstream();
-                params_s = stringstream();
-                state = TEXT;
-            } else {
-                params_s << curr;
+        auto params_begin = name_end, params_end = name_end;
+        if (raw[name_end] == ',') {
+            // function name out, params in
+            params_begin = name_end + 1;
+            params_end = raw.find(']', params_begin);
+            if (params_end == string_view::npos) {
+                // no ']' till the end, so the rest is text
+                break;
             }
         }
-        default: break;
+
+        if (cq_begin > text_begin) {
+            // there is a text segment before this CQ code
+            on_text(raw.substr(text_begin, cq_begin - text_begin));
         }
+        on_code(raw.substr(cq_begin + 4, name_end - (cq_begin + 4)),
+                raw.substr(params_begin, params_end - params_begin));
+
+        pos = text_begin = params_end + 1;
     }
 
-    // iterator end, there may be some rest of message we haven't put into segments
-    switch (state) {
-    case FUNCTION_NAME:
-    case PARAMS:
-        // we are in CQ code, but it ended with no ']', so it's a text segment
-        text_s << string(curr_cq_start, end);
-        // should fall through
-    case TEXT:
-        if (text_s.rdbuf()->in_avail()) {
-            segments.push_back(Message::Segment{"text", {{"text", Message::unescape(text_s.str())}}});
-        }
-    default: break;
+    if (text_begin < len) {
+        // the rest of message is text
+        on_text(raw.substr(text_begin));
     }
+}
 
+/**
+ * Text and params are only copied out of the raw message when the segments are built.
+ */
+static vector<Message::Segment> split(const string &raw_msg) {
+    vector<Message::Segment> segments;
+    scan(raw_msg,
+         [&](const string_view &text) {
+             segments.push_back(Message::Segment{"text", {{"text", unescaped(text)}}});
+         },
+         [&](const string_view &function, const string_view &params) {
+             Message::Segment seg;
+             seg.type = string(function);
+             split_params(params, seg.data);
+             segments.push_back(move(seg));
+         });
     return segments;
 }
 
-static string merge(const list<Message::Segment> &segments) {
-    stringstream ss;
-    for (auto seg : segments) {
+/**
+ * Move the segment into a json object of the array format.
+ */
+static json segment_to_json(string type, Message::SegmentData &data) {
+    // built in place, because a json initializer list copies every element through temporaries
+    json seg(json::value_t::object);
+    auto &seg_object = seg.get_ref<json::object_t &>();
+    seg_object.emplace("type", move(type));
+    auto &data_object = seg_object.emplace("data", json::value_t::object).first->second.get_ref<json::object_t &>();
+    for (auto &item : data) {
+        // the params are already sorted by key, so each one goes to the end
+        data_object.emplace_hint(data_object.end(), move(item.first), move(item.second));
+    }
+    return seg;
+}
+
+/**
+ * Convert the raw message directly to the array format in one pass, which gives the same result as
+ * split(), enhance(INWARD) and reduce(), without building and compacting the vector of segments.
+ */
+static json split_to_array(const string &raw_msg) {
+    auto result = json::array();
+    optional<Message::SegmentData> pending_text; // merged with the following "text" segments, if any
+
+    const auto flush_text = [&] {
+        if (pending_text) {
+            result.push_back(segment_to_json("text", *pending_text));
+            pending_text = nullopt;
+        }
+    };
+
+    scan(raw_msg,
+         [&](const string_view &text) {
+             if (pending_text) {
+                 append_unescaped((*pending_text)["text"], text);
+             } else {
+                 pending_text = Message::SegmentData{{"text", unescaped(text)}};
+             }
+         },
+         [&](const string_view &function, const string_view &params) {
+             Message::Segment seg;
+             seg.type = string(function);
+             split_params(params, seg.data);
+             if (seg.type == "text" && seg.data.find("text") != seg.data.end()) {
+                 // e.g. "[CQ:text,text=...]", merged like the plain text
+                 if (pending_text) {
+                     (*pending_text)["text"] += seg.data["text"];
+                 } else {
+                     pending_text = move(seg.data);
+                 }
+                 return;
+             }
+
+             flush_text();
+             seg.enhance(Message::Directions::INWARD);
+             result.push_back(segment_to_json(move(seg.type), seg.data));
+         });
+    flush_text();
+    return result;
+}
+
+static string merge(const vector<Message::Segment> &segments) {
+    string result;
+    for (const auto &seg : segments) {
         if (seg.type.empty()) {
             continue;
         }
         if (seg.type == "text") {
             if (const auto it = seg.data.find("text"); it != seg.data.end()) {
-                ss << Message::escape((*it).second);
+                append_escaped(result, (*it).second);
             }
         } else {
-            ss << "[CQ:" << seg.type;
-            for (const auto item : seg.data) {
-                ss << "," << item.first << "=" << Message::escape(item.second);
+            result += "[CQ:";
+            result += seg.type;
+            for (const auto &item : seg.data) {
+                result += ",";
+                result += item.first;
+                result += "=";
+                append_escaped(result, item.second);
             }
-            ss << "]";
+            result += "]";
         }
     }
-    return ss.str();
+    return result;
 }
 
 /**
  * Merge adjacent "text" segments.
  */
-static void reduce(list<Message::Segment> &segments) {
+static void reduce(vector<Message::Segment> &segments) {
     if (segments.empty()) {
         return;
     }
 
+    // compact the vector in one pass, moving the kept segments forward
     auto last_seg_it = segments.begin();
-    for (auto it = segments.begin(); ++it != segments.end();) {
+    for (auto it = segments.begin() + 1; it != segments.end(); ++it) {
         if (it->type == "text" && last_seg_it->type == "text"
             && it->data.find("text") != it->data.end()
             && last_seg_it->data.find("text") != last_seg_it->data.end()) {
             // found adjacent "text" segments
             last_seg_it->data["text"] += it->data["text"];
-            // remove the current element and continue
-            segments.erase(it);
-            it = last_seg_it;
-        } else {
-            last_seg_it = it;
+        } else if (++last_seg_it != it) {
+            *last_seg_it = move(*it);
         }
     }
+    segments.erase(last_seg_it + 1, segments.end());
 }
 
 Message::Message(const string &msg_str) {
@@ -199,7 +370,8 @@ Message::Message(const json &msg_json) {
     if (msg_json.is_string()) {
         this->segments_ = split(msg_json.get<string>());
     } else if (msg_json.is_array()) {
-        for (auto seg : msg_json) {
+        this->segments_.reserve(msg_json.size());
+        for (const auto &seg : msg_json) {
             if (seg.is_object()) {
                 try {
                     this->segments_.push_back(seg.get<Segment>());
@@ -211,36 +383,117 @@ Message::Message(const json &msg_json) {
     }
 }
 
-string Message::process_outward() const {
-    list<Segment> segments;
-    for (const auto &seg : this->segments_) {
-        segments.push_back(seg.enhanced(Directions::OUTWARD));
+static const size_t MAX_CONCURRENT_FILE_PREPARATIONS = 4;
+
+string Message::process_outward() {
+    RollingStats::Timer timer("conversion", "process_outward");
+
+    // image and record segments may need downloading, so prepare them concurrently (with at most
+    // MAX_CONCURRENT_FILE_PREPARATIONS - 1 helper tasks in the worker pool), and the others in place
+    struct FilePreparations {
+        vector<Segment *> segments;
+        size_t next_index = 0;
+        size_t running = 0; // segments being prepared right now
+        exception_ptr exception;
+        optional<Deadline::Clock::time_point> deadline; // downloads in the helpers give up at the same time
+        mutex state_mutex;
+        condition_variable cv;
+    };
+    const auto preparations = make_shared<FilePreparations>();
+    for (auto &seg : this->segments_) {
+        if (seg.type == "image" || seg.type == "record") {
+            preparations->segments.push_back(&seg);
+        } else {
+            seg.enhance(Directions::OUTWARD);
+        }
+    }
+    preparations->deadline = Deadline::current();
+
+    // a helper may only start after the current thread has prepared everything itself and returned,
+    // so the helpers hold the shared state, and only touch a segment they have claimed while it's still waiting
+    const auto prepare_files = [](FilePreparations &state) {
+        Deadline::Scope scope(state.deadline);
+        unique_lock<mutex> lock(state.state_mutex);
+        while (state.next_index < state.segments.size()) {
+            const auto seg = state.segments[state.next_index++];
+            state.running++;
+            lock.unlock();
+            try {
+                seg->enhance(Directions::OUTWARD);
+            } catch (...) {
+                lock.lock();
+                state.exception = current_exception();
+                lock.unlock();
+            }
+            lock.lock();
+            state.running--;
+        }
+        state.cv.notify_all();
+    };
+
+    if (const auto p = pool) {
+        for (size_t i = 1; i < min(preparations->segments.size(), MAX_CONCURRENT_FILE_PREPARATIONS); i++) {
+            p->push(TaskPriority::HIGH, [preparations, prepare_files](int) { prepare_files(*preparations); });
+        }
+    }
+    prepare_files(*preparations);
+    {
+        // wait for the segments claimed by the helpers, never for the helpers still queued
+        unique_lock<mutex> lock(preparations->state_mutex);
+        preparations->cv.wait(lock, [&] { return preparations->running == 0; });
+        if (preparations->exception) {
+            rethrow_exception(preparations->exception);
+        }
     }
-    return merge(segments);
+    return merge(this->segments_);
 }
 
-json Message::process_inward(optional<Format> fmt) const {
+json Message::process_inward_raw(const string &msg_str, optional<Format> fmt) {
+    RollingStats::Timer timer("conversion", "process_inward");
+
     if (!fmt) {
-        fmt = config.post_message_format;
+        fmt = live_config()->post_message_format;
     }
 
-    list<Segment> segments;
-    for (const auto &seg : this->segments_) {
-        segments.push_back(seg.enhanced(Directions::INWARD));
+    if (fmt == Formats::ARRAY) {
+        return split_to_array(msg_str);
+    }
+    return Message(msg_str).process_inward_segments(fmt);
+}
+
+json Message::process_inward(optional<Format> fmt) {
+    RollingStats::Timer timer("conversion", "process_inward");
+    return process_inward_segments(fmt);
+}
+
+json Message::process_inward_segments(optional<Format> fmt) {
+    if (!fmt) {
+        fmt = live_config()->post_message_format;
+    }
+
+    for (auto &seg : this->segments_) {
+        seg.enhance(Directions::INWARD);
     }
 
     if (fmt == Formats::STRING) {
-        return merge(segments);
+        return merge(this->segments_);
     }
 
     if (fmt == Formats::ARRAY) {
-        reduce(segments);
-        return segments;
+        reduce(this->segments_);
+        return this->segments_;
     }
 
     return nullptr;
 }
 
+void to_json(json &j, const Message::SegmentData &data) {
+    j = json::object();
+    for (const auto &item : data) {
+        j[item.first] = item.second;
+    }
+}
+
 void to_json(json &j, const Message::Segment &seg) {
     j = json{
         {"type", seg.type},
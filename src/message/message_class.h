@@ -21,6 +21,9 @@
 
 #include "common.h"
 
+#include <string_view>
+#include <vector>
+
 class Message {
 public:
     static std::string escape(std::string msg);
@@ -45,26 +48,70 @@ public:
 
     /**
      * Convert message to a string, which can be sent directly (CQ codes will be enhanced as OUTWARD).
+     * The segments are enhanced in place, so the message itself is modified.
      */
-    std::string process_outward() const;
+    std::string process_outward();
 
     /**
      * Convert received message to a json value in the specified format.
+     * The segments are enhanced in place, so the message itself is modified.
      * 
      * \param fmt: the desired message format, if not passed in, use the one in config file
      */
-    json Message::process_inward(std::optional<Format> fmt = std::nullopt) const;
+    json process_inward(std::optional<Format> fmt = std::nullopt);
+
+    /**
+     * Convert a received raw message to a json value in the specified format,
+     * the same as Message(msg_str).process_inward(fmt), but the array format is built directly in one pass.
+     */
+    static json process_inward_raw(const std::string &msg_str, std::optional<Format> fmt = std::nullopt);
+
+    /**
+     * Params of a segment, kept sorted by key in a flat vector,
+     * because a segment has only a few params, which don't deserve a node allocation each.
+     */
+    class SegmentData {
+    public:
+        using value_type = std::pair<std::string, std::string>;
+        using iterator = std::vector<value_type>::iterator;
+        using const_iterator = std::vector<value_type>::const_iterator;
+
+        SegmentData() = default;
+        SegmentData(std::initializer_list<value_type> items);
+
+        iterator begin() { return items_.begin(); }
+        iterator end() { return items_.end(); }
+        const_iterator begin() const { return items_.begin(); }
+        const_iterator end() const { return items_.end(); }
+        size_t size() const { return items_.size(); }
+        bool empty() const { return items_.empty(); }
+
+        iterator find(const std::string_view &key);
+        const_iterator find(const std::string_view &key) const;
+        std::string &operator[](const std::string_view &key);
+
+    private:
+        std::vector<value_type> items_;
+    };
 
     struct Segment {
         std::string type;
-        std::map<std::string, std::string> data;
+        SegmentData data;
 
-        Segment enhanced(const Direction direction = Directions::OUTWARD) const;
+        /**
+         * Enhance the segment in place.
+         */
+        void enhance(const Direction direction = Directions::OUTWARD);
     };
 
+    const std::vector<Segment> &segments() const { return segments_; }
+
 private:
-    std::list<Segment> segments_;
+    std::vector<Segment> segments_;
+
+    json process_inward_segments(std::optional<Format> fmt);
 };
 
+void to_json(json &j, const Message::SegmentData &data);
 void to_json(json &j, const Message::Segment &seg);
 void from_json(const json &j, Message::Segment &seg);
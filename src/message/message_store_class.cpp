@@ -0,0 +1,257 @@
+#include "./message_store_class.h"
+
+#include "app.h"
+
+#include <boost/filesystem.hpp>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static const auto TAG = u8"消息存储";
+
+/*
+ * Each record is the size of the data (4 bytes), the message id (4 bytes), the group id (8 bytes, 0 if none),
+ * followed by the record serialized as JSON.
+ */
+static const size_t RECORD_HEADER_SIZE = 16;
+
+void MessageStore::start() {
+    if (running_ || !config.use_message_store) {
+        return;
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    retention_days_ = max(config.message_store_days, 1ul);
+    directory_ = s2ws(sdk->directories().app() + "messages\\");
+
+    index_.clear();
+    group_messages_.clear();
+    files_.clear();
+    try {
+        fs::create_directories(directory_);
+        for (const auto &entry : fs::directory_iterator(directory_)) {
+            const auto name = entry.path().filename().wstring();
+            if (name.size() == 12 && name.substr(8) == L".log") {
+                try {
+                    files_[stoul(name.substr(0, 8))] = entry.path().wstring();
+                } catch (exception &) {}
+            }
+        }
+    } catch (fs::filesystem_error &) {
+        Log::e(TAG, u8"无法访问消息存储目录 " + ws2s(directory_));
+        return;
+    }
+
+    expire();
+    for (const auto &file : files_) {
+        load_file(file.first);
+    }
+
+    running_ = true;
+    Log::d(TAG, u8"消息存储已启动，共 " + to_string(index_.size()) + u8" 条消息");
+}
+
+void MessageStore::stop() {
+    if (!running_) {
+        return;
+    }
+
+    unique_lock<mutex> lock(mutex_);
+    running_ = false;
+    out_.close();
+    out_day_ = 0;
+    index_.clear();
+    group_messages_.clear();
+    files_.clear();
+    Log::d(TAG, u8"消息存储已停止");
+}
+
+MessageStore::Day MessageStore::today() {
+    const auto t = time(nullptr);
+    tm local{};
+    localtime_s(&local, &t);
+    return (local.tm_year + 1900) * 10000 + (local.tm_mon + 1) * 100 + local.tm_mday;
+}
+
+wstring MessageStore::file_path(const Day day) const {
+    return directory_ + to_wstring(day) + L".log";
+}
+
+void MessageStore::load_file(const Day day) {
+    const auto path = file_path(day);
+    uint64_t file_size = 0;
+    try {
+        file_size = fs::file_size(path);
+    } catch (fs::filesystem_error &) {
+        return;
+    }
+
+    ifstream f(path, ios::binary);
+    uint64_t offset = 0;
+    char header[RECORD_HEADER_SIZE];
+    while (offset + RECORD_HEADER_SIZE <= file_size && f.read(header, RECORD_HEADER_SIZE)) {
+        uint32_t size;
+        int32_t message_id;
+        int64_t group_id;
+        memcpy(&size, header, sizeof(size));
+        memcpy(&message_id, header + 4, sizeof(message_id));
+        memcpy(&group_id, header + 8, sizeof(group_id));
+        if (offset + RECORD_HEADER_SIZE + size > file_size || !f.seekg(size, ios::cur)) {
+            break;
+        }
+
+        index_[message_id] = {day, offset};
+        if (group_id) {
+            group_messages_[group_id].push_back(message_id);
+        }
+        offset += RECORD_HEADER_SIZE + size;
+    }
+    f.close();
+
+    // drop the incomplete record at the end, if the plugin crashed while writing it
+    if (file_size > offset) {
+        try {
+            fs::resize_file(path, offset);
+        } catch (fs::filesystem_error &) {}
+    }
+}
+
+void MessageStore::expire() {
+    // the files of the days up to "message_store_days" ago are deleted
+    const auto cutoff_time = time(nullptr) - static_cast<time_t>(retention_days_) * 24 * 60 * 60;
+    tm cutoff{};
+    localtime_s(&cutoff, &cutoff_time);
+    const Day cutoff_day = (cutoff.tm_year + 1900) * 10000 + (cutoff.tm_mon + 1) * 100 + cutoff.tm_mday;
+
+    auto expired = false;
+    while (!files_.empty() && files_.begin()->first <= cutoff_day) {
+        try {
+            fs::remove(files_.begin()->second);
+        } catch (fs::filesystem_error &) {}
+        files_.erase(files_.begin());
+        expired = true;
+    }
+    if (!expired) {
+        return;
+    }
+
+    for (auto it = index_.begin(); it != index_.end();) {
+        it = it->second.day <= cutoff_day ? index_.erase(it) : next(it);
+    }
+    for (auto it = group_messages_.begin(); it != group_messages_.end();) {
+        auto &ids = it->second;
+        while (!ids.empty() && index_.find(ids.front()) == index_.end()) {
+            ids.pop_front();
+        }
+        it = ids.empty() ? group_messages_.erase(it) : next(it);
+    }
+}
+
+void MessageStore::add(const json &record) {
+    const auto message_id = record.value("message_id", 0);
+    const auto group_id = record.value("group_id", static_cast<int64_t>(0));
+    const auto data = record.dump();
+
+    unique_lock<mutex> lock(mutex_);
+    if (!running_) {
+        return;
+    }
+
+    if (const auto day = today(); day != out_day_) {
+        // a new day, start a new file
+        out_.close();
+        out_day_ = day;
+        files_[day] = file_path(day);
+        expire();
+        out_.open(file_path(day), ios::binary | ios::app);
+        out_offset_ = out_.tellp();
+    }
+    if (!out_.is_open()) {
+        return;
+    }
+
+    char header[RECORD_HEADER_SIZE];
+    const auto size = static_cast<uint32_t>(data.size());
+    memcpy(header, &size, sizeof(size));
+    memcpy(header + 4, &message_id, sizeof(message_id));
+    memcpy(header + 8, &group_id, sizeof(group_id));
+    out_.write(header, RECORD_HEADER_SIZE);
+    out_.write(data.data(), data.size());
+    out_.flush(); // so that it can be read at once
+
+    index_[message_id] = {out_day_, out_offset_};
+    if (group_id) {
+        group_messages_[group_id].push_back(message_id);
+    }
+    out_offset_ += RECORD_HEADER_SIZE + size;
+}
+
+optional<json> MessageStore::read(const wstring &path, const uint64_t offset) {
+    ifstream f(path, ios::binary);
+    char header[RECORD_HEADER_SIZE];
+    if (!f.seekg(offset) || !f.read(header, RECORD_HEADER_SIZE)) {
+        return nullopt;
+    }
+    uint32_t size;
+    memcpy(&size, header, sizeof(size));
+    string data(size, '\0');
+    if (!f.read(&data[0], size)) {
+        return nullopt;
+    }
+    try {
+        return json::parse(data);
+    } catch (invalid_argument &) {
+        return nullopt;
+    }
+}
+
+optional<json> MessageStore::get(const int32_t message_id) {
+    wstring path;
+    uint64_t offset;
+    {
+        unique_lock<mutex> lock(mutex_);
+        const auto it = index_.find(message_id);
+        if (it == index_.end()) {
+            return nullopt;
+        }
+        path = file_path(it->second.day);
+        offset = it->second.offset;
+    }
+    return read(path, offset); // the other messages can be added and read meanwhile
+}
+
+vector<json> MessageStore::group_history(const int64_t group_id, const int32_t before_message_id, const size_t count) {
+    // find where the messages are under the lock, and read them after releasing it
+    vector<pair<wstring, uint64_t>> locations; // from new to old
+    {
+        unique_lock<mutex> lock(mutex_);
+        const auto group_it = group_messages_.find(group_id);
+        if (group_it == group_messages_.end()) {
+            return {};
+        }
+
+        const auto &ids = group_it->second;
+        auto end = ids.crbegin();
+        if (before_message_id) {
+            end = find(ids.crbegin(), ids.crend(), before_message_id);
+            if (end == ids.crend()) {
+                return {};
+            }
+            ++end;
+        }
+
+        for (auto it = end; it != ids.crend() && locations.size() < count; ++it) {
+            if (const auto index_it = index_.find(*it); index_it != index_.end()) {
+                locations.emplace_back(file_path(index_it->second.day), index_it->second.offset);
+            }
+        }
+    }
+
+    vector<json> messages;
+    for (auto it = locations.crbegin(); it != locations.crend(); ++it) {
+        if (auto message = read(it->first, it->second)) {
+            messages.push_back(move(message.value()));
+        }
+    }
+    return messages;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+
+/**
+ * Local store of the received messages, so that they can be looked up by "message_id" later.
+ *
+ * Messages are appended to one file per day in the "messages" directory of the app directory,
+ * files older than "message_store_days" days are deleted. The index (message_id -> position in the files,
+ * and the message ids of each group in order) is kept in memory, and rebuilt from the files on start.
+ */
+class MessageStore {
+public:
+    static MessageStore &instance() {
+        static MessageStore store;
+        return store;
+    }
+
+    void start();
+    void stop();
+    bool started() const { return running_; }
+
+    /**
+     * Store a received message, "record" must have "message_id", and "group_id" if it's a group message.
+     */
+    void add(const json &record);
+
+    /**
+     * \return the stored record, with the "message" field as is (CQ code string)
+     */
+    std::optional<json> get(int32_t message_id);
+
+    /**
+     * The latest "count" messages of a group before "before_message_id" (or the latest ones if it's 0),
+     * from old to new.
+     */
+    std::vector<json> group_history(int64_t group_id, int32_t before_message_id, size_t count);
+
+private:
+    MessageStore() = default;
+
+    using Day = uint32_t; // like 20181231
+
+    struct Location {
+        Day day;
+        uint64_t offset;
+    };
+
+    std::unordered_map<int32_t, Location> index_;
+    std::unordered_map<int64_t, std::deque<int32_t>> group_messages_; // message ids of each group, from old to new
+    std::map<Day, std::wstring> files_;
+
+    std::ofstream out_; // the file of "out_day_"
+    Day out_day_ = 0;
+    uint64_t out_offset_ = 0;
+
+    std::mutex mutex_;
+    std::atomic<bool> running_ = false;
+
+    unsigned long retention_days_ = 0;
+    std::wstring directory_;
+
+    static Day today();
+    std::wstring file_path(Day day) const;
+    void load_file(Day day);
+    void expire();
+
+    /**
+     * Read the record at "offset" of the file, without the lock, the file may have been deleted meanwhile.
+     */
+    static std::optional<json> read(const std::wstring &path, uint64_t offset);
+};
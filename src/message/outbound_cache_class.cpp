@@ -0,0 +1,106 @@
+#include "./outbound_cache_class.h"
+
+#include "app.h"
+
+#include <boost/filesystem.hpp>
+#include <websocketpp/common/md5.hpp>
+
+#include "./message_class.h"
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+using boost::algorithm::starts_with;
+using websocketpp::md5::md5_hash_hex;
+
+static time_t modification_time(const string &path) {
+    boost::system::error_code ec;
+    const auto mtime = fs::last_write_time(s2ws(path), ec);
+    return ec ? -1 : mtime;
+}
+
+static bool is_file_segment(const Message::Segment &seg) { return seg.type == "image" || seg.type == "record"; }
+
+OutboundCache::Result OutboundCache::convert(const json &message, const bool auto_escape) {
+    const auto escape = auto_escape && message.is_string();
+
+    decltype(cache_) cache;
+    {
+        unique_lock<mutex> lock(mutex_);
+        if (!cache_ && config.outbound_cache_size > 0) {
+            cache_ = make_shared<LruCache<string, shared_ptr<const Entry>>>(config.outbound_cache_size);
+        }
+        cache = cache_;
+    }
+
+    if (!cache) {
+        return {escape ? Message(Message::escape(message.get<string>())).process_outward()
+                       : Message(message).process_outward(),
+                nullptr};
+    }
+
+    // a fixed-length tag tells the kinds apart, so that e.g. an escaped "abc" never shares a key with "eabc",
+    // or a string with an array whose dump() is the same text
+    const auto key = md5_hash_hex(message.is_string() ? (escape ? "e:" : "s:") + message.get<string>()
+                                                      : "a:" + message.dump());
+    if (const auto entry = cache->get(key)) {
+        const auto &files = entry.value()->files;
+        if (all_of(files.begin(), files.end(), [](const auto &f) { return modification_time(f.first) == f.second; })) {
+            hit_count_++;
+            return entry.value()->result;
+        }
+        cache->erase(key); // some file has changed, prepare them again
+    }
+    miss_count_++;
+
+    auto msg = escape ? Message(Message::escape(message.get<string>())) : Message(message);
+
+    // the sources of "file://" files are checked on later hits, "cache=0" files must be revalidated every time
+    auto cacheable = true;
+    auto entry = make_shared<Entry>();
+    for (const auto &seg : msg.segments()) {
+        if (!is_file_segment(seg)) {
+            continue;
+        }
+        const auto file_it = seg.data.find("file");
+        if (file_it == seg.data.end()) {
+            continue;
+        }
+        const auto &file = (*file_it).second;
+        if (starts_with(file, "file://")) {
+            const auto path = file.substr(strlen("file://"));
+            entry->files.emplace_back(path, modification_time(path));
+        } else if (starts_with(file, "http://") || starts_with(file, "https://")) {
+            if (const auto it = seg.data.find("cache"); it != seg.data.end() && (*it).second == "0") {
+                cacheable = false;
+            }
+        }
+    }
+
+    entry->result.text = msg.process_outward();
+    entry->result.encoded = make_shared<const string>(string_to_coolq(entry->result.text));
+
+    // the files prepared in the data directory, which may be evicted or cleaned later
+    for (const auto &seg : msg.segments()) {
+        if (is_file_segment(seg)) {
+            if (const auto file_it = seg.data.find("file"); file_it != seg.data.end()) {
+                const auto path = data_file_full_path(seg.type, (*file_it).second);
+                const auto mtime = modification_time(path);
+                if (mtime < 0) {
+                    cacheable = false; // failed to prepare, try again next time
+                }
+                entry->files.emplace_back(path, mtime);
+            }
+        }
+    }
+
+    if (cacheable) {
+        cache->set(key, entry);
+    }
+    return entry->result;
+}
+
+void OutboundCache::clear() {
+    unique_lock<mutex> lock(mutex_);
+    cache_ = nullptr;
+}
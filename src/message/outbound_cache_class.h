@@ -0,0 +1,54 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <mutex>
+
+#include "utils/lru_cache_class.h"
+
+/**
+ * Memoized results of Message::process_outward for messages sent again and again (e.g. templated replies),
+ * keyed by the md5 of the original message, holding the converted message and its CoolQ encoding.
+ * An entry is dropped once any file it refers to (the prepared data files and the "file://" sources)
+ * is modified or removed, and messages with "cache=0" files are never memoized.
+ */
+class OutboundCache {
+public:
+    struct Result {
+        std::string text;
+        std::shared_ptr<const std::string> encoded; // nullptr if the cache is disabled
+    };
+
+    static OutboundCache &instance() {
+        static OutboundCache cache;
+        return cache;
+    }
+
+    /**
+     * Convert the message (a string or an array of segments), or return the memoized result.
+     * The cache is not touched if "outbound_cache_size" is 0.
+     */
+    Result convert(const json &message, bool auto_escape);
+
+    /**
+     * Forget all the entries, the next call of convert() uses the latest "outbound_cache_size".
+     */
+    void clear();
+
+    size_t hit_count() const { return hit_count_; }
+    size_t miss_count() const { return miss_count_; }
+
+private:
+    OutboundCache() = default;
+
+    struct Entry {
+        Result result;
+        std::vector<std::pair<std::string, std::time_t>> files; // full path -> modification time, or -1
+    };
+
+    std::shared_ptr<LruCache<std::string, std::shared_ptr<const Entry>>> cache_;
+    std::mutex mutex_;
+    std::atomic<size_t> hit_count_ = 0;
+    std::atomic<size_t> miss_count_ = 0;
+};
@@ -20,6 +20,7 @@
 #include "app.h"
 
 #include <ctime>
+#include <string_view>
 #include <unordered_set>
 #include <boost/filesystem.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -27,7 +28,8 @@
 #include <websocketpp/common/md5.hpp>
 
 #include "./message_class.h"
-#include "utils/http_utils.h"
+#include "./media_cache_class.h"
+#include "utils/lru_cache_class.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
@@ -35,37 +37,33 @@ namespace fs = boost::filesystem;
 using boost::algorithm::starts_with;
 using websocketpp::md5::md5_hash_hex;
 
-static Message::Segment enhance_send_file(const Message::Segment &raw, const string &data_dir);
-static Message::Segment enhance_receive_image(const Message::Segment &raw);
+static void enhance_send_file(Message::Segment &segment, const string &data_dir);
+static void enhance_receive_image(Message::Segment &segment);
 
-Message::Segment Message::Segment::enhanced(const Direction direction) const {
+void Message::Segment::enhance(const Direction direction) {
     if (direction == Directions::OUTWARD) {
         // messages to send
         if (this->type == "image") {
-            return enhance_send_file(*this, "image");
+            enhance_send_file(*this, "image");
+        } else if (this->type == "record") {
+            enhance_send_file(*this, "record");
         }
-        if (this->type == "record") {
-            return enhance_send_file(*this, "record");
-        }
-    }
-    if (direction == Directions::INWARD) {
+    } else if (direction == Directions::INWARD) {
         // messages received
         if (this->type == "image") {
-            return enhance_receive_image(*this);
+            enhance_receive_image(*this);
         }
     }
-    return *this;
 }
 
-static Message::Segment enhance_send_file(const Message::Segment &raw, const string &data_dir) {
-    const auto file_it = raw.data.find("file");
-    if (file_it == raw.data.end()) {
+static void enhance_send_file(Message::Segment &segment, const string &data_dir) {
+    const auto file_it = segment.data.find("file");
+    if (file_it == segment.data.end()) {
         // there is no "file" parameter, skip it
-        return raw;
+        return;
     }
 
-    auto segment = raw;
-    auto &file = (*file_it).second;
+    const auto &file = (*file_it).second;
 
     string filename;
     function<bool()> make_file = nullptr;
@@ -75,25 +73,13 @@ static Message::Segment enhance_send_file(const Message::Segment &raw, const str
 
         // check if to use cache
         auto use_cache = true; // use cache by default
-        if (segment.data.find("cache") != segment.data.end() && segment.data["cache"] == "0") {
+        if (const auto it = segment.data.find("cache"); it != segment.data.end() && (*it).second == "0") {
             use_cache = false;
         }
 
-        if (use_cache) {
-            filename = md5_hash_hex(url) + ".tmp";
-        } else {
-            filename = md5_hash_hex(url + to_string(random_int(1, 10000))) + ".tmp";
-        }
-
-        make_file = [=] {
-            const auto filepath = data_file_full_path(data_dir, filename);
-
-            if (use_cache && fs::is_regular_file(s2ws(filepath)) /* use cache */
-                || download_remote_file(url, filepath, true) /* or perform download */) {
-                return true;
-            }
-            return false;
-        };
+        // without cache, the cached file is revalidated with the server, rather than downloaded to a new file
+        filename = md5_hash_hex(url) + ".tmp";
+        make_file = [=] { return MediaCache::instance().fetch(url, data_dir, filename, !use_cache); };
     } else if (starts_with(file, "file://")) {
         const auto src_filepath = file.substr(strlen("file://"));
         filename = md5_hash_hex(src_filepath) + ".tmp";
@@ -113,11 +99,27 @@ static Message::Segment enhance_send_file(const Message::Segment &raw, const str
             + to_string(time(nullptr)) + "_"
             + to_string(random_int(1, 10000))) + ".tmp";
         make_file = [=, &file] {
+            static const size_t CHUNK_SIZE = 64 * 1024;
+
             const auto filepath = data_file_full_path(data_dir, filename);
-            const auto base64_encoded = file.substr(strlen("base64://"));
 
             if (ofstream f(ansi(filepath), ios::binary | ios::out); f.is_open()) {
-                f << base64_decode(base64_encoded);
+                // decode chunk by chunk straight into the file, without copying the (maybe large) data again
+                const auto encoded = string_view(file).substr(strlen("base64://"));
+                Base64Decoder decoder;
+                string decoded;
+                for (size_t pos = 0; pos < encoded.size(); pos += CHUNK_SIZE) {
+                    decoded.clear();
+                    const auto more = decoder.feed(encoded.data() + pos, min(CHUNK_SIZE, encoded.size() - pos),
+                                                   decoded);
+                    f.write(decoded.data(), decoded.size());
+                    if (!more) {
+                        break;
+                    }
+                }
+                decoded.clear();
+                decoder.finish(decoded);
+                f.write(decoded.data(), decoded.size());
                 return true;
             }
             return false;
@@ -137,7 +139,7 @@ static Message::Segment enhance_send_file(const Message::Segment &raw, const str
 
         // we are now sure that only our current thread is processing the file
         if (make_file()) {
-            // succeeded
+            // succeeded, note that "file" still refers to the original param until now
             segment.data["file"] = filename;
         }
 
@@ -147,32 +149,38 @@ static Message::Segment enhance_send_file(const Message::Segment &raw, const str
         lk.unlock();
         cv.notify_all();
     }
-
-    return segment;
 }
 
-static Message::Segment enhance_receive_image(const Message::Segment &raw) {
-    const auto file_it = raw.data.find("file");
-    if (file_it == raw.data.end()) {
+static const size_t MAX_CACHED_IMAGE_URLS = 4096;
+
+static void enhance_receive_image(Message::Segment &segment) {
+    const auto file_it = segment.data.find("file");
+    if (file_it == segment.data.end()) {
         // there is no "file" parameter, skip it
-        return raw;
+        return;
     }
 
-    auto segment = raw;
     const auto filename = (*file_it).second;
 
     if (!filename.empty()) {
-        const auto cqimg_filename = filename + ".cqimg";
-        const auto cqimg_filepath = data_file_full_path("image", cqimg_filename);
-
-        if (ifstream istrm(ansi(cqimg_filepath), ios::binary); istrm.is_open()) {
-            boost::property_tree::ptree pt;
-            read_ini(istrm, pt);
-            auto url = pt.get_optional<string>("image.url");
-            if (url && !url->empty()) {
-                segment.data["url"] = url.value();
+        // the same images are received again and again, and CoolQ never changes a .cqimg file once written,
+        // so remember the urls instead of parsing the files every time
+        static LruCache<string, string> image_urls(MAX_CACHED_IMAGE_URLS);
+
+        auto url = image_urls.get(filename);
+        if (!url) {
+            const auto cqimg_filename = filename + ".cqimg";
+            const auto cqimg_filepath = data_file_full_path("image", cqimg_filename);
+
+            if (ifstream istrm(ansi(cqimg_filepath), ios::binary); istrm.is_open()) {
+                boost::property_tree::ptree pt;
+                read_ini(istrm, pt);
+                url = pt.get<string>("image.url", "");
+                image_urls.set(filename, url.value());
             }
         }
+        if (url && !url->empty()) {
+            segment.data["url"] = url.value();
+        }
     }
-    return segment;
 }
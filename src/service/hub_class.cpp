@@ -3,32 +3,69 @@
 
 #include "app.h"
 
+#include "utils/tracing.h"
+
 #include "./impl/http_service_class.h"
 #include "./impl/ws_service_class.h"
 #include "./impl/ws_reverse_service_class.h"
+#include "./impl/pipe_service_class.h"
+#include "./impl/shm_ring_service_class.h"
 
 using namespace std;
 
 void ServiceHub::start() {
+    ServiceMap services;
+    PushableList pushable_services;
+
+    shared_ptr<HttpService> http_service;
     if (config.use_http) {
-        auto service = make_shared<HttpService>();
-        services_["http"] = service;
-        service->start();
+        http_service = make_shared<HttpService>();
+        services["http"] = http_service;
     }
 
     if (config.use_ws) {
-        auto service = make_shared<WsService>();
-        services_["ws"] = service;
-        pushable_services_.push_back(service);
-        service->start();
+        auto ws_service = make_shared<WsService>();
+        services["ws"] = ws_service;
+        pushable_services.push_back(ws_service);
+        if (http_service && WsService::uses_http_port()) {
+            // WebSocket handshakes arriving at the HTTP server are handed over to the WebSocket server
+            http_service->set_upgrade_handler(
+                [ws_service](unique_ptr<SimpleWeb::HTTP> &socket,
+                             shared_ptr<SimpleWeb::Server<SimpleWeb::HTTP>::Request> request) {
+                    ws_service->upgrade(socket, move(request));
+                });
+        }
     }
 
     if (config.use_ws_reverse) {
         auto service = make_shared<WsReverseService>();
-        services_["ws_reverse"] = service;
-        pushable_services_.push_back(service);
-        service->start();
+        services["ws_reverse"] = service;
+        pushable_services.push_back(service);
+    }
+
+    if (config.use_pipe) {
+        auto service = make_shared<PipeService>();
+        services["pipe"] = service;
+        pushable_services.push_back(service);
+    }
+
+    if (config.use_shm_ring) {
+        auto service = make_shared<ShmRingService>();
+        services["shm_ring"] = service;
+        pushable_services.push_back(service);
+    }
+
+    // binding ports and connecting to the reverse WebSocket servers take a while, do them all at once
+    vector<thread> starters;
+    for (const auto &entry : services) {
+        starters.emplace_back([service = entry.second] { service->start(); });
     }
+    for (auto &starter : starters) {
+        starter.join();
+    }
+
+    services_ = move(services);
+    atomic_store(&pushable_services_, make_shared<const PushableList>(move(pushable_services)));
 
     Log::d(TAG, u8"已开启 API 服务");
 }
@@ -38,6 +75,7 @@ void ServiceHub::stop() {
         entry.second->stop();
     }
     services_.clear();
+    atomic_store(&pushable_services_, make_shared<const PushableList>());
 
     Log::d(TAG, u8"已关闭 API 服务");
 }
@@ -48,8 +86,9 @@ bool ServiceHub::good() const {
     });
 }
 
-void ServiceHub::push_event(const json &payload) const {
-    for (const auto &service : pushable_services_) {
-        service->push_event(payload);
+void ServiceHub::push_event(const json &payload, const SerializedPayload &payload_str) const {
+    CQHTTP_TRACE_SCOPE("push", "all");
+    for (const auto &service : *atomic_load(&pushable_services_)) {
+        service->push_event(payload, payload_str);
     }
 }
@@ -2,6 +2,8 @@
 
 #include "common.h"
 
+#include <memory>
+
 #include "./service_base_class.h"
 #include "./pushable_interface.h"
 
@@ -16,14 +18,18 @@ public:
     void stop() override;
     bool good() const override;
 
-    void push_event(const json &payload) const override;
-    bool has_pushable_services() const { return !pushable_services_.empty(); }
+    void push_event(const json &payload, const SerializedPayload &payload_str) const override;
+    void push_event(const json &payload) const { push_event(payload, std::make_shared<std::string>(payload.dump())); }
+    bool has_pushable_services() const { return !std::atomic_load(&pushable_services_)->empty(); }
 
     using ServiceMap = std::map<std::string, std::shared_ptr<ServiceBase>>;
 
     const ServiceMap &get_services() const { return services_; }
 
 private:
+    using PushableList = std::vector<std::shared_ptr<IPushable>>;
+
     ServiceMap services_;
-    std::vector<std::shared_ptr<IPushable>> pushable_services_;
+    // replaced as a whole (with std::atomic_store), since events may be pushed while the services are starting
+    std::shared_ptr<const PushableList> pushable_services_ = std::make_shared<const PushableList>();
 };
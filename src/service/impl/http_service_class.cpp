@@ -1,98 +1,414 @@
 #include "./http_service_class.h"
 #include "./service_impl_common.h"
 
+#include "utils/gzip.h"
+#include "utils/http_utils.h"
+#include "utils/lru_cache_class.h"
+#include "utils/metrics_class.h"
+#include "utils/pool_autoscaler_class.h"
+#include "utils/rolling_stats_class.h"
+#include "event/async_poster_class.h"
+#include "api/send_queue_class.h"
+#include "message/outbound_cache_class.h"
+#include "service/hub_class.h"
+
 using namespace std;
 using HttpServer = SimpleWeb::Server<SimpleWeb::HTTP>;
 
 extern ApiHandlerMap api_handlers; // defined in handlers.cpp
 
+static const size_t DATA_FILE_CHUNK_SIZE = 128 * 1024;
+static const uintmax_t MAX_CACHED_DATA_FILE_SIZE = 64 * 1024;
+static const size_t DATA_FILE_CACHE_CAPACITY = 8 * 1024 * 1024; // in bytes
+static const size_t MAX_DECOMPRESSED_BODY_SIZE = 64 * 1024 * 1024;
+
+struct CachedDataFile {
+    string etag;
+    shared_ptr<const string> content;
+};
+
+/**
+ * Parse the "Range" header of a file of "size" bytes into [first, last), only a single range is supported.
+ * Return the whole file if the header can't be understood (so that it's ignored), and nullopt if not satisfiable.
+ */
+static optional<pair<uintmax_t, uintmax_t>> parse_byte_range(const string &range, const uintmax_t size) {
+    const auto whole = make_optional(make_pair(uintmax_t(0), size));
+    if (!boost::starts_with(range, "bytes=") || range.find(',') != string::npos) {
+        return whole;
+    }
+
+    const auto spec = range.substr(strlen("bytes="));
+    const auto dash = spec.find('-');
+    if (dash == string::npos) {
+        return whole;
+    }
+
+    try {
+        const auto first_str = spec.substr(0, dash), last_str = spec.substr(dash + 1);
+        if (first_str.empty()) {
+            // the last N bytes
+            const uintmax_t suffix_length = stoull(last_str);
+            if (suffix_length == 0 || size == 0) {
+                return nullopt;
+            }
+            return make_pair(size - min(suffix_length, size), size);
+        }
+
+        const uintmax_t first = stoull(first_str);
+        const auto last = last_str.empty() ? optional<uintmax_t>() : make_optional<uintmax_t>(stoull(last_str));
+        if (last && last.value() < first) {
+            return whole; // invalid, ignore it
+        }
+        if (first >= size) {
+            return nullopt;
+        }
+        return make_pair(first, last ? min(last.value() + 1, size) : size);
+    } catch (exception &) {
+        return whole;
+    }
+}
+
+/**
+ * Send the next "remaining" bytes of the file chunk by chunk, each chunk is read after the previous one is written
+ * to the socket, so that only one chunk of the file is in memory at a time.
+ */
+static void send_file_chunks(const shared_ptr<HttpServer::Response> &response, const shared_ptr<ifstream> &file,
+                             const uintmax_t remaining) {
+    if (remaining == 0) {
+        return;
+    }
+
+    vector<char> buffer(size_t(min(uintmax_t(DATA_FILE_CHUNK_SIZE), remaining)));
+    file->read(buffer.data(), buffer.size());
+    const auto count = file->gcount();
+    if (count <= 0) {
+        Log::d(TAG, u8"读取文件失败，停止发送");
+        response->close_connection_after_response = true;
+        return;
+    }
+
+    response->write(buffer.data(), count);
+    response->send([response, file, remaining, count](const SimpleWeb::error_code &ec) {
+        if (!ec) {
+            send_file_chunks(response, file, remaining - count);
+        }
+    });
+}
+
+/**
+ * Write a text response, compressed with gzip if the client accepts it and the body is large enough.
+ */
+static void write_compressible(const shared_ptr<HttpServer::Response> &response,
+                               const shared_ptr<HttpServer::Request> &request,
+                               const string &body, SimpleWeb::CaseInsensitiveMultimap headers) {
+    if (config.http_compression && body.size() >= config.http_compression_min_size) {
+        headers.emplace("Vary", "Accept-Encoding");
+        if (const auto it = request->header.find("Accept-Encoding");
+            it != request->header.end() && accepts_encoding(it->second, "gzip")) {
+            if (auto compressed = gzip_compress(body, config.http_compression_level); !compressed.empty()) {
+                Log::d(TAG, [&] {
+                    return u8"响应内容已压缩：" + to_string(body.size()) + " -> " + to_string(compressed.size());
+                });
+                headers.emplace("Content-Encoding", "gzip");
+                RollingStats::instance().add_bytes("bytes_sent", "http", compressed.size());
+                response->write(compressed, headers);
+                return;
+            }
+        }
+    }
+    RollingStats::instance().add_bytes("bytes_sent", "http", body.size());
+    response->write(body, headers);
+}
+
+/**
+ * Get the request body, decompressed according to the "Content-Encoding" header.
+ * Write an error response and return nullopt if it's not supported or can't be decompressed.
+ */
+static optional<string> request_body(const shared_ptr<HttpServer::Response> &response,
+                                     const shared_ptr<HttpServer::Request> &request) {
+    auto body = request->content.string();
+
+    const auto it = request->header.find("Content-Encoding");
+    if (it == request->header.end() || boost::iequals(it->second, "identity")) {
+        return body;
+    }
+    if (!boost::iequals(it->second, "gzip") && !boost::iequals(it->second, "deflate")) {
+        Log::d(TAG, u8"Content-Encoding 不支持：" + it->second);
+        response->write(SimpleWeb::StatusCode::client_error_unsupported_media_type);
+        return nullopt;
+    }
+
+    const auto max_size = config.http_max_request_size > 0 ? config.http_max_request_size : MAX_DECOMPRESSED_BODY_SIZE;
+    auto decompressed = gzip_decompress(body, max_size);
+    if (!decompressed) {
+        Log::d(TAG, u8"HTTP 正文解压失败");
+        response->write(SimpleWeb::StatusCode::client_error_bad_request);
+    }
+    return decompressed;
+}
+
+/**
+ * The format of the request body given by "Content-Type", JSON if not given or unknown.
+ */
+static WireFormat request_format(const shared_ptr<HttpServer::Request> &request) {
+    const auto it = request->header.find("Content-Type");
+    return it != request->header.end() ? wire_format_from_media_type(it->second).value_or(WireFormat::JSON)
+                                       : WireFormat::JSON;
+}
+
+/**
+ * The format of the response body the client asks for in "Accept", JSON by default.
+ */
+static WireFormat response_format(const shared_ptr<HttpServer::Request> &request) {
+    const auto it = request->header.find("Accept");
+    return it != request->header.end() ? wire_format_from_media_type(it->second).value_or(WireFormat::JSON)
+                                       : WireFormat::JSON;
+}
+
+/**
+ * Write the result of a call to "/<action>".
+ */
+static void write_api_result(const shared_ptr<HttpServer::Response> &response,
+                             const shared_ptr<HttpServer::Request> &request, const ApiResult &result) {
+    if (result.retcode == ApiResult::RetCodes::HTTP_SERVICE_UNAVAILABLE) {
+        Log::d(TAG, u8"发送队列已满，已拒绝请求");
+        response->write(SimpleWeb::StatusCode::server_error_service_unavailable, {{"Retry-After", "1"}});
+        return;
+    }
+    if (result.retcode == ApiResult::RetCodes::HTTP_GATEWAY_TIMEOUT) {
+        Log::d(TAG, u8"API 请求处理超时");
+        response->write(SimpleWeb::StatusCode::server_error_gateway_timeout);
+        return;
+    }
+
+    const auto format = response_format(request);
+    decltype(request->header) headers{
+        {"Content-Type", wire_media_type(format)}
+    };
+    auto resp_body = result.dump(format);
+    Log::d(TAG, [&] { return u8"响应数据已准备完毕：" + resp_body; });
+    write_compressible(response, request, resp_body, move(headers));
+    Log::d(TAG, u8"响应内容已发送");
+    Log::i(TAG, [&] { return u8"已成功处理一个 API 请求：" + request->path; });
+}
+
+/**
+ * Handle a request to "/<action>", where "handler" is the matched api handler.
+ */
+static void handle_api_request(const string &action, const ApiHandler &handler,
+                               const shared_ptr<HttpServer::Response> &response,
+                               const shared_ptr<HttpServer::Request> &request) {
+    Log::d(TAG, [&] {
+        return u8"收到 API 请求：" + request->method
+               + u8" " + request->path
+               + (request->query_string.empty() ? "" : "?" + request->query_string);
+    });
+
+    auto json_params = json::object();
+    json args = request->parse_query_string(), form;
+
+    auto authorized = authorize(request->header, args, [&response](auto status_code) {
+        response->write(status_code);
+    });
+    if (!authorized) {
+        Log::d(TAG, u8"没有提供 Token 或 Token 不符，已拒绝请求");
+        return;
+    }
+
+    if (request->method == "POST") {
+        string content_type;
+        if (const auto it = request->header.find("Content-Type");
+            it != request->header.end()) {
+            content_type = it->second;
+            Log::d(TAG, [&] { return u8"Content-Type: " + content_type; });
+        }
+
+        auto body = request_body(response, request);
+        if (!body) {
+            return;
+        }
+        const auto &body_string = body.value();
+        Log::d(TAG, [&] { return u8"HTTP 正文内容：" + body_string; });
+
+        if (boost::starts_with(content_type, "application/x-www-form-urlencoded")) {
+            form = SimpleWeb::QueryString::parse(body_string);
+        } else if (const auto format = wire_format_from_media_type(content_type)) {
+            // JSON, or the same structure in MessagePack or CBOR
+            try {
+                json_params = wire_parse(body_string, format.value()); // may throw invalid_argument
+                if (!json_params.is_object()) {
+                    throw invalid_argument("must be a JSON object");
+                }
+            } catch (invalid_argument &) {
+                Log::d(TAG, u8"HTTP 正文的 JSON 无效或者不是对象");
+                response->write(SimpleWeb::StatusCode::client_error_bad_request);
+                return;
+            }
+        } else if (!content_type.empty()) {
+            Log::d(TAG, u8"Content-Type 不支持");
+            response->write(SimpleWeb::StatusCode::client_error_not_acceptable);
+            return;
+        }
+    }
+
+    // merge form and args to json params, moving the values since they are not used any more
+    for (auto data : {&form, &args}) {
+        if (data->is_object()) {
+            for (auto it = data->begin(); it != data->end(); ++it) {
+                json_params[it.key()] = move(it.value());
+            }
+        }
+    }
+
+    // the timeout can also be given by a header, in milliseconds
+    if (const auto it = request->header.find("X-Request-Timeout");
+        it != request->header.end() && json_params.find("request_timeout") == json_params.end()) {
+        json_params["request_timeout"] = it->second;
+    }
+
+    Log::d(TAG, [&] { return u8"API 处理函数 " + action + u8" 开始处理请求"; });
+    ApiResult result;
+    Params params(move(json_params));
+    invoke_api_handler(action, handler, params, result); // call the real handler
+
+    if (result.deferred) {
+        // the response is written by the thread completing the result, e.g. the send queue
+        result.deferred->then([response, request](const ApiResult &completed) {
+            write_api_result(response, request, completed);
+        });
+        return;
+    }
+    write_api_result(response, request, result);
+}
+
 void HttpService::init() {
     Log::d(TAG, u8"初始化 HTTP");
 
     // recreate http server instance
     server_ = make_shared<HttpServer>();
+    server_->on_upgrade = upgrade_handler_;
 
+    // api handlers are dispatched by looking up the first path segment in "api_handlers",
+    // instead of registering one regex resource for each of them,
+    // other resources (batch api, data files) are matched before this
     server_->default_resource["GET"]
             = server_->default_resource["POST"]
             = [](shared_ptr<HttpServer::Response> response, shared_ptr<HttpServer::Request> request) {
-                response->write(SimpleWeb::StatusCode::client_error_not_found);
+                // "/send_msg" or "/send_msg/"
+                auto action = request->path.substr(request->path.empty() ? 0 : 1);
+                if (!action.empty() && action.back() == '/') {
+                    action.pop_back();
+                }
+
+                if (const auto it = api_handlers.find(action); it != api_handlers.end()) {
+                    handle_api_request(it->first, it->second, response, request);
+                } else {
+                    response->write(SimpleWeb::StatusCode::client_error_not_found);
+                }
             };
 
-    for (const auto &handler_kv : api_handlers) {
-        const auto path_regex = "^/" + handler_kv.first + "/?$";
-        server_->resource[path_regex]["GET"] = server_->resource[path_regex]["POST"]
-                = [&handler_kv](shared_ptr<HttpServer::Response> response,
-                                shared_ptr<HttpServer::Request> request) {
-                    Log::d(TAG, u8"收到 API 请求：" + request->method
-                           + u8" " + request->path
-                           + (request->query_string.empty() ? "" : "?" + request->query_string));
-
-                    auto json_params = json::object();
-                    json args = request->parse_query_string(), form;
-
-                    auto authorized = authorize(request->header, args, [&response](auto status_code) {
-                        response->write(status_code);
-                    });
-                    if (!authorized) {
-                        Log::d(TAG, u8"没有提供 Token 或 Token 不符，已拒绝请求");
-                        return;
-                    }
-
-                    if (request->method == "POST") {
-                        string content_type;
-                        if (const auto it = request->header.find("Content-Type");
-                            it != request->header.end()) {
-                            content_type = it->second;
-                            Log::d(TAG, u8"Content-Type: " + content_type);
-                        }
-
-                        auto body_string = request->content.string();
-                        Log::d(TAG, u8"HTTP 正文内容：" + body_string);
-
-                        if (boost::starts_with(content_type, "application/x-www-form-urlencoded")) {
-                            form = SimpleWeb::QueryString::parse(body_string);
-                        } else if (boost::starts_with(content_type, "application/json")) {
-                            try {
-                                json_params = json::parse(body_string); // may throw invalid_argument
-                                if (!json_params.is_object()) {
-                                    throw invalid_argument("must be a JSON object");
-                                }
-                            } catch (invalid_argument &) {
-                                Log::d(TAG, u8"HTTP 正文的 JSON 无效或者不是对象");
-                                response->write(SimpleWeb::StatusCode::client_error_bad_request);
-                                return;
-                            }
-                        } else if (!content_type.empty()) {
-                            Log::d(TAG, u8"Content-Type 不支持");
-                            response->write(SimpleWeb::StatusCode::client_error_not_acceptable);
-                            return;
-                        }
-                    }
-
-                    // merge form and args to json params
-                    for (auto data : {form, args}) {
-                        if (data.is_object()) {
-                            for (auto it = data.begin(); it != data.end(); ++it) {
-                                json_params[it.key()] = it.value();
-                            }
-                        }
-                    }
-
-                    Log::d(TAG, u8"API 处理函数 " + handler_kv.first + u8" 开始处理请求");
-                    ApiResult result;
-                    Params params(move(json_params));
-                    handler_kv.second(params, result); // call the real handler
-
-                    decltype(request->header) headers{
-                        {"Content-Type", "application/json; charset=UTF-8"}
-                    };
-                    auto resp_body = result.json().dump();
-                    Log::d(TAG, u8"响应数据已准备完毕：" + resp_body);
-                    response->write(resp_body, headers);
-                    Log::d(TAG, u8"响应内容已发送");
-                    Log::i(TAG, u8"已成功处理一个 API 请求：" + request->path);
-                };
-    }
+    // batch api handler
+    server_->resource["^/\\.batch/?$"]["POST"] = [](shared_ptr<HttpServer::Response> response,
+                                                   shared_ptr<HttpServer::Request> request) {
+        Log::d(TAG, [&] { return u8"收到批量 API 请求：" + request->method + u8" " + request->path; });
+
+        json args = request->parse_query_string();
+        auto authorized = authorize(request->header, args, [&response](auto status_code) {
+            response->write(status_code);
+        });
+        if (!authorized) {
+            Log::d(TAG, u8"没有提供 Token 或 Token 不符，已拒绝请求");
+            return;
+        }
+
+        // the body should be an array of actions, or an object like {"actions": [...], "parallel": true}
+        const auto body = request_body(response, request);
+        if (!body) {
+            return;
+        }
+
+        json payload;
+        try {
+            payload = wire_parse(body.value(), request_format(request)); // may throw invalid_argument
+        } catch (invalid_argument &) {}
+
+        json actions;
+        auto parallel = false;
+        if (payload.is_array()) {
+            actions = move(payload);
+        } else if (payload.is_object() && payload.find("actions") != payload.end()) {
+            actions = move(payload["actions"]);
+            parallel = Params(move(payload)).get_bool("parallel", false);
+        }
+        if (!actions.is_array()) {
+            Log::d(TAG, u8"HTTP 正文的 JSON 无效或者不是数组");
+            response->write(SimpleWeb::StatusCode::client_error_bad_request);
+            return;
+        }
+        parallel = Params(move(args)).get_bool("parallel", parallel);
+
+        Log::d(TAG, u8"开始批量处理 " + to_string(actions.size()) + u8" 个 API 请求");
+        ApiResult result;
+        result.data = invoke_api_batch(move(actions), parallel);
+        result.retcode = ApiResult::RetCodes::OK;
+
+        const auto format = response_format(request);
+        decltype(request->header) headers{
+            {"Content-Type", wire_media_type(format)}
+        };
+        auto resp_body = result.dump(format);
+        Log::d(TAG, [&] { return u8"响应数据已准备完毕：" + resp_body; });
+        write_compressible(response, request, resp_body, move(headers));
+        Log::d(TAG, u8"响应内容已发送");
+        Log::i(TAG, u8"已成功处理一个批量 API 请求，共 " + to_string(actions.size()) + u8" 个");
+    };
+
+    // metrics in Prometheus text format
+    server_->resource["^/metrics/?$"]["GET"] = [](shared_ptr<HttpServer::Response> response,
+                                                  shared_ptr<HttpServer::Request> request) {
+        json args = request->parse_query_string();
+        if (!authorize(request->header, args, [&response](auto status_code) { response->write(status_code); })) {
+            return;
+        }
+
+        vector<Metrics::Gauge> gauges;
+        if (const auto p = pool) {
+            gauges.push_back({"cqhttp_thread_pool_threads", "", double(p->size())});
+            gauges.push_back({"cqhttp_thread_pool_pending_tasks", "", double(p->pending_count())});
+        }
+        if (PoolAutoscaler::instance().started()) {
+            const auto stats = PoolAutoscaler::instance().stats();
+            gauges.push_back({"cqhttp_thread_pool_queue_wait_ms", "", stats.average_wait_ms});
+            gauges.push_back({"cqhttp_thread_pool_utilization", "", stats.utilization});
+            gauges.push_back({"cqhttp_thread_pool_resizes_total", "direction=\"grow\"", double(stats.grow_count)});
+            gauges.push_back({"cqhttp_thread_pool_resizes_total", "direction=\"shrink\"", double(stats.shrink_count)});
+        }
+        gauges.push_back({"cqhttp_server_thread_pool_threads", "", double(server_thread_pool_size())});
+        gauges.push_back({"cqhttp_async_post_queue_depth", "", double(AsyncPoster::instance().queue_size())});
+        gauges.push_back({"cqhttp_async_post_shed_total", "", double(AsyncPoster::instance().shed_count())});
+        gauges.push_back({"cqhttp_send_queue_depth", "", double(SendQueue::instance().queue_size())});
+        gauges.push_back({"cqhttp_outbound_cache_hits_total", "", double(OutboundCache::instance().hit_count())});
+        gauges.push_back({"cqhttp_outbound_cache_misses_total", "", double(OutboundCache::instance().miss_count())});
+        for (const auto &entry : ServiceHub::instance().get_services()) {
+            gauges.push_back({"cqhttp_service_good", "service=\"" + entry.first + "\"", double(entry.second->good())});
+        }
+        for (const auto &entry : ServiceHub::instance().get_services()) {
+            const auto stats = entry.second->stats();
+            if (!stats.is_object()) {
+                continue;
+            }
+            for (auto it = stats.begin(); it != stats.end(); ++it) {
+                if (it.value().is_number()) {
+                    gauges.push_back({"cqhttp_service_" + it.key(), "service=\"" + entry.first + "\"",
+                                      it.value().get<double>()});
+                }
+            }
+        }
+
+        write_compressible(response, request, Metrics::instance().render(gauges), {
+            {"Content-Type", "text/plain; version=0.0.4; charset=UTF-8"}
+        });
+    };
 
     // data files handler
     const auto regex = "^/(data/(?:bface|image|record|show)/.+)$";
@@ -122,22 +438,86 @@ void HttpService::init() {
             return;
         }
 
-        if (ifstream f(ansi_filepath, ios::in | ios::binary); f.is_open()) {
-            auto length = fs::file_size(ansi_filepath);
-            response->write(decltype(request->header){
-                {"Content-Length", to_string(length)},
-                {"Content-Type", "application/octet-stream"},
-                {"Content-Disposition", "attachment"}
-            });
-            *response << f.rdbuf();
-            Log::d(TAG, u8"文件内容已发送完毕");
+        // a failure of either is checked, so that a bad size never gets into Content-Length or Range
+        boost::system::error_code size_ec, mtime_ec;
+        const auto size = fs::file_size(ansi_filepath, size_ec);
+        const auto mtime = fs::last_write_time(ansi_filepath, mtime_ec);
+        if (size_ec || mtime_ec) {
+            // e.g. deleted after the check above
+            Log::d(TAG, u8"文件 " + relpath + u8" 的信息读取失败，可能已被删除，或者没有文件系统权限");
+            response->write(SimpleWeb::StatusCode::client_error_not_found);
+            return;
+        }
+
+        const auto etag = "\"" + to_string(size) + "-" + to_string(mtime) + "\"";
+        const auto last_modified = http_date(mtime);
+        decltype(request->header) header{
+            {"Content-Type", "application/octet-stream"},
+            {"Content-Disposition", "attachment"},
+            {"Accept-Ranges", "bytes"},
+            {"ETag", etag},
+            {"Last-Modified", last_modified}
+        };
+
+        // conditional request, "If-None-Match" takes precedence over "If-Modified-Since"
+        auto not_modified = false;
+        if (const auto it = request->header.find("If-None-Match"); it != request->header.end()) {
+            not_modified = it->second == etag || it->second == "*";
+        } else if (const auto since_it = request->header.find("If-Modified-Since"); since_it != request->header.end()) {
+            not_modified = since_it->second == last_modified; // clients send back the exact value we gave
+        }
+        if (not_modified) {
+            Log::d(TAG, u8"文件 " + relpath + u8" 未修改");
+            response->write(SimpleWeb::StatusCode::redirection_not_modified, header);
+            return;
+        }
+
+        auto status_code = SimpleWeb::StatusCode::success_ok;
+        uintmax_t first = 0, last = size; // [first, last)
+        if (const auto it = request->header.find("Range"); it != request->header.end()) {
+            const auto range = parse_byte_range(it->second, size);
+            if (!range) {
+                response->write(SimpleWeb::StatusCode::client_error_range_not_satisfiable,
+                                {{"Content-Range", "bytes */" + to_string(size)}});
+                return;
+            }
+            tie(first, last) = range.value();
+            if (last - first != size) {
+                status_code = SimpleWeb::StatusCode::success_partial_content;
+                header.emplace("Content-Range",
+                               "bytes " + to_string(first) + "-" + to_string(last - 1) + "/" + to_string(size));
+            }
+        }
+        header.emplace("Content-Length", to_string(last - first));
+
+        // small files are requested repeatedly (e.g. images), keep them in memory
+        static LruCache<string, CachedDataFile> small_file_cache(DATA_FILE_CACHE_CAPACITY);
+        if (size <= MAX_CACHED_DATA_FILE_SIZE) {
+            auto cached = small_file_cache.get(filepath);
+            if (!cached || cached->etag != etag) {
+                if (ifstream f(ansi_filepath, ios::in | ios::binary); f.is_open()) {
+                    cached = CachedDataFile{etag, make_shared<const string>(istreambuf_iterator<char>(f),
+                                                                            istreambuf_iterator<char>())};
+                    small_file_cache.set(filepath, cached.value(), size);
+                }
+            }
+            if (cached && cached->content->size() == size) {
+                response->write(status_code, cached->content->substr(first, last - first), header);
+                Log::i(TAG, u8"已成功发送文件：" + relpath);
+                return;
+            }
+        }
+
+        if (auto f = make_shared<ifstream>(ansi_filepath, ios::in | ios::binary); f->is_open()) {
+            f->seekg(first);
+            response->write(status_code, header);
+            send_file_chunks(response, f, last - first);
+            Log::i(TAG, u8"开始发送文件：" + relpath);
         } else {
             Log::d(TAG, u8"文件 " + relpath + u8" 打开失败，请检查文件系统权限");
             response->write(SimpleWeb::StatusCode::client_error_forbidden);
             return;
         }
-
-        Log::i(TAG, u8"已成功发送文件：" + relpath);
     };
 
     ServiceBase::init();
@@ -153,8 +533,13 @@ void HttpService::start() {
         init();
 
         server_->config.thread_pool_size = server_thread_pool_size();
+        server_->config.io_service_per_thread = config.server_io_service_per_thread;
         server_->config.address = config.host;
         server_->config.port = config.port;
+        if (config.http_max_request_size > 0) {
+            server_->config.max_request_size = config.http_max_request_size;
+        }
+        server_->config.timeout_idle = config.http_keep_alive_timeout;
         thread_ = thread([&]() {
             started_ = true;
             try {
@@ -5,10 +5,18 @@
 
 class HttpService final : public ServiceBase {
 public:
+    using UpgradeHandler = decltype(SimpleWeb::Server<SimpleWeb::HTTP>::on_upgrade);
+
     void start() override;
     void stop() override;
     bool good() const override;
 
+    /**
+     * Hand over requests with an "Upgrade" header (i.e. WebSocket handshakes) to the handler,
+     * so that another service can share the port. Must be called before start().
+     */
+    void set_upgrade_handler(UpgradeHandler handler) { upgrade_handler_ = std::move(handler); }
+
 protected:
     void init() override;
     void finalize() override;
@@ -16,4 +24,5 @@ protected:
 private:
     std::shared_ptr<SimpleWeb::Server<SimpleWeb::HTTP>> server_;
     std::thread thread_;
+    UpgradeHandler upgrade_handler_;
 };
@@ -0,0 +1,316 @@
+#include "./pipe_service_class.h"
+#include "./service_impl_common.h"
+
+#include <array>
+#include <deque>
+
+#include "utils/metrics_class.h"
+#include "utils/rolling_stats_class.h"
+#include "event/trace_class.h"
+
+using namespace std;
+namespace asio = boost::asio;
+using boost::system::error_code;
+
+static const DWORD PIPE_BUFFER_SIZE = 64 * 1024;
+static const size_t MAX_LINE_SIZE = 64 * 1024 * 1024;
+
+struct PipeService::Connection : enable_shared_from_this<Connection> {
+    Connection(asio::io_service &io_service, const HANDLE handle, const Endpoint endpoint)
+        : pipe(io_service, handle), strand(io_service), read_buffer(MAX_LINE_SIZE), endpoint(endpoint) {}
+
+    asio::windows::stream_handle pipe;
+    asio::io_service::strand strand; // serializes the writes
+    asio::streambuf read_buffer;
+    const Endpoint endpoint;
+
+    bool authorized = false; // only touched by the reading side
+    atomic<bool> subscribed = false; // whether events are pushed to it, set once an event client is authorized
+
+    // lines waiting to be written, only touched in "strand"
+    deque<SerializedPayload> write_queue;
+    atomic<size_t> queue_depth = 0;
+
+    /**
+     * Write one line, the newline is appended here.
+     */
+    void send(SerializedPayload line) {
+        queue_depth++;
+        auto self = shared_from_this();
+        strand.post([self, line = move(line)]() mutable {
+            self->write_queue.push_back(move(line));
+            if (self->write_queue.size() == 1) {
+                self->write_next();
+            }
+        });
+    }
+
+    void close() {
+        error_code ec;
+        pipe.close(ec);
+    }
+
+private:
+    void write_next() {
+        static const char NEWLINE = '\n';
+        auto self = shared_from_this();
+        const auto &line = *write_queue.front();
+        const array<asio::const_buffer, 2> buffers{asio::buffer(line), asio::buffer(&NEWLINE, 1)};
+        asio::async_write(pipe, buffers, strand.wrap([self](const error_code &ec, const size_t bytes) {
+            RollingStats::instance().add_bytes("bytes_sent", "pipe", bytes);
+            self->write_queue.pop_front();
+            self->queue_depth--;
+            if (ec) {
+                self->close(); // the rest of the queue fails immediately
+            }
+            if (!self->write_queue.empty()) {
+                self->write_next();
+            }
+        }));
+    }
+};
+
+string PipeService::pipe_path(const Endpoint endpoint) {
+    return R"(\\.\pipe\)" + config.pipe_name + (endpoint == Endpoint::API ? R"(\api)" : R"(\event)");
+}
+
+void PipeService::init() {
+    Log::d(TAG, u8"初始化命名管道");
+
+    io_service_ = make_shared<asio::io_service>();
+    work_ = make_unique<asio::io_service::work>(*io_service_);
+
+    ServiceBase::init();
+}
+
+void PipeService::finalize() {
+    work_ = nullptr;
+    io_service_ = nullptr;
+    ServiceBase::finalize();
+}
+
+void PipeService::start() {
+    if (config.use_pipe) {
+        init();
+
+        running_ = true;
+        accept(Endpoint::API);
+        accept(Endpoint::EVENT);
+        thread_ = thread([this]() {
+            started_ = true;
+            try {
+                io_service_->run();
+            } catch (...) {}
+            started_ = false;
+        });
+        Log::d(TAG, u8"开启命名管道服务成功，API：" + pipe_path(Endpoint::API) + u8"，事件："
+               + pipe_path(Endpoint::EVENT));
+    }
+}
+
+void PipeService::stop() {
+    running_ = false;
+    {
+        unique_lock<mutex> lock(connections_mutex_);
+        for (const auto &connection : connections_) {
+            connection->close();
+        }
+        connections_.clear();
+    }
+
+    // the api calls running in "pool" use this service when they finish
+    while (calls_in_flight_ > 0) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+
+    work_ = nullptr;
+    if (io_service_) {
+        io_service_->stop();
+    }
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    finalize();
+}
+
+bool PipeService::good() const {
+    if (config.use_pipe) {
+        return initialized_ && started_;
+    }
+    return ServiceBase::good();
+}
+
+json PipeService::stats() const {
+    size_t event_connection_count = 0;
+    {
+        unique_lock<mutex> lock(connections_mutex_);
+        for (const auto &connection : connections_) {
+            if (connection->subscribed) {
+                event_connection_count++;
+            }
+        }
+    }
+    return {
+        {"event_connections", event_connection_count},
+        {"dropped_events", dropped_event_count_.load()}
+    };
+}
+
+void PipeService::accept(const Endpoint endpoint) {
+    if (!running_) {
+        return;
+    }
+
+    const auto path = pipe_path(endpoint);
+    const auto handle = CreateNamedPipeW(s2ws(path).c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED,
+                                         PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS,
+                                         PIPE_UNLIMITED_INSTANCES, PIPE_BUFFER_SIZE, PIPE_BUFFER_SIZE, 0, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        Log::e(TAG, u8"创建命名管道 " + path + u8" 失败，错误码：" + to_string(GetLastError()));
+        return;
+    }
+
+    auto connection = make_shared<Connection>(*io_service_, handle, endpoint);
+    {
+        unique_lock<mutex> lock(connections_mutex_);
+        connections_.insert(connection);
+    }
+
+    asio::windows::overlapped_ptr overlapped(*io_service_, [this, connection, endpoint](const error_code &ec, size_t) {
+        // wait for the next client on a new instance of the pipe
+        accept(endpoint);
+
+        if (ec) {
+            remove_connection(connection);
+            connection->close();
+            return;
+        }
+
+        Log::d(TAG, u8"收到命名管道连接：" + pipe_path(endpoint));
+        if (live_config()->access_token.empty()) {
+            connection->authorized = true;
+            connection->subscribed = endpoint == Endpoint::EVENT;
+        }
+        read_line(connection);
+    });
+
+    const auto ok = ConnectNamedPipe(handle, overlapped.get());
+    const auto error = GetLastError();
+    if (!ok && error != ERROR_IO_PENDING) {
+        // ERROR_PIPE_CONNECTED means the client connected before ConnectNamedPipe, which is fine
+        overlapped.complete(error == ERROR_PIPE_CONNECTED
+                                ? error_code()
+                                : error_code(error, asio::error::get_system_category()), 0);
+    } else {
+        overlapped.release(); // completes through the io_service
+    }
+}
+
+void PipeService::read_line(const shared_ptr<Connection> &connection) {
+    asio::async_read_until(connection->pipe, connection->read_buffer, '\n',
+                           [this, connection](const error_code &ec, const size_t size) {
+                               if (ec) {
+                                   // the client disconnected, or the line exceeds MAX_LINE_SIZE
+                                   remove_connection(connection);
+                                   connection->close();
+                                   return;
+                               }
+
+                               const auto data = connection->read_buffer.data();
+                               string line(asio::buffers_begin(data), asio::buffers_begin(data) + (size - 1));
+                               connection->read_buffer.consume(size);
+                               if (!line.empty() && line.back() == '\r') {
+                                   line.pop_back();
+                               }
+                               on_line(connection, move(line));
+                           });
+}
+
+void PipeService::on_line(const shared_ptr<Connection> &connection, string line) {
+    if (!connection->authorized) {
+        // the first line of a client is {"access_token": "..."} if "access_token" is set
+        string token_given;
+        try {
+            token_given = json::parse(line).at("access_token").get<string>();
+        } catch (...) {}
+        if (token_given.empty() || !constant_time_equals(token_given, live_config()->access_token)) {
+            Log::d(TAG, u8"命名管道客户端没有提供 Token 或 Token 不符，已关闭连接");
+            remove_connection(connection);
+            connection->close();
+            return;
+        }
+        connection->authorized = true;
+        connection->subscribed = connection->endpoint == Endpoint::EVENT;
+        read_line(connection);
+        return;
+    }
+
+    if (connection->endpoint == Endpoint::EVENT || line.empty()) {
+        // nothing is expected from event clients, keep reading to find out when they disconnect
+        read_line(connection);
+        return;
+    }
+
+    Log::d(TAG, [&] { return u8"收到 API 请求（命名管道）：" + line; });
+    if (!pool) {
+        connection->send(make_shared<const string>(handle_api_message(line, false)));
+        read_line(connection);
+        return;
+    }
+
+    // one call of a connection at a time, so the results are in the order of the calls,
+    // and the next line is read only when the result is sent
+    calls_in_flight_++;
+    pool->push([this, connection, line = move(line)](int) {
+        try {
+            connection->send(make_shared<const string>(handle_api_message(line, true)));
+        } catch (...) {}
+        if (running_) {
+            read_line(connection);
+        }
+        calls_in_flight_--;
+    });
+}
+
+void PipeService::remove_connection(const shared_ptr<Connection> &connection) const {
+    unique_lock<mutex> lock(connections_mutex_);
+    connections_.erase(connection);
+}
+
+void PipeService::push_event(const json &, const SerializedPayload &payload_str) const {
+    if (!running_) {
+        return;
+    }
+
+    vector<shared_ptr<Connection>> subscribers;
+    {
+        unique_lock<mutex> lock(connections_mutex_);
+        for (const auto &connection : connections_) {
+            if (connection->subscribed) {
+                subscribers.push_back(connection);
+            }
+        }
+    }
+    if (subscribers.empty()) {
+        return;
+    }
+
+    Log::d(TAG, u8"开始通过命名管道推送事件");
+    const auto start = Metrics::Clock::now();
+    size_t succeeded_count = 0;
+    for (const auto &connection : subscribers) {
+        if (config.ws_event_queue_size > 0 && connection->queue_depth >= config.ws_event_queue_size) {
+            // the client is too slow to receive events
+            dropped_event_count_++;
+            continue;
+        }
+        connection->send(payload_str);
+        succeeded_count++;
+    }
+    EventTrace::mark("pipe");
+    Metrics::instance().observe_post("pipe", Metrics::seconds_since(start), succeeded_count == subscribers.size());
+    Log::d(TAG, [&] {
+        return u8"已成功向 " + to_string(succeeded_count) + "/" + to_string(subscribers.size())
+               + u8" 个命名管道客户端推送事件";
+    });
+}
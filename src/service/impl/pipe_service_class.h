@@ -0,0 +1,52 @@
+#pragma once
+
+#include "../service_base_class.h"
+#include "../pushable_interface.h"
+
+#include <boost/asio.hpp>
+#include <atomic>
+#include <mutex>
+#include <set>
+
+/**
+ * API calls and event push over Windows named pipes, for clients running on the same machine.
+ * Clients connect to "\\.\pipe\<pipe_name>\api" or "\\.\pipe\<pipe_name>\event",
+ * and every message in both directions is one line of JSON, in the same structure as the WebSocket API.
+ */
+class PipeService final : public ServiceBase, public IPushable {
+public:
+    void start() override;
+    void stop() override;
+    bool good() const override;
+    json stats() const override;
+
+    void push_event(const json &payload, const SerializedPayload &payload_str) const override;
+
+protected:
+    void init() override;
+    void finalize() override;
+
+private:
+    struct Connection;
+
+    enum class Endpoint { API, EVENT };
+
+    std::shared_ptr<boost::asio::io_service> io_service_;
+    std::unique_ptr<boost::asio::io_service::work> work_;
+    std::thread thread_;
+    std::atomic<bool> running_ = false;
+
+    // all open connections (including the pipe instances waiting for a client), closed on stop
+    mutable std::set<std::shared_ptr<Connection>> connections_;
+    mutable std::mutex connections_mutex_;
+
+    mutable std::atomic<size_t> dropped_event_count_ = 0;
+    std::atomic<size_t> calls_in_flight_ = 0; // api calls running in "pool"
+
+    static std::string pipe_path(Endpoint endpoint);
+
+    void accept(Endpoint endpoint);
+    void read_line(const std::shared_ptr<Connection> &connection);
+    void on_line(const std::shared_ptr<Connection> &connection, std::string line);
+    void remove_connection(const std::shared_ptr<Connection> &connection) const;
+};
@@ -3,21 +3,43 @@
 #include "app.h"
 
 #include <boost/filesystem.hpp>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
 
 #include "api/api.h"
+#include "utils/rolling_stats_class.h"
+#include "web_server/deflate.hpp"
 #include "web_server/utility.hpp"
 
 namespace fs = boost::filesystem;
 
 static const auto TAG = u8"API服务";
 
+namespace SimpleWeb {
+    template <class socket_type>
+    class SocketServer;
+}
+
+/**
+ * Whether WsT is the websocket server (the "ws" service) or a client (the "ws_reverse" service).
+ */
+template <typename WsT>
+struct IsWsServer : std::false_type {};
+
+template <typename SocketT>
+struct IsWsServer<SimpleWeb::SocketServer<SocketT>> : std::true_type {};
+
 /**
  * Do authorization (check access token),
  * should be called on incomming connection request (http server and websocket server)
  */
 static bool authorize(const SimpleWeb::CaseInsensitiveMultimap &headers, const json &query_args,
                       const std::function<void(SimpleWeb::StatusCode)> on_failed = nullptr) {
-    if (config.access_token.empty()) {
+    const auto access_token = live_config()->access_token;
+    if (access_token.empty()) {
         return true;
     }
 
@@ -37,7 +59,7 @@ static bool authorize(const SimpleWeb::CaseInsensitiveMultimap &headers, const j
         return false;
     }
 
-    if (token_given != config.access_token) {
+    if (!constant_time_equals(token_given, access_token)) {
         if (on_failed) {
             on_failed(SimpleWeb::StatusCode::client_error_forbidden);
         }
@@ -54,40 +76,60 @@ static auto server_thread_pool_size() {
 }
 
 /**
- * \brief Common "on_message" callback for websocket server's api endpoint and reverse websocket api client.
- * \tparam WsT WsServer (websocket server /api/ endpoint) or WsClient (reverse websocket api client)
+ * The format a websocket server connection asks for in the "format" query argument, e.g. "/event/?format=msgpack".
  */
-template <typename WsT>
-static void ws_api_on_message(std::shared_ptr<typename WsT::Connection> connection,
-                              std::shared_ptr<typename WsT::Message> message) {
-    auto ws_message_str = message->string();
-    Log::d(TAG, u8"收到 API 请求（WebSocket）：" + ws_message_str);
+static WireFormat ws_connection_format(const std::string &query_string) {
+    const auto args = SimpleWeb::QueryString::parse(query_string);
+    const auto it = args.find("format");
+    return it != args.end() ? wire_format_from_name(it->second).value_or(WireFormat::JSON) : WireFormat::JSON;
+}
 
-    ApiResult result;
+/**
+ * The permessage-deflate options of both the websocket server and the reverse websocket clients.
+ */
+static SimpleWeb::DeflateConfig ws_deflate_config() {
+    SimpleWeb::DeflateConfig deflate_config;
+    deflate_config.enabled = config.ws_compression;
+    deflate_config.level = std::clamp(config.ws_compression_level, -1, 9);
+    deflate_config.context_takeover = config.ws_compression_context_takeover;
+    deflate_config.min_size = config.ws_compression_min_size;
+    return deflate_config;
+}
 
-    auto send_result = [&connection, &result](const json &echo = nullptr) {
-        auto resp_json = result.json();
-        if (!echo.is_null()) {
-            resp_json["echo"] = echo;
-        }
-        auto resp_body = resp_json.dump();
-        Log::d(TAG, u8"响应数据已准备完毕：" + resp_body);
-        auto send_stream = std::make_shared<typename WsT::SendStream>();
-        *send_stream << resp_body;
-        connection->send(send_stream);
-        Log::d(TAG, u8"响应内容已发送");
-    };
+/**
+ * Handle one API call message, i.e. {"action": ..., "params": ..., "echo": ...} or a batch {"actions": [...], ...},
+ * received on a websocket or named pipe connection.
+ * \param in_worker: whether it's called in a worker of "pool", in which case batch calls are not run in parallel,
+ *                   because waiting for other tasks of the pool in a task may deadlock when the pool is busy
+ * \param format: the format of both the call and the result
+ * \param send: called with the serialized result, by the thread completing it if the result is deferred
+ */
+static void handle_api_message(const std::string &message_str, const bool in_worker, const WireFormat format,
+                               const std::function<void(const std::string &)> &send) {
+    ApiResult result;
 
     json payload;
     try {
-        payload = json::parse(ws_message_str);
+        payload = wire_parse(message_str, format);
     } catch (std::invalid_argument &) {
         // bad JSON
     }
+    if (payload.is_object() && payload.find("actions") != payload.end() && payload["actions"].is_array()) {
+        // batch call
+        auto actions = std::move(payload["actions"]);
+        auto echo = payload.find("echo") != payload.end() ? std::move(payload["echo"]) : json();
+        const auto parallel = !in_worker && Params(std::move(payload)).get_bool("parallel", false);
+        Log::d(TAG, u8"开始批量处理 " + std::to_string(actions.size()) + u8" 个 API 请求");
+        result.data = invoke_api_batch(std::move(actions), parallel);
+        result.retcode = ApiResult::RetCodes::OK;
+        send(result.dump(format, echo));
+        return;
+    }
+
     if (!(payload.is_object() && payload.find("action") != payload.end() && payload["action"].is_string())) {
         Log::d(TAG, u8"消息中的 JSON 无效或者不是对象");
         result.retcode = ApiResult::RetCodes::HTTP_BAD_REQUEST;
-        send_result();
+        send(result.dump(format));
         return;
     }
 
@@ -95,9 +137,9 @@ static void ws_api_on_message(std::shared_ptr<typename WsT::Connection> connecti
 
     auto json_params = json::object();
     if (payload.find("params") != payload.end() && payload["params"].is_object()) {
-        json_params = payload["params"];
+        json_params = std::move(payload["params"]);
     }
-    const Params params(move(json_params));
+    const Params params(std::move(json_params));
 
     try {
         invoke_api(action, params, result);
@@ -112,5 +154,166 @@ static void ws_api_on_message(std::shared_ptr<typename WsT::Connection> connecti
         echo = payload.at("echo");
     } catch (...) {}
 
-    send_result(echo);
+    if (result.deferred) {
+        result.deferred->then([format, echo, send](const ApiResult &completed) { send(completed.dump(format, echo)); });
+        return;
+    }
+    send(result.dump(format, echo));
+}
+
+/**
+ * Handle one API call message and wait for the result, see above.
+ * \return the serialized result
+ */
+static std::string handle_api_message(const std::string &message_str, const bool in_worker,
+                                      const WireFormat format = WireFormat::JSON) {
+    // shared with the callback, which may still be returning from set_value() in another thread
+    const auto promise = std::make_shared<std::promise<std::string>>();
+    auto future = promise->get_future();
+    handle_api_message(message_str, in_worker, format,
+                       [promise](const std::string &resp_body) { promise->set_value(resp_body); });
+    return future.get();
+}
+
+/**
+ * Handle one message received on a websocket api connection, and send the result back on it.
+ * \tparam WsT WsServer (websocket server /api/ endpoint) or WsClient (reverse websocket api client)
+ * \param in_worker: see handle_api_message
+ * \param format: the format of both the calls and the results, binary formats are sent in binary frames
+ */
+template <typename WsT>
+static void handle_ws_api_message(const std::shared_ptr<typename WsT::Connection> &connection,
+                                  const std::string &ws_message_str, const bool in_worker,
+                                  const WireFormat format = WireFormat::JSON) {
+    Log::d(TAG, [&] { return u8"收到 API 请求（WebSocket）：" + ws_message_str; });
+
+    // the connection may send from any thread, so a deferred result is sent by the thread completing it
+    handle_api_message(ws_message_str, in_worker, format, [connection, format](const std::string &resp_body) {
+        Log::d(TAG, [&] { return u8"响应数据已准备完毕：" + resp_body; });
+        auto send_stream = std::make_shared<typename WsT::SendStream>();
+        *send_stream << resp_body;
+        connection->send(send_stream, nullptr, is_binary(format) ? 130 : 129);
+        RollingStats::instance().add_bytes("bytes_sent", IsWsServer<WsT>::value ? "ws" : "ws_reverse",
+                                           resp_body.size());
+        Log::d(TAG, u8"响应内容已发送");
+    });
+}
+
+/**
+ * Answer a call that can't be queued with "HTTP_SERVICE_UNAVAILABLE", so that the client retries it later.
+ */
+template <typename WsT>
+static void reject_ws_api_message(const std::shared_ptr<typename WsT::Connection> &connection,
+                                  const std::string &ws_message_str, const WireFormat format) {
+    ApiResult result;
+    result.retcode = ApiResult::RetCodes::HTTP_SERVICE_UNAVAILABLE;
+
+    json echo;
+    try {
+        echo = wire_parse(ws_message_str, format).at("echo");
+    } catch (...) {}
+
+    const auto resp_body = result.dump(format, echo);
+    auto send_stream = std::make_shared<typename WsT::SendStream>();
+    *send_stream << resp_body;
+    connection->send(send_stream, nullptr, is_binary(format) ? 130 : 129);
+}
+
+/**
+ * Calls of a websocket api connection that are running in "pool", and the ones waiting for them.
+ */
+struct WsApiConnectionState {
+    std::mutex mutex;
+    size_t in_flight = 0;
+    std::deque<std::string> pending;
+};
+
+/**
+ * Get the state of the given connection, creating it on the first call.
+ * The states of closed connections are dropped here too, so no "on_close" callback is needed.
+ */
+template <typename WsT>
+static std::shared_ptr<WsApiConnectionState> ws_api_connection_state(
+    const std::shared_ptr<typename WsT::Connection> &connection) {
+    static std::map<const void *, std::pair<std::weak_ptr<void>, std::shared_ptr<WsApiConnectionState>>> states;
+    static std::mutex states_mutex;
+
+    std::unique_lock<std::mutex> lock(states_mutex);
+    auto &entry = states[connection.get()];
+    if (entry.first.expired() || entry.first.lock() != connection) {
+        // a new connection, maybe at the address of a closed one
+        entry = {connection, std::make_shared<WsApiConnectionState>()};
+        for (auto it = states.begin(); it != states.end();) {
+            it = it->second.first.expired() ? states.erase(it) : std::next(it);
+        }
+    }
+    return entry.second;
+}
+
+/**
+ * Run the calls of a connection in "pool" one after another, until there is no pending one.
+ */
+template <typename WsT>
+static void run_ws_api_calls(std::shared_ptr<typename WsT::Connection> connection,
+                             std::shared_ptr<WsApiConnectionState> state, std::string ws_message_str,
+                             const WireFormat format) {
+    pool->push([connection, state, ws_message_str = move(ws_message_str), format](int) mutable {
+        while (true) {
+            try {
+                handle_ws_api_message<WsT>(connection, ws_message_str, true, format);
+            } catch (...) {}
+
+            std::unique_lock<std::mutex> lock(state->mutex);
+            if (state->pending.empty()) {
+                state->in_flight--;
+                break;
+            }
+            ws_message_str = move(state->pending.front());
+            state->pending.pop_front();
+        }
+    });
+}
+
+/**
+ * \brief Common "on_message" callback for websocket server's api endpoint and reverse websocket api client.
+ * If "ws_api_max_in_flight" > 0, calls are handled in "pool" instead of the IO thread,
+ * at most "ws_api_max_in_flight" at the same time for each connection, and the results may be sent out of order.
+ * At most "ws_api_max_pending" calls wait for them, the calls beyond it are rejected.
+ * \tparam WsT WsServer (websocket server /api/ endpoint) or WsClient (reverse websocket api client)
+ * \param format: the format negotiated for the connection, see handle_ws_api_message
+ */
+template <typename WsT>
+static void ws_api_on_message(std::shared_ptr<typename WsT::Connection> connection, std::string ws_message_str,
+                              const WireFormat format = WireFormat::JSON) {
+    const auto max_in_flight = config.ws_api_max_in_flight;
+    if (max_in_flight == 0 || !pool) {
+        handle_ws_api_message<WsT>(connection, ws_message_str, false, format);
+        return;
+    }
+
+    const auto state = ws_api_connection_state<WsT>(connection);
+    {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        if (state->in_flight >= max_in_flight) {
+            if (config.ws_api_max_pending > 0 && state->pending.size() >= config.ws_api_max_pending) {
+                // the client sends calls faster than they can be handled
+                lock.unlock();
+                Log::d(TAG, u8"WebSocket API 连接的等待队列已满，已拒绝请求");
+                reject_ws_api_message<WsT>(connection, ws_message_str, format);
+                return;
+            }
+            // will be run by one of the running tasks when it finishes
+            state->pending.push_back(move(ws_message_str));
+            return;
+        }
+        state->in_flight++;
+    }
+    run_ws_api_calls<WsT>(connection, state, move(ws_message_str), format);
+}
+
+template <typename WsT>
+static void ws_api_on_message(std::shared_ptr<typename WsT::Connection> connection,
+                              std::shared_ptr<typename WsT::Message> message,
+                              const WireFormat format = WireFormat::JSON) {
+    ws_api_on_message<WsT>(move(connection), message->string(), format);
 }
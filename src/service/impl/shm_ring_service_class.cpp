@@ -0,0 +1,78 @@
+#include "./shm_ring_service_class.h"
+
+#include "utils/metrics_class.h"
+#include "utils/rolling_stats_class.h"
+#include "event/trace_class.h"
+
+using namespace std;
+
+void ShmRingService::init() {
+    Log::d(TAG, u8"初始化共享内存环形缓冲区");
+
+    unique_lock<mutex> lock(writer_mutex_);
+    if (!writer_.open(s2ws(config.shm_ring_name), config.shm_ring_size)) {
+        Log::e(TAG, u8"创建共享内存 " + config.shm_ring_name + u8" 失败，错误码：" + to_string(GetLastError())
+               + u8"，请检查是否有其它程序使用了相同的名称和不同的大小");
+        return;
+    }
+
+    ServiceBase::init();
+}
+
+void ShmRingService::finalize() {
+    unique_lock<mutex> lock(writer_mutex_);
+    writer_.close();
+    ServiceBase::finalize();
+}
+
+void ShmRingService::start() {
+    if (config.use_shm_ring) {
+        init();
+        if (initialized_) {
+            Log::d(TAG, u8"开启共享内存事件推送成功，名称：" + config.shm_ring_name + u8"，大小："
+                   + to_string(config.shm_ring_size));
+        }
+    }
+}
+
+void ShmRingService::stop() {
+    finalize();
+}
+
+bool ShmRingService::good() const {
+    if (config.use_shm_ring) {
+        return initialized_;
+    }
+    return ServiceBase::good();
+}
+
+json ShmRingService::stats() const {
+    return {
+        {"written_events", written_event_count_.load()},
+        {"dropped_events", dropped_event_count_.load()}
+    };
+}
+
+void ShmRingService::push_event(const json &, const SerializedPayload &payload_str) const {
+    if (!initialized_) {
+        return;
+    }
+
+    const auto start = Metrics::Clock::now();
+    bool succeeded;
+    {
+        unique_lock<mutex> lock(writer_mutex_);
+        succeeded = payload_str->size() <= UINT32_MAX
+                    && writer_.write(payload_str->data(), static_cast<uint32_t>(payload_str->size()));
+    }
+    if (succeeded) {
+        written_event_count_++;
+        RollingStats::instance().add_bytes("bytes_sent", "shm_ring", payload_str->size());
+    } else {
+        // the event is larger than the whole ring
+        dropped_event_count_++;
+        Log::w(TAG, u8"事件大小超过共享内存环形缓冲区的大小，已丢弃");
+    }
+    EventTrace::mark("shm_ring");
+    Metrics::instance().observe_post("shm_ring", Metrics::seconds_since(start), succeeded);
+}
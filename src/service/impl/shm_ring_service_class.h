@@ -0,0 +1,35 @@
+#pragma once
+
+#include "../service_base_class.h"
+#include "../pushable_interface.h"
+
+#include <atomic>
+#include <mutex>
+
+#include "utils/shm_ring.h"
+
+/**
+ * Event push into a ring buffer in named shared memory, for consumers running on the same machine.
+ * The writer never waits for the readers, a reader which falls behind by more than the size of the ring loses events.
+ * See utils/shm_ring.h for the layout and a reader.
+ */
+class ShmRingService final : public ServiceBase, public IPushable {
+public:
+    void start() override;
+    void stop() override;
+    bool good() const override;
+    json stats() const override;
+
+    void push_event(const json &payload, const SerializedPayload &payload_str) const override;
+
+protected:
+    void init() override;
+    void finalize() override;
+
+private:
+    mutable ShmRingWriter writer_;
+    mutable std::mutex writer_mutex_; // events are pushed from multiple threads, while the ring has one producer
+
+    mutable std::atomic<size_t> written_event_count_ = 0;
+    mutable std::atomic<size_t> dropped_event_count_ = 0;
+};
@@ -1,6 +1,10 @@
 #include "./ws_reverse_service_class.h"
 #include "./service_impl_common.h"
 
+#include "utils/metrics_class.h"
+#include "utils/rolling_stats_class.h"
+#include "event/trace_class.h"
+
 using namespace std;
 using WsClient = SimpleWeb::SocketClient<SimpleWeb::WS>;
 using WssClient = SimpleWeb::SocketClient<SimpleWeb::WSS>;
@@ -9,22 +13,37 @@ template <typename WsClientT>
 shared_ptr<WsClientT> WsReverseService::SubServiceBase::init_ws_reverse_client(const string &server_port_path) {
     auto client = make_shared<WsClientT>(server_port_path);
     client->config.header.emplace("User-Agent", CQAPP_USER_AGENT);
-    if (!config.access_token.empty()) {
-        client->config.header.emplace("Authorization", "Token " + config.access_token);
+    client->config.permessage_deflate = ws_deflate_config();
+    client->config.max_message_size = config.ws_max_message_size;
+    // so that the server can tell the connections apart, "API#2" and so on are all "API"
+    const auto name_str = name();
+    client->config.header.emplace("X-Client-Role", name_str.substr(0, name_str.find('#')));
+    if (const auto access_token = live_config()->access_token; !access_token.empty()) {
+        client->config.header.emplace("Authorization", "Token " + access_token);
     }
+    client->on_open = [&](shared_ptr<typename WsClientT::Connection> connection) {
+        with_unique_lock(reconnect_mutex_, [&]() {
+            reconnect_attempts_ = 0;
+        });
+        on_connected();
+    };
     client->on_close = [&](shared_ptr<typename WsClientT::Connection> connection,
                            int code, string reason) {
+        on_disconnected();
         if (config.ws_reverse_reconnect_on_code_1000 || code != 1000) {
-            with_unique_lock(should_reconnect_mutex_, [&]() {
+            with_unique_lock(reconnect_mutex_, [&]() {
                 should_reconnect_ = true;
             });
+            reconnect_cv_.notify_all();
         }
     };
     client->on_error = [&](shared_ptr<typename WsClientT::Connection> connection,
                            const SimpleWeb::error_code &error_code) {
-        with_unique_lock(should_reconnect_mutex_, [&]() {
+        on_disconnected();
+        with_unique_lock(reconnect_mutex_, [&]() {
             should_reconnect_ = true;
         });
+        reconnect_cv_.notify_all();
     };
     return client;
 }
@@ -33,6 +52,7 @@ void WsReverseService::SubServiceBase::init() {
     Log::d(TAG, u8"初始化反向 WebSocket（" + name() + u8"）");
 
     auto ws_url = url();
+    format_ = wire_format_from_name(config.ws_reverse_format).value_or(WireFormat::JSON);
 
     try {
         if (boost::algorithm::starts_with(ws_url, "ws://")) {
@@ -59,57 +79,52 @@ void WsReverseService::SubServiceBase::finalize() {
 
 void WsReverseService::SubServiceBase::start() {
     if (config.use_ws_reverse) {
-        init();
+        running_ = true;
+        start_client();
+
+        with_unique_lock(reconnect_mutex_, [&]() {
+            should_reconnect_ = false;
+            reconnect_worker_running_ = true;
+            reconnect_attempts_ = 0;
+        });
+        reconnect_worker_thread_ = thread([&]() { reconnect_worker_loop(); });
+    }
+}
+
+void WsReverseService::SubServiceBase::stop() {
+    running_ = false;
+    with_unique_lock(reconnect_mutex_, [&]() {
+        reconnect_worker_running_ = false;
+    });
+    reconnect_cv_.notify_all();
+    if (reconnect_worker_thread_.joinable()) {
+        reconnect_worker_thread_.join();
+    }
+
+    stop_client();
+}
 
-        reconnect_worker_thread_ = thread([&]() {
+void WsReverseService::SubServiceBase::start_client() {
+    init();
+
+    if (client_is_wss_.has_value()) {
+        // client successfully initialized
+        thread_ = thread([&]() {
+            started_ = true;
             try {
-                set_reconnect_worker_running(true);
-                while (is_reconnect_worker_running()) {
-                    auto should_reconn = false;
-                    with_unique_lock(should_reconnect_mutex_, [&]() {
-                        should_reconn = should_reconnect_;
-                        should_reconnect_ = false;
-                    });
-                    if (should_reconn) {
-                        Log::d(TAG, u8"反向 WebSocket（" + name() + u8"）客户端连接失败或异常断开，将在 "
-                               + to_string(config.ws_reverse_reconnect_interval) + u8" 毫秒后尝试重连");
-                        Sleep(config.ws_reverse_reconnect_interval);
-                        stop();
-                        start();
-                    }
-
-                    if (is_reconnect_worker_running()) {
-                        Sleep(500); // wait 500 ms for the next check
-                    } else {
-                        break;
-                    }
+                if (client_is_wss_.value() == false) {
+                    client_.ws->start();
+                } else {
+                    client_.wss->start();
                 }
             } catch (...) {}
+            started_ = false;
         });
-
-        if (client_is_wss_.has_value()) {
-            // client successfully initialized
-            thread_ = thread([&]() {
-                started_ = true;
-                try {
-                    if (client_is_wss_.value() == false) {
-                        client_.ws->start();
-                    } else {
-                        client_.wss->start();
-                    }
-                } catch (...) {}
-                started_ = false;
-            });
-            Log::d(TAG, u8"开启 WebSocket 反向客户端（" + name() + u8"）成功，开始连接 " + url());
-        }
+        Log::d(TAG, u8"开启 WebSocket 反向客户端（" + name() + u8"）成功，开始连接 " + url());
     }
 }
 
-void WsReverseService::SubServiceBase::stop() {
-    set_reconnect_worker_running(false); // this will notify the reconnect worker to stop
-    // detach but not join, because we want the thread continue to run until its next check
-    reconnect_worker_thread_.detach();
-
+void WsReverseService::SubServiceBase::stop_client() {
     if (started_) {
         if (client_is_wss_.value() == false) {
             client_.ws->stop();
@@ -121,10 +136,73 @@ void WsReverseService::SubServiceBase::stop() {
     if (thread_.joinable()) {
         thread_.join();
     }
+    on_disconnected();
 
     finalize();
 }
 
+void WsReverseService::SubServiceBase::reconnect_worker_loop() {
+    static const unsigned MAX_BACKOFF_EXPONENT = 16;
+
+    unique_lock<mutex> lock(reconnect_mutex_);
+    while (true) {
+        reconnect_cv_.wait(lock, [&] { return !reconnect_worker_running_ || should_reconnect_; });
+        if (!reconnect_worker_running_) {
+            break;
+        }
+
+        // exponential backoff from "ws_reverse_reconnect_interval" up to "ws_reverse_reconnect_max_interval",
+        // and a random delay in [backoff / 2, backoff], so that many bots don't reconnect at the same moment
+        const double interval = config.ws_reverse_reconnect_interval;
+        auto backoff = interval * (1u << min(reconnect_attempts_, MAX_BACKOFF_EXPONENT));
+        backoff = max(min(backoff, double(config.ws_reverse_reconnect_max_interval)), interval);
+        const auto delay = static_cast<unsigned long>(backoff / 2 + random_int(0, 1000) / 1000.0 * backoff / 2);
+        reconnect_attempts_++;
+
+        Log::d(TAG, u8"反向 WebSocket（" + name() + u8"）客户端连接失败或异常断开，将在 "
+               + to_string(delay) + u8" 毫秒后尝试重连");
+        if (reconnect_cv_.wait_for(lock, chrono::milliseconds(delay), [&] { return !reconnect_worker_running_; })) {
+            break;
+        }
+
+        should_reconnect_ = false;
+        lock.unlock();
+        // only the client is recreated, this worker keeps running
+        stop_client();
+        start_client();
+        lock.lock();
+    }
+}
+
+bool WsReverseService::SubServiceBase::send(const string &data) const {
+    const unsigned char fin_rsv_opcode = is_binary(format_) ? 130 : 129;
+    try {
+        if (client_is_wss_.value() == false) {
+            const auto send_stream = make_shared<WsClient::SendStream>();
+            *send_stream << data;
+            // the WsClient class is modified by us ("connection" property made public),
+            // so we must maintain the lock manually
+            unique_lock<mutex> lock(client_.ws->connection_mutex);
+            if (!client_.ws->connection) {
+                return false;
+            }
+            client_.ws->connection->send(send_stream, nullptr, fin_rsv_opcode);
+        } else {
+            const auto send_stream = make_shared<WssClient::SendStream>();
+            *send_stream << data;
+            unique_lock<mutex> lock(client_.wss->connection_mutex);
+            if (!client_.wss->connection) {
+                return false;
+            }
+            client_.wss->connection->send(send_stream, nullptr, fin_rsv_opcode);
+        }
+        RollingStats::instance().add_bytes("bytes_sent", "ws_reverse", data.size());
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
 bool WsReverseService::SubServiceBase::good() const {
     if (config.use_ws_reverse) {
         return initialized_ && started_;
@@ -132,7 +210,84 @@ bool WsReverseService::SubServiceBase::good() const {
     return ServiceBase::good();
 }
 
-string WsReverseService::ApiSubService::url() {
+void WsReverseService::start() {
+    use_universal_ = config.ws_reverse_use_universal_client;
+    if (use_universal_) {
+        universal_.start();
+        return;
+    }
+
+    active_api_count_ = max(config.ws_reverse_api_connections, size_t(1));
+    while (apis_.size() < active_api_count_) {
+        apis_.push_back(make_unique<ApiSubService>(apis_.size()));
+    }
+    for (size_t i = 0; i < active_api_count_; i++) {
+        apis_[i]->start();
+    }
+    event_.start();
+}
+
+void WsReverseService::stop() {
+    if (use_universal_) {
+        universal_.stop();
+        return;
+    }
+
+    for (size_t i = 0; i < active_api_count_; i++) {
+        apis_[i]->stop();
+    }
+    active_api_count_ = 0;
+    event_.stop();
+}
+
+bool WsReverseService::initialized() const {
+    if (use_universal_) {
+        return universal_.initialized();
+    }
+    for (size_t i = 0; i < active_api_count_; i++) {
+        if (!apis_[i]->initialized()) return false;
+    }
+    return event_.initialized();
+}
+
+bool WsReverseService::started() const {
+    if (use_universal_) {
+        return universal_.started();
+    }
+    for (size_t i = 0; i < active_api_count_; i++) {
+        if (!apis_[i]->started()) return false;
+    }
+    return event_.started();
+}
+
+bool WsReverseService::good() const {
+    if (use_universal_) {
+        return universal_.good();
+    }
+    for (size_t i = 0; i < active_api_count_; i++) {
+        if (!apis_[i]->good()) return false;
+    }
+    return event_.good();
+}
+
+void WsReverseService::push_event(const json &payload, const SerializedPayload &payload_str) const {
+    if (use_universal_) {
+        universal_.push_event(payload, payload_str);
+    } else {
+        event_.push_event(payload, payload_str);
+    }
+}
+
+json WsReverseService::stats() const {
+    const auto &event = use_universal_ ? static_cast<const EventSubService &>(universal_) : event_;
+    return {
+        {"buffered_events", event.buffered_count()},
+        {"dropped_events", event.dropped_count()},
+        {"unacked_batches", event.unacked_count()}
+    };
+}
+
+string WsReverseService::ApiSubService::url() const {
     return config.ws_reverse_api_url;
 }
 
@@ -140,48 +295,267 @@ void WsReverseService::ApiSubService::init() {
     SubServiceBase::init();
 
     if (client_is_wss_.has_value()) {
+        const auto format = format_;
         if (client_is_wss_.value() == false) {
-            client_.ws->on_message = ws_api_on_message<WsClient>;
+            client_.ws->on_message = [format](auto connection, auto message) {
+                ws_api_on_message<WsClient>(connection, message, format);
+            };
         } else {
-            client_.wss->on_message = ws_api_on_message<WssClient>;
+            client_.wss->on_message = [format](auto connection, auto message) {
+                ws_api_on_message<WssClient>(connection, message, format);
+            };
         }
     }
 }
 
-string WsReverseService::EventSubService::url() {
+string WsReverseService::EventSubService::url() const {
     return config.ws_reverse_event_url;
 }
 
 void WsReverseService::EventSubService::init() {
     SubServiceBase::init();
+
+    filter_ = nullptr;
+    if (!config.ws_reverse_event_filter.empty()) {
+        filter_ = load_filter(sdk->directories().app() + config.ws_reverse_event_filter);
+        if (!filter_) {
+            Log::w(TAG, u8"反向 WebSocket（" + name() + u8"）的过滤规则加载失败，将上报所有事件");
+        }
+    }
+
+    if (batch_ && client_is_wss_.has_value()) {
+        // the event client receives nothing but acknowledgements
+        if (client_is_wss_.value() == false) {
+            client_.ws->on_message = [this](auto connection, auto message) { handle_ack(message->string()); };
+        } else {
+            client_.wss->on_message = [this](auto connection, auto message) { handle_ack(message->string()); };
+        }
+    }
 }
 
-void WsReverseService::EventSubService::push_event(const json &payload) const {
-    if (started_) {
+void WsReverseService::EventSubService::start() {
+    batch_ = config.use_ws_reverse && config.ws_reverse_event_batch;
+    if (batch_) {
+        {
+            unique_lock<mutex> lock(buffer_mutex_);
+            batch_worker_running_ = true;
+        }
+        batch_worker_thread_ = thread([&]() { batch_worker_loop(); });
+    }
+    SubServiceBase::start();
+}
+
+void WsReverseService::EventSubService::stop() {
+    SubServiceBase::stop();
+    if (batch_worker_thread_.joinable()) {
+        with_unique_lock(buffer_mutex_, [&]() {
+            batch_worker_running_ = false;
+        });
+        batch_cv_.notify_all();
+        batch_worker_thread_.join();
+    }
+}
+
+void WsReverseService::EventSubService::batch_worker_loop() {
+    unique_lock<mutex> lock(buffer_mutex_);
+    while (true) {
+        batch_cv_.wait(lock, [&] { return !batch_worker_running_ || connected_ && !pending_.empty(); });
+        if (!batch_worker_running_) {
+            break;
+        }
+
+        // wait for more events until the batch is full or its first event has waited long enough
+        const auto batch_size = max(config.ws_reverse_batch_size, size_t(1));
+        batch_cv_.wait_until(lock, pending_since_ + chrono::milliseconds(config.ws_reverse_batch_interval),
+                             [&] { return !batch_worker_running_ || pending_.size() >= batch_size; });
+        if (!batch_worker_running_) {
+            break;
+        }
+
+        const auto count = min(pending_.size(), batch_size);
+        vector<const string *> elements;
+        for (size_t i = 0; i < count; i++) {
+            elements.push_back(pending_[i].get());
+        }
+        const auto seq = next_batch_seq_++;
+        const auto seq_str = wire_dump(seq, format_);
+        const auto events_str = wire_join_array(elements, format_);
+        Batch batch{seq, make_shared<string>(wire_join_object({{"batch_seq", &seq_str}, {"events", &events_str}},
+                                                              format_)), count};
+        pending_.erase(pending_.begin(), pending_.begin() + count); // the rest, if any, go in the next batch at once
+
+        if (unacked_.size() >= max(config.ws_reverse_batch_max_unacked, size_t(1))) {
+            dropped_count_ += unacked_.front().event_count;
+            Log::w(TAG, u8"反向 WebSocket（" + name() + u8"）未确认的事件批次过多，最早的批次 "
+                   + to_string(unacked_.front().seq) + u8" 已丢弃");
+            unacked_.pop_front();
+        }
+        unacked_.push_back(batch);
+
+        if (connected_) {
+            // sent with the lock held, so that the batches are never reordered with the ones sent on reconnect
+            const auto start = Metrics::Clock::now();
+            const auto succeeded = send(*batch.frame);
+            Metrics::instance().observe_post("ws_reverse", Metrics::seconds_since(start), succeeded);
+            Log::d(TAG, u8"通过 WebSocket 反向客户端上报批次 " + to_string(seq) + u8"（" + to_string(count)
+                   + u8" 个事件）" + (succeeded ? u8"成功" : u8"失败，将在重连后重新上报"));
+        }
+    }
+}
+
+bool WsReverseService::EventSubService::handle_ack(const string &message) const {
+    if (message.find("ack") == string::npos) {
+        return false; // not worth parsing
+    }
+    uint64_t acked_seq;
+    try {
+        const auto j = wire_parse(message, format_);
+        const auto it = j.find("ack");
+        if (!j.is_object() || it == j.end() || !it->is_number_unsigned() || j.count("action")) {
+            return false;
+        }
+        acked_seq = it->get<uint64_t>();
+    } catch (invalid_argument &) {
+        return false;
+    }
+
+    unique_lock<mutex> lock(buffer_mutex_);
+    while (!unacked_.empty() && unacked_.front().seq <= acked_seq) {
+        unacked_.pop_front();
+    }
+    return true;
+}
+
+size_t WsReverseService::EventSubService::unacked_count() const {
+    unique_lock<mutex> lock(buffer_mutex_);
+    return unacked_.size();
+}
+
+void WsReverseService::EventSubService::push_event(const json &payload, const SerializedPayload &payload_str) const {
+    // not "started_", which is false from a disconnection until the reconnection, when the events are buffered
+    if (running_) {
+        if (filter_ && !filter_->eval(payload)) {
+            Metrics::instance().count_filtered("ws_reverse");
+            Log::d(TAG, u8"事件不符合反向 WebSocket（" + name() + u8"）的过滤规则，不上报");
+            return;
+        }
+
+        const auto encoded = is_binary(format_) ? make_shared<string>(wire_dump(payload, format_)) : payload_str;
+
+        if (batch_) {
+            unique_lock<mutex> lock(buffer_mutex_);
+            const auto max_pending = max(config.ws_reverse_batch_size, size_t(1))
+                                     * max(config.ws_reverse_batch_max_unacked, size_t(1));
+            if (!connected_ && pending_.size() >= max_pending) {
+                // disconnected for too long, drop the oldest one
+                pending_.pop_front();
+                dropped_count_++;
+                Metrics::instance().observe_post("ws_reverse", 0, false);
+            }
+            if (pending_.empty()) {
+                pending_since_ = chrono::steady_clock::now();
+            }
+            pending_.push_back(encoded);
+            if (pending_.size() == 1 || pending_.size() >= config.ws_reverse_batch_size) {
+                batch_cv_.notify_one();
+            }
+            EventTrace::mark("ws_reverse");
+            return;
+        }
+
+        {
+            unique_lock<mutex> lock(buffer_mutex_);
+            if (!connected_) {
+                // keep it until reconnected
+                if (buffer_.size() < config.ws_reverse_event_buffer_size) {
+                    buffer_.push_back(encoded);
+                    Log::d(TAG, u8"反向 WebSocket（" + name() + u8"）未连接，事件已暂存，将在重连后上报");
+                } else {
+                    dropped_count_++;
+                    Metrics::instance().observe_post("ws_reverse", 0, false);
+                    Log::d(TAG, u8"反向 WebSocket（" + name() + u8"）未连接，事件已丢弃");
+                }
+                EventTrace::mark("ws_reverse");
+                return;
+            }
+        }
+
         Log::d(TAG, u8"开始通过 WebSocket 反向客户端上报事件");
 
-        bool succeeded;
-        try {
-            if (client_is_wss_.value() == false) {
-                const auto send_stream = make_shared<WsClient::SendStream>();
-                *send_stream << payload.dump();
-                // the WsClient class is modified by us ("connection" property made public),
-                // so we must maintain the lock manually
-                unique_lock<mutex> lock(client_.ws->connection_mutex);
-                client_.ws->connection->send(send_stream);
-                lock.unlock();
-            } else {
-                const auto send_stream = make_shared<WssClient::SendStream>();
-                *send_stream << payload.dump();
-                unique_lock<mutex> lock(client_.wss->connection_mutex);
-                client_.wss->connection->send(send_stream);
-                lock.unlock();
+        const auto start = Metrics::Clock::now();
+        const auto succeeded = send(*encoded);
+        Metrics::instance().observe_post("ws_reverse", Metrics::seconds_since(start), succeeded);
+        EventTrace::mark("ws_reverse");
+
+        Log::d(TAG, u8"通过 WebSocket 反向客户端上报数据到 " + url() + (succeeded ? u8" 成功" : u8" 失败"));
+    }
+}
+
+size_t WsReverseService::EventSubService::buffered_count() const {
+    unique_lock<mutex> lock(buffer_mutex_);
+    return buffer_.size();
+}
+
+void WsReverseService::EventSubService::on_connected() {
+    unique_lock<mutex> lock(buffer_mutex_);
+    if (batch_) {
+        // the server may or may not have received them before the connection was lost
+        if (!unacked_.empty()) {
+            Log::d(TAG, u8"反向 WebSocket（" + name() + u8"）已重连，开始重新上报 " + to_string(unacked_.size())
+                   + u8" 个未确认的事件批次");
+        }
+        for (const auto &batch : unacked_) {
+            if (!send(*batch.frame)) {
+                return;
             }
-            succeeded = true;
-        } catch (...) {
-            succeeded = false;
         }
+        connected_ = true;
+        batch_cv_.notify_all(); // then the events kept while disconnected
+        return;
+    }
 
-        Log::d(TAG, u8"通过 WebSocket 反向客户端上报数据到 " + config.ws_reverse_event_url + (succeeded ? u8" 成功" : u8" 失败"));
+    // send the buffered events before any new one, which waits for the lock
+    if (!buffer_.empty()) {
+        Log::d(TAG, u8"反向 WebSocket（" + name() + u8"）已重连，开始上报暂存的 " + to_string(buffer_.size()) + u8" 个事件");
+    }
+    while (!buffer_.empty()) {
+        if (!send(*buffer_.front())) {
+            return; // disconnected again, keep the rest
+        }
+        buffer_.pop_front();
+    }
+    connected_ = true;
+}
+
+void WsReverseService::EventSubService::on_disconnected() {
+    unique_lock<mutex> lock(buffer_mutex_);
+    connected_ = false;
+}
+
+string WsReverseService::UniversalSubService::url() const {
+    return config.ws_reverse_url;
+}
+
+void WsReverseService::UniversalSubService::init() {
+    EventSubService::init();
+
+    // API calls (and acknowledgements in the batch mode) are received on the same connection as events are sent
+    if (client_is_wss_.has_value()) {
+        const auto format = format_;
+        if (client_is_wss_.value() == false) {
+            client_.ws->on_message = [this, format](auto connection, auto message) {
+                auto message_str = message->string();
+                if (!batch_ || !handle_ack(message_str)) {
+                    ws_api_on_message<WsClient>(connection, move(message_str), format);
+                }
+            };
+        } else {
+            client_.wss->on_message = [this, format](auto connection, auto message) {
+                auto message_str = message->string();
+                if (!batch_ || !handle_ack(message_str)) {
+                    ws_api_on_message<WssClient>(connection, move(message_str), format);
+                }
+            };
+        }
     }
 }
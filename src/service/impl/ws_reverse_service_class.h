@@ -4,40 +4,34 @@
 #include "../pushable_interface.h"
 #include "web_server/client_ws.hpp"
 #include "web_server/client_wss.hpp"
+#include "event/filter.h"
+#include "utils/wire_format.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+
+/**
+ * Reverse WebSocket clients, either "ws_reverse_api_connections" API clients and one event client,
+ * or one universal client (if "ws_reverse_use_universal_client" is set) which handles both on the same connection.
+ */
 class WsReverseService final : public ServiceBase, public IPushable {
 public:
-    void start() override {
-        api_.start();
-        event_.start();
-    }
-
-    void stop() override {
-        api_.stop();
-        event_.stop();
-    }
-
-    bool initialized() const override {
-        return api_.initialized() && event_.initialized();
-    }
+    void start() override;
+    void stop() override;
+    bool initialized() const override;
+    bool started() const override;
+    bool good() const override;
 
-    bool started() const override {
-        return api_.started() && event_.started();
-    }
+    void push_event(const json &payload, const SerializedPayload &payload_str) const override;
 
-    bool good() const override {
-        return api_.good() && event_.good();
-    }
-
-    void push_event(const json &payload) const override {
-        event_.push_event(payload);
-    }
+    json stats() const override;
 
 private:
     class SubServiceBase : public ServiceBase {
     public:
-        virtual std::string name() = 0;
-        virtual std::string url() = 0;
+        virtual std::string name() const = 0;
+        virtual std::string url() const = 0;
 
         void start() override;
         void stop() override;
@@ -47,6 +41,19 @@ private:
         void init() override;
         void finalize() override;
 
+        /**
+         * Called in the client's thread when the connection is opened or closed (or failed).
+         */
+        virtual void on_connected() {}
+        virtual void on_disconnected() {}
+
+        /**
+         * Send a frame on the current connection, a binary one if "format_" is binary.
+         *
+         * \return false if there is no connection or failed to send
+         */
+        bool send(const std::string &data) const;
+
         union Client {
             std::shared_ptr<SimpleWeb::SocketClient<SimpleWeb::WS>> ws;
             std::shared_ptr<SimpleWeb::SocketClient<SimpleWeb::WSS>> wss;
@@ -58,51 +65,128 @@ private:
         Client client_;
         std::optional<bool> client_is_wss_;
         std::thread thread_;
+        // between start() and stop(), unlike "started_", which is false while reconnecting
+        std::atomic<bool> running_ = false;
+        WireFormat format_ = WireFormat::JSON; // from "ws_reverse_format", for both events and API calls
 
     private:
         template <typename WsClientT>
         std::shared_ptr<WsClientT> init_ws_reverse_client(const std::string &server_port_path);
 
+        void start_client();
+        void stop_client();
+        void reconnect_worker_loop();
+
+        // the reconnect worker sleeps until a connection is closed or failed, instead of polling
         bool should_reconnect_ = false;
-        std::mutex should_reconnect_mutex_;
-        std::thread reconnect_worker_thread_;
         bool reconnect_worker_running_ = false;
-        std::mutex reconnect_worker_running_mutex_;
-
-        bool is_reconnect_worker_running() {
-            std::unique_lock<std::mutex> lock(reconnect_worker_running_mutex_);
-            return reconnect_worker_running_;
-        }
-
-        void set_reconnect_worker_running(const bool yes_or_no) {
-            std::unique_lock<std::mutex> lock(reconnect_worker_running_mutex_);
-            reconnect_worker_running_ = yes_or_no;
-        }
+        unsigned reconnect_attempts_ = 0; // failed attempts since the last successful connection, for backoff
+        std::mutex reconnect_mutex_;
+        std::condition_variable reconnect_cv_;
+        std::thread reconnect_worker_thread_;
     };
 
     class ApiSubService final : public SubServiceBase {
     public:
-        std::string name() override {
-            return "API";
+        explicit ApiSubService(const size_t index) : index_(index) {}
+
+        std::string name() const override {
+            return index_ == 0 ? "API" : "API#" + std::to_string(index_ + 1);
         }
 
-        std::string url() override;
+        std::string url() const override;
 
     protected:
         void init() override;
-    } api_;
 
-    class EventSubService final : public SubServiceBase, public IPushable {
+    private:
+        size_t index_;
+    };
+
+    /**
+     * If "ws_reverse_event_batch" is set, events are sent in batches instead, as
+     * {"batch_seq": N, "events": [...]}, each of at most "ws_reverse_batch_size" events and sent at most
+     * "ws_reverse_batch_interval" ms after its first event. The server acknowledges the batches it has received
+     * (cumulatively) with {"ack": N}, and the unacknowledged ones (at most "ws_reverse_batch_max_unacked")
+     * are sent again after reconnecting, so that every event is delivered at least once.
+     * Events generated while disconnected wait in "pending_", and are batched and sent after reconnecting.
+     */
+    class EventSubService : public SubServiceBase, public IPushable {
     public:
-        std::string name() override {
+        std::string name() const override {
             return "Event";
         }
 
-        std::string url() override;
+        std::string url() const override;
 
-        void push_event(const json &payload) const override;
+        void start() override;
+        void stop() override;
+
+        void push_event(const json &payload, const SerializedPayload &payload_str) const override;
+
+        size_t buffered_count() const;
+        size_t dropped_count() const { return dropped_count_; }
+        size_t unacked_count() const;
+
+    protected:
+        void init() override;
+        void on_connected() override;
+        void on_disconnected() override;
+
+        /**
+         * Handle the message if it's an acknowledgement of batches.
+         *
+         * \return false if it's not one, e.g. an API call on the universal client
+         */
+        bool handle_ack(const std::string &message) const;
+
+        bool batch_ = false; // "ws_reverse_event_batch"
+
+    private:
+        std::shared_ptr<IFilter> filter_; // loaded from "ws_reverse_event_filter", null if not set
+
+        // events (already encoded in "format_") generated while disconnected,
+        // sent on reconnect (at most "ws_reverse_event_buffer_size")
+        mutable std::deque<SerializedPayload> buffer_;
+        mutable std::mutex buffer_mutex_;
+        bool connected_ = false; // guarded by "buffer_mutex_"
+        mutable std::atomic<size_t> dropped_count_ = 0;
+
+        struct Batch {
+            uint64_t seq;
+            SerializedPayload frame;
+            size_t event_count;
+        };
+
+        // the following are for the batch mode, also guarded by "buffer_mutex_"
+        // events of the next batches, kept here while disconnected (at most as many as "unacked_" may hold)
+        mutable std::deque<SerializedPayload> pending_;
+        mutable std::chrono::steady_clock::time_point pending_since_;
+        mutable std::deque<Batch> unacked_;
+        mutable uint64_t next_batch_seq_ = 1;
+        bool batch_worker_running_ = false;
+        mutable std::condition_variable batch_cv_;
+        std::thread batch_worker_thread_;
+
+        void batch_worker_loop();
+    };
+
+    class UniversalSubService final : public EventSubService {
+    public:
+        std::string name() const override {
+            return "Universal";
+        }
+
+        std::string url() const override;
 
     protected:
         void init() override;
-    } event_;
+    };
+
+    // the API clients are kept once created, and only the first "active_api_count_" of them are started
+    std::vector<std::unique_ptr<ApiSubService>> apis_;
+    size_t active_api_count_ = 0;
+    EventSubService event_;
+    UniversalSubService universal_;
+    bool use_universal_ = false;
 };
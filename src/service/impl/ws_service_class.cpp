@@ -1,8 +1,12 @@
 #include "./ws_service_class.h"
 #include "./service_impl_common.h"
 
+#include "utils/metrics_class.h"
+#include "utils/rolling_stats_class.h"
+#include "event/trace_class.h"
+#include "event/journal_class.h"
+
 using namespace std;
-using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
 
 void WsService::init() {
     Log::d(TAG, u8"初始化 WebSocket");
@@ -17,23 +21,70 @@ void WsService::init() {
             *send_stream << "authorization failed";
             connection->send(send_stream);
             connection->send_close(1000); // we don't want this client any more
-            return;
+            return false;
         }
+        return true;
     };
 
     server_ = make_shared<WsServer>();
 
     auto &api_endpoint = server_->endpoint["^/api/?$"];
     api_endpoint.on_open = on_open_callback;
-    api_endpoint.on_message = ws_api_on_message<WsServer>;
+    api_endpoint.on_message = [](shared_ptr<WsServer::Connection> connection,
+                                 shared_ptr<WsServer::Message> message) {
+        ws_api_on_message<WsServer>(connection, message, ws_connection_format(connection->query_string));
+    };
 
     auto &event_endpoint = server_->endpoint["^/event/?$"];
-    event_endpoint.on_open = on_open_callback;
+    event_endpoint.on_open = [this, on_open_callback](shared_ptr<WsServer::Connection> connection) {
+        if (!on_open_callback(connection)) {
+            return;
+        }
+
+        // the client can subscribe to only part of the events, by giving a filter in the query string,
+        // which is compiled only once here
+        shared_ptr<IFilter> filter;
+        json args = SimpleWeb::QueryString::parse(connection->query_string);
+        if (const auto it = args.find("filter"); it != args.end() && it->is_string()) {
+            try {
+                filter = construct_filter(json::parse(it->get<string>()));
+            } catch (invalid_argument &e) {
+                Log::d(TAG, string(u8"WebSocket 客户端提供的过滤规则无效，已关闭连接，错误信息：") + e.what());
+                connection->send_close(1008, "invalid filter");
+                return;
+            }
+            Log::d(TAG, u8"WebSocket 客户端已设置过滤规则");
+        }
+
+        // the client can ask for the events it missed, if the journal is enabled
+        uint64_t resume_from = 0;
+        if (const auto it = args.find("resume_from"); it != args.end() && it->is_string()) {
+            try {
+                resume_from = stoull(it->get<string>());
+            } catch (exception &) {}
+        }
+
+        const auto subscriber = add_event_subscriber(connection, move(filter),
+                                                     ws_connection_format(connection->query_string));
+        if (resume_from > 0 && EventJournal::instance().started()) {
+            replay_events(subscriber, resume_from);
+        }
+    };
+    event_endpoint.on_close = [this](shared_ptr<WsServer::Connection> connection, int, const string &) {
+        remove_event_subscriber(connection.get());
+    };
+    event_endpoint.on_error = [this](shared_ptr<WsServer::Connection> connection, const SimpleWeb::error_code &) {
+        remove_event_subscriber(connection.get());
+    };
 
     ServiceBase::init();
 }
 
 void WsService::finalize() {
+    {
+        unique_lock<mutex> lock(event_subscribers_write_mutex_);
+        atomic_store(&event_subscribers_, make_shared<const EventSubscriberList>());
+    }
     server_ = nullptr;
     ServiceBase::finalize();
 }
@@ -41,10 +92,22 @@ void WsService::finalize() {
 void WsService::start() {
     if (config.use_ws) {
         init();
+        stopping_ = false;
 
         server_->config.thread_pool_size = server_thread_pool_size();
+        server_->config.io_service_per_thread = config.server_io_service_per_thread;
         server_->config.address = config.ws_host;
         server_->config.port = config.ws_port;
+        server_->config.permessage_deflate = ws_deflate_config();
+        server_->config.max_message_size = config.ws_max_message_size;
+
+        if (uses_http_port()) {
+            // the connections run in the io_service of the HTTP server, no thread of our own is needed
+            started_ = true;
+            Log::d(TAG, u8"开启 API WebSocket 服务器成功，与 HTTP 服务器共用端口 " + to_string(config.port));
+            return;
+        }
+
         thread_ = thread([&]() {
             started_ = true;
             try {
@@ -58,6 +121,12 @@ void WsService::start() {
 }
 
 void WsService::stop() {
+    // the replays running in "pool" use this service until they finish, which they do soon after this
+    stopping_ = true;
+    while (replays_in_flight_ > 0) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+
     if (started_) {
         server_->stop();
         started_ = false;
@@ -68,6 +137,28 @@ void WsService::stop() {
     finalize();
 }
 
+bool WsService::uses_http_port() {
+    return config.use_http && config.ws_use_http_port;
+}
+
+void WsService::upgrade(unique_ptr<SimpleWeb::HTTP> &socket,
+                        shared_ptr<SimpleWeb::Server<SimpleWeb::HTTP>::Request> request) const {
+    const auto server = server_;
+    if (!started_ || !server) {
+        return; // the socket is closed along with the HTTP connection
+    }
+
+    auto connection = make_shared<WsServer::Connection>(move(socket));
+    connection->method = move(request->method);
+    connection->path = move(request->path);
+    connection->query_string = move(request->query_string);
+    connection->http_version = move(request->http_version);
+    connection->header = move(request->header);
+    connection->remote_endpoint_address = move(request->remote_endpoint_address);
+    connection->remote_endpoint_port = request->remote_endpoint_port;
+    server->upgrade(connection);
+}
+
 bool WsService::good() const {
     if (config.use_ws) {
         return initialized_ && started_;
@@ -75,22 +166,205 @@ bool WsService::good() const {
     return ServiceBase::good();
 }
 
-void WsService::push_event(const json &payload) const {
-    if (started_) {
-        Log::d(TAG, u8"开始通过 WebSocket 服务端推送事件");
-        size_t total_count = 0;
-        size_t succeeded_count = 0;
-        for (const auto &connection : server_->get_connections()) {
-            if (boost::algorithm::starts_with(connection->path, "/event")) {
-                total_count++;
+WsService::EventSubscriber WsService::add_event_subscriber(const shared_ptr<WsServer::Connection> &connection,
+                                                           shared_ptr<IFilter> filter, const WireFormat format) const {
+    EventSubscriber subscriber{
+        connection, make_shared<atomic<size_t>>(0), move(filter), format, make_shared<atomic<uint64_t>>(0)
+    };
+    unique_lock<mutex> lock(event_subscribers_write_mutex_);
+    auto subscribers = make_shared<EventSubscriberList>(*atomic_load(&event_subscribers_));
+    subscribers->push_back(subscriber);
+    atomic_store(&event_subscribers_, shared_ptr<const EventSubscriberList>(move(subscribers)));
+    return subscriber;
+}
+
+void WsService::remove_event_subscriber(const WsServer::Connection *connection) const {
+    unique_lock<mutex> lock(event_subscribers_write_mutex_);
+    const auto old_subscribers = atomic_load(&event_subscribers_);
+    auto subscribers = make_shared<EventSubscriberList>();
+    subscribers->reserve(old_subscribers->size());
+    for (const auto &subscriber : *old_subscribers) {
+        if (subscriber.connection.get() != connection) {
+            subscribers->push_back(subscriber);
+        }
+    }
+    atomic_store(&event_subscribers_, shared_ptr<const EventSubscriberList>(move(subscribers)));
+}
+
+bool WsService::is_event_subscriber(const WsServer::Connection *connection) const {
+    const auto subscribers = atomic_load(&event_subscribers_);
+    return any_of(subscribers->cbegin(), subscribers->cend(), [connection](const EventSubscriber &subscriber) {
+        return subscriber.connection.get() == connection;
+    });
+}
+
+void WsService::replay_events(const EventSubscriber &subscriber, const uint64_t from_seq) const {
+    static const size_t BATCH_SIZE = 256;
+    static const auto STALL_TIMEOUT = chrono::seconds(30); // for a client that stops receiving but stays connected
+
+    // the subscriber is added before reading the last sequence number, so every event after it is pushed normally,
+    // and the ones up to it are skipped by push_event from now on (a few may be sent twice, but none is missed)
+    const auto until_seq = EventJournal::instance().last_seq();
+    *subscriber.replayed_until = until_seq;
+    if (from_seq > until_seq) {
+        return;
+    }
+
+    Log::d(TAG, u8"开始向 WebSocket 客户端补发事件，从序号 " + to_string(from_seq) + u8" 到 " + to_string(until_seq));
+    const auto replay = [this, subscriber, from_seq, until_seq] {
+        struct InFlightGuard {
+            atomic<size_t> &count;
+            ~InFlightGuard() { count--; }
+        } in_flight_guard{replays_in_flight_};
+
+        const auto &connection = subscriber.connection;
+        const auto &depth = subscriber.queue_depth;
+        const auto replaying = [&] { return !stopping_ && is_event_subscriber(connection.get()); };
+        auto seq = from_seq;
+        size_t sent_count = 0;
+        while (seq <= until_seq && replaying()) {
+            const auto records = EventJournal::instance().read(seq, BATCH_SIZE, until_seq);
+            if (records.empty()) {
+                break;
+            }
+            for (const auto &record : records) {
+                // the events are parsed again only if the subscriber needs it
+                const auto needs_parsing = subscriber.filter || is_binary(subscriber.format);
+                json payload;
+                try {
+                    payload = needs_parsing ? json::parse(record.data) : json();
+                } catch (invalid_argument &) {
+                    Log::w(TAG, u8"事件日志中序号为 " + to_string(record.seq) + u8" 的事件已损坏，跳过");
+                    continue;
+                }
+                if (subscriber.filter && !subscriber.filter->eval(payload)) {
+                    continue;
+                }
                 try {
                     const auto send_stream = make_shared<WsServer::SendStream>();
-                    *send_stream << payload.dump();
-                    connection->send(send_stream);
-                    succeeded_count++;
+                    *send_stream << (is_binary(subscriber.format) ? wire_dump(payload, subscriber.format) : record.data);
+                    (*depth)++;
+                    RollingStats::instance().add_bytes("bytes_sent", "ws", send_stream->size());
+                    connection->send(send_stream, [depth](const SimpleWeb::error_code &) { (*depth)--; },
+                                     is_binary(subscriber.format) ? 130 : 129);
+                    sent_count++;
                 } catch (...) {}
             }
+            seq = records.back().seq + 1;
+
+            // don't queue the whole journal in memory at once
+            const auto stall_deadline = chrono::steady_clock::now() + STALL_TIMEOUT;
+            while (*depth >= BATCH_SIZE && replaying()) {
+                if (chrono::steady_clock::now() >= stall_deadline) {
+                    Log::w(TAG, u8"WebSocket 客户端长时间未接收补发的事件，已断开连接");
+                    connection->send_close(1008, "event replay stalled");
+                    break;
+                }
+                this_thread::sleep_for(chrono::milliseconds(10));
+            }
+            if (*depth >= BATCH_SIZE) {
+                break;
+            }
         }
-        Log::d(TAG, u8"已成功向 " + to_string(succeeded_count) + "/" + to_string(total_count) + u8" 个 WebSocket 客户端推送事件");
+        Log::d(TAG, u8"已向 WebSocket 客户端补发 " + to_string(sent_count) + u8" 个事件");
+    };
+
+    replays_in_flight_++;
+    if (pool) {
+        pool->push(TaskPriority::LOW, [replay](int) { replay(); });
+    } else {
+        replay();
     }
 }
+
+void WsService::push_event(const json &payload, const SerializedPayload &payload_str) const {
+    if (started_) {
+        Log::d(TAG, u8"开始通过 WebSocket 服务端推送事件");
+        const auto start = Metrics::Clock::now();
+        const auto subscribers = atomic_load(&event_subscribers_);
+        size_t succeeded_count = 0;
+        size_t filtered_count = 0;
+
+        // the binary formats are encoded only if some subscriber asks for them, and only once for all of them
+        SerializedPayload encoded[] = {payload_str, nullptr, nullptr};
+        auto encoded_payload = [&](const WireFormat format) -> const string & {
+            auto &e = encoded[static_cast<size_t>(format)];
+            if (!e) {
+                e = make_shared<string>(wire_dump(payload, format));
+            }
+            return *e;
+        };
+
+        const auto seq_it = payload.find("journal_seq");
+        const auto seq = seq_it != payload.end() ? seq_it->get<uint64_t>() : 0;
+
+        for (const auto &subscriber : *subscribers) {
+            const auto &connection = subscriber.connection;
+            const auto &depth = subscriber.queue_depth;
+
+            if (seq > 0 && seq <= *subscriber.replayed_until) {
+                continue; // sent by replay_events
+            }
+
+            if (subscriber.filter && !subscriber.filter->eval(payload)) {
+                filtered_count++;
+                continue;
+            }
+
+            if (config.ws_event_queue_size > 0 && *depth >= config.ws_event_queue_size) {
+                // the client is too slow to receive events
+                if (config.ws_event_queue_full_action == "disconnect") {
+                    Log::w(TAG, u8"WebSocket 客户端 " + connection->remote_endpoint_address
+                           + u8" 的事件发送队列已满，已断开连接");
+                    disconnected_count_++;
+                    remove_event_subscriber(connection.get());
+                    connection->send_close(1008, "event queue is full");
+                } else {
+                    Log::d(TAG, u8"WebSocket 客户端 " + connection->remote_endpoint_address
+                           + u8" 的事件发送队列已满，已丢弃事件");
+                    dropped_event_count_++;
+                }
+                continue;
+            }
+
+            try {
+                const auto send_stream = make_shared<WsServer::SendStream>();
+                *send_stream << encoded_payload(subscriber.format);
+                (*depth)++;
+                RollingStats::instance().add_bytes("bytes_sent", "ws", send_stream->size());
+                connection->send(send_stream, [depth](const SimpleWeb::error_code &) { (*depth)--; },
+                                 is_binary(subscriber.format) ? 130 : 129);
+                succeeded_count++;
+            } catch (...) {}
+        }
+        EventTrace::mark("ws");
+        if (filtered_count > 0) {
+            Metrics::instance().count_filtered("ws", filtered_count);
+        }
+        if (subscribers->size() > filtered_count) {
+            Metrics::instance().observe_post("ws", Metrics::seconds_since(start),
+                                             succeeded_count == subscribers->size() - filtered_count);
+        }
+        Log::d(TAG, [&] {
+            return u8"已成功向 " + to_string(succeeded_count) + "/" + to_string(subscribers->size() - filtered_count)
+                   + u8" 个 WebSocket 客户端推送事件";
+        });
+    }
+}
+
+json WsService::stats() const {
+    const auto subscribers = atomic_load(&event_subscribers_);
+    size_t max_depth = 0, total_depth = 0;
+    for (const auto &subscriber : *subscribers) {
+        const size_t depth = *subscriber.queue_depth;
+        max_depth = max(max_depth, depth);
+        total_depth += depth;
+    }
+    return {
+        {"event_connections", subscribers->size()},
+        {"event_queue_depth_max", max_depth},
+        {"event_queue_depth_total", total_depth},
+        {"dropped_events", dropped_event_count_.load()},
+        {"disconnected_slow_clients", disconnected_count_.load()}
+    };
+}
@@ -2,21 +2,82 @@
 
 #include "../service_base_class.h"
 #include "../pushable_interface.h"
+#include "web_server/server_http.hpp"
 #include "web_server/server_ws.hpp"
+#include "event/filter.h"
+#include "utils/wire_format.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 class WsService final : public ServiceBase, public IPushable {
 public:
     void start() override;
     void stop() override;
     bool good() const override;
+    json stats() const override;
+
+    void push_event(const json &payload, const SerializedPayload &payload_str) const override;
 
-    void push_event(const json &payload) const override;
+    /**
+     * Whether the WebSocket server shares the port of the HTTP server ("ws_use_http_port"),
+     * in which case it doesn't listen itself, but takes over the connections through upgrade().
+     */
+    static bool uses_http_port();
+
+    /**
+     * Take over a WebSocket handshake request received by the HTTP server.
+     */
+    void upgrade(std::unique_ptr<SimpleWeb::HTTP> &socket,
+                 std::shared_ptr<SimpleWeb::Server<SimpleWeb::HTTP>::Request> request) const;
 
 protected:
     void init() override;
     void finalize() override;
 
 private:
-    std::shared_ptr<SimpleWeb::SocketServer<SimpleWeb::WS>> server_;
+    using WsServer = SimpleWeb::SocketServer<SimpleWeb::WS>;
+
+    std::shared_ptr<WsServer> server_;
     std::thread thread_;
+
+    struct EventSubscriber {
+        std::shared_ptr<WsServer::Connection> connection;
+
+        // number of events that have been sent to the connection but not yet written to the socket,
+        // used to limit the memory a slow client can take
+        std::shared_ptr<std::atomic<size_t>> queue_depth;
+
+        // given by the client in the "filter" query argument, null if it wants all events
+        std::shared_ptr<IFilter> filter;
+
+        // given by the client in the "format" query argument
+        WireFormat format;
+
+        // events up to this "journal_seq" are sent by replay_events instead of push_event, 0 if not resuming
+        std::shared_ptr<std::atomic<uint64_t>> replayed_until;
+    };
+
+    using EventSubscriberList = std::vector<EventSubscriber>;
+
+    // copy-on-write snapshot of the authorized "/event/" connections, updated on open and close,
+    // so that push_event can read it without locking or copying
+    mutable std::shared_ptr<const EventSubscriberList> event_subscribers_ = std::make_shared<EventSubscriberList>();
+    mutable std::mutex event_subscribers_write_mutex_;
+
+    mutable std::atomic<size_t> dropped_event_count_ = 0;
+    mutable std::atomic<size_t> disconnected_count_ = 0;
+    mutable std::atomic<size_t> replays_in_flight_ = 0; // replay_events running in "pool"
+    std::atomic<bool> stopping_ = false; // tells the replays to give up
+
+    EventSubscriber add_event_subscriber(const std::shared_ptr<WsServer::Connection> &connection,
+                                         std::shared_ptr<IFilter> filter, WireFormat format) const;
+    void remove_event_subscriber(const WsServer::Connection *connection) const;
+    bool is_event_subscriber(const WsServer::Connection *connection) const;
+
+    /**
+     * Send the events in the journal starting at "from_seq" ("resume_from" query argument) to a new subscriber.
+     */
+    void replay_events(const EventSubscriber &subscriber, uint64_t from_seq) const;
 };
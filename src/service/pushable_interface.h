@@ -2,8 +2,13 @@
 
 #include "common.h"
 
+/**
+ * Event payload serialized (only once) to JSON text, shared by all services it's pushed to.
+ */
+using SerializedPayload = std::shared_ptr<const std::string>;
+
 class IPushable {
 public:
     virtual ~IPushable() = default;
-    virtual void push_event(const json &payload) const = 0;
+    virtual void push_event(const json &payload, const SerializedPayload &payload_str) const = 0;
 };
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "common.h"
+
 class ServiceBase {
 public:
     ServiceBase() = default;
@@ -13,6 +15,11 @@ public:
     virtual bool started() const { return started_; }
     virtual bool good() const { return true; }
 
+    /**
+     * Runtime statistics of the service, null if there is nothing to report.
+     */
+    virtual json stats() const { return nullptr; }
+
 protected:
     bool initialized_ = false;
     bool started_ = false;
@@ -22,6 +22,7 @@
 #include "common.h"
 
 #include "utils/pack_class.h"
+#include "utils/json_writer_class.h"
 
 struct Stranger {
     const static size_t MIN_SIZE = 18;
@@ -40,8 +41,8 @@ struct Stranger {
         };
     }
 
-    static Stranger from_bytes(const bytes &bytes) {
-        auto pack = Pack(bytes);
+    static Stranger from_bytes(const std::string_view &bytes) {
+        auto pack = PackView(bytes);
         Stranger stranger;
         stranger.user_id = pack.pop_int<int64_t>();
         stranger.nickname = pack.pop_string();
@@ -64,8 +65,18 @@ struct Group {
         };
     }
 
-    static Group from_bytes(const bytes &bytes) {
-        auto pack = Pack(bytes);
+    /**
+     * Write the same content as json() directly, keys must be in ascending order.
+     */
+    void write_json(JsonWriter &writer) const {
+        writer.begin_object()
+              .field("group_id", group_id)
+              .field("group_name", group_name)
+              .end_object();
+    }
+
+    static Group from_bytes(const std::string_view &bytes) {
+        auto pack = PackView(bytes);
         Group group;
         group.group_id = pack.pop_int<int64_t>();
         group.group_name = pack.pop_string();
@@ -98,13 +109,13 @@ struct GroupMember {
             {"user_id", user_id},
             {"nickname", nickname},
             {"card", card},
-            {"sex", sex == 0 ? "male" : sex == 1 ? "female" : "unknown"},
+            {"sex", sex_str()},
             {"age", age},
             {"area", area},
             {"join_time", join_time},
             {"last_sent_time", last_sent_time},
             {"level", level},
-            {"role",role == 3 ? "owner" : role == 2 ? "admin" : role == 1 ? "member" : "unknown"},
+            {"role", role_str()},
             {"unfriendly", unfriendly},
             {"title", title},
             {"title_expire_time", title_expire_time},
@@ -112,8 +123,39 @@ struct GroupMember {
         };
     }
 
-    static GroupMember from_bytes(const bytes &bytes) {
-        auto pack = Pack(bytes);
+    /**
+     * Write the same content as json() directly, keys must be in ascending order.
+     */
+    void write_json(JsonWriter &writer) const {
+        writer.begin_object()
+              .field("age", age)
+              .field("area", area)
+              .field("card", card)
+              .field("card_changeable", card_changeable)
+              .field("group_id", group_id)
+              .field("join_time", join_time)
+              .field("last_sent_time", last_sent_time)
+              .field("level", level)
+              .field("nickname", nickname)
+              .field("role", role_str())
+              .field("sex", sex_str())
+              .field("title", title)
+              .field("title_expire_time", title_expire_time)
+              .field("unfriendly", unfriendly)
+              .field("user_id", user_id)
+              .end_object();
+    }
+
+    const char *sex_str() const {
+        return sex == 0 ? "male" : sex == 1 ? "female" : "unknown";
+    }
+
+    const char *role_str() const {
+        return role == 3 ? "owner" : role == 2 ? "admin" : role == 1 ? "member" : "unknown";
+    }
+
+    static GroupMember from_bytes(const std::string_view &bytes) {
+        auto pack = PackView(bytes);
         GroupMember member;
         member.group_id = pack.pop_int<int64_t>();
         member.user_id = pack.pop_int<int64_t>();
@@ -148,12 +190,12 @@ struct Anonymous {
         };
     }
 
-    static Anonymous from_bytes(const bytes &bytes) {
-        auto pack = Pack(bytes);
+    static Anonymous from_bytes(const std::string_view &bytes) {
+        auto pack = PackView(bytes);
         Anonymous anonymous;
         anonymous.id = pack.pop_int<int64_t>();
         anonymous.name = pack.pop_string();
-        anonymous.token = pack.pop_token();
+        anonymous.token = std::string(pack.pop_token());
         return anonymous;
     }
 };
@@ -175,8 +217,8 @@ struct GroupFile {
         };
     }
 
-    static GroupFile from_bytes(const bytes &bytes) {
-        auto pack = Pack(bytes);
+    static GroupFile from_bytes(const std::string_view &bytes) {
+        auto pack = PackView(bytes);
         GroupFile file;
         file.id = pack.pop_string();
         file.name = pack.pop_string();
@@ -22,6 +22,11 @@
 #include "app.h"
 
 #include <boost/filesystem.hpp>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
 
 #include "api/api.h"
 #include "utils/http_utils.h"
@@ -49,9 +54,54 @@ static string version_cpk_url(const string &version, const int build_number) {
     return update_source() + "versions/" + version + "(b" + to_string(build_number) + ")/" CQAPP_ID ".cpk";
 }
 
-// return tuple<is_newer, version, build_number, description>
-optional<tuple<bool, string, int, string>> get_latest_version() {
-    const auto data_opt = get_remote_json(latest_url());
+/**
+ * Fetch a JSON file from the update source with a conditional request,
+ * so that an unchanged file is not sent again. The last response is kept in the app's tmp directory.
+ */
+static optional<json> get_update_json(const string &url, const string &cache_filename) {
+    static mutex validators_mutex;
+    static map<string, HttpCacheValidators> validators_by_url;
+
+    const auto path = sdk->directories().app_tmp() + cache_filename;
+    const auto ws_path = s2ws(path);
+
+    HttpCacheValidators validators;
+    with_unique_lock(validators_mutex, [&] { validators = validators_by_url[url]; });
+    if (validators.etag.empty() && validators.last_modified.empty()) {
+        // fetched before the plugin started, fall back to the modification time of the local file
+        boost::system::error_code ec;
+        if (const auto mtime = fs::last_write_time(ws_path, ec); !ec) {
+            validators.last_modified = http_date(mtime);
+        }
+    }
+
+    const auto result = download_remote_file_if_modified(url, path, validators);
+    if (result == DownloadResult::FAILED) {
+        return nullopt;
+    }
+    if (result == DownloadResult::DOWNLOADED) {
+        with_unique_lock(validators_mutex, [&] { validators_by_url[url] = validators; });
+    }
+
+    try {
+        if (ifstream f(ws_path); f.is_open()) {
+            return json::parse(f);
+        }
+    } catch (invalid_argument &) {
+    }
+    return nullopt;
+}
+
+struct LatestVersion {
+    bool is_newer = false;
+    string version;
+    int build_number = 0;
+    string description;
+    string sha256; // checksum of the cpk, empty if the update source doesn't provide it
+};
+
+static optional<LatestVersion> get_latest_version() {
+    const auto data_opt = get_update_json(latest_url(), "update_latest_" + config.update_channel + ".json");
     if (!data_opt) {
         return nullopt;
     }
@@ -60,57 +110,100 @@ optional<tuple<bool, string, int, string>> get_latest_version() {
     if (data.is_object()
         && data.find("version") != data.end() && data["version"].is_string()
         && data.find("build") != data.end() && data["build"].is_number_integer()) {
-        auto version = data["version"].get<string>();
-        auto build_number = data["build"].get<int>();
-        string description;
-        if (const auto info = get_remote_json(version_info_url(version, build_number)).value_or(nullptr);
-            info.is_object() && info.find("description") != info.end() && info["description"].is_string()) {
-            description = info["description"].get<string>();
+        LatestVersion result;
+        result.version = data["version"].get<string>();
+        result.build_number = data["build"].get<int>();
+        result.is_newer = result.build_number > CQAPP_BUILD_NUMBER;
+        if (!result.is_newer) {
+            return result; // no need to fetch the info of the current version
         }
 
-        auto result = make_tuple(false, version, build_number, description);
-        if (data["build"].get<int>() > CQAPP_BUILD_NUMBER) {
-            get<0>(result) = true;
+        const auto info = get_update_json(version_info_url(result.version, result.build_number),
+                                          "update_info_" + result.version + "_build_"
+                                          + to_string(result.build_number) + ".json").value_or(nullptr);
+        if (info.is_object() && info.find("description") != info.end() && info["description"].is_string()) {
+            result.description = info["description"].get<string>();
+        }
+        if (info.is_object() && info.find("sha256") != info.end() && info["sha256"].is_string()) {
+            result.sha256 = boost::algorithm::to_lower_copy(info["sha256"].get<string>());
         }
         return result;
     }
     return nullopt;
 }
 
-bool perform_update(const string &version, const int build_number) {
-    const auto cpk_url = version_cpk_url(version, build_number);
-    const auto tmp_path = sdk->directories().app_tmp() + version + "_build_" + to_string(build_number) + ".cpk";
+static bool perform_update(const LatestVersion &latest) {
+    static const auto TAG = u8"更新";
+
+    const auto cpk_url = version_cpk_url(latest.version, latest.build_number);
+    const auto tmp_path = sdk->directories().app_tmp() + latest.version + "_build_"
+                          + to_string(latest.build_number) + ".cpk";
+    // streamed to the file, so the package is never held in memory as a whole
     if (!download_remote_file(cpk_url, tmp_path, true)) {
         // download failed
         return false;
     }
 
+    if (!latest.sha256.empty()) {
+        if (const auto sha256 = file_sha256_hex(tmp_path); !sha256 || sha256.value() != latest.sha256) {
+            Log::e(TAG, u8"下载的新版本校验失败，可能已损坏或被篡改");
+            boost::system::error_code ec;
+            fs::remove(ansi(tmp_path), ec);
+            return false;
+        }
+    }
+
     const auto local_cpk_path = sdk->directories().coolq() + "app\\" CQAPP_ID ".cpk";
     try {
-        copy_file(ansi(tmp_path), ansi(local_cpk_path), fs::copy_option::overwrite_if_exists);
-        fs::remove(ansi(tmp_path));
+        boost::system::error_code ec;
+        fs::rename(ansi(tmp_path), ansi(local_cpk_path), ec);
+        if (ec) {
+            // e.g. on another volume
+            copy_file(ansi(tmp_path), ansi(local_cpk_path), fs::copy_option::overwrite_if_exists);
+            fs::remove(ansi(tmp_path));
+        }
         return true;
     } catch (fs::filesystem_error &) {
         return false;
     }
 }
 
+static mutex checker_mutex;
+static condition_variable checker_cv;
+static thread checker_thread;
+static bool checking = false;
+static bool skip_delay = false;
+static bool manual_requested = false; // a manual check came while the current one was waiting or running
+static bool cancelled = false;
+
+/**
+ * Whether the plugin is being disabled, so that the check stops before updating or asking the user.
+ */
+static bool check_cancelled() {
+    unique_lock<mutex> lock(checker_mutex);
+    return cancelled;
+}
+
 static void restart_coolq() {
     invoke_api("set_restart");
 }
 
-void check_update(const bool is_automatically) {
+static void check_update(const bool is_automatically) {
     static const auto TAG = u8"检查更新";
 
     if (is_automatically) Log::i(TAG, u8"正在检查更新...");
 
-    if (const auto version_opt = get_latest_version(); version_opt) {
-        bool is_newer;
-        string version, description;
-        int build_number;
-        tie(is_newer, version, build_number, description) = version_opt.value();
+    const auto latest_opt = get_latest_version();
+    if (check_cancelled()) {
+        return; // disabled while fetching, a message box now would keep "Disable" waiting for the user
+    }
+    if (latest_opt) {
+        const auto &latest = latest_opt.value();
+        const auto &version = latest.version;
+        const auto &description = latest.description;
+        const auto build_number = latest.build_number;
 
-        if (is_newer) {
+        if (latest.is_newer) {
             // should update
             if (is_automatically) Log::i(TAG, u8"发现新版本：" + version + u8", build " + to_string(build_number));
             if (app.is_locked()) {
@@ -121,7 +214,7 @@ void check_update(const bool is_automatically) {
             } else {
                 if (is_automatically && config.auto_perform_update) {
                     // auto update
-                    if (perform_update(version, build_number)) {
+                    if (perform_update(latest)) {
                         Log::i(TAG, u8"更新成功，即将重启酷 Q 以生效");
                         restart_coolq();
                     } else {
@@ -134,7 +227,7 @@ void check_update(const bool is_automatically) {
                                             + (description.empty() ? u8"无" : description)
                                             + u8"\r\n\r\n是否现在更新？");
                     if (code == IDYES) {
-                        if (perform_update(version, build_number)) {
+                        if (perform_update(latest)) {
                             code = message_box(MB_YESNO | MB_ICONQUESTION, u8"更新成功，请重启酷 Q 以生效。\r\n\r\n是否现在重启酷 Q？");
                             if (code == IDYES) {
                                 restart_coolq();
@@ -154,3 +247,65 @@ void check_update(const bool is_automatically) {
         else message_box(MB_OK | MB_ICONERROR, u8"检查更新失败，请检查网络连接是否通畅，或尝试更换更新源。");
     }
 }
+
+
+void check_update_async(const bool is_automatically) {
+    static const auto TAG = u8"检查更新";
+
+    unique_lock<mutex> lock(checker_mutex);
+    if (checking) {
+        // one check at a time, a manual one hurries the one waiting to start, and is done as a manual one
+        if (!is_automatically) {
+            skip_delay = true;
+            manual_requested = true;
+            Log::i(TAG, u8"正在检查更新，请稍候");
+        }
+        cancelled = false;
+        checker_cv.notify_all();
+        return;
+    }
+    checking = true;
+    skip_delay = !is_automatically;
+    manual_requested = false;
+    cancelled = false;
+    if (checker_thread.joinable()) {
+        checker_thread.join(); // the last check has finished, but its thread may not have returned yet
+    }
+
+    // a thread of its own instead of "pool", the update source may be slow and the message boxes wait for the user
+    checker_thread = thread([is_automatically] {
+        SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+
+        unique_lock<mutex> lock(checker_mutex);
+        if (is_automatically && config.auto_check_update_delay > 0) {
+            // spread the checks of many instances sharing the same update source
+            const auto delay = chrono::seconds(random_int(0, config.auto_check_update_delay));
+            checker_cv.wait_for(lock, delay, [] { return skip_delay || cancelled; });
+        }
+
+        auto automatically = is_automatically && !manual_requested;
+        while (!cancelled) {
+            manual_requested = false;
+            lock.unlock();
+            check_update(automatically);
+            lock.lock();
+            if (!manual_requested) {
+                break;
+            }
+            automatically = false; // requested while the automatic check was running, the user expects an answer
+        }
+        checking = false;
+    });
+}
+
+void cancel_update_check() {
+    unique_lock<mutex> lock(checker_mutex);
+    cancelled = true;
+    checker_cv.notify_all();
+
+    // the thread uses "sdk" and "config", so it must be gone before the plugin is disabled or unloaded
+    if (checker_thread.joinable() && checker_thread.get_id() != this_thread::get_id()) {
+        lock.unlock();
+        checker_thread.join();
+    }
+}
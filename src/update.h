@@ -19,4 +19,13 @@
 
 #pragma once
 
-void check_update(const bool is_automatically);
+/**
+ * Check for updates on a low priority thread of its own, at most one check at a time.
+ * An automatic check first waits for a random time within "auto_check_update_delay".
+ */
+void check_update_async(const bool is_automatically);
+
+/**
+ * Cancel the automatic check waiting to start, if any, and wait for a running check to end.
+ */
+void cancel_update_check();
@@ -0,0 +1,73 @@
+#include "./aho_corasick_class.h"
+
+#include <algorithm>
+#include <queue>
+
+using namespace std;
+
+AhoCorasick::AhoCorasick(const vector<string> &keywords) : nodes_(1) {
+    for (const auto &keyword : keywords) {
+        size_t node = 0;
+        for (const unsigned char byte : keyword) {
+            auto next_node = child(node, byte);
+            if (next_node == 0) {
+                next_node = nodes_.size();
+                auto &children = nodes_[node].children;
+                children.insert(lower_bound(children.begin(), children.end(), make_pair(byte, size_t(0))),
+                                {byte, next_node});
+                nodes_.emplace_back();
+            }
+            node = next_node;
+        }
+        nodes_[node].terminal = true;
+    }
+
+    // build fail links in BFS order, so that the fail target of a node is always done before the node itself
+    queue<size_t> q;
+    for (const auto &c : nodes_[0].children) {
+        q.push(c.second);
+    }
+    while (!q.empty()) {
+        const auto node = q.front();
+        q.pop();
+        for (const auto &c : nodes_[node].children) {
+            const auto child_node = c.second;
+            nodes_[child_node].fail = next(nodes_[node].fail, c.first);
+            nodes_[child_node].terminal = nodes_[child_node].terminal || nodes_[nodes_[child_node].fail].terminal;
+            q.push(child_node);
+        }
+    }
+}
+
+size_t AhoCorasick::child(const size_t node, const unsigned char byte) const {
+    const auto &children = nodes_[node].children;
+    const auto it = lower_bound(children.begin(), children.end(), make_pair(byte, size_t(0)));
+    return it != children.end() && it->first == byte ? it->second : 0;
+}
+
+size_t AhoCorasick::next(size_t node, const unsigned char byte) const {
+    while (true) {
+        if (const auto c = child(node, byte); c != 0) {
+            return c;
+        }
+        if (node == 0) {
+            return 0;
+        }
+        node = nodes_[node].fail;
+    }
+}
+
+bool AhoCorasick::contains_any(const string_view &text) const {
+    if (nodes_[0].terminal) {
+        return true; // there is an empty keyword
+    }
+
+    size_t node = 0;
+    for (const unsigned char byte : text) {
+        node = next(node, byte);
+        if (nodes_[node].terminal) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+
+/**
+ * Aho-Corasick automaton over bytes, telling whether a text contains any of a set of keywords in one pass.
+ */
+class AhoCorasick {
+public:
+    explicit AhoCorasick(const std::vector<std::string> &keywords);
+
+    bool contains_any(const std::string_view &text) const;
+
+private:
+    struct Node {
+        std::vector<std::pair<unsigned char, size_t>> children; // sorted by byte
+        size_t fail = 0;
+        bool terminal = false; // some keyword ends here, or at any node on the fail chain
+    };
+
+    std::vector<Node> nodes_;
+
+    size_t child(size_t node, unsigned char byte) const; // return 0 (the root) if not exists
+    size_t next(size_t node, unsigned char byte) const;
+};
@@ -21,6 +21,8 @@ misrepresented as being the original source code.
 
 3. This notice may not be removed or altered from any source distribution.
 
+Altered for CoolQ HTTP API: base64_decode is table-driven, and Base64Decoder is added for incremental decoding.
+
 Renиж Nyffenegger rene.nyffenegger@adp-gmbh.ch
 */
 
@@ -32,11 +34,6 @@ static const std::string base64_chars =
     "abcdefghijklmnopqrstuvwxyz"
     "0123456789+/";
 
-static inline bool is_base64(unsigned char c)
-{
-    return (isalnum(c) || (c == '+') || (c == '/'));
-}
-
 std::string base64_encode(const unsigned char *bytes_to_encode, unsigned int in_len)
 {
     std::string ret;
@@ -81,49 +78,63 @@ std::string base64_encode(const unsigned char *bytes_to_encode, unsigned int in_
     return ret;
 }
 
-std::string base64_decode(const std::string &encoded_string)
+// value of each base64 character, or -1 for the others (including '=')
+static const struct Base64DecodeTable {
+    signed char values[256];
+
+    Base64DecodeTable() {
+        for (auto &v : values)
+            v = -1;
+        for (size_t i = 0; i < base64_chars.size(); i++)
+            values[static_cast<unsigned char>(base64_chars[i])] = static_cast<signed char>(i);
+    }
+} base64_decode_table;
+
+bool Base64Decoder::feed(const char *data, size_t len, std::string &out)
 {
-    int in_len = encoded_string.size();
-    int i = 0;
-    int j = 0;
-    int in_ = 0;
-    unsigned char char_array_4[4], char_array_3[3];
-    std::string ret;
+    if (ended_)
+        return false;
 
-    while (in_len-- && (encoded_string[in_] != '=') && is_base64(encoded_string[in_]))
+    out.reserve(out.size() + (len + count_) / 4 * 3);
+
+    for (size_t pos = 0; pos < len; pos++)
     {
-        char_array_4[i++] = encoded_string[in_];
-        in_++;
-        if (i == 4)
+        const auto v = base64_decode_table.values[static_cast<unsigned char>(data[pos])];
+        if (v < 0)
         {
-            for (i = 0; i < 4; i++)
-                char_array_4[i] = (unsigned char) base64_chars.find(char_array_4[i]);
-
-            char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-            char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-            char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
+            // '=' or any other character ends the data
+            ended_ = true;
+            return false;
+        }
 
-            for (i = 0; (i < 3); i++)
-                ret += char_array_3[i];
-            i = 0;
+        quad_[count_++] = static_cast<unsigned char>(v);
+        if (count_ == 4)
+        {
+            out += static_cast<char>((quad_[0] << 2) | (quad_[1] >> 4));
+            out += static_cast<char>(((quad_[1] & 0xf) << 4) | (quad_[2] >> 2));
+            out += static_cast<char>(((quad_[2] & 0x3) << 6) | quad_[3]);
+            count_ = 0;
         }
     }
+    return true;
+}
 
-    if (i)
-    {
-        for (j = i; j < 4; j++)
-            char_array_4[j] = 0;
-
-        for (j = 0; j < 4; j++)
-            char_array_4[j] = (unsigned char) base64_chars.find(char_array_4[j]);
-
-        char_array_3[0] = (char_array_4[0] << 2) + ((char_array_4[1] & 0x30) >> 4);
-        char_array_3[1] = ((char_array_4[1] & 0xf) << 4) + ((char_array_4[2] & 0x3c) >> 2);
-        char_array_3[2] = ((char_array_4[2] & 0x3) << 6) + char_array_4[3];
-
-        for (j = 0; (j < i - 1); j++)
-            ret += char_array_3[j];
-    }
+void Base64Decoder::finish(std::string &out)
+{
+    // a partial group of n characters carries n - 1 bytes
+    if (count_ >= 2)
+        out += static_cast<char>((quad_[0] << 2) | (quad_[1] >> 4));
+    if (count_ >= 3)
+        out += static_cast<char>(((quad_[1] & 0xf) << 4) | (quad_[2] >> 2));
+    count_ = 0;
+    ended_ = true;
+}
 
+std::string base64_decode(const std::string &encoded_string)
+{
+    std::string ret;
+    Base64Decoder decoder;
+    decoder.feed(encoded_string.data(), encoded_string.size(), ret);
+    decoder.finish(ret);
     return ret;
 }
@@ -4,3 +4,25 @@
 
 std::string base64_encode(const unsigned char *, unsigned int len);
 std::string base64_decode(const std::string &str);
+
+/**
+ * Decode base64 data chunk by chunk, e.g. straight to a file, without holding all the decoded data.
+ * Like base64_decode, decoding stops at the first '=' or non-base64 character.
+ */
+class Base64Decoder {
+public:
+    /**
+     * Decode a chunk and append the result to "out", return false if the end of the data is reached.
+     */
+    bool feed(const char *data, size_t len, std::string &out);
+
+    /**
+     * Append the bytes of the last partial group, if any.
+     */
+    void finish(std::string &out);
+
+private:
+    unsigned char quad_[4]{};
+    size_t count_ = 0;
+    bool ended_ = false;
+};
@@ -23,17 +23,97 @@
 
 #include <curl/curl.h>
 
+#include "utils/deadline_class.h"
+
 using namespace std;
 
+/**
+ * Share DNS cache, TLS sessions and (if supported) the connection cache between all easy handles,
+ * so that requests to the same host can reuse the established connections.
+ */
+static CURLSH *share_handle() {
+    static struct Share {
+        CURLSH *handle;
+        mutex locks[CURL_LOCK_DATA_LAST];
+
+        Share() {
+            handle = curl_share_init();
+            curl_share_setopt(handle, CURLSHOPT_USERDATA, this);
+            curl_share_setopt(handle, CURLSHOPT_LOCKFUNC,
+                              static_cast<curl_lock_function>([](CURL *, curl_lock_data data, curl_lock_access,
+                                                                 void *userptr) {
+                                  static_cast<Share *>(userptr)->locks[data].lock();
+                              }));
+            curl_share_setopt(handle, CURLSHOPT_UNLOCKFUNC,
+                              static_cast<curl_unlock_function>([](CURL *, curl_lock_data data, void *userptr) {
+                                  static_cast<Share *>(userptr)->locks[data].unlock();
+                              }));
+            curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+            curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+            #if LIBCURL_VERSION_NUM >= 0x073900 // 7.57.0
+            curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+            #endif
+        }
+    } share;
+    return share.handle;
+}
+
+/**
+ * Idle easy handles, each of them keeps its own alive connections (if the connection cache is not shared),
+ * and they will be reset and reused by later requests instead of being cleaned up.
+ */
+static struct {
+    vector<CURL *> handles;
+    mutex mtx;
+    const size_t max_idle_count = 16;
+
+    CURL *acquire() {
+        {
+            unique_lock<mutex> lock(mtx);
+            if (!handles.empty()) {
+                const auto handle = handles.back();
+                handles.pop_back();
+                return handle;
+            }
+        }
+        return curl_easy_init();
+    }
+
+    void release(CURL *handle) {
+        curl_easy_reset(handle); // reset options, but keep alive connections and caches
+        unique_lock<mutex> lock(mtx);
+        if (handles.size() < max_idle_count) {
+            handles.push_back(handle);
+        } else {
+            lock.unlock();
+            curl_easy_cleanup(handle);
+        }
+    }
+} idle_handles;
+
 curl::Response curl::Request::send() {
     Response response;
 
-    const auto curl = curl_easy_init();
+    // the whole transfer must end before the deadline of the current thread, if any
+    auto timeout_ms = timeout * 1000;
+    if (const auto remaining = Deadline::remaining()) {
+        if (remaining->count() == 0) {
+            response.curl_code = CURLE_OPERATION_TIMEDOUT;
+            return response;
+        }
+        timeout_ms = timeout_ms > 0 ? min<long>(timeout_ms, long(remaining->count())) : long(remaining->count());
+    }
+
+    const auto curl = idle_handles.acquire();
+    curl_easy_setopt(curl, CURLOPT_SHARE, share_handle());
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
     curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
     curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L); // this is unsafe
 
     if (method == Method::POST) {
         curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    } else if (method == Method::HEAD) {
+        curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
     }
 
     auto header_cb = [](char *buf, size_t size, size_t count, void *headers) {
@@ -43,7 +123,7 @@ curl::Response curl::Request::send() {
         if (sep_pos != string::npos) {
             k = line.substr(0, sep_pos);
             v = line.substr(sep_pos + 1);
-            boost::algorithm::trim_left(v);
+            boost::algorithm::trim(v); // including the "\r\n" at the end of the line
             (*static_cast<Headers *>(headers))[k] = v;
         }
         return size * count;
@@ -76,10 +156,11 @@ curl::Response curl::Request::send() {
 
     if (body.size()) {
         curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body.c_str());
+        curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(body.size())); // may be binary
     }
 
     curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, connect_timeout);
-    curl_easy_setopt(curl, CURLOPT_TIMEOUT, timeout);
+    curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, timeout_ms);
 
     response.curl_code = curl_easy_perform(curl);
 
@@ -98,7 +179,7 @@ curl::Response curl::Request::send() {
     }
 
     curl_slist_free_all(chunk);
-    curl_easy_cleanup(curl);
+    idle_handles.release(curl);
 
     return response;
 }
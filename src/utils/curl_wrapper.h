@@ -57,7 +57,8 @@ namespace curl {
 
     enum class Method {
         GET,
-        POST
+        POST,
+        HEAD
     };
 
     struct Request {
@@ -90,5 +91,10 @@ namespace curl {
             method = Method::POST;
             return send();
         }
+
+        Response head() {
+            method = Method::HEAD;
+            return send();
+        }
     };
 }
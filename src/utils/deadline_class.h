@@ -0,0 +1,59 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+
+/**
+ * The deadline of the work done by the current thread, e.g. an API call with a timeout.
+ * Blocking operations (HTTP requests, waiting in the send queue) give up once it's exceeded,
+ * and work handed over to other threads should carry it there with a Scope.
+ */
+class Deadline {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static std::optional<Clock::time_point> current() { return current_; }
+
+    /**
+     * Time left before the deadline, zero if it's exceeded, or nullopt if there is no deadline.
+     */
+    static std::optional<std::chrono::milliseconds> remaining() {
+        if (!current_) {
+            return std::nullopt;
+        }
+        const auto left = std::chrono::duration_cast<std::chrono::milliseconds>(*current_ - Clock::now());
+        return std::max(left, std::chrono::milliseconds(0));
+    }
+
+    static bool exceeded() { return current_ && Clock::now() >= *current_; }
+
+    /**
+     * Set the deadline of the current thread until the scope ends, an earlier deadline already set is kept.
+     */
+    class Scope {
+    public:
+        explicit Scope(const std::optional<Clock::time_point> deadline) : previous_(current_) {
+            if (deadline && (!current_ || *deadline < *current_)) {
+                current_ = deadline;
+            }
+        }
+
+        /**
+         * No deadline is set if "timeout" is zero.
+         */
+        explicit Scope(const std::chrono::milliseconds timeout)
+            : Scope(timeout.count() > 0 ? std::make_optional(Clock::now() + timeout) : std::nullopt) {}
+
+        ~Scope() { current_ = previous_; }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        std::optional<Clock::time_point> previous_;
+    };
+
+private:
+    static inline thread_local std::optional<Clock::time_point> current_;
+};
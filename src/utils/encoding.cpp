@@ -4,6 +4,9 @@
 
 #include <iconv.h>
 #include <codecvt>
+#include <cerrno>
+#include <unordered_map>
+#include <unordered_set>
 
 using namespace std;
 
@@ -41,33 +44,105 @@ string string_decode(const bytes &b, const Encoding encoding) {
     return ws2s(wstring(multibyte_to_widechar(encoding, b.c_str()).get()));
 }
 
+/**
+ * Iconv descriptors opened by the current thread, keyed by "from_enc>to_enc".
+ * iconv_open is expensive and a descriptor can't be used by several threads at once,
+ * so each thread keeps its own ones until it exits.
+ */
+class IconvCache {
+public:
+    ~IconvCache() {
+        for (const auto &item : cds_) {
+            iconv_close(item.second);
+        }
+    }
+
+    iconv_t get(const string &from_enc, const string &to_enc) {
+        const auto key = from_enc + ">" + to_enc;
+        if (const auto it = cds_.find(key); it != cds_.end()) {
+            // reset the conversion state left by the last call
+            iconv(it->second, nullptr, nullptr, nullptr, nullptr);
+            return it->second;
+        }
+
+        const auto cd = iconv_open(to_enc.c_str(), from_enc.c_str());
+        if (cd != reinterpret_cast<iconv_t>(-1)) {
+            cds_.emplace(key, cd);
+        }
+        return cd;
+    }
+
+private:
+    unordered_map<string, iconv_t> cds_;
+};
+
+static bool is_ascii_compatible(const string &encoding) {
+    static const unordered_set<string> encodings = {
+        "utf-8", "utf8", "gb18030", "gbk", "gb2312", "cp936", "ascii", "us-ascii",
+    };
+    return encodings.find(boost::algorithm::to_lower_copy(encoding)) != encodings.end();
+}
+
+static bool is_ascii(const bytes &text) {
+    return all_of(text.cbegin(), text.cend(), [](const char c) { return static_cast<unsigned char>(c) < 0x80; });
+}
+
 static bytes iconv_convert_encoding(const bytes &text, const string &from_enc, const string &to_enc,
                                     const float capability_factor) {
-    bytes result;
-
-    const auto cd = iconv_open(to_enc.c_str(), from_enc.c_str());
-    auto in = const_cast<char *>(text.data());
-    auto in_bytes_left = text.size();
+    if (text.empty()) {
+        return bytes();
+    }
 
-    if (in_bytes_left == 0) {
-        return result;
+    if (is_ascii(text) && is_ascii_compatible(from_enc) && is_ascii_compatible(to_enc)) {
+        // pure ASCII text is the same in both encodings, no need to convert
+        return text;
     }
 
-    auto out_bytes_left = static_cast<decltype(in_bytes_left)>(static_cast<double>(in_bytes_left) * capability_factor);
-    auto out = new char[out_bytes_left] {0};
-    const auto out_begin = out;
+    thread_local IconvCache cache;
+    thread_local vector<char> buffer;
 
-    try {
-        if (static_cast<size_t>(-1) != iconv(cd, &in, &in_bytes_left, &out, &out_bytes_left)) {
-            // successfully converted
-            result = out_begin;
+    // the buffer is kept for the next conversion of the thread, but not once a huge text has grown it
+    static const size_t MAX_KEPT_BUFFER_SIZE = 64 * 1024;
+    struct BufferTrimmer {
+        ~BufferTrimmer() {
+            if (buffer.capacity() > MAX_KEPT_BUFFER_SIZE) {
+                vector<char>().swap(buffer);
+            }
         }
-    } catch (...) {}
+    } buffer_trimmer;
+
+    const auto cd = cache.get(from_enc, to_enc);
+    if (cd == reinterpret_cast<iconv_t>(-1)) {
+        return bytes();
+    }
+
+    const auto initial_size = static_cast<size_t>(static_cast<double>(text.size()) * capability_factor);
+    if (buffer.size() < initial_size) {
+        buffer.resize(initial_size);
+    }
 
-    delete[] out_begin;
-    iconv_close(cd);
+    auto in = const_cast<char *>(text.data());
+    auto in_bytes_left = text.size();
+    size_t out_used = 0;
+
+    while (true) {
+        auto out = buffer.data() + out_used;
+        auto out_bytes_left = buffer.size() - out_used;
+        const auto ret = iconv(cd, &in, &in_bytes_left, &out, &out_bytes_left);
+        out_used = out - buffer.data();
+
+        if (ret != static_cast<size_t>(-1)) {
+            break; // successfully converted
+        }
+        if (errno != E2BIG) {
+            // invalid or incomplete multibyte sequence
+            return bytes();
+        }
+        // output buffer is full, grow it and continue from where we stopped
+        buffer.resize(max(buffer.size() * 2, size_t(64)));
+    }
 
-    return result;
+    return bytes(buffer.data(), out_used);
 }
 
 bytes iconv_string_encode(const string &s, const string &encoding, const float capability_factor) {
@@ -0,0 +1,89 @@
+#include "./gzip.h"
+
+#include <boost/algorithm/string.hpp>
+#include <vector>
+#include <zlib.h>
+
+using namespace std;
+
+static const size_t CHUNK_SIZE = 16 * 1024;
+
+string gzip_compress(const string &data, const int level) {
+    z_stream stream{};
+    // window bits 15 + 16 for the gzip header and trailer
+    if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return "";
+    }
+
+    string result;
+    result.resize(deflateBound(&stream, static_cast<uLong>(data.size())));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&result[0]);
+    stream.avail_out = static_cast<uInt>(result.size());
+    const auto ret = deflate(&stream, Z_FINISH); // the bound is enough to finish in one call
+    result.resize(ret == Z_STREAM_END ? stream.total_out : 0);
+    deflateEnd(&stream);
+    return result;
+}
+
+optional<string> gzip_decompress(const string &data, const size_t max_size) {
+    z_stream stream{};
+    // window bits 15 + 32 to detect gzip or zlib header automatically
+    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+        return nullopt;
+    }
+
+    string result;
+    vector<unsigned char> chunk(CHUNK_SIZE);
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+    stream.avail_in = static_cast<uInt>(data.size());
+    auto ret = Z_OK;
+    while (ret == Z_OK) {
+        stream.next_out = chunk.data();
+        stream.avail_out = static_cast<uInt>(chunk.size());
+        ret = inflate(&stream, Z_NO_FLUSH);
+        result.append(reinterpret_cast<char *>(chunk.data()), chunk.size() - stream.avail_out);
+        if (max_size > 0 && result.size() > max_size) {
+            ret = Z_BUF_ERROR;
+            break;
+        }
+    }
+    inflateEnd(&stream);
+
+    if (ret != Z_STREAM_END) {
+        return nullopt; // invalid, truncated, or too large
+    }
+    return result;
+}
+
+bool accepts_encoding(const string &accept_encoding, const string &coding) {
+    optional<bool> exact, wildcard; // an exact match takes precedence over "*"
+
+    vector<string> items;
+    boost::split(items, accept_encoding, boost::is_any_of(","));
+    for (auto &item : items) {
+        vector<string> parts;
+        boost::split(parts, item, boost::is_any_of(";"));
+        const auto name = boost::trim_copy(parts.front());
+        auto &match = boost::iequals(name, coding) ? exact : wildcard;
+        if (&match == &wildcard && name != "*") {
+            continue;
+        }
+
+        // "gzip;q=0" means not acceptable
+        auto acceptable = true;
+        for (size_t i = 1; i < parts.size(); i++) {
+            const auto param = boost::trim_copy(parts[i]);
+            if (boost::istarts_with(param, "q=")) {
+                try {
+                    acceptable = stod(param.substr(2)) > 0;
+                } catch (exception &) {
+                    acceptable = false;
+                }
+            }
+        }
+        match = acceptable;
+    }
+    return exact.value_or(wildcard.value_or(false));
+}
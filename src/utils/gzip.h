@@ -0,0 +1,20 @@
+#pragma once
+
+#include <optional>
+#include <string>
+
+/**
+ * Compress data into the gzip format, level is 0-9, or -1 for zlib's default.
+ */
+std::string gzip_compress(const std::string &data, int level = -1);
+
+/**
+ * Decompress gzip or zlib ("deflate" content coding) data.
+ * Return nullopt if the data is invalid, or the result is larger than max_size (0 means no limit).
+ */
+std::optional<std::string> gzip_decompress(const std::string &data, size_t max_size = 0);
+
+/**
+ * Check if a content coding (e.g. "gzip") is acceptable according to an "Accept-Encoding" header.
+ */
+bool accepts_encoding(const std::string &accept_encoding, const std::string &coding);
@@ -2,16 +2,23 @@
 
 #include "app.h"
 
+#include <condition_variable>
+#include <ctime>
 #include <regex>
+#include <unordered_map>
 #include <boost/filesystem.hpp>
 #include <cpprest/http_client.h>
 #undef U  // fix bug in cpprestsdk
 
 #include "utils/curl_wrapper.h"
+#include "utils/deadline_class.h"
+#include "utils/gzip.h"
 
 using namespace std;
 namespace fs = boost::filesystem;
 
+static const regex JSONP_END_REGEX("\\);?\\s*$");
+
 namespace http = web::http;
 using http::http_exception;
 using http::http_headers;
@@ -25,6 +32,86 @@ using http::client::http_client_config;
     "AppleWebKit/537.36 (KHTML, like Gecko) " \
     "Chrome/56.0.2924.87 Safari/537.36"
 
+/**
+ * Get a long-lived http_client for the scheme, host and port of the given url.
+ * The clients are kept so that the underlying keep-alive connections can be reused by later requests.
+ */
+static shared_ptr<http_client> get_http_client(const web::uri &uri) {
+    static unordered_map<wstring, shared_ptr<http_client>> clients;
+    static mutex clients_mutex;
+
+    const auto base_uri = uri.authority();
+
+    unique_lock<mutex> lock(clients_mutex);
+    auto &client = clients[base_uri.to_string()];
+    if (!client) {
+        client = make_shared<http_client>(base_uri);
+    }
+    return client;
+}
+
+/**
+ * Cancels a request when the deadline of the thread sending it is exceeded, with a timer of the system thread pool.
+ */
+class DeadlineCanceller {
+public:
+    explicit DeadlineCanceller(const chrono::milliseconds remaining) {
+        timer_ = CreateThreadpoolTimer(on_timer, &source_, nullptr);
+        if (timer_) {
+            ULARGE_INTEGER due; // negative for a time relative to now, in 100 nanoseconds
+            due.QuadPart = static_cast<ULONGLONG>(-static_cast<LONGLONG>(remaining.count()) * 10000);
+            FILETIME due_time{due.LowPart, due.HighPart};
+            SetThreadpoolTimer(timer_, &due_time, 0, 0);
+        }
+    }
+
+    ~DeadlineCanceller() {
+        if (timer_) {
+            SetThreadpoolTimer(timer_, nullptr, 0, 0);
+            WaitForThreadpoolTimerCallbacks(timer_, TRUE);
+            CloseThreadpoolTimer(timer_);
+        }
+    }
+
+    DeadlineCanceller(const DeadlineCanceller &) = delete;
+    DeadlineCanceller &operator=(const DeadlineCanceller &) = delete;
+
+    pplx::cancellation_token token() const { return source_.get_token(); }
+
+private:
+    pplx::cancellation_token_source source_;
+    PTP_TIMER timer_ = nullptr;
+
+    static VOID CALLBACK on_timer(PTP_CALLBACK_INSTANCE, const PVOID context, PTP_TIMER) {
+        static_cast<pplx::cancellation_token_source *>(context)->cancel();
+    }
+};
+
+/**
+ * Send the request through the cached client of the url's host,
+ * cancelling it (as an http_exception) if the current thread has a deadline (see Deadline) which is exceeded.
+ */
+static pplx::task<http_response> send_request(const string &url, http_request &request) {
+    const web::uri uri(s2ws(url));
+    request.set_request_uri(uri.resource());
+
+    if (const auto remaining = Deadline::remaining()) {
+        if (remaining->count() == 0) {
+            return pplx::task_from_exception<http_response>(http_exception(L"deadline exceeded"));
+        }
+        auto canceller = make_shared<DeadlineCanceller>(remaining.value());
+        return get_http_client(uri)->request(request, canceller->token())
+            .then([canceller](pplx::task<http_response> task) {
+                try {
+                    return task.get();
+                } catch (pplx::task_canceled &) {
+                    throw http_exception(L"deadline exceeded");
+                }
+            });
+    }
+    return get_http_client(uri)->request(request);
+}
+
 static optional<json> get_remote_json_cpprestsdk(const string &url, const bool use_fake_ua, const string &cookies) {
     http_request request(http::methods::GET);
     request.headers().add(L"User-Agent", s2ws(use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT));
@@ -33,8 +120,7 @@ static optional<json> get_remote_json_cpprestsdk(const string &url, const bool u
         request.headers().add(L"Cookie", s2ws(cookies));
     }
 
-    auto task = http_client(s2ws(url))
-            .request(request)
+    auto task = send_request(url, request)
             .then([](pplx::task<http_response> task) {
                 auto next_task = pplx::task_from_result<string>("");
                 try {
@@ -48,7 +134,7 @@ static optional<json> get_remote_json_cpprestsdk(const string &url, const bool u
                 return next_task;
             })
             .then([](string &body) {
-                if (smatch m; regex_search(body, m, regex("\\);?\\s*$"))) {
+                if (smatch m; regex_search(body, m, JSONP_END_REGEX)) {
                     // is jsonp
                     if (auto start = body.find("("); start != string::npos) {
                         body = body.substr(start + 1, body.size() - (start + 1) - m.length());
@@ -80,7 +166,7 @@ static optional<json> get_remote_json_libcurl(const string &url, const bool use_
     if (const auto response = request.get();
         response.status_code >= 200 && response.status_code < 300) {
         auto body = response.body;
-        if (smatch m; regex_search(body, m, regex("\\);?\\s*$"))) {
+        if (smatch m; regex_search(body, m, JSONP_END_REGEX)) {
             // is jsonp
             if (const auto start = body.find("("); start != string::npos) {
                 body = body.substr(start + 1, body.size() - (start + 1) - m.length());
@@ -103,19 +189,36 @@ optional<json> get_remote_json(const string &url, const bool use_fake_ua, const
     return get_remote_json_cpprestsdk(url, use_fake_ua, cookies);
 }
 
-static bool download_remote_file_cpprestsdk(const string &url, const string &local_path, const bool use_fake_ua) {
+/**
+ * Download to "local_path", or if "validators" is given, do a conditional request
+ * and download to a temporary file which replaces "local_path" on success.
+ */
+static DownloadResult download_remote_file_cpprestsdk(const string &url, const string &local_path,
+                                                      const bool use_fake_ua, HttpCacheValidators *validators) {
     using concurrency::streams::container_buffer;
 
-    auto succeeded = false;
+    auto result = DownloadResult::FAILED;
 
-    auto ansi_local_path = ansi(local_path);
+    const auto download_path = validators ? local_path + ".download" : local_path;
+    const auto ansi_download_path = ansi(download_path);
 
     http_request request(http::methods::GET);
     request.headers().add(L"User-Agent", s2ws(use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT));
     request.headers().add(L"Referer", s2ws(url));
+    if (validators && !validators->etag.empty()) {
+        request.headers().add(L"If-None-Match", s2ws(validators->etag));
+    }
+    if (validators && !validators->last_modified.empty()) {
+        request.headers().add(L"If-Modified-Since", s2ws(validators->last_modified));
+    }
 
-    http_client(s2ws(url)).request(request).then([&](http_response response) {
-        if (ofstream f(ansi_local_path, ios::out | ios::binary); f.is_open()) {
+    send_request(url, request).then([&](http_response response) {
+        if (validators && response.status_code() == http::status_codes::NotModified) {
+            result = DownloadResult::NOT_MODIFIED;
+            return;
+        }
+
+        if (ofstream f(ansi_download_path, ios::out | ios::binary); f.is_open()) {
             auto length = response.headers().content_length();
             decltype(length) read_count = 0;
             auto body_stream = response.body();
@@ -133,31 +236,48 @@ static bool download_remote_file_cpprestsdk(const string &url, const string &loc
             if (response.status_code() >= 200 && response.status_code() < 300
                 && (length > 0 && read_count == length
                     || length == 0 && read_count > 0)) {
-                succeeded = true;
+                result = DownloadResult::DOWNLOADED;
             }
         }
+
+        if (validators && result == DownloadResult::DOWNLOADED) {
+            const auto &headers = response.headers();
+            const auto etag_it = headers.find(L"ETag");
+            validators->etag = etag_it != headers.end() ? ws2s(etag_it->second) : "";
+            const auto last_modified_it = headers.find(L"Last-Modified");
+            validators->last_modified = last_modified_it != headers.end() ? ws2s(last_modified_it->second) : "";
+        }
     }).wait();
 
-    if (!succeeded && fs::exists(ansi_local_path)) {
-        fs::remove(ansi_local_path);
+    if (result != DownloadResult::DOWNLOADED && fs::exists(ansi_download_path)) {
+        fs::remove(ansi_download_path);
     }
 
-    return succeeded;
+    return result;
 }
 
-static bool download_remote_file_libcurl(const string &url, const string &local_path, const bool use_fake_ua) {
-    auto succeeded = false;
-    const auto ansi_local_path = ansi(local_path);
+static DownloadResult download_remote_file_libcurl(const string &url, const string &local_path,
+                                                   const bool use_fake_ua, HttpCacheValidators *validators) {
+    auto result = DownloadResult::FAILED;
+
+    const auto download_path = validators ? local_path + ".download" : local_path;
+    const auto ansi_download_path = ansi(download_path);
 
     auto request = curl::Request(url, curl::Headers{
         {"User-Agent", use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT},
         {"Referer", url}
     });
+    if (validators && !validators->etag.empty()) {
+        request.headers["If-None-Match"] = validators->etag;
+    }
+    if (validators && !validators->last_modified.empty()) {
+        request.headers["If-Modified-Since"] = validators->last_modified;
+    }
 
     struct {
         size_t read_count;
         ofstream file;
-    } write_data_wrapper{0, ofstream(ansi_local_path, ios::out | ios::binary)};
+    } write_data_wrapper{0, ofstream(ansi_download_path, ios::out | ios::binary)};
 
     if (write_data_wrapper.file.is_open()) {
         request.write_data = &write_data_wrapper;
@@ -168,42 +288,371 @@ static bool download_remote_file_libcurl(const string &url, const string &local_
             return size * count;
         };
 
-        if (const auto response = request.get();
-            response.status_code >= 200 && response.status_code < 300
+        const auto response = request.get();
+        if (validators && response.status_code == 304) {
+            result = DownloadResult::NOT_MODIFIED;
+        } else if (response.status_code >= 200 && response.status_code < 300
             && (response.content_length > 0 && write_data_wrapper.read_count == response.content_length
                 || response.content_length == 0 && write_data_wrapper.read_count > 0)) {
-            succeeded = true;
+            result = DownloadResult::DOWNLOADED;
+        }
+
+        if (validators && result == DownloadResult::DOWNLOADED) {
+            const auto etag_it = response.headers.find("ETag");
+            validators->etag = etag_it != response.headers.end() ? boost::algorithm::trim_copy(etag_it->second) : "";
+            const auto last_modified_it = response.headers.find("Last-Modified");
+            validators->last_modified = last_modified_it != response.headers.end()
+                                            ? boost::algorithm::trim_copy(last_modified_it->second) : "";
         }
 
         write_data_wrapper.file.close();
     }
 
-    if (!succeeded && fs::exists(ansi_local_path)) {
-        fs::remove(ansi_local_path);
+    if (result != DownloadResult::DOWNLOADED && fs::exists(ansi_download_path)) {
+        fs::remove(ansi_download_path);
     }
 
-    return succeeded;
+    return result;
 }
 
-bool download_remote_file(const string &url, const string &local_path, const bool use_fake_ua) {
+/**
+ * Hold one of the "download_max_connections_per_host" connection slots of a host while alive.
+ */
+class HostConnectionSlot {
+public:
+    explicit HostConnectionSlot(string host) : host_(move(host)) {
+        unique_lock<mutex> lock(mutex_);
+        cv_.wait(lock, [this] {
+            return config.download_max_connections_per_host == 0
+                   || in_use_[host_] < config.download_max_connections_per_host;
+        });
+        in_use_[host_]++;
+    }
+
+    ~HostConnectionSlot() {
+        {
+            unique_lock<mutex> lock(mutex_);
+            if (--in_use_[host_] == 0) {
+                in_use_.erase(host_);
+            }
+        }
+        cv_.notify_all();
+    }
+
+    HostConnectionSlot(const HostConnectionSlot &) = delete;
+    HostConnectionSlot &operator=(const HostConnectionSlot &) = delete;
+
+private:
+    string host_;
+
+    static mutex mutex_;
+    static condition_variable cv_;
+    static map<string, size_t> in_use_;
+};
+
+mutex HostConnectionSlot::mutex_;
+condition_variable HostConnectionSlot::cv_;
+map<string, size_t> HostConnectionSlot::in_use_;
+
+static const int MAX_CHUNK_ATTEMPTS = 3;
+
+/**
+ * Write the received data at the current position of the file, refusing more than "limit" bytes in total.
+ */
+struct ChunkSink {
+    fstream file;
+    uint64_t written;
+    uint64_t limit;
+
+    static size_t write(char *buf, const size_t size, const size_t count, void *data) {
+        auto sink = static_cast<ChunkSink *>(data);
+        const auto n = size * count;
+        if (sink->written + n > sink->limit) {
+            return 0; // more than requested, abort the transfer
+        }
+        sink->file.write(buf, n);
+        if (!sink->file) {
+            return 0;
+        }
+        sink->written += n;
+        return n;
+    }
+};
+
+/**
+ * Download the bytes [begin, end] into the preallocated file,
+ * resuming from where the previous attempt stopped if the connection breaks.
+ */
+static bool download_chunk(const string &url, const string &ansi_path, const curl::Headers &headers,
+                           const string &host, const uint64_t begin, const uint64_t end) {
+    uint64_t offset = begin;
+    for (auto attempt = 0; attempt < MAX_CHUNK_ATTEMPTS && offset <= end; attempt++) {
+        ChunkSink sink{fstream(ansi_path, ios::in | ios::out | ios::binary), 0, end - offset + 1};
+        if (!sink.file.is_open()) {
+            return false;
+        }
+        sink.file.seekp(offset);
+
+        auto request = curl::Request(url, headers);
+        request.headers["Range"] = "bytes=" + to_string(offset) + "-" + to_string(end);
+        request.write_data = &sink;
+        request.write_func = ChunkSink::write;
+
+        int status_code;
+        {
+            HostConnectionSlot slot(host);
+            status_code = request.get().status_code;
+        }
+        offset += sink.written;
+        if (status_code != 206 && status_code != 0) {
+            return false; // the server refused the range, or the file has changed (see "If-Range")
+        }
+    }
+    return offset > end;
+}
+
+static bool parse_content_range_total(const string &content_range, uint64_t &total) {
+    // e.g. "bytes 0-1023/4096"
+    const auto slash = content_range.rfind('/');
+    if (slash == string::npos) {
+        return false;
+    }
+    try {
+        total = stoull(content_range.substr(slash + 1));
+        return true;
+    } catch (exception &) {
+        return false; // the total size is unknown ("*")
+    }
+}
+
+/**
+ * The chunks after the first one, downloaded by the calling thread and by helpers in "pool".
+ * A helper may only start after the calling thread has downloaded everything itself and returned,
+ * so the helpers hold this state, and only touch the file for a chunk they have claimed.
+ */
+struct ChunkDownloads {
+    string url;
+    string ansi_path;
+    curl::Headers headers;
+    string host;
+    uint64_t first; // bytes already received with the first chunk
+    uint64_t total;
+    uint64_t chunk_size;
+    uint64_t chunk_count;
+    uint64_t next_chunk = 0;
+    size_t running = 0; // chunks being downloaded right now
+    bool failed = false;
+    optional<Deadline::Clock::time_point> deadline;
+    mutex state_mutex;
+    condition_variable cv;
+
+    void download() {
+        Deadline::Scope scope(deadline);
+        unique_lock<mutex> lock(state_mutex);
+        while (!failed && next_chunk < chunk_count) {
+            const auto begin = first + next_chunk++ * chunk_size;
+            const auto end = min(begin + chunk_size, total) - 1;
+            running++;
+            lock.unlock();
+            auto ok = false;
+            try {
+                ok = download_chunk(url, ansi_path, headers, host, begin, end);
+            } catch (...) {}
+            lock.lock();
+            failed = failed || !ok;
+            running--;
+        }
+        cv.notify_all();
+    }
+};
+
+/**
+ * Download in chunks of "download_chunk_size" with HTTP range requests, in "download_concurrency" connections.
+ * The first chunk is requested alone, it tells whether the server supports ranges and the total size,
+ * and if it doesn't, the whole file comes in that first response.
+ *
+ * It always uses libcurl, which is linked on every platform, because the chunks are streamed by its write callback
+ * into their places in the preallocated file, and a broken chunk is resumed from where it stopped (see ChunkSink).
+ */
+static DownloadResult download_remote_file_chunked(const string &url, const string &local_path,
+                                                   const bool use_fake_ua, HttpCacheValidators *validators) {
+    auto result = DownloadResult::FAILED;
+
+    const auto download_path = validators ? local_path + ".download" : local_path;
+    const auto ansi_download_path = ansi(download_path);
+    const auto host = ws2s(web::uri(s2ws(url)).host());
+    const auto chunk_size = max<uint64_t>(config.download_chunk_size, 1) * 1024;
+
+    curl::Headers headers{
+        {"User-Agent", use_fake_ua ? FAKE_USER_AGENT : CQAPP_USER_AGENT},
+        {"Referer", url}
+    };
+
+    auto request = curl::Request(url, headers);
+    if (validators && !validators->etag.empty()) {
+        request.headers["If-None-Match"] = validators->etag;
+    }
+    if (validators && !validators->last_modified.empty()) {
+        request.headers["If-Modified-Since"] = validators->last_modified;
+    }
+    request.headers["Range"] = "bytes=0-" + to_string(chunk_size - 1);
+
+    ChunkSink sink{fstream(ansi_download_path, ios::out | ios::binary | ios::trunc), 0, UINT64_MAX};
+    if (!sink.file.is_open()) {
+        return result;
+    }
+    request.write_data = &sink;
+    request.write_func = ChunkSink::write;
+
+    curl::Response response;
+    {
+        HostConnectionSlot slot(host);
+        response = request.get();
+    }
+    sink.file.close();
+
+    uint64_t total = 0;
+    if (validators && response.status_code == 304) {
+        result = DownloadResult::NOT_MODIFIED;
+    } else if (response.status_code == 200) {
+        // ranges not supported, the whole file is already here
+        if (response.content_length > 0 && sink.written == response.content_length
+            || response.content_length == 0 && sink.written > 0) {
+            result = DownloadResult::DOWNLOADED;
+        }
+    } else if (response.status_code == 206 && response.headers.count("Content-Range")
+               && parse_content_range_total(response.headers["Content-Range"], total) && sink.written <= total) {
+        auto ok = sink.written == total;
+        if (!ok) {
+            boost::system::error_code ec;
+            fs::resize_file(ansi_download_path, total, ec); // preallocate, the chunks are written in place
+            ok = !ec;
+        }
+
+        if (ok && sink.written < total) {
+            // the other chunks must come from the same version of the file as the first one
+            if (const auto it = response.headers.find("ETag"); it != response.headers.end()) {
+                headers["If-Range"] = boost::algorithm::trim_copy(it->second);
+            } else if (const auto it = response.headers.find("Last-Modified"); it != response.headers.end()) {
+                headers["If-Range"] = boost::algorithm::trim_copy(it->second);
+            }
+
+            const auto chunks = make_shared<ChunkDownloads>();
+            chunks->url = url;
+            chunks->ansi_path = ansi_download_path;
+            chunks->headers = headers;
+            chunks->host = host;
+            chunks->first = sink.written;
+            chunks->total = total;
+            chunks->chunk_size = chunk_size;
+            chunks->chunk_count = (total - chunks->first + chunk_size - 1) / chunk_size;
+            chunks->deadline = Deadline::current();
+
+            if (const auto p = pool) {
+                for (uint64_t i = 1; i < min<uint64_t>(chunks->chunk_count, config.download_concurrency); i++) {
+                    p->push(TaskPriority::HIGH, [chunks](int) { chunks->download(); });
+                }
+            }
+            chunks->download();
+            {
+                // wait for the chunks claimed by the helpers, never for the helpers still queued
+                unique_lock<mutex> lock(chunks->state_mutex);
+                chunks->cv.wait(lock, [&] { return chunks->running == 0; });
+                ok = !chunks->failed;
+            }
+        }
+
+        if (ok) {
+            result = DownloadResult::DOWNLOADED;
+        }
+    }
+
+    if (validators && result == DownloadResult::DOWNLOADED) {
+        const auto etag_it = response.headers.find("ETag");
+        validators->etag = etag_it != response.headers.end() ? boost::algorithm::trim_copy(etag_it->second) : "";
+        const auto last_modified_it = response.headers.find("Last-Modified");
+        validators->last_modified = last_modified_it != response.headers.end()
+                                        ? boost::algorithm::trim_copy(last_modified_it->second)
+                                        : "";
+    }
+
+    if (result != DownloadResult::DOWNLOADED && fs::exists(ansi_download_path)) {
+        fs::remove(ansi_download_path);
+    }
+
+    return result;
+}
+
+string http_date(const time_t t) {
+    tm gmt{};
+    gmtime_s(&gmt, &t);
+    char buf[64];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &gmt);
+    return buf;
+}
+
+static DownloadResult download(const string &url, const string &local_path, const bool use_fake_ua,
+                               HttpCacheValidators *validators) {
+    if (config.download_concurrency > 1) {
+        return download_remote_file_chunked(url, local_path, use_fake_ua, validators);
+    }
     if (is_in_wine()) {
-        return download_remote_file_libcurl(url, local_path, use_fake_ua);
+        return download_remote_file_libcurl(url, local_path, use_fake_ua, validators);
     }
-    return download_remote_file_cpprestsdk(url, local_path, use_fake_ua);
+    return download_remote_file_cpprestsdk(url, local_path, use_fake_ua, validators);
 }
 
-static HttpSimpleResponse post_json_cpprestsdk(const string &url, const json &payload) {
+bool download_remote_file(const string &url, const string &local_path, const bool use_fake_ua) {
+    return download(url, local_path, use_fake_ua, nullptr) == DownloadResult::DOWNLOADED;
+}
+
+DownloadResult download_remote_file_if_modified(const string &url, const string &local_path,
+                                                HttpCacheValidators &validators, const bool use_fake_ua) {
+    const auto result = download(url, local_path, use_fake_ua, &validators);
+    if (result == DownloadResult::DOWNLOADED) {
+        try {
+            fs::rename(ansi(local_path + ".download"), ansi(local_path)); // replaces the old file
+        } catch (fs::filesystem_error &) {
+            boost::system::error_code ec;
+            fs::remove(ansi(local_path + ".download"), ec);
+            return DownloadResult::FAILED;
+        }
+    }
+    return result;
+}
+
+/**
+ * The value of "X-Signature" header of the body, or empty if "secret" is not set.
+ */
+static string signature(const string &body) {
+    const auto c = live_config();
+    if (c->secret.empty()) {
+        return "";
+    }
+    if (c->signature_algorithm == "sha256") {
+        return "sha256=" + hmac_sha256_hex(c->secret, body);
+    }
+    return "sha1=" + hmac_sha1_hex(c->secret, body);
+}
+
+static const auto DEFAULT_POST_CONTENT_TYPE = "application/json; charset=UTF-8";
+
+static HttpSimpleResponse post_json_cpprestsdk(const string &url, const string &body,
+                                               const map<string, string> &extra_headers) {
     http_request request(http::methods::POST);
     request.headers().add(L"User-Agent", CQAPP_USER_AGENT);
-    request.headers().add(L"Content-Type", L"application/json; charset=UTF-8");
-    const auto body = payload.dump();
-    request.set_body(payload.dump());
-    if (!config.secret.empty()) {
-        request.headers().add(L"X-Signature", s2ws("sha1=" + hmac_sha1_hex(config.secret, body)));
+    if (extra_headers.find("Content-Type") == extra_headers.end()) {
+        request.headers().add(L"Content-Type", s2ws(DEFAULT_POST_CONTENT_TYPE));
+    }
+    for (const auto &header : extra_headers) {
+        request.headers().add(s2ws(header.first), s2ws(header.second));
+    }
+    request.set_body(body);
+    if (const auto sig = signature(body); !sig.empty()) {
+        request.headers().add(L"X-Signature", s2ws(sig));
     }
 
-    auto client = http_client(s2ws(url));
-    auto task = client.request(request);
+    auto task = send_request(url, request);
 
     HttpSimpleResponse result;
     try {
@@ -216,12 +665,17 @@ static HttpSimpleResponse post_json_cpprestsdk(const string &url, const json &pa
     return result;
 }
 
-static HttpSimpleResponse post_json_libcurl(const string &url, const json &payload) {
-    const auto body = payload.dump();
-    auto request = curl::Request(url, "application/json; charset=UTF-8", body);
+static HttpSimpleResponse post_json_libcurl(const string &url, const string &body,
+                                            const map<string, string> &extra_headers) {
+    const auto content_type_it = extra_headers.find("Content-Type");
+    auto request = curl::Request(url, content_type_it != extra_headers.end() ? content_type_it->second
+                                                                             : DEFAULT_POST_CONTENT_TYPE, body);
     request.headers["User-Agent"] = CQAPP_USER_AGENT;
-    if (!config.secret.empty()) {
-        request.headers["X-Signature"] = "sha1=" + hmac_sha1_hex(config.secret, body);
+    for (const auto &header : extra_headers) {
+        request.headers[header.first] = header.second;
+    }
+    if (const auto sig = signature(body); !sig.empty()) {
+        request.headers["X-Signature"] = sig;
     }
 
     const auto response = request.post();
@@ -230,8 +684,54 @@ static HttpSimpleResponse post_json_libcurl(const string &url, const json &paylo
 }
 
 HttpSimpleResponse post_json(const string &url, const json &payload) {
+    return post_json(url, payload.dump());
+}
+
+void prewarm_http_connection(const string &url) {
+    if (is_in_wine()) {
+        // the connection goes to the shared connection cache of libcurl (see curl_wrapper.cpp)
+        if (pool) {
+            pool->push(TaskPriority::LOW, [url](int) {
+                auto request = curl::Request(url);
+                request.user_agent = CQAPP_USER_AGENT;
+                request.head(); // if it fails, the connection will be opened by the first post instead
+            });
+        }
+        return;
+    }
+    try {
+        const web::uri uri(s2ws(url));
+        http_request request(http::methods::HEAD);
+        request.set_request_uri(uri.resource());
+        request.headers().add(L"User-Agent", CQAPP_USER_AGENT);
+        get_http_client(uri)->request(request).then([](pplx::task<http_response> task) {
+            try {
+                task.get();
+            } catch (...) {
+                // the connection will be opened by the first post instead
+            }
+        });
+    } catch (...) {
+        // invalid url
+    }
+}
+
+HttpSimpleResponse post_json(const string &url, const string &body, const map<string, string> &extra_headers) {
+    const auto c = live_config();
+    if (c->post_compression && body.size() >= c->http_compression_min_size) {
+        // the receiver opted in, the signature is of the compressed body, i.e. the bytes actually sent
+        if (auto compressed = gzip_compress(body, c->http_compression_level); !compressed.empty()) {
+            auto headers = extra_headers;
+            headers["Content-Encoding"] = "gzip";
+            if (is_in_wine()) {
+                return post_json_libcurl(url, compressed, headers);
+            }
+            return post_json_cpprestsdk(url, compressed, headers);
+        }
+    }
+
     if (is_in_wine()) {
-        return post_json_libcurl(url, payload);
+        return post_json_libcurl(url, body, extra_headers);
     }
-    return post_json_cpprestsdk(url, payload);
+    return post_json_cpprestsdk(url, body, extra_headers);
 }
@@ -2,11 +2,35 @@
 
 #include "common.h"
 
+#include <map>
+
 std::optional<json> get_remote_json(const std::string &url, const bool use_fake_ua = false,
                                     const std::string &cookies = "");
 
 bool download_remote_file(const std::string &url, const std::string &local_path, const bool use_fake_ua = false);
 
+/**
+ * Validators of a downloaded file, for HTTP conditional requests.
+ */
+struct HttpCacheValidators {
+    std::string etag;
+    std::string last_modified;
+};
+
+/**
+ * Format a time as an HTTP-date, e.g. "Sun, 06 Nov 1994 08:49:37 GMT".
+ */
+std::string http_date(std::time_t t);
+
+enum class DownloadResult { FAILED, DOWNLOADED, NOT_MODIFIED };
+
+/**
+ * Download a file with a conditional request, so that the server can tell the local file is still fresh.
+ * The local file is replaced only after the new one is completely downloaded, and the validators are updated.
+ */
+DownloadResult download_remote_file_if_modified(const std::string &url, const std::string &local_path,
+                                                HttpCacheValidators &validators, const bool use_fake_ua = false);
+
 struct HttpSimpleResponse {
     int status_code = 0;
     std::string body;
@@ -17,3 +41,16 @@ struct HttpSimpleResponse {
 };
 
 HttpSimpleResponse post_json(const std::string &url, const json &payload);
+
+/**
+ * Open a keep-alive connection to the host of the url in background, by a HEAD request whose response is ignored,
+ * so that the first post_json() to it doesn't have to wait for the connection (and the TLS handshake).
+ */
+void prewarm_http_connection(const std::string &url);
+
+/**
+ * Post an already serialized JSON text, to avoid dumping the same payload again.
+ * The body may also be in a binary format, if "Content-Type" is given in extra_headers.
+ */
+HttpSimpleResponse post_json(const std::string &url, const std::string &body,
+                             const std::map<std::string, std::string> &extra_headers = {});
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "common.h"
+
+#include <string_view>
+#include <type_traits>
+
+/**
+ * Write JSON text directly into a string, without building a json object first.
+ * The output is the same as json::dump() as long as object keys are written in ascending order.
+ */
+class JsonWriter {
+public:
+    explicit JsonWriter(std::string &out) : out_(out) {}
+
+    JsonWriter &begin_object() { return open('{'); }
+    JsonWriter &end_object() { return close('}'); }
+    JsonWriter &begin_array() { return open('['); }
+    JsonWriter &end_array() { return close(']'); }
+
+    JsonWriter &key(const std::string_view &k) {
+        separate();
+        write_string(k);
+        out_ += ':';
+        first_ = true; // no comma between the key and its value
+        return *this;
+    }
+
+    template <typename IntType, std::enable_if_t<std::is_integral_v<IntType>, int> = 0>
+    JsonWriter &value(const IntType v) {
+        separate();
+        if constexpr (std::is_same_v<IntType, bool>) {
+            out_ += v ? "true" : "false";
+        } else {
+            out_ += std::to_string(v);
+        }
+        return *this;
+    }
+
+    JsonWriter &value(const std::string_view &v) {
+        separate();
+        write_string(v);
+        return *this;
+    }
+
+    JsonWriter &value(const char *v) { return value(std::string_view(v)); }
+    JsonWriter &value(const std::string &v) { return value(std::string_view(v)); }
+
+    JsonWriter &value(std::nullptr_t) {
+        separate();
+        out_ += "null";
+        return *this;
+    }
+
+    template <typename T>
+    JsonWriter &field(const std::string_view &k, const T &v) {
+        return key(k).value(v);
+    }
+
+private:
+    std::string &out_;
+    bool first_ = true;
+
+    void separate() {
+        if (!first_) {
+            out_ += ',';
+        }
+        first_ = false;
+    }
+
+    JsonWriter &open(const char c) {
+        separate();
+        out_ += c;
+        first_ = true;
+        return *this;
+    }
+
+    JsonWriter &close(const char c) {
+        out_ += c;
+        first_ = false;
+        return *this;
+    }
+
+    void write_string(const std::string_view &s) {
+        static const char hex[] = "0123456789abcdef";
+
+        out_ += '"';
+        size_t run_begin = 0;
+        for (size_t i = 0; i < s.size(); i++) {
+            const auto c = static_cast<unsigned char>(s[i]);
+            if (c >= 0x20 && c != '"' && c != '\\') {
+                continue;
+            }
+            out_.append(s.data() + run_begin, i - run_begin);
+            run_begin = i + 1;
+            switch (c) {
+            case '"':
+                out_ += "\\\"";
+                break;
+            case '\\':
+                out_ += "\\\\";
+                break;
+            case '\b':
+                out_ += "\\b";
+                break;
+            case '\f':
+                out_ += "\\f";
+                break;
+            case '\n':
+                out_ += "\\n";
+                break;
+            case '\r':
+                out_ += "\\r";
+                break;
+            case '\t':
+                out_ += "\\t";
+                break;
+            default:
+                out_ += "\\u00";
+                out_ += hex[c >> 4];
+                out_ += hex[c & 0xF];
+            }
+        }
+        out_.append(s.data() + run_begin, s.size() - run_begin);
+        out_ += '"';
+    }
+};
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "common.h"
+
+#include <list>
+#include <map>
+#include <mutex>
+
+/**
+ * A thread-safe map that keeps entries up to a total cost (e.g. the count, or the size in bytes),
+ * evicting the least recently used ones.
+ */
+template <typename Key, typename Value>
+class LruCache {
+public:
+    explicit LruCache(const size_t capacity) : capacity_(capacity) {}
+
+    std::optional<Value> get(const Key &key) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        const auto it = index_.find(key);
+        if (it == index_.end()) {
+            return std::nullopt;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second); // mark as the most recently used
+        return it->second->value;
+    }
+
+    void set(const Key &key, Value value, const size_t cost = 1) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        erase_locked(key);
+        if (cost > capacity_) {
+            return;
+        }
+
+        entries_.push_front({key, std::move(value), cost});
+        index_[key] = entries_.begin();
+        total_cost_ += cost;
+
+        while (total_cost_ > capacity_) {
+            index_.erase(entries_.back().key);
+            total_cost_ -= entries_.back().cost;
+            entries_.pop_back();
+        }
+    }
+
+    void erase(const Key &key) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        erase_locked(key);
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        entries_.clear();
+        index_.clear();
+        total_cost_ = 0;
+    }
+
+private:
+    struct Entry {
+        Key key;
+        Value value;
+        size_t cost;
+    };
+
+    std::list<Entry> entries_; // the most recently used first
+    std::map<Key, typename std::list<Entry>::iterator> index_;
+    size_t capacity_;
+    size_t total_cost_ = 0;
+    std::mutex mutex_;
+
+    void erase_locked(const Key &key) {
+        if (const auto it = index_.find(key); it != index_.end()) {
+            total_cost_ -= it->second->cost;
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+    }
+};
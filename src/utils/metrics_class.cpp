@@ -0,0 +1,136 @@
+#include "./metrics_class.h"
+#include "./rolling_stats_class.h"
+
+#include <iomanip>
+#include <sstream>
+
+using namespace std;
+
+const vector<double> Metrics::Histogram::BUCKETS = {
+    0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+
+void Metrics::Histogram::observe(const double seconds) {
+    // only the first bucket that fits is counted here, they are accumulated when rendering
+    const auto it = lower_bound(BUCKETS.cbegin(), BUCKETS.cend(), seconds);
+    if (it != BUCKETS.cend()) {
+        bucket_counts_[it - BUCKETS.cbegin()].fetch_add(1, memory_order_relaxed);
+    }
+    count_.fetch_add(1, memory_order_relaxed);
+    sum_micros_.fetch_add(static_cast<uint64_t>(seconds * 1e6), memory_order_relaxed);
+}
+
+static string format_value(const double value) {
+    ostringstream ss;
+    ss << setprecision(10) << value;
+    return ss.str();
+}
+
+void Metrics::Histogram::render(string &out, const string &name, const string &labels) const {
+    const auto prefix = labels.empty() ? "" : labels + ",";
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < BUCKETS.size(); i++) {
+        cumulative += bucket_counts_[i].load(memory_order_relaxed);
+        out += name + "_bucket{" + prefix + "le=\"" + format_value(BUCKETS[i]) + "\"} " + to_string(cumulative) + "\n";
+    }
+    const auto count = count_.load(memory_order_relaxed);
+    const auto braced_labels = labels.empty() ? "" : "{" + labels + "}";
+    out += name + "_bucket{" + prefix + "le=\"+Inf\"} " + to_string(count) + "\n";
+    out += name + "_sum" + braced_labels + " " + format_value(sum_micros_.load(memory_order_relaxed) / 1e6) + "\n";
+    out += name + "_count" + braced_labels + " " + to_string(count) + "\n";
+}
+
+Metrics::Series &Metrics::series(map<string, unique_ptr<Series>> &m, const string &key) {
+    {
+        shared_lock<shared_mutex> lock(mutex_);
+        if (const auto it = m.find(key); it != m.end()) {
+            return *it->second;
+        }
+    }
+    unique_lock<shared_mutex> lock(mutex_);
+    auto &ptr = m[key];
+    if (!ptr) {
+        ptr = make_unique<Series>();
+    }
+    return *ptr;
+}
+
+void Metrics::observe_api(const string &action, const double seconds, const int retcode) {
+    RollingStats::instance().add_duration("api_calls", action, seconds);
+    auto &s = series(api_series_, action);
+    s.latency.observe(seconds);
+    if (retcode != 0) {
+        s.failures.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void Metrics::observe_post(const string &sink, const double seconds, const bool succeeded) {
+    RollingStats::instance().add_duration("event_posts", sink, seconds);
+    auto &s = series(post_series_, sink);
+    s.latency.observe(seconds);
+    if (!succeeded) {
+        s.failures.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+void Metrics::count_filtered(const string &filter, const size_t count) {
+    RollingStats::instance().count("events_filtered", filter, count);
+    {
+        shared_lock<shared_mutex> lock(mutex_);
+        if (const auto it = filtered_counts_.find(filter); it != filtered_counts_.end()) {
+            it->second.fetch_add(count, memory_order_relaxed);
+            return;
+        }
+    }
+    unique_lock<shared_mutex> lock(mutex_);
+    filtered_counts_[filter].fetch_add(count, memory_order_relaxed);
+}
+
+string Metrics::render(vector<Gauge> gauges) const {
+    string out;
+    shared_lock<shared_mutex> lock(mutex_);
+
+    out += "# HELP cqhttp_api_request_duration_seconds Time spent handling API requests.\n"
+        "# TYPE cqhttp_api_request_duration_seconds histogram\n";
+    for (const auto &entry : api_series_) {
+        entry.second->latency.render(out, "cqhttp_api_request_duration_seconds", "action=\"" + entry.first + "\"");
+    }
+    out += "# HELP cqhttp_api_request_failures_total API requests whose retcode is not 0.\n"
+        "# TYPE cqhttp_api_request_failures_total counter\n";
+    for (const auto &entry : api_series_) {
+        out += "cqhttp_api_request_failures_total{action=\"" + entry.first + "\"} "
+            + to_string(entry.second->failures.load(memory_order_relaxed)) + "\n";
+    }
+
+    out += "# HELP cqhttp_event_post_duration_seconds Time spent posting an event to a sink.\n"
+        "# TYPE cqhttp_event_post_duration_seconds histogram\n";
+    for (const auto &entry : post_series_) {
+        entry.second->latency.render(out, "cqhttp_event_post_duration_seconds", "sink=\"" + entry.first + "\"");
+    }
+    out += "# HELP cqhttp_event_post_failures_total Events failed to be posted to a sink.\n"
+        "# TYPE cqhttp_event_post_failures_total counter\n";
+    for (const auto &entry : post_series_) {
+        out += "cqhttp_event_post_failures_total{sink=\"" + entry.first + "\"} "
+            + to_string(entry.second->failures.load(memory_order_relaxed)) + "\n";
+    }
+
+    out += "# HELP cqhttp_events_filtered_total Events dropped by event filters.\n"
+        "# TYPE cqhttp_events_filtered_total counter\n";
+    for (const auto &entry : filtered_counts_) {
+        out += "cqhttp_events_filtered_total{filter=\"" + entry.first + "\"} "
+            + to_string(entry.second.load(memory_order_relaxed)) + "\n";
+    }
+
+    // series of the same metric must be adjacent
+    stable_sort(gauges.begin(), gauges.end(), [](const Gauge &a, const Gauge &b) { return a.name < b.name; });
+    string last_name;
+    for (const auto &gauge : gauges) {
+        if (gauge.name != last_name) {
+            out += "# TYPE " + gauge.name + " gauge\n";
+            last_name = gauge.name;
+        }
+        out += gauge.name + (gauge.labels.empty() ? "" : "{" + gauge.labels + "}") + " "
+            + format_value(gauge.value) + "\n";
+    }
+    return out;
+}
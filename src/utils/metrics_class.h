@@ -0,0 +1,86 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <vector>
+
+/**
+ * Counters and latency histograms of API calls and event posting,
+ * rendered in Prometheus text format by the "/metrics" endpoint.
+ * They are also recorded into RollingStats, for the rolling counters of the "get_stats" API.
+ */
+class Metrics {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Gauge {
+        std::string name;
+        std::string labels; // e.g. service="ws", may be empty
+        double value;
+    };
+
+    static Metrics &instance() {
+        static Metrics metrics;
+        return metrics;
+    }
+
+    /**
+     * Record an API call of "action", which finished in "seconds" with the given retcode.
+     */
+    void observe_api(const std::string &action, double seconds, int retcode);
+
+    /**
+     * Record an event posted to "sink" (e.g. "http", "ws", "ws_reverse").
+     */
+    void observe_post(const std::string &sink, double seconds, bool succeeded);
+
+    /**
+     * Record an event dropped by the filter of "filter" (e.g. "global", "ws", "ws_reverse").
+     */
+    void count_filtered(const std::string &filter, size_t count = 1);
+
+    /**
+     * Render all the metrics, and the given gauges which are collected by the caller at the moment.
+     */
+    std::string render(std::vector<Gauge> gauges) const;
+
+    static double seconds_since(const Clock::time_point &start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    }
+
+private:
+    Metrics() = default;
+
+    class Histogram {
+    public:
+        static const std::vector<double> BUCKETS; // upper bounds in seconds
+
+        Histogram() : bucket_counts_(BUCKETS.size()) {}
+
+        void observe(double seconds);
+        void render(std::string &out, const std::string &name, const std::string &labels) const;
+
+    private:
+        std::vector<std::atomic<uint64_t>> bucket_counts_;
+        std::atomic<uint64_t> count_ = 0;
+        std::atomic<uint64_t> sum_micros_ = 0;
+    };
+
+    struct Series {
+        Histogram latency;
+        std::atomic<uint64_t> failures = 0;
+    };
+
+    std::map<std::string, std::unique_ptr<Series>> api_series_;
+    std::map<std::string, std::unique_ptr<Series>> post_series_;
+    std::map<std::string, std::atomic<uint64_t>> filtered_counts_;
+    mutable std::shared_mutex mutex_; // only for inserting new keys into the maps above
+
+    Series &series(std::map<std::string, std::unique_ptr<Series>> &m, const std::string &key);
+};
@@ -51,3 +51,32 @@ bytes Pack::pop_token() {
 bool Pack::pop_bool() {
     return static_cast<bool>(pop_int<int32_t>());
 }
+
+void PackView::check_enough(const size_t needed) const {
+    if (this->size() < needed) {
+        throw BytesNotEnoughError("there aren't enough bytes to pop (" + to_string(needed) + " bytes needed)");
+    }
+}
+
+string PackView::pop_string() {
+    const auto len = pop_int<int16_t>();
+    if (len == 0) {
+        return string();
+    }
+    return string_from_coolq(string(pop_bytes(len)));
+}
+
+string_view PackView::pop_bytes(const size_t len) {
+    check_enough(len);
+    const auto result = this->bytes_.substr(this->curr_, len);
+    this->curr_ += len;
+    return result;
+}
+
+string_view PackView::pop_token() {
+    return this->pop_bytes(this->pop_int<int16_t>());
+}
+
+bool PackView::pop_bool() {
+    return static_cast<bool>(pop_int<int32_t>());
+}
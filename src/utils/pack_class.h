@@ -22,10 +22,41 @@
 
 #include "common.h"
 
+#include <cstdlib>
+#include <string_view>
+#include <type_traits>
+
 class BytesNotEnoughError : public std::runtime_error {
     using runtime_error::runtime_error;
 };
 
+/**
+ * Convert a big-endian integer read from the raw bytes into the host byte order (little-endian).
+ */
+template <typename IntType>
+inline IntType from_big_endian(const char *data) {
+    constexpr auto size = sizeof(IntType);
+    static_assert(size == 1 || size == 2 || size == 4 || size == 8, "unsupported integer size");
+
+    using UIntType = std::conditional_t<size == 1, uint8_t,
+                                        std::conditional_t<size == 2, unsigned short,
+                                                           std::conditional_t<size == 4, unsigned long,
+                                                                              unsigned __int64>>>;
+    UIntType u;
+    memcpy(static_cast<void *>(&u), data, size);
+    if constexpr (size == 2) {
+        u = _byteswap_ushort(u);
+    } else if constexpr (size == 4) {
+        u = _byteswap_ulong(u);
+    } else if constexpr (size == 8) {
+        u = _byteswap_uint64(u);
+    }
+
+    IntType result;
+    memcpy(static_cast<void *>(&result), &u, size);
+    return result;
+}
+
 class Pack {
 public:
     Pack() : bytes_(""), curr_(0) {}
@@ -39,12 +70,8 @@ public:
         constexpr auto size = sizeof(IntType);
         check_enough(size);
 
-        auto s = this->bytes_.substr(this->curr_, size);
+        const auto result = from_big_endian<IntType>(this->bytes_.data() + this->curr_);
         this->curr_ += size;
-        std::reverse(s.begin(), s.end());
-
-        IntType result;
-        memcpy(static_cast<void *>(&result), s.data(), size);
         return result;
     }
 
@@ -59,3 +86,38 @@ private:
 
     void check_enough(const size_t needed) const;
 };
+
+/**
+ * Same as Pack, but doesn't own or copy the bytes,
+ * tokens popped from it are views into the same buffer.
+ * The viewed bytes must outlive the PackView and the views popped from it.
+ */
+class PackView {
+public:
+    PackView() : curr_(0) {}
+    explicit PackView(const std::string_view &b) : bytes_(b), curr_(0) {}
+
+    size_t size() const { return bytes_.size() - curr_; }
+    bool empty() const { return size() == 0; }
+
+    template <typename IntType>
+    IntType pop_int() {
+        constexpr auto size = sizeof(IntType);
+        check_enough(size);
+
+        const auto result = from_big_endian<IntType>(this->bytes_.data() + this->curr_);
+        this->curr_ += size;
+        return result;
+    }
+
+    std::string pop_string();
+    std::string_view pop_bytes(const size_t len);
+    std::string_view pop_token();
+    bool pop_bool();
+
+private:
+    std::string_view bytes_;
+    size_t curr_;
+
+    void check_enough(const size_t needed) const;
+};
@@ -22,21 +22,27 @@
 
 #include "common.h"
 
+#include "message/outbound_cache_class.h"
+
+/**
+ * The parameters are immutable and shared between copies,
+ * so that a Params can be passed to asynchronous tasks without copying the json.
+ */
 class Params {
 public:
-    Params() : params_(nullptr) {}
-    explicit Params(const json &j) : params_(j) {}
-    explicit Params(const json &&j) : params_(j) {}
+    Params() : params_(std::make_shared<const json>(nullptr)) {}
+    explicit Params(const json &j) : params_(std::make_shared<const json>(j)) {}
+    explicit Params(json &&j) : params_(std::make_shared<const json>(std::move(j))) {}
 
     /**
-     * Return std::nullopt if the key does not exist.
+     * Return nullptr if the key does not exist.
+     * The returned pointer is valid as long as this Params (or any copy of it) lives.
      */
-    std::optional<json> get(const std::string &key) const;
+    const json *get(const std::string &key) const;
 
     template <typename Type>
     std::optional<Type> get(const std::string &key) const {
-        auto v = get(key);
-        if (v) {
+        if (const auto v = get(key)) {
             try {
                 return v->get<Type>();
             } catch (std::domain_error &) {
@@ -49,9 +55,21 @@ public:
     std::string get_string(const std::string &key, const std::string &default_val = "") const;
     std::string get_message(const std::string &key = "message",
                             const std::string &auto_escape_key = "auto_escape") const;
+
+    /**
+     * Same as get_message, with the CoolQ encoding of the message if it's from the outbound cache.
+     */
+    OutboundCache::Result get_outbound_message(const std::string &key = "message",
+                                               const std::string &auto_escape_key = "auto_escape") const;
+
     int64_t get_integer(const std::string &key, const int64_t default_val = 0) const;
     bool get_bool(const std::string &key, const bool default_val = false) const;
 
+    /**
+     * The whole parameter object (or null).
+     */
+    const json &raw() const { return *params_; }
+
 private:
-    json params_;
+    std::shared_ptr<const json> params_;
 };
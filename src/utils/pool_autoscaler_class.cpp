@@ -0,0 +1,96 @@
+#include "./pool_autoscaler_class.h"
+
+#include "app.h"
+
+#include "utils/task_scheduler_class.h"
+
+using namespace std;
+
+static const auto TAG = u8"线程池";
+
+static const auto INTERVAL = chrono::seconds(1);
+static const size_t SHRINK_AFTER_IDLE_INTERVALS = 10;
+
+void PoolAutoscaler::start() {
+    unique_lock<mutex> lock(mutex_);
+    if (running_ || config.thread_pool_max_size == 0 || !pool || pool->max_size() <= pool->size()) {
+        return;
+    }
+
+    stats_ = {};
+    idle_intervals_ = 0;
+    pool->take_load_stats(); // discard the load before starting
+    running_ = true;
+    thread_ = thread([this] {
+        unique_lock<mutex> lock(mutex_);
+        while (running_) {
+            cv_.wait_for(lock, INTERVAL, [this] { return !running_; });
+            if (running_) {
+                adjust();
+            }
+        }
+    });
+    Log::d(TAG, u8"线程池自动伸缩已启动，线程数范围 " + to_string(max(config.thread_pool_min_size, size_t(1))) + u8" ~ "
+                    + to_string(pool->max_size()));
+}
+
+void PoolAutoscaler::stop() {
+    {
+        unique_lock<mutex> lock(mutex_);
+        if (!running_) {
+            return;
+        }
+        running_ = false;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+PoolAutoscaler::Stats PoolAutoscaler::stats() const {
+    unique_lock<mutex> lock(mutex_);
+    return stats_;
+}
+
+void PoolAutoscaler::adjust() {
+    const auto p = pool;
+    if (!p) {
+        return;
+    }
+
+    const auto load = p->take_load_stats();
+    stats_.average_wait_ms = load.average_wait_ms;
+    stats_.utilization = load.utilization;
+
+    const auto size = p->size();
+    const auto min_size = min(max(config.thread_pool_min_size, size_t(1)), p->max_size());
+    const auto target_wait = double(config.thread_pool_target_wait);
+
+    // tasks waiting too long, or all workers blocked while there are still tasks queued
+    const auto overloaded = load.average_wait_ms > target_wait
+                            || (load.utilization > 0.9 && p->pending_count() >= size);
+    const auto idle = load.average_wait_ms < target_wait / 4 && load.utilization < 0.5;
+
+    if (overloaded) {
+        idle_intervals_ = 0;
+        if (size < p->max_size()) {
+            const auto new_size = min(size + max(size / 2, size_t(1)), p->max_size());
+            p->resize(new_size);
+            stats_.grow_count++;
+            Log::d(TAG, [&] {
+                return u8"任务平均等待 " + to_string(int(load.average_wait_ms)) + u8" 毫秒，线程繁忙率 "
+                       + to_string(int(load.utilization * 100)) + u8"%，线程数增加到 " + to_string(new_size);
+            });
+        }
+    } else if (idle) {
+        if (++idle_intervals_ >= SHRINK_AFTER_IDLE_INTERVALS && size > min_size) {
+            idle_intervals_ = 0;
+            p->resize(size - 1);
+            stats_.shrink_count++;
+            Log::d(TAG, [&] { return u8"线程池空闲，线程数减少到 " + to_string(size - 1); });
+        }
+    } else {
+        idle_intervals_ = 0;
+    }
+}
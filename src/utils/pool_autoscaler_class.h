@@ -0,0 +1,46 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+/**
+ * Grow or shrink the worker pool every second between "thread_pool_min_size" and "thread_pool_max_size",
+ * according to how long the tasks wait in the queues and how busy the workers are.
+ * Grows quickly when the pool is overloaded, and shrinks one by one after it stays idle for a while.
+ */
+class PoolAutoscaler {
+public:
+    struct Stats {
+        size_t grow_count;
+        size_t shrink_count;
+        double average_wait_ms; // of the last interval
+        double utilization; // of the last interval
+    };
+
+    static PoolAutoscaler &instance() {
+        static PoolAutoscaler autoscaler;
+        return autoscaler;
+    }
+
+    void start();
+    void stop();
+    bool started() const { return running_; }
+
+    Stats stats() const;
+
+private:
+    PoolAutoscaler() = default;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    std::atomic<bool> running_ = false;
+
+    Stats stats_{};
+    size_t idle_intervals_ = 0;
+
+    void adjust();
+};
@@ -0,0 +1,139 @@
+#include "./rolling_stats_class.h"
+
+using namespace std;
+
+static int64_t current_tick() {
+    return chrono::duration_cast<chrono::seconds>(RollingStats::Clock::now().time_since_epoch()).count();
+}
+
+template <size_t N>
+void RollingStats::add_to(array<Slot, N> &slots, const int64_t tick, const uint64_t count, const uint64_t sum) {
+    // only the owner thread writes, so plain loads and stores are enough
+    auto &slot = slots[tick % N];
+    if (slot.tick.load(memory_order_relaxed) != tick) {
+        slot.count.store(0, memory_order_relaxed);
+        slot.sum.store(0, memory_order_relaxed);
+        slot.tick.store(tick, memory_order_release);
+    }
+    slot.count.store(slot.count.load(memory_order_relaxed) + count, memory_order_relaxed);
+    slot.sum.store(slot.sum.load(memory_order_relaxed) + sum, memory_order_relaxed);
+}
+
+template <size_t N>
+void RollingStats::sum_up(const array<Slot, N> &slots, const int64_t first_tick, const int64_t last_tick,
+                          uint64_t &count, uint64_t &sum) {
+    for (const auto &slot : slots) {
+        const auto tick = slot.tick.load(memory_order_acquire);
+        if (tick < first_tick || tick > last_tick) {
+            continue;
+        }
+        const auto c = slot.count.load(memory_order_relaxed);
+        const auto s = slot.sum.load(memory_order_relaxed);
+        if (slot.tick.load(memory_order_acquire) == tick) { // not reused by the owner meanwhile
+            count += c;
+            sum += s;
+        }
+    }
+}
+
+RollingStats::Shard &RollingStats::local_shard() {
+    struct Owner {
+        shared_ptr<Shard> shard;
+
+        ~Owner() {
+            if (shard) shard->retired = true;
+        }
+    };
+    static thread_local Owner owner;
+
+    if (!owner.shard) {
+        owner.shard = make_shared<Shard>();
+        unique_lock<mutex> lock(shards_mutex_);
+        shards_.push_back(owner.shard);
+    }
+    return *owner.shard;
+}
+
+void RollingStats::record(const Kind kind, const char *category, const string_view name, const uint64_t count,
+                          const uint64_t sum) {
+    auto &shard = local_shard();
+
+    // the other threads never modify the maps, so the owner can search them without the lock
+    Series *series = nullptr;
+    if (const auto it = shard.series.find(category); it != shard.series.end()) {
+        if (const auto name_it = it->second.find(name); name_it != it->second.end()) {
+            series = name_it->second.get();
+        }
+    }
+    if (!series) {
+        unique_lock<mutex> lock(shard.mutex);
+        auto &ptr = shard.series[category][string(name)];
+        ptr = make_unique<Series>(kind);
+        series = ptr.get();
+    }
+
+    const auto tick = current_tick();
+    add_to(series->seconds, tick, count, sum);
+    add_to(series->ten_seconds, tick / 10, count, sum);
+    shard.last_tick.store(tick, memory_order_relaxed);
+}
+
+json RollingStats::snapshot() {
+    struct Totals {
+        Kind kind;
+        uint64_t counts[3]{};
+        uint64_t sums[3]{};
+    };
+    map<string, map<string, Totals>> totals;
+
+    const auto tick = current_tick();
+    {
+        unique_lock<mutex> lock(shards_mutex_);
+        // the shards of exited threads are kept until their counters are out of all the windows
+        shards_.erase(remove_if(shards_.begin(), shards_.end(), [tick](const shared_ptr<Shard> &shard) {
+            return shard->retired && shard->last_tick.load(memory_order_relaxed) < tick - 310;
+        }), shards_.end());
+
+        for (const auto &shard : shards_) {
+            unique_lock<mutex> shard_lock(shard->mutex);
+            for (const auto &category : shard->series) {
+                for (const auto &entry : category.second) {
+                    const auto &series = *entry.second;
+                    auto &t = totals[category.first].try_emplace(entry.first, Totals{series.kind}).first->second;
+                    sum_up(series.seconds, tick - 1, tick - 1, t.counts[0], t.sums[0]);
+                    sum_up(series.seconds, tick - 60, tick - 1, t.counts[1], t.sums[1]);
+                    // the complete 10 seconds before, and the complete seconds of the current 10 seconds
+                    sum_up(series.ten_seconds, tick / 10 - 29, tick / 10 - 1, t.counts[2], t.sums[2]);
+                    sum_up(series.seconds, tick / 10 * 10, tick - 1, t.counts[2], t.sums[2]);
+                }
+            }
+        }
+    }
+
+    static const char *WINDOWS[] = {"1s", "1m", "5m"};
+    auto result = json::object();
+    for (const auto &category : totals) {
+        auto &category_json = result[category.first];
+        for (const auto &entry : category.second) {
+            const auto &t = entry.second;
+            auto &series_json = category_json[entry.first];
+            for (size_t i = 0; i < 3; i++) {
+                switch (t.kind) {
+                case Kind::COUNT:
+                    series_json[WINDOWS[i]] = t.counts[i];
+                    break;
+                case Kind::BYTES:
+                    series_json[WINDOWS[i]] = t.sums[i];
+                    break;
+                case Kind::DURATION:
+                    series_json[WINDOWS[i]] = {
+                        {"count", t.counts[i]},
+                        {"avg_ms", t.counts[i] > 0 ? t.sums[i] / 1000.0 / t.counts[i] : 0.0}
+                    };
+                    break;
+                }
+            }
+        }
+    }
+    return result;
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+/**
+ * Counters over the last second, minute and 5 minutes, returned by the "get_stats" API.
+ *
+ * Every thread records into a shard of its own, without locking once the series exists,
+ * and the shards are only added up when the counters are read.
+ */
+class RollingStats {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    static RollingStats &instance() {
+        static RollingStats stats;
+        return stats;
+    }
+
+    /**
+     * Count "n" occurrences in the series "name" of "category", e.g. ("events_in", "message").
+     */
+    void count(const char *category, std::string_view name, uint64_t n = 1) {
+        record(Kind::COUNT, category, name, n, 0);
+    }
+
+    /**
+     * Record "bytes" sent at once, e.g. ("bytes_sent", "ws").
+     */
+    void add_bytes(const char *category, std::string_view name, uint64_t bytes) {
+        record(Kind::BYTES, category, name, 1, bytes);
+    }
+
+    /**
+     * Record something which took "seconds", the average is returned.
+     */
+    void add_duration(const char *category, std::string_view name, double seconds) {
+        record(Kind::DURATION, category, name, 1, static_cast<uint64_t>(seconds * 1e6));
+    }
+
+    /**
+     * Record the time spent in the scope it lives in.
+     */
+    class Timer {
+    public:
+        Timer(const char *category, const char *name) : category_(category), name_(name), start_(Clock::now()) {}
+
+        ~Timer() {
+            instance().add_duration(category_, name_, std::chrono::duration<double>(Clock::now() - start_).count());
+        }
+
+    private:
+        const char *category_;
+        const char *name_;
+        Clock::time_point start_;
+    };
+
+    /**
+     * Add up the shards, as {category: {name: {"1s": ..., "1m": ..., "5m": ...}}}.
+     * A window only covers complete seconds, so its rate doesn't jump, and "5m" is at least 290 seconds.
+     */
+    json snapshot();
+
+private:
+    RollingStats() = default;
+
+    enum class Kind { COUNT, BYTES, DURATION };
+
+    struct Slot {
+        std::atomic<int64_t> tick = -1;
+        std::atomic<uint64_t> count = 0;
+        std::atomic<uint64_t> sum = 0;
+    };
+
+    struct Series {
+        Kind kind;
+        std::array<Slot, 64> seconds; // more than the 61 ticks needed for the last minute and the current second
+        std::array<Slot, 32> ten_seconds; // the same for the last 5 minutes
+
+        explicit Series(const Kind kind) : kind(kind) {}
+    };
+
+    /**
+     * The series of one thread, only that thread writes to them.
+     */
+    struct Shard {
+        std::mutex mutex; // held when adding a series, and when reading from other threads
+        std::map<std::string, std::map<std::string, std::unique_ptr<Series>, std::less<>>, std::less<>> series;
+        std::atomic<int64_t> last_tick = 0;
+        std::atomic<bool> retired = false; // the thread has exited
+    };
+
+    std::mutex shards_mutex_;
+    std::vector<std::shared_ptr<Shard>> shards_;
+
+    template <size_t N>
+    static void add_to(std::array<Slot, N> &slots, int64_t tick, uint64_t count, uint64_t sum);
+    template <size_t N>
+    static void sum_up(const std::array<Slot, N> &slots, int64_t first_tick, int64_t last_tick, uint64_t &count,
+                       uint64_t &sum);
+
+    void record(Kind kind, const char *category, std::string_view name, uint64_t count, uint64_t sum);
+    Shard &local_shard();
+};
@@ -0,0 +1,125 @@
+#include "./shared_cache_class.h"
+
+#include "app.h"
+
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <boost/filesystem.hpp>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+static const auto TAG = u8"共享缓存";
+
+shared_ptr<SharedCache> SharedCache::current() {
+    static mutex current_mutex;
+    static string current_dir;
+    static shared_ptr<SharedCache> current_cache;
+
+    const auto dir = config.shared_cache_dir;
+    unique_lock<mutex> lock(current_mutex);
+    if (dir != current_dir) {
+        // changed by a restart
+        current_dir = dir;
+        current_cache = dir.empty() ? nullptr : make_shared<DirectorySharedCache>(dir);
+    }
+    return current_cache;
+}
+
+DirectorySharedCache::DirectorySharedCache(const string &dir) {
+    const fs::path root(s2ws(dir));
+    info_dir_ = (root / L"info").wstring();
+    media_dir_ = (root / L"media").wstring();
+
+    boost::system::error_code ec;
+    fs::create_directories(info_dir_, ec);
+    fs::create_directories(media_dir_, ec);
+    if (ec) {
+        Log::w(TAG, u8"共享缓存目录 " + dir + u8" 创建失败，将只使用本地缓存");
+    }
+}
+
+wstring DirectorySharedCache::temp_path(const wstring &path) {
+    static atomic<unsigned long> counter = 0;
+    return path + L"." + to_wstring(GetCurrentProcessId()) + L"." + to_wstring(counter++) + L".tmp";
+}
+
+optional<string> DirectorySharedCache::get(const string &key, const chrono::seconds ttl) {
+    const auto path = (fs::path(info_dir_) / s2ws(key)).wstring();
+    boost::system::error_code ec;
+    const auto mtime = fs::last_write_time(path, ec);
+    if (ec || mtime + ttl.count() <= time(nullptr)) {
+        return nullopt;
+    }
+
+    ifstream f(path, ios::in | ios::binary);
+    if (!f.is_open()) {
+        return nullopt;
+    }
+    stringstream ss;
+    ss << f.rdbuf();
+    return ss.str();
+}
+
+void DirectorySharedCache::set(const string &key, const string &value) {
+    const auto path = (fs::path(info_dir_) / s2ws(key)).wstring();
+    const auto tmp = temp_path(path);
+    {
+        ofstream f(tmp, ios::out | ios::binary | ios::trunc);
+        if (!f.is_open()) {
+            return;
+        }
+        f.write(value.data(), value.size());
+        if (!f) {
+            f.close();
+            DeleteFileW(tmp.c_str());
+            return;
+        }
+    }
+    if (!MoveFileExW(tmp.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(tmp.c_str());
+    }
+}
+
+void DirectorySharedCache::erase(const string &key) {
+    DeleteFileW((fs::path(info_dir_) / s2ws(key)).wstring().c_str());
+}
+
+void DirectorySharedCache::erase_prefix(const string &prefix) {
+    const auto wprefix = s2ws(prefix);
+    boost::system::error_code ec;
+    for (fs::directory_iterator it(info_dir_, ec), end; !ec && it != end; it.increment(ec)) {
+        if (boost::starts_with(it->path().filename().wstring(), wprefix)) {
+            DeleteFileW(it->path().wstring().c_str());
+        }
+    }
+}
+
+bool DirectorySharedCache::link_or_copy(const wstring &from, const wstring &to) {
+    // the media files are only ever replaced by renaming (see download_remote_file_if_modified),
+    // never written in place, so sharing the data with a hard link is safe
+    const auto tmp = temp_path(to);
+    if (!CreateHardLinkW(tmp.c_str(), from.c_str(), nullptr) && !CopyFileW(from.c_str(), tmp.c_str(), TRUE)) {
+        return false;
+    }
+    if (!MoveFileExW(tmp.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING)) {
+        DeleteFileW(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool DirectorySharedCache::get_file(const string &name, const string &local_path) {
+    const auto path = (fs::path(media_dir_) / s2ws(name)).wstring();
+    if (GetFileAttributesW(path.c_str()) == INVALID_FILE_ATTRIBUTES || !link_or_copy(path, s2ws(local_path))) {
+        return false;
+    }
+    Log::d(TAG, u8"文件 " + name + u8" 已从共享缓存中取得");
+    return true;
+}
+
+void DirectorySharedCache::put_file(const string &name, const string &local_path) {
+    link_or_copy(s2ws(local_path), (fs::path(media_dir_) / s2ws(name)).wstring());
+}
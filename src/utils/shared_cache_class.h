@@ -0,0 +1,65 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <memory>
+
+/**
+ * A cache shared by the plugin instances of a deployment (e.g. many bots in the same groups),
+ * sitting behind the local caches (InfoCache and MediaCache), so that one instance's fetch saves the others theirs.
+ *
+ * Values are strings under keys made of [a-z0-9_.] characters, which are fresh for the "ttl" given when reading.
+ * Files are stored by name, and copied into the local data directories when found.
+ */
+class SharedCache {
+public:
+    virtual ~SharedCache() = default;
+
+    /**
+     * The backend configured by "shared_cache_dir", or nullptr if there is none.
+     */
+    static std::shared_ptr<SharedCache> current();
+
+    virtual std::optional<std::string> get(const std::string &key, std::chrono::seconds ttl) = 0;
+    virtual void set(const std::string &key, const std::string &value) = 0;
+    virtual void erase(const std::string &key) = 0;
+    virtual void erase_prefix(const std::string &prefix) = 0;
+
+    /**
+     * Put the file "name" at "local_path" if the cache has it.
+     */
+    virtual bool get_file(const std::string &name, const std::string &local_path) = 0;
+    virtual void put_file(const std::string &name, const std::string &local_path) = 0;
+};
+
+/**
+ * A directory accessible by all the instances, on the same machine or a network share.
+ * Values are files in "info", whose modification times tell their age, and files are in "media".
+ * Everything is written to a temporary file first and then renamed, so that readers never see partial data.
+ *
+ * Files are hard linked into the local data directories if they are on the same volume, and copied otherwise.
+ * The directory is not size-limited by the plugin, old files in "media" can be deleted at any time.
+ */
+class DirectorySharedCache : public SharedCache {
+public:
+    explicit DirectorySharedCache(const std::string &dir);
+
+    std::optional<std::string> get(const std::string &key, std::chrono::seconds ttl) override;
+    void set(const std::string &key, const std::string &value) override;
+    void erase(const std::string &key) override;
+    void erase_prefix(const std::string &prefix) override;
+
+    bool get_file(const std::string &name, const std::string &local_path) override;
+    void put_file(const std::string &name, const std::string &local_path) override;
+
+private:
+    std::wstring info_dir_;
+    std::wstring media_dir_;
+
+    /// A temporary name next to "path", unique among the instances.
+    static std::wstring temp_path(const std::wstring &path);
+
+    /// Replace "to" with a hard link to (or if impossible, a copy of) "from".
+    static bool link_or_copy(const std::wstring &from, const std::wstring &to);
+};
@@ -0,0 +1,343 @@
+#pragma once
+
+/**
+ * A single-producer multi-consumer ring buffer of variable-size records in named shared memory,
+ * used to publish events to consumers on the same machine.
+ *
+ * This header depends only on the Windows SDK and the standard library,
+ * so that consumers written in C++ can include it directly (see ShmRingReader).
+ *
+ * Layout (little-endian): a 64-byte ShmRingHeader, followed by "capacity" bytes of data.
+ * A record starts at (position % capacity) with a 4-byte size and a 4-byte type, followed by the data,
+ * and is padded to a multiple of 8 bytes. Records never wrap around the end:
+ * if one doesn't fit, a padding record fills the rest, and the record is written at the beginning.
+ * Positions only grow, so a reader which is more than "capacity" behind the writer has lost records.
+ *
+ * Readers map the ring read-only. To wait for records, they register in a small separate mapping,
+ * and the writer releases a semaphore once for each reader registered when it finishes a record.
+ */
+
+#include <Windows.h>
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "atomics in shared memory must be lock-free");
+
+struct ShmRingHeader {
+    static constexpr char MAGIC[8] = {'C', 'Q', 'H', 'A', 'P', 'I', 'R', 'B'};
+    static constexpr uint32_t VERSION = 2;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint64_t capacity; // size of the data area, a multiple of 8
+
+    // the end of the last complete record, readers may read everything before it
+    std::atomic<uint64_t> write_pos;
+    // the end of the record being written, everything more than "capacity" before it may be overwritten
+    std::atomic<uint64_t> reserve_pos;
+    std::atomic<uint64_t> record_count;
+
+    char reserved[16];
+};
+
+static_assert(sizeof(ShmRingHeader) == 64, "the header must be 64 bytes");
+
+/**
+ * The part of the shared memory which readers write to.
+ */
+struct ShmRingWaiters {
+    // readers which are about to wait, or waiting, for the next record
+    std::atomic<uint32_t> count;
+
+    char reserved[60];
+};
+
+static_assert(sizeof(ShmRingWaiters) == 64, "the waiters area must be 64 bytes");
+
+namespace shm_ring {
+    static const uint32_t RECORD_DATA = 0;
+    static const uint32_t RECORD_PADDING = 1;
+    static const uint64_t RECORD_HEADER_SIZE = 8;
+
+    inline uint64_t aligned_size(const uint64_t data_size) {
+        return (RECORD_HEADER_SIZE + data_size + 7) / 8 * 8;
+    }
+
+    /// The names of the file mappings, and of the semaphore released for the waiting readers after every write.
+    inline std::wstring mapping_name(const std::wstring &name) { return L"Local\\" + name; }
+    inline std::wstring waiters_name(const std::wstring &name) { return L"Local\\" + name + L"-waiters"; }
+    inline std::wstring semaphore_name(const std::wstring &name) { return L"Local\\" + name + L"-wakeup"; }
+} // namespace shm_ring
+
+/**
+ * Maps the shared memory of a ring, either creating it (writer) or opening an existing one (reader).
+ */
+class ShmRingMapping {
+public:
+    ShmRingMapping() = default;
+    ShmRingMapping(const ShmRingMapping &) = delete;
+    ShmRingMapping &operator=(const ShmRingMapping &) = delete;
+    ~ShmRingMapping() { close(); }
+
+    bool create(const std::wstring &name, const uint64_t capacity) {
+        close();
+        const auto total = sizeof(ShmRingHeader) + capacity;
+        mapping_ = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, static_cast<DWORD>(total >> 32),
+                                      static_cast<DWORD>(total & 0xFFFFFFFF), shm_ring::mapping_name(name).c_str());
+        const auto existed = GetLastError() == ERROR_ALREADY_EXISTS;
+        waiters_mapping_ = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, 0,
+                                              sizeof(ShmRingWaiters), shm_ring::waiters_name(name).c_str());
+        if (!map(name, FILE_MAP_ALL_ACCESS, true)) {
+            return false;
+        }
+        if (existed && header_->capacity != capacity) {
+            close(); // left by another instance with a different size
+            return false;
+        }
+        if (!existed) {
+            std::memcpy(header_->magic, ShmRingHeader::MAGIC, sizeof(header_->magic));
+            header_->version = ShmRingHeader::VERSION;
+            header_->header_size = sizeof(ShmRingHeader);
+            header_->capacity = capacity;
+        }
+        return true;
+    }
+
+    bool open(const std::wstring &name) {
+        close();
+        mapping_ = OpenFileMappingW(FILE_MAP_READ, FALSE, shm_ring::mapping_name(name).c_str());
+        waiters_mapping_ = OpenFileMappingW(FILE_MAP_READ | FILE_MAP_WRITE, FALSE, shm_ring::waiters_name(name).c_str());
+        if (!map(name, FILE_MAP_READ, false)) {
+            return false;
+        }
+        if (std::memcmp(header_->magic, ShmRingHeader::MAGIC, sizeof(header_->magic)) != 0
+            || header_->version != ShmRingHeader::VERSION) {
+            close();
+            return false;
+        }
+        return true;
+    }
+
+    void close() {
+        if (header_) {
+            UnmapViewOfFile(header_);
+            header_ = nullptr;
+        }
+        if (mapping_) {
+            CloseHandle(mapping_);
+            mapping_ = nullptr;
+        }
+        if (waiters_) {
+            UnmapViewOfFile(waiters_);
+            waiters_ = nullptr;
+        }
+        if (waiters_mapping_) {
+            CloseHandle(waiters_mapping_);
+            waiters_mapping_ = nullptr;
+        }
+        if (semaphore_) {
+            CloseHandle(semaphore_);
+            semaphore_ = nullptr;
+        }
+    }
+
+    ShmRingHeader *header() const { return header_; }
+    char *data() const { return reinterpret_cast<char *>(header_) + sizeof(ShmRingHeader); }
+    ShmRingWaiters *waiters() const { return waiters_; }
+    HANDLE semaphore() const { return semaphore_; }
+
+private:
+    HANDLE mapping_ = nullptr;
+    HANDLE waiters_mapping_ = nullptr;
+    HANDLE semaphore_ = nullptr;
+    ShmRingHeader *header_ = nullptr;
+    ShmRingWaiters *waiters_ = nullptr;
+
+    bool map(const std::wstring &name, const DWORD access, const bool create_semaphore) {
+        if (!mapping_ || !waiters_mapping_) {
+            close();
+            return false;
+        }
+        header_ = static_cast<ShmRingHeader *>(MapViewOfFile(mapping_, access, 0, 0, 0));
+        waiters_ = static_cast<ShmRingWaiters *>(
+            MapViewOfFile(waiters_mapping_, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0, sizeof(ShmRingWaiters)));
+        semaphore_ = create_semaphore
+                         ? CreateSemaphoreW(nullptr, 0, LONG_MAX, shm_ring::semaphore_name(name).c_str())
+                         : OpenSemaphoreW(SYNCHRONIZE, FALSE, shm_ring::semaphore_name(name).c_str());
+        if (!header_ || !waiters_ || !semaphore_) {
+            close();
+            return false;
+        }
+        return true;
+    }
+};
+
+/**
+ * The producer side. Not thread-safe, calls of write() must be serialized by the caller.
+ */
+class ShmRingWriter {
+public:
+    bool open(const std::wstring &name, const uint64_t capacity) {
+        return mapping_.create(name, std::max<uint64_t>(capacity / 8 * 8, 64));
+    }
+
+    void close() { mapping_.close(); }
+
+    /**
+     * \return false if the record is larger than the ring
+     */
+    bool write(const char *data, const uint32_t size) {
+        const auto header = mapping_.header();
+        const auto need = shm_ring::aligned_size(size);
+        if (!header || need > header->capacity) {
+            return false;
+        }
+        const auto capacity = header->capacity;
+
+        auto pos = header->write_pos.load(std::memory_order_relaxed);
+        const auto offset = pos % capacity;
+        const auto padding = capacity - offset < need ? capacity - offset : 0;
+
+        // tell the readers which part is about to be overwritten, before touching it
+        header->reserve_pos.store(pos + padding + need, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+
+        if (padding > 0) {
+            write_record_header(offset, static_cast<uint32_t>(padding - shm_ring::RECORD_HEADER_SIZE),
+                                shm_ring::RECORD_PADDING);
+            pos += padding;
+        }
+        write_record_header(pos % capacity, size, shm_ring::RECORD_DATA);
+        std::memcpy(mapping_.data() + pos % capacity + shm_ring::RECORD_HEADER_SIZE, data, size);
+
+        header->write_pos.store(pos + need, std::memory_order_release);
+        header->record_count.fetch_add(1, std::memory_order_relaxed);
+
+        // a reader registers before checking "write_pos", so either it sees the record, or it is counted here
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (const auto waiting = mapping_.waiters()->count.exchange(0)) {
+            ReleaseSemaphore(mapping_.semaphore(), static_cast<LONG>(waiting), nullptr);
+        }
+        return true;
+    }
+
+private:
+    ShmRingMapping mapping_;
+
+    void write_record_header(const uint64_t offset, const uint32_t size, const uint32_t type) const {
+        std::memcpy(mapping_.data() + offset, &size, sizeof(size));
+        std::memcpy(mapping_.data() + offset + sizeof(size), &type, sizeof(type));
+    }
+};
+
+/**
+ * The consumer side, each reader has its own position.
+ *
+ *     ShmRingReader reader;
+ *     if (reader.open(L"coolq-http-api")) {
+ *         while (true) {
+ *             std::string event;
+ *             if (reader.read(event)) {
+ *                 // handle the JSON event
+ *             } else {
+ *                 reader.wait(100);
+ *             }
+ *         }
+ *     }
+ */
+class ShmRingReader {
+public:
+    /**
+     * Open the ring, starting to read at the newest record if "from_start" is false.
+     */
+    bool open(const std::wstring &name, const bool from_start = false) {
+        if (!mapping_.open(name)) {
+            return false;
+        }
+        const auto write_pos = mapping_.header()->write_pos.load(std::memory_order_acquire);
+        const auto capacity = mapping_.header()->capacity;
+        read_pos_ = from_start && write_pos <= capacity ? 0 : write_pos;
+        return true;
+    }
+
+    void close() { mapping_.close(); }
+
+    /**
+     * Read the next record into "out".
+     * \return false if there is none yet
+     */
+    bool read(std::string &out) {
+        const auto header = mapping_.header();
+        const auto capacity = header->capacity;
+        while (true) {
+            const auto write_pos = header->write_pos.load(std::memory_order_acquire);
+            if (read_pos_ >= write_pos) {
+                return false;
+            }
+            if (write_pos - read_pos_ > capacity) {
+                skip_to(write_pos);
+                continue;
+            }
+
+            const auto offset = read_pos_ % capacity;
+            uint32_t size, type;
+            std::memcpy(&size, mapping_.data() + offset, sizeof(size));
+            std::memcpy(&type, mapping_.data() + offset + sizeof(size), sizeof(type));
+            const auto record_size = shm_ring::aligned_size(size);
+            if (type == shm_ring::RECORD_DATA && record_size <= capacity - offset) {
+                out.assign(mapping_.data() + offset + shm_ring::RECORD_HEADER_SIZE, size);
+            }
+
+            // the writer may have overwritten the record while it was copied
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (header->reserve_pos.load(std::memory_order_relaxed) - read_pos_ > capacity) {
+                skip_to(header->write_pos.load(std::memory_order_acquire));
+                continue;
+            }
+
+            read_pos_ += record_size;
+            if (type == shm_ring::RECORD_DATA) {
+                return true;
+            }
+        }
+    }
+
+    /**
+     * Wait until the writer writes something, or the timeout expires.
+     * It returns at once if there are records not read yet, and may rarely return early without any.
+     */
+    void wait(const DWORD timeout_ms) const {
+        auto &count = mapping_.waiters()->count;
+        count.fetch_add(1);
+        if (mapping_.header()->write_pos.load() > read_pos_
+            || WaitForSingleObject(mapping_.semaphore(), timeout_ms) != WAIT_OBJECT_0) {
+            // unregister, unless the writer has already released the semaphore for this reader
+            auto n = count.load();
+            while (n > 0 && !count.compare_exchange_weak(n, n - 1)) {
+            }
+            if (n == 0) {
+                // take the release back, or leave it to wake up a later wait early
+                WaitForSingleObject(mapping_.semaphore(), 0);
+            }
+        }
+    }
+
+    /// Number of records lost because the reader fell behind by more than the capacity.
+    uint64_t lost_count() const { return lost_count_; }
+
+private:
+    ShmRingMapping mapping_;
+    uint64_t read_pos_ = 0;
+    uint64_t lost_count_ = 0;
+
+    void skip_to(const uint64_t write_pos) {
+        lost_count_++; // at least one, the exact number is unknown
+        read_pos_ = write_pos;
+    }
+};
@@ -0,0 +1,175 @@
+#include "./task_scheduler_class.h"
+
+using namespace std;
+
+// the scheduler and worker index of the current thread, if it's a worker thread
+static thread_local const TaskScheduler *current_scheduler = nullptr;
+static thread_local size_t current_worker_id = 0;
+
+TaskScheduler::TaskScheduler(const size_t thread_count, const size_t max_thread_count) {
+    const auto count = max(thread_count, size_t(1));
+    const auto max_count = max(max_thread_count, count);
+    for (size_t i = 0; i < max_count; i++) {
+        workers_.push_back(make_unique<Worker>());
+    }
+    threads_.reserve(max_count);
+    resize(count);
+}
+
+void TaskScheduler::resize(const size_t thread_count) {
+    const auto count = min(max(thread_count, size_t(1)), workers_.size());
+
+    unique_lock<mutex> lock(resize_mutex_);
+    if (!running_) {
+        return;
+    }
+    {
+        unique_lock<mutex> park_lock(park_mutex_);
+        active_count_ = count;
+    }
+    park_cv_.notify_all(); // wake up the parked workers which become active again
+
+    for (auto i = threads_.size(); i < count; i++) {
+        threads_.emplace_back([this, i] { worker_loop(i); });
+    }
+}
+
+TaskScheduler::LoadStats TaskScheduler::take_load_stats() {
+    unique_lock<mutex> lock(resize_mutex_);
+    const auto now = Clock::now();
+    const auto elapsed_micros = chrono::duration_cast<chrono::microseconds>(now - stats_taken_at_).count();
+    stats_taken_at_ = now;
+
+    const auto started = started_count_.exchange(0);
+    const auto wait = wait_micros_.exchange(0);
+    const auto busy = busy_micros_.exchange(0);
+
+    LoadStats stats;
+    stats.started_count = started;
+    stats.average_wait_ms = started > 0 ? wait / 1000.0 / started : 0;
+    stats.utilization = elapsed_micros > 0 ? min(double(busy) / (double(elapsed_micros) * active_count_), 1.0) : 0;
+    return stats;
+}
+
+void TaskScheduler::stop() {
+    unique_lock<mutex> resize_lock(resize_mutex_);
+    if (!running_.exchange(false)) {
+        return;
+    }
+
+    {
+        unique_lock<mutex> lock(sleep_mutex_);
+    }
+    sleep_cv_.notify_all();
+    {
+        unique_lock<mutex> lock(park_mutex_);
+    }
+    park_cv_.notify_all();
+
+    for (auto &thread : threads_) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    threads_.clear();
+
+    for (auto &worker : workers_) {
+        unique_lock<mutex> lock(worker->mutex);
+        for (auto &queue : worker->queues) {
+            queue.clear();
+        }
+    }
+    pending_count_ = 0;
+}
+
+bool TaskScheduler::in_worker() const { return current_scheduler == this; }
+
+void TaskScheduler::enqueue(const TaskPriority priority, Task task) {
+    if (!running_) {
+        return; // the task is discarded, its future will get a broken_promise error
+    }
+
+    // tasks pushed by a worker go to its own queue, others are distributed evenly among the active workers
+    const auto worker_id = current_scheduler == this
+                               ? current_worker_id
+                               : next_worker_.fetch_add(1) % active_count_;
+    task.enqueued_at = Clock::now();
+    {
+        auto &worker = *workers_[worker_id];
+        unique_lock<mutex> lock(worker.mutex);
+        worker.queues[static_cast<size_t>(priority)].push_back(move(task));
+    }
+    pending_count_++;
+
+    if (sleeping_count_ > 0) {
+        {
+            unique_lock<mutex> lock(sleep_mutex_);
+        }
+        sleep_cv_.notify_one();
+    }
+}
+
+TaskScheduler::Task TaskScheduler::try_pop(const size_t worker_id) {
+    for (size_t p = 0; p < PRIORITY_COUNT; p++) {
+        // take the oldest task from its own queue first
+        {
+            auto &worker = *workers_[worker_id];
+            unique_lock<mutex> lock(worker.mutex);
+            if (auto &queue = worker.queues[p]; !queue.empty()) {
+                auto task = move(queue.front());
+                queue.pop_front();
+                return task;
+            }
+        }
+
+        // then steal the newest task of the same priority from the others, parked ones included
+        for (size_t i = 1; i < workers_.size(); i++) {
+            auto &victim = *workers_[(worker_id + i) % workers_.size()];
+            unique_lock<mutex> lock(victim.mutex, try_to_lock);
+            if (!lock.owns_lock()) {
+                continue; // busy, try the next one
+            }
+            if (auto &queue = victim.queues[p]; !queue.empty()) {
+                auto task = move(queue.back());
+                queue.pop_back();
+                return task;
+            }
+        }
+    }
+    return Task();
+}
+
+void TaskScheduler::worker_loop(const size_t worker_id) {
+    current_scheduler = this;
+    current_worker_id = worker_id;
+
+    while (running_) {
+        if (worker_id >= active_count_) {
+            if (pending_count_ > 0) {
+                // this worker may have consumed a wakeup meant for the active ones
+                {
+                    unique_lock<mutex> lock(sleep_mutex_);
+                }
+                sleep_cv_.notify_one();
+            }
+            unique_lock<mutex> lock(park_mutex_);
+            park_cv_.wait(lock, [this, worker_id] { return !running_ || worker_id < active_count_; });
+            continue;
+        }
+
+        if (auto task = try_pop(worker_id)) {
+            pending_count_--;
+            const auto start = Clock::now();
+            wait_micros_ += chrono::duration_cast<chrono::microseconds>(start - task.enqueued_at).count();
+            started_count_++;
+            task(static_cast<int>(worker_id));
+            busy_micros_ += chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+            continue;
+        }
+
+        unique_lock<mutex> lock(sleep_mutex_);
+        sleeping_count_++;
+        sleep_cv_.wait(lock, [this] { return !running_ || pending_count_ > 0; });
+        sleeping_count_--;
+    }
+}
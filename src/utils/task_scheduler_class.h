@@ -0,0 +1,156 @@
+#pragma once
+
+#include "common.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <type_traits>
+
+enum class TaskPriority {
+    HIGH = 0, // e.g. sending messages
+    NORMAL = 1,
+    LOW = 2, // e.g. cleaning data directory
+};
+
+/**
+ * Thread pool in which each worker has its own task queues (one per priority),
+ * idle workers steal tasks from the others, so that pushing and popping don't contend on one single lock.
+ * Tasks are called with the index of the worker that runs them, the same as ctpl::thread_pool.
+ *
+ * The number of active workers can be changed by resize() between 1 and "max_thread_count",
+ * threads are started when first needed, and the ones beyond the active count are parked instead of exiting.
+ */
+class TaskScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /**
+     * Load of the scheduler since the previous call of take_load_stats().
+     */
+    struct LoadStats {
+        double average_wait_ms; // time the tasks waited in the queues before being started
+        double utilization; // busy (running or blocking in tasks) time of the active workers, 0 to 1
+        size_t started_count;
+    };
+
+    explicit TaskScheduler(size_t thread_count, size_t max_thread_count = 0);
+    ~TaskScheduler() { stop(); }
+
+    TaskScheduler(const TaskScheduler &) = delete;
+    TaskScheduler &operator=(const TaskScheduler &) = delete;
+
+    template <typename F>
+    auto push(F &&f) {
+        return push(TaskPriority::NORMAL, std::forward<F>(f));
+    }
+
+    /**
+     * Schedule "f", which is moved into the task (so it can capture move-only objects).
+     *
+     * \return a future of the result of "f(worker_id)"
+     */
+    template <typename F>
+    auto push(const TaskPriority priority, F &&f) -> std::future<std::invoke_result_t<std::decay_t<F>, int>> {
+        using ResultType = std::invoke_result_t<std::decay_t<F>, int>;
+        std::packaged_task<ResultType(int)> packaged_task(std::forward<F>(f));
+        auto future = packaged_task.get_future();
+        enqueue(priority, Task(std::move(packaged_task)));
+        return future;
+    }
+
+    /**
+     * Stop all workers, tasks that are not started yet will be discarded.
+     */
+    void stop();
+
+    /**
+     * Count of the active workers.
+     */
+    size_t size() const { return active_count_; }
+
+    size_t max_size() const { return workers_.size(); }
+
+    /**
+     * Change the count of the active workers, clamped to [1, max_size()].
+     * Tasks queued on the parked workers are stolen by the active ones.
+     */
+    void resize(size_t thread_count);
+
+    LoadStats take_load_stats();
+
+    /**
+     * Count of the tasks that are scheduled but not started yet.
+     */
+    size_t pending_count() const { return pending_count_; }
+
+    /**
+     * Whether the current thread is a worker of this scheduler, in which case waiting for other tasks may deadlock.
+     */
+    bool in_worker() const;
+
+private:
+    /**
+     * Move-only type-erased "void(int)" callable.
+     */
+    class Task {
+    public:
+        Task() = default;
+
+        template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+        explicit Task(F &&f) : impl_(std::make_unique<Impl<std::decay_t<F>>>(std::forward<F>(f))) {}
+
+        void operator()(const int worker_id) const { impl_->run(worker_id); }
+        explicit operator bool() const { return impl_ != nullptr; }
+
+        Clock::time_point enqueued_at;
+
+    private:
+        struct Base {
+            virtual ~Base() = default;
+            virtual void run(int worker_id) = 0;
+        };
+
+        template <typename F>
+        struct Impl : Base {
+            F f;
+            explicit Impl(F &&f) : f(std::move(f)) {}
+            void run(const int worker_id) override { f(worker_id); }
+        };
+
+        std::unique_ptr<Base> impl_;
+    };
+
+    static constexpr size_t PRIORITY_COUNT = 3;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> queues[PRIORITY_COUNT];
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_; // "max_thread_count" of them, fixed after construction
+    std::vector<std::thread> threads_; // started on demand, guarded by resize_mutex_
+    std::mutex resize_mutex_;
+    std::atomic<size_t> active_count_ = 0;
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+
+    std::atomic<uint64_t> wait_micros_ = 0;
+    std::atomic<uint64_t> busy_micros_ = 0;
+    std::atomic<size_t> started_count_ = 0;
+    Clock::time_point stats_taken_at_ = Clock::now();
+
+    std::atomic<bool> running_ = true;
+    std::atomic<size_t> next_worker_ = 0; // for round-robin distribution of tasks pushed from other threads
+    std::atomic<size_t> pending_count_ = 0;
+    std::atomic<size_t> sleeping_count_ = 0;
+    std::mutex sleep_mutex_;
+    std::condition_variable sleep_cv_;
+
+    void enqueue(TaskPriority priority, Task task);
+    Task try_pop(size_t worker_id);
+    void worker_loop(size_t worker_id);
+};
@@ -0,0 +1,14 @@
+#include "./tracing.h"
+
+#ifdef CQHTTP_TRACING
+
+// the GUID is the one derived from the name, as by EventSource and "tracelog -guid *CoolQHttpApi"
+TRACELOGGING_DEFINE_PROVIDER(cqhttp_trace_provider, "CoolQHttpApi",
+                             (0x66cab6aa, 0x913f, 0x5abb, 0x8e, 0x02, 0xf6, 0x38, 0x18, 0xaa, 0x11, 0x7c));
+
+namespace tracing {
+    void start() { TraceLoggingRegister(cqhttp_trace_provider); }
+    void stop() { TraceLoggingUnregister(cqhttp_trace_provider); }
+} // namespace tracing
+
+#endif
@@ -0,0 +1,63 @@
+#pragma once
+
+/**
+ * ETW (TraceLogging) instrumentation of the plugin boundaries, only compiled in the "Profile" configuration,
+ * which defines CQHTTP_TRACING. In other configurations the macros expand to nothing.
+ *
+ * The provider is "CoolQHttpApi" {66cab6aa-913f-5abb-8e02-f63818aa117c}, which can be recorded by any ETW
+ * controller and opened in WPA, e.g.
+ *     xperf -start cqhttp -on 66cab6aa-913f-5abb-8e02-f63818aa117c
+ *     xperf -stop cqhttp -d cqhttp.etl
+ *
+ * Each scope writes a "Region" start event and a stop event (with opcodes 1 and 2), both with the fields
+ * "Category" and "Name", so that WPA shows them as regions of the thread. The categories are:
+ * "event" (a CQEVENT entry), "api" (an API handler), "sdk" (a CoolQ SDK call), "post" (an HTTP post),
+ * "push" (pushing to the WebSocket, pipe and shared memory services) and "filter" (the global filter).
+ */
+
+#ifdef CQHTTP_TRACING
+
+#include <Windows.h>
+
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+
+TRACELOGGING_DECLARE_PROVIDER(cqhttp_trace_provider);
+
+namespace tracing {
+    void start();
+    void stop();
+
+    class Scope {
+    public:
+        Scope(const char *category, const char *name) : category_(category), name_(name) {
+            TraceLoggingWrite(cqhttp_trace_provider, "Region", TraceLoggingOpcode(WINEVENT_OPCODE_START),
+                              TraceLoggingString(category_, "Category"), TraceLoggingString(name_, "Name"));
+        }
+
+        ~Scope() {
+            TraceLoggingWrite(cqhttp_trace_provider, "Region", TraceLoggingOpcode(WINEVENT_OPCODE_STOP),
+                              TraceLoggingString(category_, "Category"), TraceLoggingString(name_, "Name"));
+        }
+
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+
+    private:
+        const char *category_;
+        const char *name_; // must outlive the scope
+    };
+} // namespace tracing
+
+#define CQHTTP_TRACE_SCOPE(category, name) const tracing::Scope cqhttp_trace_scope_(category, name)
+
+#else
+
+namespace tracing {
+    inline void start() {}
+    inline void stop() {}
+} // namespace tracing
+
+#define CQHTTP_TRACE_SCOPE(category, name) ((void)0)
+
+#endif
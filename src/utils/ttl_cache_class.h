@@ -0,0 +1,74 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <map>
+#include <mutex>
+
+/**
+ * A thread-safe map whose entries expire after a given time to live.
+ * Expired entries are skipped by "get", and swept out when the map grows.
+ */
+template <typename Key, typename Value>
+class TtlCache {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    std::optional<Value> get(const Key &key) const {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (const auto it = entries_.find(key); it != entries_.end() && it->second.expire_at > Clock::now()) {
+            return it->second.value;
+        }
+        return std::nullopt;
+    }
+
+    void set(const Key &key, Value value, const std::chrono::seconds ttl) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        entries_[key] = {std::move(value), Clock::now() + ttl};
+        if (entries_.size() >= sweep_threshold_) {
+            sweep();
+            sweep_threshold_ = std::max(entries_.size() * 2, MIN_SWEEP_THRESHOLD);
+        }
+    }
+
+    void erase(const Key &key) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        entries_.erase(key);
+    }
+
+    /**
+     * Erase all entries whose key satisfies "pred".
+     */
+    template <typename Pred>
+    void erase_if(Pred pred) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            it = pred(it->first) ? entries_.erase(it) : std::next(it);
+        }
+    }
+
+    void clear() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        entries_.clear();
+    }
+
+private:
+    static constexpr size_t MIN_SWEEP_THRESHOLD = 1024;
+
+    struct Entry {
+        Value value;
+        Clock::time_point expire_at;
+    };
+
+    std::map<Key, Entry> entries_;
+    size_t sweep_threshold_ = MIN_SWEEP_THRESHOLD;
+    mutable std::mutex mutex_;
+
+    void sweep() {
+        const auto now = Clock::now();
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            it = it->second.expire_at <= now ? entries_.erase(it) : std::next(it);
+        }
+    }
+};
@@ -0,0 +1,156 @@
+#include "./wire_format.h"
+
+#include <boost/algorithm/string.hpp>
+
+using namespace std;
+
+optional<WireFormat> wire_format_from_name(const string &name) {
+    if (name == "json") return WireFormat::JSON;
+    if (name == "msgpack") return WireFormat::MSGPACK;
+    if (name == "cbor") return WireFormat::CBOR;
+    return nullopt;
+}
+
+optional<WireFormat> wire_format_from_media_type(const string &media_types) {
+    vector<string> items;
+    boost::split(items, media_types, boost::is_any_of(","));
+    for (const auto &item : items) {
+        const auto type = boost::to_lower_copy(boost::trim_copy(item.substr(0, item.find(';'))));
+        if (type == "application/json") return WireFormat::JSON;
+        if (type == "application/msgpack" || type == "application/x-msgpack") return WireFormat::MSGPACK;
+        if (type == "application/cbor") return WireFormat::CBOR;
+    }
+    return nullopt;
+}
+
+string wire_media_type(const WireFormat format) {
+    switch (format) {
+    case WireFormat::MSGPACK:
+        return "application/msgpack";
+    case WireFormat::CBOR:
+        return "application/cbor";
+    default:
+        return "application/json; charset=UTF-8";
+    }
+}
+
+string wire_dump(const json &j, const WireFormat format) {
+    switch (format) {
+    case WireFormat::MSGPACK: {
+        const auto bytes = json::to_msgpack(j);
+        return string(bytes.begin(), bytes.end());
+    }
+    case WireFormat::CBOR: {
+        const auto bytes = json::to_cbor(j);
+        return string(bytes.begin(), bytes.end());
+    }
+    default:
+        return j.dump();
+    }
+}
+
+json wire_parse(const string &data, const WireFormat format) {
+    try {
+        switch (format) {
+        case WireFormat::MSGPACK:
+            return json::from_msgpack(vector<uint8_t>(data.begin(), data.end()));
+        case WireFormat::CBOR:
+            return json::from_cbor(vector<uint8_t>(data.begin(), data.end()));
+        default:
+            return json::parse(data);
+        }
+    } catch (invalid_argument &) {
+        throw;
+    } catch (exception &e) {
+        // the binary parsers may throw other exceptions on truncated data
+        throw invalid_argument(e.what());
+    }
+}
+
+/**
+ * Append the header of an array (major type 4 in CBOR) with "count" elements,
+ * or of a map (major type 5) with "count" pairs.
+ */
+static void append_array_header(string &out, const size_t count, const WireFormat format, const bool map = false) {
+    auto append_be = [&out](const uint64_t value, const int bytes) {
+        for (auto i = bytes - 1; i >= 0; i--) {
+            out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+        }
+    };
+
+    if (format == WireFormat::MSGPACK) {
+        if (count < 16) {
+            out.push_back(static_cast<char>((map ? 0x80 : 0x90) | count));
+        } else if (count <= 0xffff) {
+            out.push_back(static_cast<char>(map ? 0xde : 0xdc));
+            append_be(count, 2);
+        } else {
+            out.push_back(static_cast<char>(map ? 0xdf : 0xdd));
+            append_be(count, 4);
+        }
+    } else {
+        const auto major = map ? 0xa0 : 0x80;
+        if (count < 24) {
+            out.push_back(static_cast<char>(major | count));
+        } else if (count <= 0xff) {
+            out.push_back(static_cast<char>(major | 24));
+            append_be(count, 1);
+        } else if (count <= 0xffff) {
+            out.push_back(static_cast<char>(major | 25));
+            append_be(count, 2);
+        } else {
+            out.push_back(static_cast<char>(major | 26));
+            append_be(count, 4);
+        }
+    }
+}
+
+string wire_join_array(const vector<const string *> &elements, const WireFormat format) {
+    size_t size = 2 + elements.size();
+    for (const auto element : elements) {
+        size += element->size();
+    }
+    string result;
+    result.reserve(size);
+
+    if (format == WireFormat::JSON) {
+        result = "[";
+        for (const auto element : elements) {
+            if (result.size() > 1) {
+                result += ",";
+            }
+            result += *element;
+        }
+        result += "]";
+        return result;
+    }
+
+    // binary arrays are just a header followed by the elements
+    append_array_header(result, elements.size(), format);
+    for (const auto element : elements) {
+        result += *element;
+    }
+    return result;
+}
+
+string wire_join_object(const vector<pair<string, const string *>> &members, const WireFormat format) {
+    string result;
+    if (format == WireFormat::JSON) {
+        result = "{";
+        for (const auto &member : members) {
+            if (result.size() > 1) {
+                result += ",";
+            }
+            result += json(member.first).dump() + ":" + *member.second;
+        }
+        result += "}";
+        return result;
+    }
+
+    append_array_header(result, members.size(), format, true);
+    for (const auto &member : members) {
+        result += wire_dump(member.first, format);
+        result += *member.second;
+    }
+    return result;
+}
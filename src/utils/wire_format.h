@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+
+#include <vector>
+
+/**
+ * Serialization formats of events and API calls, JSON text or one of the binary formats nlohmann::json supports.
+ */
+enum class WireFormat { JSON, MSGPACK, CBOR };
+
+/**
+ * Get the format by its name ("json", "msgpack" or "cbor"), nullopt if unknown.
+ */
+std::optional<WireFormat> wire_format_from_name(const std::string &name);
+
+/**
+ * Get the format of a "Content-Type" value, or the first supported one in an "Accept" header, nullopt if none.
+ */
+std::optional<WireFormat> wire_format_from_media_type(const std::string &media_types);
+
+/**
+ * The value of "Content-Type" header of the format.
+ */
+std::string wire_media_type(WireFormat format);
+
+inline bool is_binary(const WireFormat format) { return format != WireFormat::JSON; }
+
+std::string wire_dump(const json &j, WireFormat format);
+
+/**
+ * Parse the data in the given format, throw invalid_argument if it's invalid.
+ */
+json wire_parse(const std::string &data, WireFormat format);
+
+/**
+ * Join already serialized values into an array of the format, without parsing them again.
+ */
+std::string wire_join_array(const std::vector<const std::string *> &elements, WireFormat format);
+
+/**
+ * Build an object of the format from keys and already serialized values, like wire_join_array().
+ */
+std::string wire_join_object(const std::vector<std::pair<std::string, const std::string *>> &members,
+                             WireFormat format);
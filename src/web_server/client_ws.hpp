@@ -2,6 +2,7 @@
 #define CLIENT_WS_HPP
 
 #include "crypto.hpp"
+#include "deflate.hpp"
 #include "utility.hpp"
 
 #include <boost/algorithm/string/predicate.hpp>
@@ -128,6 +129,9 @@ namespace SimpleWeb {
         }
       }
 
+      std::unique_ptr<PerMessageDeflate> deflate; // change: set if permessage-deflate is negotiated
+      std::mutex deflate_mutex;                   // change: compressed messages must be queued in the order they are compressed
+
       asio::io_service::strand strand;
 
       class SendData {
@@ -181,6 +185,31 @@ namespace SimpleWeb {
         cancel_timeout();
         set_timeout();
 
+        // change: compress data frames if permessage-deflate is negotiated
+        auto opcode = fin_rsv_opcode & 0x0f;
+        if(deflate && (opcode == 1 || opcode == 2) && (fin_rsv_opcode & 0x40) == 0 && deflate->should_compress(message_stream->size())) {
+          std::string raw, compressed;
+          raw.resize(message_stream->size());
+          message_stream->read(&raw[0], static_cast<std::streamsize>(raw.size()));
+          std::unique_lock<std::mutex> lock(deflate_mutex);
+          auto compressed_stream = std::make_shared<SendStream>();
+          if(deflate->compress(raw, compressed)) {
+            compressed_stream->write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+            queue_frame(compressed_stream, callback, fin_rsv_opcode | 0x40); // RSV1 marks a compressed message
+          }
+          else {
+            compressed_stream->write(raw.data(), static_cast<std::streamsize>(raw.size()));
+            queue_frame(compressed_stream, callback, fin_rsv_opcode);
+          }
+          return;
+        }
+
+        queue_frame(message_stream, callback, fin_rsv_opcode);
+      }
+
+    private:
+      void queue_frame(const std::shared_ptr<SendStream> &message_stream, const std::function<void(const error_code &)> &callback,
+                       unsigned char fin_rsv_opcode) {
         // Create mask
         std::vector<unsigned char> mask;
         mask.resize(4);
@@ -226,6 +255,8 @@ namespace SimpleWeb {
         });
       }
 
+    public:
+
       void send_close(int status, const std::string &reason = "", const std::function<void(const error_code &)> &callback = nullptr) {
         // Send close only once (in case close is initiated by client)
         if(closed)
@@ -286,6 +317,11 @@ namespace SimpleWeb {
       /// Additional header fields to send when performing WebSocket handshake.
       /// Use this variable to for instance set Sec-WebSocket-Protocol.
       CaseInsensitiveMultimap header;
+      /// change: permessage-deflate options. Disabled by default.
+      DeflateConfig permessage_deflate;
+      /// change: messages larger than this, after decompression if compressed, close the connection with 1009.
+      /// Defaults to 0, i.e. no limit.
+      std::size_t max_message_size = 0;
     };
     /// Set before calling start().
     Config config;
@@ -395,6 +431,9 @@ namespace SimpleWeb {
       request << "Sec-WebSocket-Version: 13\r\n";
       for(auto &header_field : config.header)
         request << header_field.first << ": " << header_field.second << "\r\n";
+      auto deflate_offer = PerMessageDeflate::make_offer(config.permessage_deflate);
+      if(!deflate_offer.empty())
+        request << "Sec-WebSocket-Extensions: " << deflate_offer << "\r\n";
       request << "\r\n";
 
       connection->message = std::shared_ptr<Message>(new Message());
@@ -422,6 +461,15 @@ namespace SimpleWeb {
               static auto ws_magic_string = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
               if(header_it != connection->header.end() &&
                  Crypto::Base64::decode(header_it->second) == Crypto::sha1(*nonce_base64 + ws_magic_string)) {
+                auto extensions_it = connection->header.find("Sec-WebSocket-Extensions");
+                if(extensions_it != connection->header.end()) {
+                  bool valid;
+                  connection->deflate = PerMessageDeflate::accept_response(extensions_it->second, this->config.permessage_deflate, valid);
+                  if(!valid) {
+                    this->connection_error(connection, make_error_code::make_error_code(errc::protocol_error));
+                    return;
+                  }
+                }
                 this->connection_open(connection);
                 read_message(connection);
               }
@@ -520,11 +568,38 @@ namespace SimpleWeb {
     }
 
     void read_message_content(const std::shared_ptr<Connection> &connection) {
+      if(config.max_message_size > 0 && connection->message->length > config.max_message_size) {
+        // change: don't even read a message which is too big
+        const std::string reason("message too big");
+        connection->send_close(1009, reason);
+        this->connection_close(connection, 1009, reason);
+        return;
+      }
       asio::async_read(*connection->socket, connection->message->streambuf, asio::transfer_exactly(connection->message->length), [this, connection](const error_code &ec, std::size_t /*bytes_transferred*/) {
         auto lock = connection->handler_runner->continue_lock();
         if(!lock)
           return;
         if(!ec) {
+          if(connection->message->fin_rsv_opcode & 0x40) {
+            // change: RSV1 set, the message is compressed by permessage-deflate
+            std::string compressed, decompressed;
+            compressed.resize(connection->message->length);
+            connection->message->read(&compressed[0], static_cast<std::streamsize>(compressed.size()));
+            auto opcode = connection->message->fin_rsv_opcode & 0x0f;
+            if(!connection->deflate || (opcode != 1 && opcode != 2) || !connection->deflate->decompress(std::move(compressed), decompressed, config.max_message_size)) {
+              const auto too_big = config.max_message_size > 0 && decompressed.size() > config.max_message_size;
+              const auto status = too_big ? 1009 : 1002;
+              const std::string reason(too_big ? "message too big" : connection->deflate ? "invalid compressed message" : "unexpected RSV1 bit");
+              connection->send_close(status, reason);
+              this->connection_close(connection, status, reason);
+              return;
+            }
+            std::ostream message_data_out_stream(&connection->message->streambuf);
+            message_data_out_stream.write(decompressed.data(), static_cast<std::streamsize>(decompressed.size()));
+            connection->message->length = decompressed.size();
+            connection->message->fin_rsv_opcode &= ~0x40;
+          }
+
           // If connection close
           if((connection->message->fin_rsv_opcode & 0x0f) == 8) {
             int status = 0;
@@ -0,0 +1,261 @@
+#ifndef SIMPLE_WEB_DEFLATE_HPP
+#define SIMPLE_WEB_DEFLATE_HPP
+
+// change: permessage-deflate (RFC 7692) support, shared by the WebSocket server and client
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+namespace SimpleWeb {
+  /// Options of the permessage-deflate extension.
+  class DeflateConfig {
+  public:
+    /// Offer (client) or accept (server) the extension. Defaults to false.
+    bool enabled = false;
+    /// zlib compression level, 0-9, or -1 for zlib's default.
+    int level = Z_DEFAULT_COMPRESSION;
+    /// Keep the compression context between messages. Uses more memory per connection but compresses better.
+    bool context_takeover = true;
+    /// Messages smaller than this are sent uncompressed.
+    std::size_t min_size = 0;
+  };
+
+  /// Compression state of one connection, created once the extension is negotiated.
+  class PerMessageDeflate {
+  public:
+    /// The parameters of an extension offer or response, e.g. "permessage-deflate; client_max_window_bits".
+    using Params = std::vector<std::pair<std::string, std::string>>;
+
+    PerMessageDeflate(int level, int send_window_bits, bool send_no_context_takeover, std::size_t min_size) noexcept
+        : send_no_context_takeover(send_no_context_takeover), min_size(min_size) {
+      // zlib can't produce raw deflate streams with 256-byte windows, so never compress if the peer requires that
+      can_send_compressed = send_window_bits >= 9 && send_window_bits <= 15 &&
+                            deflateInit2(&deflate_stream, level, Z_DEFLATED, -send_window_bits, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+      deflate_initialized = can_send_compressed;
+      // a 15-bit window can inflate data compressed with any smaller window
+      inflate_initialized = inflateInit2(&inflate_stream, -15) == Z_OK;
+    }
+
+    ~PerMessageDeflate() noexcept {
+      if(deflate_initialized)
+        deflateEnd(&deflate_stream);
+      if(inflate_initialized)
+        inflateEnd(&inflate_stream);
+    }
+
+    PerMessageDeflate(const PerMessageDeflate &) = delete;
+    PerMessageDeflate &operator=(const PerMessageDeflate &) = delete;
+
+    bool should_compress(std::size_t size) const noexcept {
+      return can_send_compressed && size > 0 && size >= min_size;
+    }
+
+    /// Compress one message. Calls must be made in the order the messages are sent.
+    bool compress(const std::string &in, std::string &out) noexcept {
+      out.clear();
+      deflate_stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+      deflate_stream.avail_in = static_cast<uInt>(in.size());
+      unsigned char chunk[16384];
+      do {
+        deflate_stream.next_out = chunk;
+        deflate_stream.avail_out = sizeof(chunk);
+        if(deflate(&deflate_stream, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+          return false;
+        out.append(reinterpret_cast<char *>(chunk), sizeof(chunk) - deflate_stream.avail_out);
+      } while(deflate_stream.avail_out == 0);
+
+      // the sync flush ends with an empty stored block, which the receiver appends back
+      if(out.size() >= 4 && out.compare(out.size() - 4, 4, "\x00\x00\xff\xff", 4) == 0)
+        out.resize(out.size() - 4);
+      if(send_no_context_takeover)
+        deflateReset(&deflate_stream);
+      return true;
+    }
+
+    /// Decompress one message, failing if the result exceeds max_size (0 means no limit).
+    bool decompress(std::string in, std::string &out, std::size_t max_size = 0) noexcept {
+      if(!inflate_initialized)
+        return false;
+      out.clear();
+      in.append("\x00\x00\xff\xff", 4);
+      inflate_stream.next_in = reinterpret_cast<Bytef *>(&in[0]);
+      inflate_stream.avail_in = static_cast<uInt>(in.size());
+      unsigned char chunk[16384];
+      while(true) {
+        inflate_stream.next_out = chunk;
+        inflate_stream.avail_out = sizeof(chunk);
+        auto ret = inflate(&inflate_stream, Z_SYNC_FLUSH);
+        if(ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR)
+          return false;
+        out.append(reinterpret_cast<char *>(chunk), sizeof(chunk) - inflate_stream.avail_out);
+        if(max_size > 0 && out.size() > max_size)
+          return false;
+        if(ret == Z_STREAM_END) {
+          // the peer ended the deflate stream (BFINAL), the next message starts a new one
+          inflateReset(&inflate_stream);
+          break;
+        }
+        if(inflate_stream.avail_out != 0 && (inflate_stream.avail_in == 0 || ret == Z_BUF_ERROR))
+          break;
+      }
+      return true;
+    }
+
+    /// Split a Sec-WebSocket-Extensions header into extensions and their parameters.
+    static std::vector<std::pair<std::string, Params>> parse_extensions(const std::string &header) {
+      std::vector<std::pair<std::string, Params>> result;
+      std::size_t pos = 0;
+      while(pos <= header.size()) {
+        auto end = header.find(',', pos);
+        if(end == std::string::npos)
+          end = header.size();
+        auto extension = header.substr(pos, end - pos);
+        pos = end + 1;
+
+        std::vector<std::string> parts;
+        std::size_t part_pos = 0;
+        while(part_pos <= extension.size()) {
+          auto part_end = extension.find(';', part_pos);
+          if(part_end == std::string::npos)
+            part_end = extension.size();
+          parts.push_back(trim(extension.substr(part_pos, part_end - part_pos)));
+          part_pos = part_end + 1;
+        }
+        if(parts.empty() || parts.front().empty())
+          continue;
+
+        Params params;
+        for(std::size_t i = 1; i < parts.size(); i++) {
+          auto eq = parts[i].find('=');
+          if(eq == std::string::npos)
+            params.emplace_back(parts[i], "");
+          else {
+            auto value = trim(parts[i].substr(eq + 1));
+            if(value.size() >= 2 && value.front() == '"' && value.back() == '"')
+              value = value.substr(1, value.size() - 2);
+            params.emplace_back(trim(parts[i].substr(0, eq)), value);
+          }
+        }
+        result.emplace_back(parts.front(), std::move(params));
+      }
+      return result;
+    }
+
+    /// Server side: accept the first acceptable permessage-deflate offer of the client.
+    /// Returns nullptr if there is none, otherwise fills in the Sec-WebSocket-Extensions response header.
+    static std::unique_ptr<PerMessageDeflate> accept_offer(const std::string &offers, const DeflateConfig &config, std::string &response) {
+      if(!config.enabled)
+        return nullptr;
+      for(auto &offer : parse_extensions(offers)) {
+        if(offer.first != "permessage-deflate")
+          continue;
+
+        auto acceptable = true;
+        auto server_no_context_takeover = !config.context_takeover;
+        auto client_no_context_takeover = !config.context_takeover;
+        int server_window_bits = 15;
+        for(auto &param : offer.second) {
+          if(param.first == "server_no_context_takeover" && param.second.empty())
+            server_no_context_takeover = true;
+          else if(param.first == "client_no_context_takeover" && param.second.empty())
+            client_no_context_takeover = true;
+          else if(param.first == "server_max_window_bits") {
+            server_window_bits = parse_window_bits(param.second);
+            acceptable = server_window_bits >= 9; // see the constructor
+          }
+          else if(param.first == "client_max_window_bits")
+            acceptable = param.second.empty() || parse_window_bits(param.second) >= 8; // we always inflate with a 15-bit window
+          else
+            acceptable = false;
+          if(!acceptable)
+            break;
+        }
+        if(!acceptable)
+          continue;
+
+        response = "permessage-deflate";
+        if(server_no_context_takeover)
+          response += "; server_no_context_takeover";
+        if(client_no_context_takeover)
+          response += "; client_no_context_takeover";
+        if(server_window_bits < 15)
+          response += "; server_max_window_bits=" + std::to_string(server_window_bits);
+        return std::unique_ptr<PerMessageDeflate>(new PerMessageDeflate(config.level, server_window_bits, server_no_context_takeover, config.min_size));
+      }
+      return nullptr;
+    }
+
+    /// Client side: the Sec-WebSocket-Extensions request header, empty if the extension is disabled.
+    static std::string make_offer(const DeflateConfig &config) {
+      if(!config.enabled)
+        return "";
+      std::string offer = "permessage-deflate; client_max_window_bits";
+      if(!config.context_takeover)
+        offer += "; server_no_context_takeover; client_no_context_takeover";
+      return offer;
+    }
+
+    /// Client side: apply the server's response to our offer.
+    /// Returns nullptr if the server didn't accept it. Sets valid to false if the response is not a valid answer to the offer.
+    static std::unique_ptr<PerMessageDeflate> accept_response(const std::string &response, const DeflateConfig &config, bool &valid) {
+      valid = true;
+      for(auto &extension : parse_extensions(response)) {
+        if(extension.first != "permessage-deflate" || !config.enabled) {
+          valid = false; // we never offer any other extension
+          return nullptr;
+        }
+
+        auto client_no_context_takeover = !config.context_takeover;
+        int client_window_bits = 15;
+        for(auto &param : extension.second) {
+          if(param.first == "client_no_context_takeover")
+            client_no_context_takeover = true;
+          else if(param.first == "client_max_window_bits")
+            client_window_bits = parse_window_bits(param.second);
+          else if(param.first != "server_no_context_takeover" && param.first != "server_max_window_bits") {
+            valid = false;
+            return nullptr;
+          }
+        }
+        if(client_window_bits < 8) {
+          valid = false;
+          return nullptr;
+        }
+        // a window of 8 bits is valid, but then we just send every message uncompressed
+        return std::unique_ptr<PerMessageDeflate>(new PerMessageDeflate(config.level, client_window_bits, client_no_context_takeover, config.min_size));
+      }
+      return nullptr;
+    }
+
+  private:
+    z_stream deflate_stream{};
+    z_stream inflate_stream{};
+    bool deflate_initialized = false;
+    bool inflate_initialized = false;
+    bool can_send_compressed = false;
+    bool send_no_context_takeover;
+    std::size_t min_size;
+
+    static std::string trim(const std::string &s) {
+      auto begin = s.find_first_not_of(" \t");
+      if(begin == std::string::npos)
+        return "";
+      auto end = s.find_last_not_of(" \t");
+      return s.substr(begin, end - begin + 1);
+    }
+
+    /// Returns 0 if the value is not a valid window size (8-15).
+    static int parse_window_bits(const std::string &value) {
+      if(value.empty() || value.size() > 2 || value.find_first_not_of("0123456789") != std::string::npos)
+        return 0;
+      auto bits = std::atoi(value.c_str());
+      return bits >= 8 && bits <= 15 ? bits : 0;
+    }
+  };
+} // namespace SimpleWeb
+
+#endif /* SIMPLE_WEB_DEFLATE_HPP */
@@ -0,0 +1,69 @@
+#ifndef SIMPLE_WEB_IO_SERVICE_POOL_HPP
+#define SIMPLE_WEB_IO_SERVICE_POOL_HPP
+
+// change: one io_service per thread, shared by the HTTP and WebSocket servers
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#ifdef USE_STANDALONE_ASIO
+#include <asio.hpp>
+#else
+#include <boost/asio.hpp>
+namespace SimpleWeb {
+  namespace asio = boost::asio;
+} // namespace SimpleWeb
+#endif
+
+namespace SimpleWeb {
+  /// io_services that are run by one thread each. Accepted connections are spread over them round-robin,
+  /// so all handlers of a connection run in the same thread, and the threads don't contend on one completion queue.
+  class IoServicePool {
+  public:
+    /// Create the io_services, they are not run until run_threads() is called.
+    void start(std::size_t size) {
+      io_services.clear();
+      works.clear();
+      for(std::size_t i = 0; i < size; i++) {
+        io_services.emplace_back(std::make_shared<asio::io_service>());
+        // keep run() from returning while the io_service has no connection
+        works.emplace_back(new asio::io_service::work(*io_services.back()));
+      }
+    }
+
+    bool empty() const noexcept {
+      return io_services.empty();
+    }
+
+    /// The io_service for the next connection, or fallback if the pool is not started.
+    asio::io_service &next(asio::io_service &fallback) noexcept {
+      if(io_services.empty())
+        return fallback;
+      return *io_services[next_index++ % io_services.size()];
+    }
+
+    /// Run each io_service in a new thread, appended to threads.
+    void run_threads(std::vector<std::thread> &threads) {
+      for(auto &io_service : io_services) {
+        threads.emplace_back([io_service]() {
+          io_service->run();
+        });
+      }
+    }
+
+    void stop() noexcept {
+      works.clear();
+      for(auto &io_service : io_services)
+        io_service->stop();
+    }
+
+  private:
+    std::vector<std::shared_ptr<asio::io_service>> io_services;
+    std::vector<std::unique_ptr<asio::io_service::work>> works;
+    std::atomic<std::size_t> next_index{0};
+  };
+} // namespace SimpleWeb
+
+#endif /* SIMPLE_WEB_IO_SERVICE_POOL_HPP */
@@ -1,10 +1,12 @@
 #ifndef SERVER_HTTP_HPP
 #define SERVER_HTTP_HPP
 
+#include "io_service_pool.hpp"
 #include "utility.hpp"
 #include <condition_variable>
 #include <functional>
 #include <iostream>
+#include <limits>
 #include <map>
 #include <sstream>
 #include <thread>
@@ -159,9 +161,11 @@ namespace SimpleWeb {
       }
       /// Convenience function to return std::string. Note that the stream buffer is emptied when this functions is used.
       std::string string() {
-        std::stringstream ss;
-        ss << rdbuf();
-        return ss.str();
+        // change: copy the buffer only once, instead of through a stringstream
+        auto data = streambuf.data();
+        std::string str(asio::buffers_begin(data), asio::buffers_end(data));
+        streambuf.consume(streambuf.size());
+        return str;
       }
 
     private:
@@ -194,8 +198,8 @@ namespace SimpleWeb {
     private:
       asio::streambuf streambuf;
 
-      Request(const std::string &remote_endpoint_address = std::string(), unsigned short remote_endpoint_port = 0)
-          : content(streambuf), remote_endpoint_address(remote_endpoint_address), remote_endpoint_port(remote_endpoint_port) {}
+      Request(std::size_t max_request_size, const std::string &remote_endpoint_address = std::string(), unsigned short remote_endpoint_port = 0)
+          : content(streambuf), remote_endpoint_address(remote_endpoint_address), remote_endpoint_port(remote_endpoint_port), streambuf(max_request_size) {}
 
       bool parse() {
         std::string line;
@@ -269,9 +273,14 @@ namespace SimpleWeb {
 
       std::unique_ptr<asio::deadline_timer> timer;
 
+      // change: bytes of the next pipelined request(s) that were read together with the previous one
+      std::string pending_input;
+
       void close() {
         error_code ec;
         std::unique_lock<std::mutex> lock(socket_close_mutex); // The following operations seems to be needed to run sequentially
+        if(!socket) // change: the socket is moved away by on_upgrade
+          return;
         socket->lowest_layer().shutdown(asio::ip::tcp::socket::shutdown_both, ec);
         socket->lowest_layer().close(ec);
       }
@@ -306,13 +315,13 @@ namespace SimpleWeb {
 
     class Session {
     public:
-      Session(std::shared_ptr<Connection> connection) : connection(std::move(connection)) {
+      Session(std::shared_ptr<Connection> connection, std::size_t max_request_size = std::numeric_limits<std::size_t>::max()) : connection(std::move(connection)) {
         try {
           auto remote_endpoint = this->connection->socket->lowest_layer().remote_endpoint();
-          request = std::shared_ptr<Request>(new Request(remote_endpoint.address().to_string(), remote_endpoint.port()));
+          request = std::shared_ptr<Request>(new Request(max_request_size, remote_endpoint.address().to_string(), remote_endpoint.port()));
         }
         catch(...) {
-          request = std::shared_ptr<Request>(new Request());
+          request = std::shared_ptr<Request>(new Request(max_request_size));
         }
       }
 
@@ -336,11 +345,20 @@ namespace SimpleWeb {
       long timeout_request = 5;
       /// Timeout on content handling. Defaults to 300 seconds.
       long timeout_content = 300;
+      /// change: timeout on waiting for the next request of a keep-alive connection. Defaults to timeout_request.
+      long timeout_idle = 0;
+      /// change: maximum size of the request line, header and content in bytes, larger requests get "413 Payload Too Large".
+      /// Defaults to no limit.
+      std::size_t max_request_size = std::numeric_limits<std::size_t>::max();
       /// IPv4 address in dotted decimal form or IPv6 address in hexadecimal notation.
       /// If empty, the address will be any address.
       std::string address;
       /// Set to false to avoid binding the socket to an address that is already in use. Defaults to true.
       bool reuse_address = true;
+      /// change: if io_service is not set, give each of the thread_pool_size threads an io_service of its own,
+      /// and spread the accepted connections over them, while the thread calling start() only accepts.
+      /// Defaults to false, i.e. all threads run the same io_service.
+      bool io_service_per_thread = false;
     };
     /// Set before calling start().
     Config config;
@@ -394,15 +412,24 @@ namespace SimpleWeb {
       acceptor->bind(endpoint);
       acceptor->listen();
 
+      // change: the pool must exist before the first accept
+      auto use_pool = internal_io_service && config.io_service_per_thread && config.thread_pool_size > 1;
+      if(use_pool)
+        io_service_pool.start(config.thread_pool_size);
+
       accept();
 
       if(internal_io_service) {
-        // If thread_pool_size>1, start m_io_service.run() in (thread_pool_size-1) threads for thread-pooling
         threads.clear();
-        for(size_t c = 1; c < config.thread_pool_size; c++) {
-          threads.emplace_back([this]() {
-            this->io_service->run();
-          });
+        if(use_pool)
+          io_service_pool.run_threads(threads);
+        else {
+          // If thread_pool_size>1, start m_io_service.run() in (thread_pool_size-1) threads for thread-pooling
+          for(size_t c = 1; c < config.thread_pool_size; c++) {
+            threads.emplace_back([this]() {
+              this->io_service->run();
+            });
+          }
         }
 
         // Main thread
@@ -428,8 +455,10 @@ namespace SimpleWeb {
           connections->clear();
         }
 
-        if(internal_io_service)
+        if(internal_io_service) {
+          io_service_pool.stop();
           io_service->stop();
+        }
       }
     }
 
@@ -448,6 +477,7 @@ namespace SimpleWeb {
 
     std::unique_ptr<asio::ip::tcp::acceptor> acceptor;
     std::vector<std::thread> threads;
+    IoServicePool io_service_pool;
 
     std::shared_ptr<std::unordered_set<Connection *>> connections;
     std::shared_ptr<std::mutex> connections_mutex;
@@ -480,13 +510,37 @@ namespace SimpleWeb {
       return connection;
     }
 
-    void read_request_and_content(const std::shared_ptr<Session> &session) {
-      session->connection->set_timeout(config.timeout_request);
+    /// change: reply "413 Payload Too Large" and close the connection
+    void write_payload_too_large(const std::shared_ptr<Session> &session) {
+      auto write_buffer = std::make_shared<asio::streambuf>();
+      std::ostream response(write_buffer.get());
+      response << "HTTP/1.1 413 Payload Too Large\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      session->connection->set_timeout(config.timeout_content);
+      asio::async_write(*session->connection->socket, *write_buffer, [session, write_buffer](const error_code &, size_t /*bytes_transferred*/) {
+        session->connection->cancel_timeout();
+        session->connection->close();
+      });
+    }
+
+    /// change: keep_alive is set when waiting for a following request on the same connection (maybe already read)
+    void read_request_and_content(const std::shared_ptr<Session> &session, bool keep_alive = false) {
+      if(!session->connection->pending_input.empty()) {
+        std::ostream pending(&session->request->streambuf);
+        pending.write(session->connection->pending_input.data(), static_cast<std::streamsize>(session->connection->pending_input.size()));
+        session->connection->pending_input.clear();
+      }
+
+      session->connection->set_timeout(keep_alive && config.timeout_idle > 0 ? config.timeout_idle : config.timeout_request);
       asio::async_read_until(*session->connection->socket, session->request->streambuf, "\r\n\r\n", [this, session](const error_code &ec, size_t bytes_transferred) {
         session->connection->cancel_timeout();
         auto cancel_pair = session->connection->cancel_handlers_bool_and_lock();
         if(cancel_pair.first)
           return;
+        if(ec == asio::error::not_found) {
+          // the header exceeds "max_request_size"
+          write_payload_too_large(session);
+          return;
+        }
         if(!ec) {
           // request->streambuf.size() is not necessarily the same as bytes_transferred, from Boost-docs:
           // "After a successful async_read_until operation, the streambuf may contain additional data beyond the delimiter"
@@ -509,7 +563,21 @@ namespace SimpleWeb {
                 this->on_error(session->request, make_error_code::make_error_code(errc::protocol_error));
               return;
             }
-            if(content_length > num_additional_bytes) {
+            if(content_length > config.max_request_size - std::min<std::size_t>(bytes_transferred, config.max_request_size)) {
+              write_payload_too_large(session);
+              return;
+            }
+            if(content_length < num_additional_bytes) {
+              // change: the rest is the beginning of the next pipelined request, keep it for the next session
+              auto &streambuf = session->request->streambuf;
+              auto data = streambuf.data();
+              std::string content(asio::buffers_begin(data), asio::buffers_begin(data) + static_cast<std::ptrdiff_t>(content_length));
+              session->connection->pending_input.assign(asio::buffers_begin(data) + static_cast<std::ptrdiff_t>(content_length), asio::buffers_end(data));
+              streambuf.consume(streambuf.size());
+              std::ostream(&streambuf).write(content.data(), static_cast<std::streamsize>(content.size()));
+              this->find_resource(session);
+            }
+            else if(content_length > num_additional_bytes) {
               session->connection->set_timeout(config.timeout_content);
               asio::async_read(*session->connection->socket, session->request->streambuf, asio::transfer_exactly(content_length - num_additional_bytes), [this, session](const error_code &ec, size_t /*bytes_transferred*/) {
                 session->connection->cancel_timeout();
@@ -525,8 +593,16 @@ namespace SimpleWeb {
             else
               this->find_resource(session);
           }
-          else
+          else {
+            if(num_additional_bytes > 0) {
+              // change: no content, so all of the rest belongs to the next pipelined request
+              auto &streambuf = session->request->streambuf;
+              auto data = streambuf.data();
+              session->connection->pending_input.assign(asio::buffers_begin(data), asio::buffers_end(data));
+              streambuf.consume(streambuf.size());
+            }
             this->find_resource(session);
+          }
         }
         else if(this->on_error)
           this->on_error(session->request, ec);
@@ -574,14 +650,14 @@ namespace SimpleWeb {
               if(case_insensitive_equal(it->second, "close"))
                 return;
               else if(case_insensitive_equal(it->second, "keep-alive")) {
-                auto new_session = std::make_shared<Session>(response->session->connection);
-                this->read_request_and_content(new_session);
+                auto new_session = std::make_shared<Session>(response->session->connection, this->config.max_request_size);
+                this->read_request_and_content(new_session, true);
                 return;
               }
             }
             if(response->session->request->http_version >= "1.1") {
-              auto new_session = std::make_shared<Session>(response->session->connection);
-              this->read_request_and_content(new_session);
+              auto new_session = std::make_shared<Session>(response->session->connection, this->config.max_request_size);
+              this->read_request_and_content(new_session, true);
               return;
             }
           }
@@ -613,7 +689,7 @@ namespace SimpleWeb {
 
   protected:
     void accept() override {
-      auto session = std::make_shared<Session>(create_connection(*io_service));
+      auto session = std::make_shared<Session>(create_connection(io_service_pool.next(*io_service)), config.max_request_size);
 
       acceptor->async_accept(*session->connection->socket, [this, session](const error_code &ec) {
         auto cancel_pair = session->connection->cancel_handlers_bool_and_lock();
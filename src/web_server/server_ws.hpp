@@ -2,6 +2,8 @@
 #define SERVER_WS_HPP
 
 #include "crypto.hpp"
+#include "deflate.hpp"
+#include "io_service_pool.hpp"
 #include "utility.hpp"
 
 #include <atomic>
@@ -139,7 +141,10 @@ namespace SimpleWeb {
         }
       }
 
-      bool generate_handshake(const std::shared_ptr<asio::streambuf> &write_buffer) {
+      std::unique_ptr<PerMessageDeflate> deflate; // change: set if permessage-deflate is negotiated
+      std::mutex deflate_mutex;                   // change: compressed messages must be queued in the order they are compressed
+
+      bool generate_handshake(const std::shared_ptr<asio::streambuf> &write_buffer, const DeflateConfig &deflate_config) {
         std::ostream handshake(write_buffer.get());
 
         auto header_it = header.find("Sec-WebSocket-Key");
@@ -153,6 +158,13 @@ namespace SimpleWeb {
         handshake << "Upgrade: websocket\r\n";
         handshake << "Connection: Upgrade\r\n";
         handshake << "Sec-WebSocket-Accept: " << Crypto::Base64::encode(sha1) << "\r\n";
+        auto extensions_it = header.find("Sec-WebSocket-Extensions");
+        if(extensions_it != header.end()) {
+          std::string extensions_response;
+          deflate = PerMessageDeflate::accept_offer(extensions_it->second, deflate_config, extensions_response);
+          if(deflate)
+            handshake << "Sec-WebSocket-Extensions: " << extensions_response << "\r\n";
+        }
         handshake << "\r\n";
 
         return true;
@@ -225,6 +237,26 @@ namespace SimpleWeb {
         cancel_timeout();
         set_timeout();
 
+        // change: compress data frames if permessage-deflate is negotiated
+        auto opcode = fin_rsv_opcode & 0x0f;
+        if(deflate && (opcode == 1 || opcode == 2) && (fin_rsv_opcode & 0x40) == 0 && deflate->should_compress(message_stream->size())) {
+          auto data = message_stream->streambuf.data();
+          std::string raw(asio::buffers_begin(data), asio::buffers_end(data)), compressed;
+          std::unique_lock<std::mutex> lock(deflate_mutex);
+          if(deflate->compress(raw, compressed)) {
+            auto compressed_stream = std::make_shared<SendStream>();
+            compressed_stream->write(compressed.data(), static_cast<std::streamsize>(compressed.size()));
+            queue_frame(compressed_stream, callback, fin_rsv_opcode | 0x40); // RSV1 marks a compressed message
+            return;
+          }
+        }
+
+        queue_frame(message_stream, callback, fin_rsv_opcode);
+      }
+
+    private:
+      void queue_frame(const std::shared_ptr<SendStream> &message_stream, const std::function<void(const error_code &)> &callback,
+                       unsigned char fin_rsv_opcode) {
         auto header_stream = std::make_shared<SendStream>();
 
         size_t length = message_stream->size();
@@ -256,6 +288,8 @@ namespace SimpleWeb {
         });
       }
 
+    public:
+
       void send_close(int status, const std::string &reason = "", const std::function<void(const error_code &)> &callback = nullptr) {
         // Send close only once (in case close is initiated by server)
         if(closed)
@@ -342,6 +376,15 @@ namespace SimpleWeb {
       std::string address;
       /// Set to false to avoid binding the socket to an address that is already in use. Defaults to true.
       bool reuse_address = true;
+      /// change: if io_service is not set, give each of the thread_pool_size threads an io_service of its own,
+      /// and spread the accepted connections over them, while the thread calling start() only accepts.
+      /// Defaults to false, i.e. all threads run the same io_service.
+      bool io_service_per_thread = false;
+      /// change: permessage-deflate options. Disabled by default.
+      DeflateConfig permessage_deflate;
+      /// change: messages larger than this, after decompression if compressed, close the connection with 1009.
+      /// Defaults to 0, i.e. no limit.
+      std::size_t max_message_size = 0;
     };
     /// Set before calling start().
     Config config;
@@ -384,15 +427,24 @@ namespace SimpleWeb {
       acceptor->bind(endpoint);
       acceptor->listen();
 
+      // change: the pool must exist before the first accept
+      auto use_pool = internal_io_service && config.io_service_per_thread && config.thread_pool_size > 1;
+      if(use_pool)
+        io_service_pool.start(config.thread_pool_size);
+
       accept();
 
       if(internal_io_service) {
-        // If thread_pool_size>1, start m_io_service.run() in (thread_pool_size-1) threads for thread-pooling
         threads.clear();
-        for(size_t c = 1; c < config.thread_pool_size; c++) {
-          threads.emplace_back([this]() {
-            io_service->run();
-          });
+        if(use_pool)
+          io_service_pool.run_threads(threads);
+        else {
+          // If thread_pool_size>1, start m_io_service.run() in (thread_pool_size-1) threads for thread-pooling
+          for(size_t c = 1; c < config.thread_pool_size; c++) {
+            threads.emplace_back([this]() {
+              io_service->run();
+            });
+          }
         }
         // Main thread
         if(config.thread_pool_size > 0)
@@ -408,16 +460,19 @@ namespace SimpleWeb {
       if(acceptor) {
         error_code ec;
         acceptor->close(ec);
+      }
 
-        for(auto &pair : endpoint) {
-          std::unique_lock<std::mutex> lock(pair.second.connections_mutex);
-          for(auto &connection : pair.second.connections)
-            connection->close();
-          pair.second.connections.clear();
-        }
+      // change: also close the connections taken over by upgrade(), when the server is not started itself
+      for(auto &pair : endpoint) {
+        std::unique_lock<std::mutex> lock(pair.second.connections_mutex);
+        for(auto &connection : pair.second.connections)
+          connection->close();
+        pair.second.connections.clear();
+      }
 
-        if(internal_io_service)
-          io_service->stop();
+      if(acceptor && internal_io_service) {
+        io_service_pool.stop();
+        io_service->stop();
       }
     }
 
@@ -465,6 +520,7 @@ namespace SimpleWeb {
 
     std::unique_ptr<asio::ip::tcp::acceptor> acceptor;
     std::vector<std::thread> threads;
+    IoServicePool io_service_pool;
 
     std::shared_ptr<ScopeRunner> handler_runner;
 
@@ -495,7 +551,7 @@ namespace SimpleWeb {
         if(regex::regex_match(connection->path, path_match, regex_endpoint.first)) {
           auto write_buffer = std::make_shared<asio::streambuf>();
 
-          if(connection->generate_handshake(write_buffer)) {
+          if(connection->generate_handshake(write_buffer, config.permessage_deflate)) {
             connection->path_match = std::move(path_match);
             connection->set_timeout(config.timeout_request);
             asio::async_write(*connection->socket, *write_buffer, [this, connection, write_buffer, &regex_endpoint](const error_code &ec, size_t /*bytes_transferred*/) {
@@ -601,6 +657,13 @@ namespace SimpleWeb {
     }
 
     void read_message_content(const std::shared_ptr<Connection> &connection, size_t length, Endpoint &endpoint, unsigned char fin_rsv_opcode) const {
+      if(config.max_message_size > 0 && length > config.max_message_size) {
+        // change: don't even read a message which is too big
+        const std::string reason("message too big");
+        connection->send_close(1009, reason);
+        connection_close(connection, endpoint, 1009, reason);
+        return;
+      }
       asio::async_read(*connection->socket, connection->read_buffer, asio::transfer_exactly(4 + length), [this, connection, length, &endpoint, fin_rsv_opcode](const error_code &ec, size_t /*bytes_transferred*/) {
         auto lock = connection->handler_runner->continue_lock();
         if(!lock)
@@ -618,8 +681,29 @@ namespace SimpleWeb {
           message->fin_rsv_opcode = fin_rsv_opcode;
 
           std::ostream message_data_out_stream(&message->streambuf);
-          for(size_t c = 0; c < length; c++) {
-            message_data_out_stream.put(raw_message_data.get() ^ mask[c % 4]);
+          if(fin_rsv_opcode & 0x40) {
+            // change: RSV1 set, the message is compressed by permessage-deflate
+            std::string compressed, decompressed;
+            compressed.resize(length);
+            for(size_t c = 0; c < length; c++)
+              compressed[c] = static_cast<char>(raw_message_data.get() ^ mask[c % 4]);
+            auto opcode = fin_rsv_opcode & 0x0f;
+            if(!connection->deflate || (opcode != 1 && opcode != 2) || !connection->deflate->decompress(std::move(compressed), decompressed, config.max_message_size)) {
+              const auto too_big = config.max_message_size > 0 && decompressed.size() > config.max_message_size;
+              const auto status = too_big ? 1009 : 1002;
+              const std::string reason(too_big ? "message too big" : connection->deflate ? "invalid compressed message" : "unexpected RSV1 bit");
+              connection->send_close(status, reason);
+              connection_close(connection, endpoint, status, reason);
+              return;
+            }
+            message_data_out_stream.write(decompressed.data(), static_cast<std::streamsize>(decompressed.size()));
+            message->length = decompressed.size();
+            message->fin_rsv_opcode = static_cast<unsigned char>(fin_rsv_opcode & ~0x40);
+          }
+          else {
+            for(size_t c = 0; c < length; c++) {
+              message_data_out_stream.put(raw_message_data.get() ^ mask[c % 4]);
+            }
           }
 
           // If connection close
@@ -710,7 +794,7 @@ namespace SimpleWeb {
 
   protected:
     void accept() override {
-      std::shared_ptr<Connection> connection(new Connection(handler_runner, config.timeout_idle, *io_service));
+      std::shared_ptr<Connection> connection(new Connection(handler_runner, config.timeout_idle, io_service_pool.next(*io_service)));
 
       acceptor->async_accept(*connection->socket, [this, connection](const error_code &ec) {
         auto lock = connection->handler_runner->continue_lock();
@@ -49,7 +49,7 @@ namespace SimpleWeb {
     asio::ssl::context context;
 
     void accept() override {
-      std::shared_ptr<Connection> connection(new Connection(handler_runner, config.timeout_idle, *io_service, context));
+      std::shared_ptr<Connection> connection(new Connection(handler_runner, config.timeout_idle, io_service_pool.next(*io_service), context));
 
       acceptor->async_accept(connection->socket->lowest_layer(), [this, connection](const error_code &ec) {
         auto lock = connection->handler_runner->continue_lock();